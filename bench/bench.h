@@ -0,0 +1,48 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+//////////////////////////////////////////////////////////////////////
+
+namespace bench
+{
+    // each benchmark registers itself with a static registrar
+
+    using bench_function = void (*)();
+
+    struct registrar
+    {
+        registrar(char const *name, bench_function fn);
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // best of runs, in nanoseconds per item
+
+    template <typename F> double time_per_item(size_t items, int runs, F &&fn)
+    {
+        double best = 1e300;
+        for(int r = 0; r < runs; ++r) {
+            auto t0 = std::chrono::steady_clock::now();
+            fn();
+            auto t1 = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::nano>(t1 - t0).count() / items);
+        }
+        return best;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // stop the optimizer throwing results away
+
+    void keep(void const *p);
+
+}    // namespace bench
+
+#define BENCH(name)                                                      \
+    static void bench_##name();                                          \
+    static bench::registrar bench_registrar_##name(#name, bench_##name); \
+    static void bench_##name()
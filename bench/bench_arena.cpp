@@ -0,0 +1,120 @@
+//////////////////////////////////////////////////////////////////////
+// typed_arena: the per element paths (an alloc() for each one like push_back
+// used to do, and push_back) against the bulk ones (reserve + push_back,
+// append, grow_uninitialized) and std::vector
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "bench.h"
+#include "gerber_arena.h"
+
+//////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    // same shape as gpu::vertex_entity
+    struct vertex
+    {
+        float x, y;
+        uint32_t entity_id;
+    };
+
+    size_t constexpr num_vertices = 4'000'000;
+
+    // like finish_entity, vertices come in runs of a few dozen
+    size_t constexpr run_length = 24;
+
+    int constexpr runs = 10;
+
+    //////////////////////////////////////////////////////////////////////
+
+    vertex make_vertex(size_t i)
+    {
+        return { static_cast<float>(i), static_cast<float>(i >> 3), static_cast<uint32_t>(i / run_length) };
+    }
+
+}    // namespace
+
+//////////////////////////////////////////////////////////////////////
+
+BENCH(arena_append)
+{
+    gerber_lib::typed_arena<vertex> arena;
+    arena.init();
+
+    std::vector<vertex> source(run_length);
+
+    auto fill_source = [&](size_t base) {
+        for(size_t j = 0; j < run_length; ++j) {
+            source[j] = make_vertex(base + j);
+        }
+    };
+
+    // the old push_back, alloc() works out the alignment and checks the commit every time
+    double per_alloc = bench::time_per_item(num_vertices, runs, [&] {
+        arena.clear();
+        for(size_t i = 0; i < num_vertices; ++i) {
+            vertex *v = reinterpret_cast<vertex *>(arena.alloc(sizeof(vertex)));
+            *v = make_vertex(i);
+        }
+        bench::keep(arena.data());
+    });
+
+    double push_back = bench::time_per_item(num_vertices, runs, [&] {
+        arena.clear();
+        for(size_t i = 0; i < num_vertices; ++i) {
+            arena.push_back(make_vertex(i));
+        }
+        bench::keep(arena.data());
+    });
+
+    double reserved = bench::time_per_item(num_vertices, runs, [&] {
+        arena.clear();
+        arena.reserve(num_vertices);
+        for(size_t i = 0; i < num_vertices; ++i) {
+            arena.push_back(make_vertex(i));
+        }
+        bench::keep(arena.data());
+    });
+
+    double append = bench::time_per_item(num_vertices, runs, [&] {
+        arena.clear();
+        for(size_t i = 0; i < num_vertices; i += run_length) {
+            fill_source(i);
+            arena.append(source);
+        }
+        bench::keep(arena.data());
+    });
+
+    double grow = bench::time_per_item(num_vertices, runs, [&] {
+        arena.clear();
+        for(size_t i = 0; i < num_vertices; i += run_length) {
+            size_t j = i;
+            for(vertex &v : arena.grow_uninitialized(run_length)) {
+                v = make_vertex(j++);
+            }
+        }
+        bench::keep(arena.data());
+    });
+
+    std::vector<vertex> vec;
+    double vector = bench::time_per_item(num_vertices, runs, [&] {
+        vec.clear();
+        for(size_t i = 0; i < num_vertices; ++i) {
+            vec.push_back(make_vertex(i));
+        }
+        bench::keep(vec.data());
+    });
+
+    std::printf("%zu vertices, runs of %zu, best of %d\n", num_vertices, run_length, runs);
+    std::printf("  alloc() per vertex   %6.2f ns/vertex\n", per_alloc);
+    std::printf("  push_back            %6.2f ns/vertex\n", push_back);
+    std::printf("  reserve + push_back  %6.2f ns/vertex\n", reserved);
+    std::printf("  append               %6.2f ns/vertex\n", append);
+    std::printf("  grow_uninitialized   %6.2f ns/vertex\n", grow);
+    std::printf("  std::vector          %6.2f ns/vertex\n", vector);
+
+    arena.release();
+}
@@ -0,0 +1,157 @@
+//////////////////////////////////////////////////////////////////////
+// job_pool throughput with lots of tiny jobs, against a pool like the one
+// it replaced (one mutex, one std::deque, a shared_ptr per job)
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "job_pool.h"
+
+//////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    size_t constexpr num_jobs = 1'000'000;
+
+    // for the nested one, each outer job adds this many inner ones from a worker
+    size_t constexpr jobs_per_spawner = 1000;
+
+    int constexpr runs = 5;
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct locked_pool
+    {
+        struct job_item
+        {
+            uint32_t flags;
+            std::function<void(std::stop_token)> work;
+        };
+
+        std::mutex queue_mutex;
+        std::condition_variable_any queue_cv;
+        std::deque<std::shared_ptr<job_item>> queue;
+        std::atomic<size_t> active{ 0 };
+        std::vector<std::jthread> workers;
+
+        void start_workers(size_t thread_count)
+        {
+            for(size_t i = 0; i < thread_count; ++i) {
+                workers.emplace_back([this](std::stop_token st) {
+                    while(true) {
+                        std::shared_ptr<job_item> job;
+                        {
+                            std::unique_lock l(queue_mutex);
+                            if(!queue_cv.wait(l, st, [this] { return !queue.empty(); })) {
+                                return;
+                            }
+                            job = std::move(queue.front());
+                            queue.pop_front();
+                        }
+                        job->work(st);
+                        active.fetch_sub(1, std::memory_order_release);
+                    }
+                });
+            }
+        }
+
+        template <typename F> void add_job(uint32_t flags, F &&func)
+        {
+            active.fetch_add(1, std::memory_order_relaxed);
+            auto job = std::make_shared<job_item>(flags, std::forward<F>(func));
+            {
+                std::lock_guard l(queue_mutex);
+                queue.push_back(std::move(job));
+            }
+            queue_cv.notify_one();
+        }
+
+        bool get_active_job_count(uint32_t)
+        {
+            return active.load(std::memory_order_acquire) != 0;
+        }
+
+        void shut_down()
+        {
+            for(auto &w : workers) {
+                w.request_stop();
+            }
+            queue_cv.notify_all();
+            workers.clear();
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // the main thread adds them all, the workers take them from the shared queue
+
+    template <typename P> double external(P &pool)
+    {
+        std::atomic<size_t> count{ 0 };
+        return bench::time_per_item(num_jobs, runs, [&] {
+            for(size_t i = 0; i < num_jobs; ++i) {
+                pool.add_job(1, [&count](std::stop_token) { count.fetch_add(1, std::memory_order_relaxed); });
+            }
+            while(pool.get_active_job_count(1)) {
+                std::this_thread::yield();
+            }
+        });
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // jobs adding jobs, which go on the worker's own deque and get stolen
+
+    template <typename P> double nested(P &pool)
+    {
+        std::atomic<size_t> count{ 0 };
+        return bench::time_per_item(num_jobs, runs, [&] {
+            for(size_t i = 0; i < num_jobs / jobs_per_spawner; ++i) {
+                pool.add_job(2, [&pool, &count](std::stop_token) {
+                    for(size_t j = 0; j < jobs_per_spawner; ++j) {
+                        pool.add_job(2, [&count](std::stop_token) { count.fetch_add(1, std::memory_order_relaxed); });
+                    }
+                });
+            }
+            while(pool.get_active_job_count(2)) {
+                std::this_thread::yield();
+            }
+        });
+    }
+
+}    // namespace
+
+//////////////////////////////////////////////////////////////////////
+
+BENCH(job_pool)
+{
+    size_t threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+
+    double ext, nest, ext_locked, nest_locked;
+    {
+        job_pool pool;
+        pool.start_workers(threads);
+        ext = external(pool);
+        nest = nested(pool);
+        pool.shut_down();
+    }
+    {
+        locked_pool pool;
+        pool.start_workers(threads);
+        ext_locked = external(pool);
+        nest_locked = nested(pool);
+        pool.shut_down();
+    }
+
+    std::printf("%zu empty jobs, %zu workers, best of %d (ns/job)\n", num_jobs, threads, runs);
+    std::printf("                   job_pool   mutex + deque\n");
+    std::printf("  added outside    %8.1f   %8.1f\n", ext, ext_locked);
+    std::printf("  added by jobs    %8.1f   %8.1f\n", nest, nest_locked);
+}
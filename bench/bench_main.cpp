@@ -0,0 +1,64 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+#include "bench.h"
+
+//////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    struct entry
+    {
+        char const *name;
+        bench::bench_function fn;
+    };
+
+    void const *volatile keep_sink;
+
+    std::vector<entry> &benchmarks()
+    {
+        static std::vector<entry> all;
+        return all;
+    }
+
+}    // namespace
+
+//////////////////////////////////////////////////////////////////////
+
+namespace bench
+{
+    registrar::registrar(char const *name, bench_function fn)
+    {
+        benchmarks().push_back({ name, fn });
+    }
+
+    void keep(void const *p)
+    {
+        keep_sink = p;
+    }
+
+}    // namespace bench
+
+//////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+    std::vector<entry> &all = benchmarks();
+    std::sort(all.begin(), all.end(), [](entry const &a, entry const &b) { return std::string_view(a.name) < std::string_view(b.name); });
+
+    for(entry const &e : all) {
+        bool run = argc < 2;
+        for(int i = 1; i < argc && !run; ++i) {
+            run = std::string_view(argv[i]) == e.name;
+        }
+        if(run) {
+            std::printf("== %s\n", e.name);
+            e.fn();
+        }
+    }
+    return 0;
+}
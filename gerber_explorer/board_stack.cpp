@@ -0,0 +1,513 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "gerber_log.h"
+#include "gerber_util.h"
+#include "board_stack.h"
+#include "drill_holes.h"
+#include "job_pool.h"
+#include "job_trace.h"
+
+LOG_CONTEXT("board_stack", info);
+
+namespace
+{
+    using namespace Clipper2Lib;
+    using namespace gerber_3d;
+
+    //////////////////////////////////////////////////////////////////////
+
+    enum body_t
+    {
+        body_substrate,
+        body_plating,
+        body_copper_top,
+        body_copper_bottom,
+        body_soldermask_top,
+        body_soldermask_bottom,
+        body_silkscreen_top,
+        body_silkscreen_bottom,
+        num_bodies
+    };
+
+    char const *body_names[num_bodies] = { "substrate",      "plating",           "copper_top",     "copper_bottom",
+                                           "soldermask_top", "soldermask_bottom", "silkscreen_top", "silkscreen_bottom" };
+
+    size_t constexpr num_roles = static_cast<size_t>(board_role::num_roles);
+
+    //////////////////////////////////////////////////////////////////////
+
+    Paths64 rect_path(gerber_lib::rect const &r)
+    {
+        double constexpr S = (double)gpu_3d_drawer::CLIPPER_SCALE;
+        int64_t x0 = static_cast<int64_t>(r.min_pos.x * S);
+        int64_t y0 = static_cast<int64_t>(r.min_pos.y * S);
+        int64_t x1 = static_cast<int64_t>(r.max_pos.x * S);
+        int64_t y1 = static_cast<int64_t>(r.max_pos.y * S);
+        return { { { x0, y0 }, { x1, y0 }, { x1, y1 }, { x0, y1 } } };
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    Paths64 outer_contours(PolyTree64 const &tree)
+    {
+        Paths64 outers;
+        outers.reserve(tree.Count());
+        for(auto const &child : tree) {
+            outers.push_back(child->Polygon());
+        }
+        return outers;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Union of sets of shapes with no holes (outlines, drills). They can go
+    // through a drawer's bucketed union, so 20k holes isn't one big Clipper call
+
+    Paths64 union_solids(std::vector<Paths64> &&parts)
+    {
+        std::erase_if(parts, [](Paths64 const &p) { return p.empty(); });
+        if(parts.size() <= 1) {
+            return parts.empty() ? Paths64{} : std::move(parts[0]);
+        }
+        gpu_3d_drawer drawer;
+        for(auto &part : parts) {
+            for(auto &path : part) {
+                drawer.pending_contours.push_back({ std::move(path), gerber_lib::polarity_dark });
+            }
+        }
+        drawer.resolve_2d();
+        return outer_contours(drawer.resolved_tree);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // The cutouts in an outline layer. A hole which covers most of its outer is
+    // the inside of a routed loop, the loops routed inside it are cutouts (the
+    // island in each one falls out of the board). Any other hole is a slot or a
+    // cutout in a filled board shape
+
+    Paths64 outline_cutouts(PolyTree64 const &tree)
+    {
+        Paths64 cutouts;
+        for(auto const &outer : tree) {
+            double const outer_area = std::fabs(Area(outer->Polygon()));
+            for(auto const &hole : *outer) {
+                if(std::fabs(Area(hole->Polygon())) * 2 > outer_area) {
+                    for(auto const &loop : *hole) {
+                        cutouts.push_back(loop->Polygon());
+                    }
+                } else {
+                    cutouts.push_back(hole->Polygon());
+                }
+            }
+        }
+        return cutouts;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // All the inputs for a role as one set of paths. The drills only contribute
+    // their outer contours, the outline is its outer contours with the cutouts
+    // taken out
+
+    Paths64 combine_role(board_role role, std::span<board_stack_input const> inputs, gpu_3d_drawer const *drawers, bool plated = true)
+    {
+        bool solids = role == board_role::outline || role == board_role::drill;
+
+        std::vector<Paths64> parts;
+        std::vector<Paths64> cutouts;
+        for(size_t i = 0; i < inputs.size(); ++i) {
+            if(inputs[i].role != role || (role == board_role::drill && drill_file_is_plated(*inputs[i].file) != plated)) {
+                continue;
+            }
+            if(solids) {
+                parts.push_back(outer_contours(drawers[i].resolved_tree));
+            } else {
+                parts.push_back(PolyTreeToPaths64(drawers[i].resolved_tree));
+            }
+            if(role == board_role::outline) {
+                cutouts.push_back(outline_cutouts(drawers[i].resolved_tree));
+            }
+        }
+        if(solids) {
+            Paths64 board = union_solids(std::move(parts));
+            Paths64 cut = union_solids(std::move(cutouts));
+            if(cut.empty()) {
+                return board;
+            }
+            Clipper64 clipper;
+            clipper.AddSubject(board);
+            clipper.AddClip(cut);
+            Paths64 result;
+            clipper.Execute(ClipType::Difference, FillRule::NonZero, result);
+            return result;
+        }
+        if(parts.size() <= 1) {
+            return parts.empty() ? Paths64{} : std::move(parts[0]);
+        }
+        Clipper64 clipper;
+        for(auto const &p : parts) {
+            clipper.AddSubject(p);
+        }
+        Paths64 result;
+        clipper.Execute(ClipType::Union, FillRule::NonZero, result);
+        return result;
+    }
+
+}    // namespace
+
+namespace gerber_3d
+{
+    //////////////////////////////////////////////////////////////////////
+
+    board_role board_role_from_layer_type(int layer_type)
+    {
+        using namespace gerber_lib;
+
+        if(is_layer_type(layer_type, layer::board) || is_layer_type(layer_type, layer::outline)) {
+            return board_role::outline;
+        }
+        if(is_layer_type(layer_type, layer::drill) || is_layer_type(layer_type, layer::drill_top) ||
+           is_layer_type(layer_type, layer::drill_bottom)) {
+            return board_role::drill;
+        }
+        if(is_layer_type(layer_type, layer::copper_top)) {
+            return board_role::copper_top;
+        }
+        if(is_layer_type(layer_type, layer::copper_bottom)) {
+            return board_role::copper_bottom;
+        }
+        if(is_layer_type(layer_type, layer::soldermask_top)) {
+            return board_role::soldermask_top;
+        }
+        if(is_layer_type(layer_type, layer::soldermask_bottom)) {
+            return board_role::soldermask_bottom;
+        }
+        if(is_layer_type(layer_type, layer::overlay_top)) {
+            return board_role::silkscreen_top;
+        }
+        if(is_layer_type(layer_type, layer::overlay_bottom)) {
+            return board_role::silkscreen_bottom;
+        }
+        return board_role::none;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    char const *board_role_name(board_role role)
+    {
+        switch(role) {
+        case board_role::outline:
+            return "outline";
+        case board_role::drill:
+            return "drill";
+        case board_role::copper_top:
+            return "copper_top";
+        case board_role::copper_bottom:
+            return "copper_bottom";
+        case board_role::soldermask_top:
+            return "soldermask_top";
+        case board_role::soldermask_bottom:
+            return "soldermask_bottom";
+        case board_role::silkscreen_top:
+            return "silkscreen_top";
+        case board_role::silkscreen_bottom:
+            return "silkscreen_bottom";
+        default:
+            return "none";
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool export_board_stack(std::filesystem::path const &path,
+                            std::span<board_stack_input const> inputs,
+                            board_stack_params const &params,
+                            std::stop_token stop_token,
+                            job_progress *progress)
+    {
+        job_trace::stage trace("board_stack", path.filename().string());
+
+        // each phase counts the parts it has finished
+        std::atomic<size_t> parts_done;
+        auto begin_phase = [&](float phase_begin, float phase_end) {
+            parts_done = 0;
+            if(progress != nullptr) {
+                progress->step(phase_begin, phase_end);
+            }
+        };
+        auto part_done = [&](size_t num_parts) {
+            size_t done = parts_done.fetch_add(1) + 1;
+            if(progress != nullptr) {
+                progress->set(static_cast<float>(done) / num_parts);
+            }
+        };
+
+        // resolve all the layers at once
+
+        std::unique_ptr<gpu_3d_drawer[]> layer_drawers(new gpu_3d_drawer[inputs.size()]);
+
+        begin_phase(0.0f, 0.4f);
+        job_pool::parallel_for(0, inputs.size(), 1, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                if(inputs[i].role != board_role::none && !stop_token.stop_requested()) {
+                    job_trace::stage resolve_trace("resolve", board_role_name(inputs[i].role));
+                    layer_drawers[i].init();
+                    layer_drawers[i].tesselation_quality = params.tesselation_quality;
+                    layer_drawers[i].stop_token = stop_token;
+                    if(inputs[i].role == board_role::drill) {
+                        layer_drawers[i].set_drill_file(inputs[i].file);
+                    } else {
+                        layer_drawers[i].set_gerber(inputs[i].file);
+                    }
+                }
+                part_done(inputs.size());
+            }
+        });
+
+        if(stop_token.stop_requested()) {
+            for(size_t i = 0; i < inputs.size(); ++i) {
+                layer_drawers[i].release();
+            }
+            LOG_INFO("Cancelled exporting {}", path.string());
+            return false;
+        }
+
+        // the drill role is the plated holes, non-plated ones get their own slot on the end
+        Paths64 roles[num_roles + 1];
+        job_pool::parallel_for(1, num_roles + 1, 1, [&](size_t begin, size_t end) {
+            for(size_t r = begin; r < end; ++r) {
+                if(r == num_roles) {
+                    roles[r] = combine_role(board_role::drill, inputs, layer_drawers.get(), false);
+                } else {
+                    roles[r] = combine_role(static_cast<board_role>(r), inputs, layer_drawers.get());
+                }
+            }
+        });
+
+        for(size_t i = 0; i < inputs.size(); ++i) {
+            layer_drawers[i].release();
+        }
+        layer_drawers.reset();
+
+        auto role_paths = [&](board_role r) -> Paths64 const & { return roles[static_cast<size_t>(r)]; };
+
+        Paths64 &outline = roles[static_cast<size_t>(board_role::outline)];
+        if(outline.empty()) {
+            if(params.board_extent.is_empty_rect()) {
+                LOG_ERROR("No outline layer and no board extent, can't export the board");
+                return false;
+            }
+            LOG_INFO("No outline layer, using the board extent");
+            outline = rect_path(params.board_extent);
+        }
+
+        gpu_3d_drawer bodies[num_bodies];
+        for(auto &b : bodies) {
+            b.init();
+            b.stop_token = stop_token;
+            b.decimation_tolerance = params.decimation_tolerance;
+        }
+
+        auto cancelled = [&]() {
+            if(!stop_token.stop_requested()) {
+                return false;
+            }
+            for(auto &b : bodies) {
+                b.release();
+            }
+            LOG_INFO("Cancelled exporting {}", path.string());
+            return true;
+        };
+
+        // the holes, shared by everything else. The barrel walls of the plated
+        // ones are in the holes in the substrate
+
+        Paths64 const &plated = role_paths(board_role::drill);
+        Paths64 const &non_plated = roles[num_roles];
+        bool const plating = !plated.empty() && params.plating_thickness > 0;
+
+        Paths64 holes;
+        Paths64 substrate_holes;
+        {
+            std::vector<Paths64> all{ plated, non_plated };
+            holes = union_solids(std::move(all));
+        }
+        if(plating) {
+            make_barrels(plated, params.plating_thickness * gpu_3d_drawer::CLIPPER_SCALE, bodies[body_plating].resolved_tree);
+            std::vector<Paths64> all{ outer_contours(bodies[body_plating].resolved_tree), non_plated };
+            substrate_holes = union_solids(std::move(all));
+        } else {
+            substrate_holes = holes;
+        }
+
+        // 2D region for each body, clipped to the outline then the holes cut out
+
+        bool present[num_bodies] = {};
+        present[body_substrate] = true;
+        present[body_plating] = plating;
+
+        if(cancelled()) {
+            return false;
+        }
+
+        begin_phase(0.4f, 0.6f);
+        job_pool::parallel_for(0, num_bodies, 1, [&](size_t begin, size_t end) {
+            for(size_t b = begin; b < end; ++b) {
+                DEFER(part_done(num_bodies));
+                if(b == body_plating || stop_token.stop_requested()) {
+                    continue;
+                }
+                if(b == body_substrate) {
+                    subtract_holes(outline, substrate_holes, bodies[b].resolved_tree);
+                    continue;
+                }
+                board_role role{};
+                switch(b) {
+                case body_copper_top:
+                    role = board_role::copper_top;
+                    break;
+                case body_copper_bottom:
+                    role = board_role::copper_bottom;
+                    break;
+                case body_soldermask_top:
+                    role = board_role::soldermask_top;
+                    break;
+                case body_soldermask_bottom:
+                    role = board_role::soldermask_bottom;
+                    break;
+                case body_silkscreen_top:
+                    role = board_role::silkscreen_top;
+                    break;
+                case body_silkscreen_bottom:
+                    role = board_role::silkscreen_bottom;
+                    break;
+                }
+                Paths64 const &paths = role_paths(role);
+                bool mask = role == board_role::soldermask_top || role == board_role::soldermask_bottom;
+
+                // a soldermask layer with no openings is still a layer, anything else with nothing in it isn't
+                if(paths.empty() && !(mask && std::ranges::any_of(inputs, [=](auto const &in) { return in.role == role; }))) {
+                    continue;
+                }
+                Paths64 region;
+                {
+                    Clipper64 clipper;
+                    if(mask) {
+                        clipper.AddSubject(outline);
+                        clipper.AddClip(paths);
+                        clipper.Execute(ClipType::Difference, FillRule::NonZero, region);
+                    } else {
+                        clipper.AddSubject(paths);
+                        clipper.AddClip(outline);
+                        clipper.Execute(ClipType::Intersection, FillRule::NonZero, region);
+                    }
+                }
+                subtract_holes(region, holes, bodies[b].resolved_tree);
+                present[b] = true;
+            }
+        });
+
+        // z bands, the bottom side is the top side mirrored below 0
+
+        double const T = params.board_thickness;
+        double const cu = params.copper_thickness;
+        double const mask_top = present[body_soldermask_top] ? params.soldermask_thickness : 0;
+        double const mask_bottom = present[body_soldermask_bottom] ? params.soldermask_thickness : 0;
+        double const silk = params.silkscreen_thickness;
+
+        if(cancelled()) {
+            return false;
+        }
+
+        // the copper shapes the soldermask and silkscreen sit on, copied out first
+        // because a cancelled copper extrude releases its tree while they run
+        Paths64 copper_reference[num_bodies];
+        for(body_t copper : { body_copper_top, body_copper_bottom }) {
+            if(present[copper]) {
+                copper_reference[copper] = PolyTreeToPaths64(bodies[copper].resolved_tree);
+            }
+        }
+
+        begin_phase(0.6f, 0.85f);
+        job_pool::parallel_for(0, num_bodies, 1, [&](size_t begin, size_t end) {
+            for(size_t b = begin; b < end; ++b) {
+                DEFER(part_done(num_bodies));
+                if(!present[b] || stop_token.stop_requested()) {
+                    continue;
+                }
+                job_trace::stage extrude_trace("extrude", body_names[b]);
+                gpu_3d_drawer &d = bodies[b];
+
+                // the soldermask and silkscreen sit higher where there's copper under them
+                auto extrude_over_copper = [&](body_t copper, double base, double thickness, double sign) {
+                    double off0 = base;
+                    double on0 = base + cu;
+                    if(!present[copper]) {
+                        d.extrude(std::min(sign * off0, sign * (off0 + thickness)), std::max(sign * off0, sign * (off0 + thickness)));
+                        return;
+                    }
+                    d.extrude_two_shell(copper_reference[copper],
+                                        std::min(sign * on0, sign * (on0 + thickness)),
+                                        std::max(sign * on0, sign * (on0 + thickness)),
+                                        std::min(sign * off0, sign * (off0 + thickness)),
+                                        std::max(sign * off0, sign * (off0 + thickness)));
+                };
+
+                switch(b) {
+                case body_substrate:
+                case body_plating:
+                    d.extrude(0, T);
+                    break;
+                case body_copper_top:
+                    d.extrude(T, T + cu);
+                    break;
+                case body_copper_bottom:
+                    d.extrude(-cu, 0);
+                    break;
+                case body_soldermask_top:
+                    extrude_over_copper(body_copper_top, T, mask_top, 1);
+                    break;
+                case body_soldermask_bottom:
+                    extrude_over_copper(body_copper_bottom, 0, mask_bottom, -1);
+                    break;
+                case body_silkscreen_top:
+                    extrude_over_copper(body_copper_top, T + mask_top, silk, 1);
+                    break;
+                case body_silkscreen_bottom:
+                    extrude_over_copper(body_copper_bottom, mask_bottom, silk, -1);
+                    break;
+                }
+            }
+        });
+
+        if(cancelled()) {
+            return false;
+        }
+
+        std::vector<mesh_body> mesh_bodies;
+        for(size_t b = 0; b < num_bodies; ++b) {
+            gpu_3d_drawer const &d = bodies[b];
+            if(present[b] && d.mesh_indices.size() != 0) {
+                mesh_bodies.push_back({ body_names[b], { d.mesh_vertices.data(), d.mesh_vertices.size() }, { d.mesh_indices.data(), d.mesh_indices.size() } });
+            }
+        }
+
+        bool ok = false;
+        if(mesh_bodies.empty()) {
+            LOG_ERROR("Nothing to export");
+        } else {
+            begin_phase(0.85f, 1.0f);
+            ok = write_mesh(path, mesh_format_from_path(path), mesh_bodies, stop_token, progress);
+        }
+
+        for(auto &b : bodies) {
+            b.release();
+        }
+        return ok;
+    }
+
+}    // namespace gerber_3d
@@ -0,0 +1,86 @@
+//////////////////////////////////////////////////////////////////////
+// Whole board as a 3D stack of bodies, written to one mesh file
+//
+// Every input layer is resolved on the job_pool at the same time. The outline
+// and the holes are worked out once, every body is clipped to the outline and
+// has the holes cut out of it (see drill_holes.h), then the bodies are extruded
+// in parallel, each into its own z band:
+//
+//   silkscreen top     on the soldermask, raised over copper
+//   soldermask top     over the board, raised over copper, openings cut out
+//   copper top         T .. T + copper
+//   substrate          0 .. T, with the plated barrel walls in its holes
+//   copper bottom      -copper .. 0
+//   soldermask bottom
+//   silkscreen bottom
+
+#pragma once
+
+#include <filesystem>
+#include <span>
+#include <stop_token>
+#include <string>
+
+#include "gerber_lib.h"
+#include "gpu_3d_drawer.h"
+
+namespace gerber_3d
+{
+    //////////////////////////////////////////////////////////////////////
+
+    enum class board_role
+    {
+        none,
+        outline,
+        drill,
+        copper_top,
+        copper_bottom,
+        soldermask_top,
+        soldermask_bottom,
+        silkscreen_top,
+        silkscreen_bottom,
+        num_roles
+    };
+
+    // which part of the stack a layer type is, none for the ones that aren't used
+    // (inner copper, paste, assembly, mechanical...)
+    board_role board_role_from_layer_type(int layer_type);
+
+    char const *board_role_name(board_role role);
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct board_stack_input
+    {
+        gerber_lib::gerber_file *file;
+        board_role role;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // thicknesses in board units (mm)
+
+    struct board_stack_params
+    {
+        double board_thickness{ 1.6 };
+        double copper_thickness{ 0.035 };
+        double soldermask_thickness{ 0.02 };
+        double silkscreen_thickness{ 0.01 };
+        double plating_thickness{ 0.025 };    // barrel walls of plated holes, 0 for none
+        tesselation_quality_t tesselation_quality{ tesselation_quality::high };
+        double decimation_tolerance{ 0.0005 };    // see gpu_3d_drawer::decimation_tolerance
+
+        // the board shape if there's no outline layer
+        gerber_lib::rect board_extent{};
+    };
+
+    // soldermask layers are openings (as they are in the gerbers), copper and
+    // silkscreen are what's there, drills go through everything. If stop_token is
+    // stopped it gives up, frees everything and deletes any partly written file
+
+    bool export_board_stack(std::filesystem::path const &path,
+                            std::span<board_stack_input const> inputs,
+                            board_stack_params const &params,
+                            std::stop_token stop_token = {},
+                            job_progress *progress = nullptr);
+
+}    // namespace gerber_3d
@@ -0,0 +1,308 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <tuple>
+#include <unordered_map>
+
+#include "clearance_check.h"
+#include "gerber_log.h"
+#include "gpu_3d_drawer.h"
+#include "job_pool.h"
+#include "job_trace.h"
+#include "spatial_grid.h"
+
+LOG_CONTEXT("clearance_check", info);
+
+namespace
+{
+    using namespace Clipper2Lib;
+
+    int constexpr max_grid_dim = 2048;
+
+    // roughly how many edges in a cell
+    size_t constexpr edges_per_cell = 4;
+
+    // hits for the same two nets further apart than this many clearances are different places
+    double constexpr separate_places = 4.0;
+
+    using edge = gerber_3d::contour_grid::edge;
+
+    //////////////////////////////////////////////////////////////////////
+    // One layer's islands and their edges in a grid, grown by half the clearance
+    // so any two edges closer than that share a cell. Islands are numbered from 0
+    // here, first_island is where the layer's start in the numbering across all of them
+
+    struct layer_grid
+    {
+        gerber_3d::contour_grid grid;
+        std::vector<gerber_3d::contour_info> contours;
+        std::vector<uint32_t> contour_island;
+        uint32_t first_island{};
+        uint32_t num_islands{};
+
+        // every outer is an island, islands inside holes too. The islands in a
+        // hole come before the outer's next hole so go by the outer, not the order
+        void build(PolyTree64 const &tree, double clearance)
+        {
+            std::vector<Path64 const *> paths;
+            std::unordered_map<PolyPath64 const *, uint32_t> island_index;
+            gerber_3d::for_each_contour(tree, [&](Path64 const &path, gerber_3d::contour_info const &info) {
+                auto [it, added] = island_index.try_emplace(info.outer, num_islands);
+                if(added) {
+                    num_islands += 1;
+                }
+                paths.push_back(&path);
+                contours.push_back(info);
+                contour_island.push_back(it->second);
+            });
+
+            // cells smaller than the clearance just put every edge in more of them
+            grid.build(paths, edges_per_cell, max_grid_dim, clearance / 2, std::max(1.0, clearance));
+        }
+
+        uint32_t island_of(edge const &e) const
+        {
+            return first_island + contour_island[e.contour];
+        }
+
+        // the island p is in, from the nearest edge a ray towards +x crosses
+        bool island_at(Point64 const &p, uint32_t &island) const
+        {
+            gerber_3d::contour_grid::hit h = grid.ray_cast(p);
+            if(!h.found || h.up != contours[h.contour].material_left) {
+                return false;
+            }
+            island = first_island + contour_island[h.contour];
+            return true;
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct closest
+    {
+        double distance_sq;
+        double ax, ay;
+        double bx, by;
+    };
+
+    void closest_to_segment(double px, double py, Point64 const &a, Point64 const &b, bool p_first, closest &best)
+    {
+        double dx = static_cast<double>(b.x - a.x);
+        double dy = static_cast<double>(b.y - a.y);
+        double len_sq = dx * dx + dy * dy;
+        double t = len_sq > 0 ? std::clamp(((px - a.x) * dx + (py - a.y) * dy) / len_sq, 0.0, 1.0) : 0.0;
+        double qx = a.x + t * dx;
+        double qy = a.y + t * dy;
+        double d = (px - qx) * (px - qx) + (py - qy) * (py - qy);
+        if(d < best.distance_sq) {
+            best = p_first ? closest{ d, px, py, qx, qy } : closest{ d, qx, qy, px, py };
+        }
+    }
+
+    // islands on a resolved layer don't cross, so the closest points are an end of one of them
+    closest edge_distance(edge const &p, edge const &q)
+    {
+        closest best{ std::numeric_limits<double>::max() };
+        closest_to_segment(static_cast<double>(p.a.x), static_cast<double>(p.a.y), q.a, q.b, true, best);
+        closest_to_segment(static_cast<double>(p.b.x), static_cast<double>(p.b.y), q.a, q.b, true, best);
+        closest_to_segment(static_cast<double>(q.a.x), static_cast<double>(q.a.y), p.a, p.b, false, best);
+        closest_to_segment(static_cast<double>(q.b.x), static_cast<double>(q.b.y), p.a, p.b, false, best);
+        return best;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct hit
+    {
+        uint32_t layer;
+        uint32_t net_a;    // net_a < net_b
+        uint32_t net_b;
+        closest where;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    uint32_t find_net(std::vector<uint32_t> &parent, uint32_t i)
+    {
+        while(parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+}    // namespace
+
+namespace gerber_3d
+{
+    //////////////////////////////////////////////////////////////////////
+
+    clearance_result check_clearance(std::span<PolyTree64 const *const> layers, Paths64 const &plated_holes, double min_clearance, std::stop_token stop_token)
+    {
+        job_trace::stage trace("clearance", {});
+
+        clearance_result result;
+
+        double const clearance = min_clearance * gpu_3d_drawer::CLIPPER_SCALE;
+        double const clearance_sq = clearance * clearance;
+
+        // islands are numbered across all the layers
+        std::vector<layer_grid> grids(layers.size());
+        job_pool::parallel_for(0, layers.size(), 1, [&](size_t begin, size_t end) {
+            for(size_t l = begin; l < end; ++l) {
+                grids[l].build(*layers[l], clearance);
+            }
+        });
+        for(auto &g : grids) {
+            g.first_island = static_cast<uint32_t>(result.num_islands);
+            result.num_islands += g.num_islands;
+        }
+
+        // the islands each plated hole goes through are the same net
+        std::vector<uint32_t> net(result.num_islands);
+        std::iota(net.begin(), net.end(), 0);
+        {
+            std::vector<uint32_t> hole_island(plated_holes.size() * layers.size(), UINT32_MAX);
+            job_pool::parallel_for(0, plated_holes.size(), 256, [&](size_t begin, size_t end) {
+                for(size_t h = begin; h < end; ++h) {
+                    if(plated_holes[h].empty()) {
+                        continue;
+                    }
+                    for(size_t l = 0; l < layers.size(); ++l) {
+                        uint32_t island;
+                        if(grids[l].island_at(plated_holes[h][0], island)) {
+                            hole_island[h * layers.size() + l] = island;
+                        }
+                    }
+                }
+            });
+            for(size_t h = 0; h < plated_holes.size(); ++h) {
+                uint32_t first = UINT32_MAX;
+                for(size_t l = 0; l < layers.size(); ++l) {
+                    uint32_t island = hole_island[h * layers.size() + l];
+                    if(island == UINT32_MAX) {
+                        continue;
+                    }
+                    if(first == UINT32_MAX) {
+                        first = island;
+                    } else {
+                        uint32_t a = find_net(net, first);
+                        uint32_t b = find_net(net, island);
+                        net[std::max(a, b)] = std::min(a, b);
+                    }
+                }
+            }
+            for(uint32_t i = 0; i < static_cast<uint32_t>(net.size()); ++i) {
+                net[i] = find_net(net, i);
+            }
+            result.num_nets = 0;
+            for(uint32_t i = 0; i < static_cast<uint32_t>(net.size()); ++i) {
+                result.num_nets += net[i] == i;
+            }
+        }
+
+        // every pair of edges from different nets which share a cell, checked in the
+        // cell with the corner of where their grown boxes overlap so only once
+
+        std::vector<hit> hits;
+        for(uint32_t l = 0; l < static_cast<uint32_t>(layers.size()) && !stop_token.stop_requested(); ++l) {
+            layer_grid const &g = grids[l];
+            if(g.grid.edges.empty()) {
+                continue;
+            }
+            auto edge_net = [&](edge const &e) { return net[g.island_of(e)]; };
+            size_t const num_cells = g.grid.grid.num_cells();
+            std::vector<hit> layer_hits = job_pool::parallel_reduce(
+                0,
+                num_cells,
+                64,
+                std::vector<hit>{},
+                [&](size_t begin, size_t end) {
+                    std::vector<hit> found;
+                    if(stop_token.stop_requested()) {
+                        return found;
+                    }
+                    for(size_t c = begin; c < end; ++c) {
+                        std::span<edge const> items = g.grid.cell(c);
+                        for(size_t i = 0; i < items.size(); ++i) {
+                            edge const &p = items[i];
+                            uint32_t net_p = edge_net(p);
+                            for(size_t j = i + 1; j < items.size(); ++j) {
+                                edge const &q = items[j];
+                                uint32_t net_q = edge_net(q);
+                                if(net_p == net_q) {
+                                    continue;
+                                }
+                                cell_grid const &cells = g.grid.grid;
+                                double left = std::max(std::min(p.a.x, p.b.x), std::min(q.a.x, q.b.x)) - g.grid.margin;
+                                double top = std::max(std::min(p.a.y, p.b.y), std::min(q.a.y, q.b.y)) - g.grid.margin;
+                                if(cells.cell_index(cells.cell_x(left), cells.cell_y(top)) != c) {
+                                    continue;
+                                }
+                                closest d = edge_distance(p, q);
+                                if(d.distance_sq < clearance_sq) {
+                                    if(net_p < net_q) {
+                                        found.push_back({ l, net_p, net_q, d });
+                                    } else {
+                                        found.push_back({ l, net_q, net_p, { d.distance_sq, d.bx, d.by, d.ax, d.ay } });
+                                    }
+                                }
+                            }
+                        }
+                    }
+                    return found;
+                },
+                [](std::vector<hit> a, std::vector<hit> b) {
+                    a.insert(a.end(), b.begin(), b.end());
+                    return a;
+                });
+            hits.insert(hits.end(), layer_hits.begin(), layer_hits.end());
+        }
+
+        if(stop_token.stop_requested()) {
+            result.cancelled = true;
+            return result;
+        }
+
+        // closest first for each pair of nets, then the other places they're too close
+
+        std::sort(hits.begin(), hits.end(), [](hit const &a, hit const &b) {
+            return std::tie(a.layer, a.net_a, a.net_b, a.where.distance_sq) < std::tie(b.layer, b.net_a, b.net_b, b.where.distance_sq);
+        });
+        double const apart_sq = (separate_places * clearance) * (separate_places * clearance);
+        double const inv_scale = 1.0 / gpu_3d_drawer::CLIPPER_SCALE;
+        size_t first_of_pair = 0;
+        for(size_t i = 0; i < hits.size(); ++i) {
+            hit const &h = hits[i];
+            if(i != 0 && (h.layer != hits[i - 1].layer || h.net_a != hits[i - 1].net_a || h.net_b != hits[i - 1].net_b)) {
+                first_of_pair = result.violations.size();
+            }
+            bool new_place = true;
+            for(size_t v = first_of_pair; v < result.violations.size() && new_place; ++v) {
+                double dx = result.violations[v].from.x * gpu_3d_drawer::CLIPPER_SCALE - h.where.ax;
+                double dy = result.violations[v].from.y * gpu_3d_drawer::CLIPPER_SCALE - h.where.ay;
+                new_place = dx * dx + dy * dy > apart_sq;
+            }
+            if(new_place) {
+                result.violations.push_back({ { h.where.ax * inv_scale, h.where.ay * inv_scale },
+                                              { h.where.bx * inv_scale, h.where.by * inv_scale },
+                                              std::sqrt(h.where.distance_sq) * inv_scale,
+                                              h.layer,
+                                              h.net_a,
+                                              h.net_b });
+            }
+        }
+        std::stable_sort(result.violations.begin(), result.violations.end(), [](clearance_violation const &a, clearance_violation const &b) {
+            return a.distance < b.distance;
+        });
+
+        LOG_INFO("{} layers, {} islands, {} nets, {} edge pairs too close, {} violations", layers.size(), result.num_islands, result.num_nets, hits.size(),
+                 result.violations.size());
+        return result;
+    }
+
+}    // namespace gerber_3d
@@ -0,0 +1,54 @@
+//////////////////////////////////////////////////////////////////////
+// Minimum clearance check between copper of different nets
+//
+// Works on resolved layers (gpu_3d_drawer::resolved_tree). Every outer polygon
+// of a layer is one piece of connected copper, the pieces on different layers
+// which a plated hole goes through are the same net. The edges of each layer
+// go in a grid, inflated by half the clearance so any two edges closer than
+// that share a cell, and the cells are checked on the job_pool. Edges of the
+// same net are never a violation.
+
+#pragma once
+
+#include <span>
+#include <stop_token>
+#include <vector>
+
+#include "gerber_2d.h"
+
+#include "clipper2/clipper.h"
+
+namespace gerber_3d
+{
+    //////////////////////////////////////////////////////////////////////
+
+    struct clearance_violation
+    {
+        gerber_lib::vec2d from;    // the closest points, board units
+        gerber_lib::vec2d to;
+        double distance{};
+        uint32_t layer{};          // index into the layers passed in
+        uint32_t net_a{};
+        uint32_t net_b{};
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct clearance_result
+    {
+        std::vector<clearance_violation> violations;    // closest first
+        size_t num_islands{};
+        size_t num_nets{};
+        bool cancelled{};
+    };
+
+    // layers and plated_holes in CLIPPER_SCALE units, min_clearance in board units.
+    // Two nets closer than min_clearance in more than one place (further apart
+    // than a few clearances) are reported once for each place
+
+    clearance_result check_clearance(std::span<Clipper2Lib::PolyTree64 const *const> layers,
+                                     Clipper2Lib::Paths64 const &plated_holes,
+                                     double min_clearance,
+                                     std::stop_token stop_token = {});
+
+}    // namespace gerber_3d
@@ -0,0 +1,750 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "clipper2/clipper.h"
+
+#include "gerber_log.h"
+#include "copper_nets.h"
+#include "job_pool.h"
+#include "job_trace.h"
+#include "spatial_grid.h"
+
+LOG_CONTEXT("copper_nets", info);
+
+namespace
+{
+    using gerber_lib::vec2f;
+    using gerber::copper_nets;
+
+    // grids are at most this many cells across
+    int constexpr max_grid_dim = 2048;
+
+    // entities which cover more cells than this (pours, planes) aren't put in the
+    // entity grid, everything is checked against them directly
+    size_t constexpr max_entity_cells = 1024;
+
+    // entities with more outline vertices than this get their own edge grid
+    uint32_t constexpr edge_grid_threshold = 64;
+
+    uint32_t constexpr no_index = UINT32_MAX;
+
+    // outlines go through Clipper in these units
+    double constexpr clipper_scale = 1000000;
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct box
+    {
+        float x0, y0, x1, y1;
+
+        bool overlaps(box const &o) const
+        {
+            return x0 <= o.x1 && o.x0 <= x1 && y0 <= o.y1 && o.y0 <= y1;
+        }
+
+        bool contains(box const &o) const
+        {
+            return x0 <= o.x0 && y0 <= o.y0 && x1 >= o.x1 && y1 >= o.y1;
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // Items (indices) bucketed by their boxes
+
+    struct box_grid : gerber_3d::cell_grid
+    {
+        box bounds{};
+        std::vector<uint32_t> items;
+
+        size_t cells_covered(box const &b) const
+        {
+            return cell_grid::cells_covered(b.x0, b.y0, b.x1, b.y1);
+        }
+
+        // grid over the boxes with about one cell per item, then the
+        // items for which use(i) says so are put in it
+        template <typename B, typename U> void build(size_t num_items, B &&get_box, U &&use)
+        {
+            bounds = { FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for(size_t i = 0; i < num_items; ++i) {
+                box b = get_box(i);
+                bounds = { std::min(bounds.x0, b.x0), std::min(bounds.y0, b.y0), std::max(bounds.x1, b.x1), std::max(bounds.y1, b.y1) };
+            }
+            if(num_items == 0) {
+                bounds = {};
+            }
+            fit(bounds.x0, bounds.y0, bounds.x1, bounds.y1, static_cast<double>(num_items), max_grid_dim);
+            bucket(items, [&](auto &&place) {
+                for(uint32_t i = 0; i < static_cast<uint32_t>(num_items); ++i) {
+                    if(use(i)) {
+                        box b = get_box(i);
+                        place(b.x0, b.y0, b.x1, b.y1, i);
+                    }
+                }
+            });
+        }
+
+        std::span<uint32_t const> cell(size_t c) const
+        {
+            return cell_grid::cell(items, c);
+        }
+
+        std::span<uint32_t const> cell(int x, int y) const
+        {
+            return cell(cell_index(x, y));
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct edge
+    {
+        vec2f a;
+        vec2f b;
+    };
+
+    box edge_box(edge const &e)
+    {
+        return { std::min(e.a.x, e.b.x), std::min(e.a.y, e.b.y), std::max(e.a.x, e.b.x), std::max(e.a.y, e.b.y) };
+    }
+
+    // the edges of a big outline and a grid of them
+    struct edge_index
+    {
+        std::vector<edge> edges;
+        box_grid grid;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    // a piece of copper: a dark entity or, if clear entities were drawn over
+    // it, one of the pieces which are left
+
+    struct entity_ref
+    {
+        box bounds;
+        std::span<vec2f const> vertices;    // all the contours one after the other
+        std::span<int const> contours;      // the size of each one
+        uint32_t layer;
+        uint32_t entity;
+        uint32_t edges;    // into entity_edges, or no_index if it's small
+        bool drill;
+        bool large;        // not in the entity grid
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // What's left of a dark entity after the clear ones drawn over it, each
+    // piece is an outer contour and its holes
+
+    struct cut_entity
+    {
+        std::vector<vec2f> vertices;
+        std::vector<int> contour_sizes;
+        std::vector<uint32_t> piece_contours;    // how many contours each piece has
+    };
+
+    Clipper2Lib::Paths64 entity_paths(copper_nets::layer_input const &layer, gerber::tesselator_entity const &e)
+    {
+        Clipper2Lib::Paths64 paths;
+        size_t start = e.outline_offset;
+        for(int c = 0; c < e.num_contours; ++c) {
+            size_t n = layer.contour_sizes[e.contour_offset + c];
+            Clipper2Lib::Path64 &path = paths.emplace_back();
+            path.reserve(n);
+            for(size_t i = start; i < start + n; ++i) {
+                vec2f const &p = layer.outline_vertices[i];
+                path.emplace_back(std::llround(p.x * clipper_scale), std::llround(p.y * clipper_scale));
+            }
+            start += n;
+        }
+        return paths;
+    }
+
+    void add_pieces(Clipper2Lib::PolyPath64 const &node, cut_entity &cut)
+    {
+        auto add_contour = [&](Clipper2Lib::Path64 const &path) {
+            for(auto const &p : path) {
+                cut.vertices.push_back({ static_cast<float>(p.x / clipper_scale), static_cast<float>(p.y / clipper_scale) });
+            }
+            cut.contour_sizes.push_back(static_cast<int>(path.size()));
+        };
+        for(auto const &outer : node) {
+            uint32_t num_contours = 1;
+            add_contour(outer->Polygon());
+            for(auto const &hole : *outer) {
+                add_contour(hole->Polygon());
+                num_contours += 1;
+            }
+            cut.piece_contours.push_back(num_contours);
+
+            // islands in the holes are pieces of their own
+            for(auto const &hole : *outer) {
+                add_pieces(*hole, cut);
+            }
+        }
+    }
+
+    cut_entity cut_out(copper_nets::layer_input const &layer, uint32_t entity, std::span<uint32_t const> clears)
+    {
+        Clipper2Lib::Paths64 clip;
+        for(uint32_t c : clears) {
+            Clipper2Lib::Paths64 paths = entity_paths(layer, layer.entities[c]);
+            clip.insert(clip.end(), paths.begin(), paths.end());
+        }
+        Clipper2Lib::Clipper64 clipper;
+        clipper.AddSubject(entity_paths(layer, layer.entities[entity]));
+        clipper.AddClip(clip);
+        Clipper2Lib::PolyTree64 tree;
+        clipper.Execute(Clipper2Lib::ClipType::Difference, Clipper2Lib::FillRule::NonZero, tree);
+
+        cut_entity cut;
+        add_pieces(tree, cut);
+        return cut;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    double orient(vec2f const &a, vec2f const &b, vec2f const &c)
+    {
+        return (static_cast<double>(b.x) - a.x) * (static_cast<double>(c.y) - a.y) - (static_cast<double>(b.y) - a.y) * (static_cast<double>(c.x) - a.x);
+    }
+
+    bool on_segment(vec2f const &a, vec2f const &b, vec2f const &p)
+    {
+        return std::min(a.x, b.x) <= p.x && p.x <= std::max(a.x, b.x) && std::min(a.y, b.y) <= p.y && p.y <= std::max(a.y, b.y);
+    }
+
+    // touching counts
+    bool edges_touch(edge const &p, edge const &q)
+    {
+        double d1 = orient(q.a, q.b, p.a);
+        double d2 = orient(q.a, q.b, p.b);
+        double d3 = orient(p.a, p.b, q.a);
+        double d4 = orient(p.a, p.b, q.b);
+        if(((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0))) {
+            return true;
+        }
+        return (d1 == 0 && on_segment(q.a, q.b, p.a)) || (d2 == 0 && on_segment(q.a, q.b, p.b)) || (d3 == 0 && on_segment(p.a, p.b, q.a)) ||
+               (d4 == 0 && on_segment(p.a, p.b, q.b));
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Lock free union-find, the root with the higher id is linked under the lower one
+
+    struct union_find
+    {
+        std::unique_ptr<std::atomic<uint32_t>[]> parent;
+
+        explicit union_find(size_t n) : parent(new std::atomic<uint32_t>[n])
+        {
+            for(uint32_t i = 0; i < static_cast<uint32_t>(n); ++i) {
+                parent[i].store(i, std::memory_order_relaxed);
+            }
+        }
+
+        uint32_t find(uint32_t i) const
+        {
+            while(true) {
+                uint32_t p = parent[i].load(std::memory_order_relaxed);
+                if(p == i) {
+                    return i;
+                }
+                uint32_t gp = parent[p].load(std::memory_order_relaxed);
+                if(gp != p) {
+                    // path halving, if it fails someone else moved it up already
+                    parent[i].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+                }
+                i = gp;
+            }
+        }
+
+        void unite(uint32_t a, uint32_t b)
+        {
+            while(true) {
+                a = find(a);
+                b = find(b);
+                if(a == b) {
+                    return;
+                }
+                if(a < b) {
+                    std::swap(a, b);
+                }
+                uint32_t expected = a;
+                if(parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed)) {
+                    return;
+                }
+            }
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct net_builder
+    {
+        std::vector<entity_ref> entities;
+        std::vector<edge_index> entity_edges;
+
+        //////////////////////////////////////////////////////////////////////
+
+        template <typename F> static bool for_each_edge(entity_ref const &r, F &&fn)
+        {
+            size_t start = 0;
+            for(int n : r.contours) {
+                for(size_t i = 0, j = n - 1; i < static_cast<size_t>(n); j = i++) {
+                    if(fn(edge{ r.vertices[start + j], r.vertices[start + i] })) {
+                        return true;
+                    }
+                }
+                start += n;
+            }
+            return false;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        void gather_edges(entity_ref const &r, box const &area, std::vector<edge> &out) const
+        {
+            out.clear();
+            if(r.edges == no_index) {
+                for_each_edge(r, [&](edge const &e) {
+                    if(edge_box(e).overlaps(area)) {
+                        out.push_back(e);
+                    }
+                    return false;
+                });
+                return;
+            }
+            edge_index const &index = entity_edges[r.edges];
+            box_grid const &grid = index.grid;
+            if(!grid.bounds.overlaps(area)) {
+                return;
+            }
+            thread_local std::vector<uint32_t> found;
+            found.clear();
+            for(int y = grid.cell_y(area.y0); y <= grid.cell_y(area.y1); ++y) {
+                for(int x = grid.cell_x(area.x0); x <= grid.cell_x(area.x1); ++x) {
+                    for(uint32_t i : grid.cell(x, y)) {
+                        if(edge_box(index.edges[i]).overlaps(area)) {
+                            found.push_back(i);
+                        }
+                    }
+                }
+            }
+            // an edge is in every cell it crosses
+            std::sort(found.begin(), found.end());
+            found.erase(std::unique(found.begin(), found.end()), found.end());
+            for(uint32_t i : found) {
+                out.push_back(index.edges[i]);
+            }
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // crossings of a ray from p, odd is inside. For a big outline the ray
+        // goes towards whichever side of its grid is nearer
+
+        bool point_inside(entity_ref const &r, vec2f const &p) const
+        {
+            bool towards_left = false;
+            auto crosses = [&](edge const &e, double &x) {
+                if((e.a.y > p.y) == (e.b.y > p.y)) {
+                    return false;
+                }
+                x = e.a.x + (static_cast<double>(p.y) - e.a.y) * (static_cast<double>(e.b.x) - e.a.x) / (static_cast<double>(e.b.y) - e.a.y);
+                return towards_left ? x <= p.x : x >= p.x;
+            };
+            int crossings = 0;
+            if(r.edges == no_index) {
+                for_each_edge(r, [&](edge const &e) {
+                    double x;
+                    crossings += crosses(e, x);
+                    return false;
+                });
+                return (crossings & 1) != 0;
+            }
+            // a cell at a time along the row, each crossing counted in the cell it's in
+            edge_index const &index = entity_edges[r.edges];
+            box_grid const &grid = index.grid;
+            if(p.y < grid.bounds.y0 || p.y > grid.bounds.y1 || p.x < grid.bounds.x0 || p.x > grid.bounds.x1) {
+                return false;
+            }
+            towards_left = p.x - grid.bounds.x0 < grid.bounds.x1 - p.x;
+            int y = grid.cell_y(p.y);
+            int x_end = towards_left ? -1 : grid.nx;
+            int step = towards_left ? -1 : 1;
+            for(int x = grid.cell_x(p.x); x != x_end; x += step) {
+                for(uint32_t i : grid.cell(x, y)) {
+                    double cross_x;
+                    if(crosses(index.edges[i], cross_x) && grid.cell_x(static_cast<float>(cross_x)) == x) {
+                        crossings += 1;
+                    }
+                }
+            }
+            return (crossings & 1) != 0;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        bool outlines_touch(entity_ref const &a, entity_ref const &b) const
+        {
+            box area{ std::max(a.bounds.x0, b.bounds.x0), std::max(a.bounds.y0, b.bounds.y0), std::min(a.bounds.x1, b.bounds.x1),
+                      std::min(a.bounds.y1, b.bounds.y1) };
+
+            thread_local std::vector<edge> edges_a;
+            thread_local std::vector<edge> edges_b;
+            gather_edges(a, area, edges_a);
+            gather_edges(b, area, edges_b);
+            for(edge const &ea : edges_a) {
+                box ba = edge_box(ea);
+                for(edge const &eb : edges_b) {
+                    if(ba.overlaps(edge_box(eb)) && edges_touch(ea, eb)) {
+                        return true;
+                    }
+                }
+            }
+
+            // no edges cross, so either one is inside the other or they're apart
+            return (b.bounds.contains(a.bounds) && point_inside(b, a.vertices[0])) || (a.bounds.contains(b.bounds) && point_inside(a, b.vertices[0]));
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // copper only connects on its own layer, drills connect to copper on any layer
+
+        static bool can_connect(entity_ref const &a, entity_ref const &b)
+        {
+            if(a.drill || b.drill) {
+                return a.drill != b.drill;
+            }
+            return a.layer == b.layer;
+        }
+    };
+
+}    // namespace
+
+namespace gerber
+{
+    //////////////////////////////////////////////////////////////////////
+
+    copper_nets::layer_input copper_nets::layer_input::from_drawer(gerber_drawer const &drawer, bool is_drill)
+    {
+        return { { drawer.entities.data(), drawer.entities.size() },
+                 { drawer.outline_vertices.data(), drawer.outline_vertices.size() },
+                 { drawer.contour_sizes.data(), drawer.contour_sizes.size() },
+                 is_drill };
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void copper_nets::clear()
+    {
+        layer_base.clear();
+        net_ids.clear();
+        net_start.clear();
+        net_members.clear();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    uint32_t copper_nets::net_of(uint32_t layer, uint32_t entity) const
+    {
+        if(layer + 1 >= layer_base.size() || entity >= layer_base[layer + 1] - layer_base[layer]) {
+            return no_net;
+        }
+        return net_ids[layer_base[layer] + entity];
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    std::span<copper_nets::member const> copper_nets::members(uint32_t net) const
+    {
+        if(net == no_net || net + 1 >= net_start.size()) {
+            return {};
+        }
+        return { net_members.data() + net_start[net], net_members.data() + net_start[net + 1] };
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool copper_nets::build(std::span<layer_input const> layers, std::stop_token stop_token)
+    {
+        job_trace::stage trace("copper_nets", {});
+
+        clear();
+
+        net_builder b;
+
+        layer_base.resize(layers.size() + 1, 0);
+        for(size_t l = 0; l < layers.size(); ++l) {
+            layer_base[l + 1] = layer_base[l] + static_cast<uint32_t>(layers[l].entities.size());
+        }
+        size_t const num_entities = layer_base.back();
+
+        std::vector<uint32_t> entity_layer(num_entities);
+        for(uint32_t l = 0; l < static_cast<uint32_t>(layers.size()); ++l) {
+            std::fill(entity_layer.begin() + layer_base[l], entity_layer.begin() + layer_base[l + 1], l);
+        }
+        auto entity_of = [&](uint32_t id) -> tesselator_entity const & {
+            uint32_t l = entity_layer[id];
+            return layers[l].entities[id - layer_base[l]];
+        };
+        auto entity_box = [&](uint32_t id) {
+            gerber_lib::rect const &r = entity_of(id).bounds;
+            return box{ static_cast<float>(r.min_pos.x), static_cast<float>(r.min_pos.y), static_cast<float>(r.max_pos.x), static_cast<float>(r.max_pos.y) };
+        };
+        auto has_outline = [&](uint32_t id) { return entity_of(id).outline_size >= 3; };
+        auto is_clear = [&](uint32_t id) { return (entity_of(id).flags & entity_flags_t::clear) != 0; };
+
+        // clear entities take the copper away from the dark ones drawn before
+        // them on the same layer, which can leave a dark one in pieces
+        box_grid clear_grid;
+        clear_grid.build(
+            num_entities, [&](size_t i) { return entity_box(static_cast<uint32_t>(i)); },
+            [&](uint32_t i) { return is_clear(i) && has_outline(i); });
+
+        auto for_each_clear_over = [&](uint32_t i, auto &&fn) {
+            box a = entity_box(i);
+            for(int y = clear_grid.cell_y(a.y0); y <= clear_grid.cell_y(a.y1); ++y) {
+                for(int x = clear_grid.cell_x(a.x0); x <= clear_grid.cell_x(a.x1); ++x) {
+                    for(uint32_t c : clear_grid.cell(x, y)) {
+                        if(c > i && entity_layer[c] == entity_layer[i] && entity_box(c).overlaps(a) && fn(c)) {
+                            return;
+                        }
+                    }
+                }
+            }
+        };
+
+        std::vector<uint32_t> cut_index(num_entities, no_index);
+        std::vector<uint32_t> cut_entities;
+        if(!clear_grid.items.empty()) {
+            std::vector<uint8_t> covered(num_entities);
+            job_pool::parallel_for(0, num_entities, 1024, [&](size_t begin, size_t end) {
+                for(uint32_t i = static_cast<uint32_t>(begin); i < end && !stop_token.stop_requested(); ++i) {
+                    if(!is_clear(i) && has_outline(i)) {
+                        for_each_clear_over(i, [&](uint32_t) {
+                            covered[i] = 1;
+                            return true;
+                        });
+                    }
+                }
+            });
+            for(uint32_t i = 0; i < static_cast<uint32_t>(num_entities); ++i) {
+                if(covered[i]) {
+                    cut_index[i] = static_cast<uint32_t>(cut_entities.size());
+                    cut_entities.push_back(i);
+                }
+            }
+        }
+        std::vector<cut_entity> cuts(cut_entities.size());
+        job_pool::parallel_for(0, cut_entities.size(), 16, [&](size_t begin, size_t end) {
+            std::vector<uint32_t> clears;
+            for(size_t n = begin; n < end && !stop_token.stop_requested(); ++n) {
+                uint32_t i = cut_entities[n];
+                uint32_t l = entity_layer[i];
+                clears.clear();
+                for_each_clear_over(i, [&](uint32_t c) {
+                    clears.push_back(c - layer_base[l]);
+                    return false;
+                });
+                // a clear is in every cell it covers
+                std::sort(clears.begin(), clears.end());
+                clears.erase(std::unique(clears.begin(), clears.end()), clears.end());
+                cuts[n] = cut_out(layers[l], i - layer_base[l], clears);
+            }
+        });
+
+        if(stop_token.stop_requested()) {
+            clear();
+            return false;
+        }
+
+        // the pieces of copper, in the order of their entities
+        std::vector<uint32_t> first_ref(num_entities + 1);
+        for(uint32_t l = 0; l < static_cast<uint32_t>(layers.size()); ++l) {
+            layer_input const &layer = layers[l];
+            for(uint32_t i = 0; i < static_cast<uint32_t>(layer.entities.size()); ++i) {
+                uint32_t id = layer_base[l] + i;
+                first_ref[id] = static_cast<uint32_t>(b.entities.size());
+                if(is_clear(id) || !has_outline(id)) {
+                    continue;
+                }
+                tesselator_entity const &e = layer.entities[i];
+                if(cut_index[id] == no_index) {
+                    b.entities.push_back({ entity_box(id), layer.outline_vertices.subspan(e.outline_offset, e.outline_size),
+                                           layer.contour_sizes.subspan(e.contour_offset, e.num_contours), l, i, no_index, layer.is_drill, false });
+                    continue;
+                }
+                cut_entity const &cut = cuts[cut_index[id]];
+                size_t vertex = 0;
+                size_t contour = 0;
+                for(uint32_t num_contours : cut.piece_contours) {
+                    size_t num_vertices = 0;
+                    for(uint32_t c = 0; c < num_contours; ++c) {
+                        num_vertices += cut.contour_sizes[contour + c];
+                    }
+                    std::span<vec2f const> vertices{ cut.vertices.data() + vertex, num_vertices };
+                    box bounds{ FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX };
+                    for(vec2f const &p : vertices) {
+                        bounds = { std::min(bounds.x0, p.x), std::min(bounds.y0, p.y), std::max(bounds.x1, p.x), std::max(bounds.y1, p.y) };
+                    }
+                    b.entities.push_back({ bounds, vertices, { cut.contour_sizes.data() + contour, num_contours }, l, i, no_index, layer.is_drill, false });
+                    vertex += num_vertices;
+                    contour += num_contours;
+                }
+            }
+        }
+        first_ref[num_entities] = static_cast<uint32_t>(b.entities.size());
+        size_t const num_refs = b.entities.size();
+
+        // edge grids for the big outlines
+        std::vector<uint32_t> big;
+        for(uint32_t i = 0; i < static_cast<uint32_t>(num_refs); ++i) {
+            if(b.entities[i].vertices.size() > edge_grid_threshold) {
+                b.entities[i].edges = static_cast<uint32_t>(b.entity_edges.size());
+                b.entity_edges.emplace_back();
+                big.push_back(i);
+            }
+        }
+        job_pool::parallel_for(0, big.size(), 1, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end && !stop_token.stop_requested(); ++i) {
+                entity_ref const &r = b.entities[big[i]];
+                edge_index &index = b.entity_edges[r.edges];
+                b.for_each_edge(r, [&](edge const &e) {
+                    index.edges.push_back(e);
+                    return false;
+                });
+                index.grid.build(
+                    index.edges.size(), [&](size_t e) { return edge_box(index.edges[e]); }, [](uint32_t) { return true; });
+            }
+        });
+
+        // the entity grid, without the ones which would fill a lot of it
+        box_grid grid;
+        grid.build(
+            num_refs, [&](size_t i) { return b.entities[i].bounds; }, [&](uint32_t i) { return grid.cells_covered(b.entities[i].bounds) <= max_entity_cells; });
+
+        std::vector<uint32_t> large;
+        for(uint32_t i = 0; i < static_cast<uint32_t>(num_refs); ++i) {
+            entity_ref &r = b.entities[i];
+            r.large = grid.cells_covered(r.bounds) > max_entity_cells;
+            if(r.large) {
+                large.push_back(i);
+            }
+        }
+
+        union_find sets(num_refs);
+
+        auto try_connect = [&](uint32_t i, uint32_t j) {
+            entity_ref const &a = b.entities[i];
+            entity_ref const &c = b.entities[j];
+            if(net_builder::can_connect(a, c) && a.bounds.overlaps(c.bounds) && sets.find(i) != sets.find(j) && b.outlines_touch(a, c)) {
+                sets.unite(i, j);
+            }
+        };
+
+        // pairs in the grid, each one is checked in the cell which has the
+        // corner of where they overlap
+        size_t const num_cells = grid.num_cells();
+        job_pool::parallel_for(0, num_cells, 256, [&](size_t begin, size_t end) {
+            if(stop_token.stop_requested()) {
+                return;
+            }
+            for(size_t c = begin; c < end; ++c) {
+                std::span<uint32_t const> items = grid.cell(c);
+                for(size_t p = 0; p < items.size(); ++p) {
+                    for(size_t q = p + 1; q < items.size(); ++q) {
+                        box const &a = b.entities[items[p]].bounds;
+                        box const &d = b.entities[items[q]].bounds;
+                        int x = grid.cell_x(std::max(a.x0, d.x0));
+                        int y = grid.cell_y(std::max(a.y0, d.y0));
+                        if(grid.cell_index(x, y) == c) {
+                            try_connect(items[p], items[q]);
+                        }
+                    }
+                }
+            }
+        });
+
+        // and everything against the large ones
+        if(!large.empty()) {
+            job_pool::parallel_for(0, num_refs, 1024, [&](size_t begin, size_t end) {
+                if(stop_token.stop_requested()) {
+                    return;
+                }
+                for(size_t i = begin; i < end; ++i) {
+                    for(uint32_t l : large) {
+                        // large against large only once
+                        if(l != i && !(b.entities[i].large && l > i)) {
+                            try_connect(static_cast<uint32_t>(i), l);
+                        }
+                    }
+                }
+            });
+        }
+
+        if(stop_token.stop_requested()) {
+            clear();
+            return false;
+        }
+
+        // number the nets in the order of their first piece, an entity's net is
+        // its first piece's and it's a member of the nets of all its pieces
+        std::vector<uint32_t> root(num_refs);
+        job_pool::parallel_for(0, num_refs, 4096, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                root[i] = sets.find(static_cast<uint32_t>(i));
+            }
+        });
+        uint32_t num_nets = 0;
+        std::vector<uint32_t> ref_net(num_refs);
+        for(size_t i = 0; i < num_refs; ++i) {
+            // the root is the lowest id in the set so it's numbered first
+            if(root[i] == i) {
+                ref_net[i] = num_nets++;
+            } else {
+                ref_net[i] = ref_net[root[i]];
+            }
+        }
+        net_ids.assign(num_entities, no_net);
+        for(size_t i = 0; i < num_entities; ++i) {
+            if(first_ref[i] != first_ref[i + 1]) {
+                net_ids[i] = ref_net[first_ref[i]];
+            }
+        }
+
+        // the pieces of an entity are next to each other so a net's last member
+        // says whether it's got the entity already
+        std::vector<uint32_t> last_entity(num_nets, no_index);
+        auto for_each_member = [&](auto &&fn) {
+            std::fill(last_entity.begin(), last_entity.end(), no_index);
+            for(size_t i = 0; i < num_refs; ++i) {
+                entity_ref const &r = b.entities[i];
+                uint32_t id = layer_base[r.layer] + r.entity;
+                uint32_t n = ref_net[i];
+                if(last_entity[n] != id) {
+                    last_entity[n] = id;
+                    fn(n, r);
+                }
+            }
+        };
+        net_start.assign(num_nets + 1, 0);
+        for_each_member([&](uint32_t n, entity_ref const &) { net_start[n + 1] += 1; });
+        for(size_t n = 1; n < net_start.size(); ++n) {
+            net_start[n] += net_start[n - 1];
+        }
+        net_members.resize(net_start.back());
+        std::vector<uint32_t> fill(net_start.begin(), net_start.end() - 1);
+        for_each_member([&](uint32_t n, entity_ref const &r) { net_members[fill[n]++] = { r.layer, r.entity }; });
+
+        LOG_INFO("{} entities on {} layers, {} nets ({} cut by clear ones, {} large pieces, {} edge grids)", num_entities, layers.size(), num_nets,
+                 cut_entities.size(), large.size(), b.entity_edges.size());
+        return true;
+    }
+
+}    // namespace gerber
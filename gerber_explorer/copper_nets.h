@@ -0,0 +1,78 @@
+//////////////////////////////////////////////////////////////////////
+// Electrical connectivity of copper layers
+//
+// Works on the tesselated entities: two fill entities on the same copper layer
+// are connected if their outlines overlap or touch, and a (plated) drill entity
+// connects everything it overlaps on every copper layer. Candidate pairs come
+// from a grid over the entity bounds, the exact test uses the outlines (with
+// an edge grid for big entities like pours) and the connected entities are
+// joined with a lock free union-find, all on the job_pool.
+//
+// Clear (negative) entities are cut out of the dark ones drawn before them on
+// the same layer (with Clipper) first, so the copper is what's actually left.
+// A dark entity which a clear one splits in two is in the net of each piece.
+
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <stop_token>
+#include <vector>
+
+#include "gerber_drawer.h"
+
+namespace gerber
+{
+    //////////////////////////////////////////////////////////////////////
+
+    struct copper_nets
+    {
+        // one layer of the tesselated entities, drill layers bridge the copper layers
+        struct layer_input
+        {
+            std::span<tesselator_entity const> entities;
+            std::span<gerber_lib::vec2f const> outline_vertices;
+            std::span<int const> contour_sizes;
+            bool is_drill;
+
+            static layer_input from_drawer(gerber_drawer const &drawer, bool is_drill);
+        };
+
+        // an entity as the layer it's on and its index in that layer's entities
+        struct member
+        {
+            uint32_t layer;
+            uint32_t entity;
+        };
+
+        static constexpr uint32_t no_net = UINT32_MAX;
+
+        // false if it was stopped (and then it's empty)
+        bool build(std::span<layer_input const> layers, std::stop_token stop_token = {});
+
+        void clear();
+
+        // the net of the entity's first piece, no_net for clear entities, ones
+        // which are cleared away completely and ones out of range
+        uint32_t net_of(uint32_t layer, uint32_t entity) const;
+
+        std::span<member const> members(uint32_t net) const;
+
+        // all the entities in the same net as this one (including it)
+        std::span<member const> same_net(uint32_t layer, uint32_t entity) const
+        {
+            return members(net_of(layer, entity));
+        }
+
+        size_t num_nets() const
+        {
+            return net_start.empty() ? 0 : net_start.size() - 1;
+        }
+
+        std::vector<uint32_t> layer_base;    // an entity's id is layer_base[layer] + its index
+        std::vector<uint32_t> net_ids;       // by entity id
+        std::vector<uint32_t> net_start;     // where each net's members begin, and one on the end
+        std::vector<member> net_members;     // an entity in pieces can be in more than one net
+    };
+
+}    // namespace gerber
@@ -0,0 +1,171 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+#include "gerber_log.h"
+#include "gerber_util.h"
+#include "drill_holes.h"
+#include "job_pool.h"
+#include "job_trace.h"
+#include "spatial_grid.h"
+
+LOG_CONTEXT("drill_holes", info);
+
+namespace
+{
+    using namespace Clipper2Lib;
+
+    int constexpr max_grid_dim = 1024;
+
+    // roughly how many segments in a cell
+    size_t constexpr segments_per_cell = 4;
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool says_non_plated(std::string_view s)
+    {
+        std::string l = gerber_util::to_lowercase(s);
+        return l.contains("nonplated") || l.contains("non_plated") || l.contains("non-plated") || l.contains("npth");
+    }
+
+}    // namespace
+
+namespace gerber_3d
+{
+    //////////////////////////////////////////////////////////////////////
+
+    bool drill_file_is_plated(gerber_lib::gerber_file const &file)
+    {
+        for(auto const &[key, value] : file.attributes) {
+            std::string k = gerber_util::to_lowercase(key);
+            if((k == ".filefunction" || k == "filefunction") && says_non_plated(value)) {
+                return false;
+            }
+        }
+        for(auto const &comment : file.comments) {
+            if(says_non_plated(comment)) {
+                return false;
+            }
+        }
+        return !says_non_plated(std::filesystem::path(file.filename).filename().string());
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void subtract_holes(Paths64 const &subject, Paths64 const &holes, PolyTree64 &result)
+    {
+        job_trace::stage trace("subtract_holes", {});
+
+        result.Clear();
+
+        // the holes near an edge of the subject go through Clipper with it
+
+        std::vector<Path64 const *> subject_contours;
+        subject_contours.reserve(subject.size());
+        for(auto const &p : subject) {
+            subject_contours.push_back(&p);
+        }
+        contour_grid subject_grid;
+        subject_grid.build(subject_contours, segments_per_cell, max_grid_dim);
+
+        std::vector<uint8_t> near_edge(holes.size());
+        job_pool::parallel_for(0, holes.size(), 256, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                near_edge[i] = holes[i].size() >= 3 && subject_grid.any_edge_near(GetBounds(holes[i]));
+            }
+        });
+
+        {
+            Paths64 clip;
+            for(size_t i = 0; i < holes.size(); ++i) {
+                if(near_edge[i]) {
+                    clip.push_back(holes[i]);
+                }
+            }
+            Clipper64 clipper;
+            clipper.AddSubject(subject);
+            clipper.AddClip(clip);
+            clipper.Execute(ClipType::Difference, FillRule::NonZero, result);
+        }
+
+        // the rest are either inside a polygon of the result and clear of its
+        // edges or not in it at all
+
+        std::vector<Path64 const *> result_contours;
+        std::vector<contour_info> info;
+        for_each_contour(result, [&](Path64 const &path, contour_info const &c) {
+            result_contours.push_back(&path);
+            info.push_back(c);
+        });
+
+        contour_grid result_grid;
+        result_grid.build(result_contours, segments_per_cell, max_grid_dim);
+
+        std::vector<PolyPath64 *> owner(holes.size(), nullptr);
+        job_pool::parallel_for(0, holes.size(), 256, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                if(near_edge[i] || holes[i].size() < 3) {
+                    continue;
+                }
+                // the hole doesn't touch any edge so any point on it will do
+                contour_grid::hit h = result_grid.ray_cast(holes[i][0]);
+                if(h.found && h.up == info[h.contour].material_left) {
+                    owner[i] = info[h.contour].outer;
+                }
+            }
+        });
+
+        size_t num_clipped = 0;
+        size_t num_direct = 0;
+        for(size_t i = 0; i < holes.size(); ++i) {
+            num_clipped += near_edge[i];
+            if(owner[i] != nullptr) {
+                Path64 hole = holes[i];
+                if(IsPositive(hole) == IsPositive(owner[i]->Polygon())) {
+                    std::reverse(hole.begin(), hole.end());
+                }
+                owner[i]->AddChild(hole);
+                num_direct += 1;
+            }
+        }
+        LOG_INFO("subtract_holes: {} holes, {} clipped, {} added directly", holes.size(), num_clipped, num_direct);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void make_barrels(Paths64 const &holes, double thickness, PolyTree64 &result)
+    {
+        result.Clear();
+
+        std::vector<Path64> outers(holes.size());
+        job_pool::parallel_for(0, holes.size(), 256, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                Paths64 inflated = InflatePaths(Paths64{ holes[i] }, thickness, JoinType::Round, EndType::Polygon);
+                if(!inflated.empty()) {
+                    outers[i] = std::move(*std::max_element(inflated.begin(), inflated.end(), [](Path64 const &a, Path64 const &b) {
+                        return std::fabs(Area(a)) < std::fabs(Area(b));
+                    }));
+                }
+            }
+        });
+
+        for(size_t i = 0; i < holes.size(); ++i) {
+            if(outers[i].size() < 3) {
+                continue;
+            }
+            if(!IsPositive(outers[i])) {
+                std::reverse(outers[i].begin(), outers[i].end());
+            }
+            Path64 hole = holes[i];
+            if(IsPositive(hole)) {
+                std::reverse(hole.begin(), hole.end());
+            }
+            result.AddChild(outers[i])->AddChild(hole);
+        }
+    }
+
+}    // namespace gerber_3d
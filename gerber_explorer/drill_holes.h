@@ -0,0 +1,35 @@
+//////////////////////////////////////////////////////////////////////
+// Cutting drill holes out of resolved layers
+//
+// Most holes on a board are well inside a pad, pour or the substrate and don't
+// touch any edge of the shape they're cut from. Those don't need Clipper at all,
+// they just become holes in whichever polygon they're in. The edges are put in a
+// grid, holes which have edges near them go through one (small) Clipper
+// difference, the rest are found in the result with a ray cast through the grid
+// and added as holes directly.
+
+#pragma once
+
+#include "gerber_lib.h"
+
+#include "clipper2/clipper.h"
+
+namespace gerber_3d
+{
+    //////////////////////////////////////////////////////////////////////
+    // from the X2 file function, the comments (KiCad, Altium) or the filename,
+    // plated unless it says otherwise
+
+    bool drill_file_is_plated(gerber_lib::gerber_file const &file);
+
+    // subject minus holes into result, the holes must not overlap each other
+    // (a resolved drill layer is fine)
+
+    void subtract_holes(Clipper2Lib::Paths64 const &subject, Clipper2Lib::Paths64 const &holes, Clipper2Lib::PolyTree64 &result);
+
+    // a ring of width thickness (CLIPPER_SCALE units) around each hole, one outer
+    // with one hole for each, for the plated barrel walls
+
+    void make_barrels(Clipper2Lib::Paths64 const &holes, double thickness, Clipper2Lib::PolyTree64 &result);
+
+}    // namespace gerber_3d
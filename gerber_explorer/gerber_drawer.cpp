@@ -1,8 +1,11 @@
 //////////////////////////////////////////////////////////////////////
 
+#include <unordered_map>
+
 #include "tesselator.h"
 
 #include "gerber_lib.h"
+#include "gerber_flatten.h"
 #include "log_drawer.h"
 #include "gerber_drawer.h"
 #include "gerber_explorer.h"
@@ -10,6 +13,8 @@
 #include "gerber_net.h"
 
 #include "gpu_colors.h"
+#include "job_pool.h"
+#include "job_trace.h"
 
 LOG_CONTEXT("gerber_drawer", info);
 
@@ -57,6 +62,11 @@ namespace gerber
         fill_vertices.clear();    // the verts (for outlines and fills)
         fill_indices.clear();     // the indices (for fills)
         entity_flags.clear();
+        compact_fill_vertices.clear();
+        compact_fill_indices.clear();
+        compact_tiles.clear();
+        compact_ranges.clear();
+        compact_range_entities.clear();
     }
 
     //////////////////////////////////////////////////////////////////////
@@ -77,6 +87,11 @@ namespace gerber
         fill_vertices.release();
         fill_indices.release();
         entity_flags.release();
+        compact_fill_vertices.release();
+        compact_fill_indices.release();
+        compact_tiles.release();
+        compact_ranges.release();
+        compact_range_entities.release();
     }
 
     //////////////////////////////////////////////////////////////////////
@@ -193,30 +208,290 @@ namespace gerber
         current_entity_id = -1;
 
         clear();
-        g->draw(*this);
+        gerber_error_code draw_result;
+        {
+            job_trace::stage trace("draw", layer != nullptr ? std::string_view(layer->name) : std::string_view{});
+            draw_result = g->draw(*this);
+        }
+        if(draw_result == gerber_lib::error_cancelled) {
+            clear();
+            boundary_arena.release();
+            interior_arena.release();
+            temp_points.release();
+            return;
+        }
         finish_entity();
         finalize();
 
-        // create the lines index buffer and flags buffer
+        // tesselator scratch space isn't needed until the next set_gerber, give it back to the arena_pool for other drawers
+        boundary_arena.release();
+        interior_arena.release();
+        temp_points.release();
 
-        int max_entity_id = 0;
+        // create the lines index buffer and flags buffer and get the entity bounds
+
+        // one line per outline vertex, so each entity's lines start at its outline_offset
+        // and the entities can be done in parallel
+        std::span<gpu::line_instance> lines = outline_lines.grow_uninitialized(outline_vertices.size());
+
+        auto build_lines = [&](size_t begin, size_t end) {
+            int max_id = 0;
+            for(size_t i = begin; i < end; ++i) {
+                tesselator_entity &e = entities[i];
+                uint32_t id = (uint32_t)e.entity_id();
+                max_id = std::max(max_id, e.entity_id());
+                gpu::line_instance *line = lines.data() + e.outline_offset;
+                vec2f min{ FLT_MAX, FLT_MAX };
+                vec2f max{ -FLT_MAX, -FLT_MAX };
+                size_t contour_start = e.outline_offset;
+                for(int c = 0; c < e.num_contours; ++c) {
+                    int contour_size = contour_sizes[e.contour_offset + c];
+                    size_t s = contour_start;
+                    size_t t = contour_start + contour_size - 1;
+                    size_t u = t;
+                    for(; s <= u; t = s++) {
+                        *line++ = { (uint32_t)s, (uint32_t)t, id, 0 };
+                        vec2f const &v = outline_vertices[s];
+                        min = { std::min(v.x, min.x), std::min(v.y, min.y) };
+                        max = { std::max(v.x, max.x), std::max(v.y, max.y) };
+                    }
+                    contour_start += contour_size;
+                }
+                e.bounds = rect(vec2d(min), vec2d(max));
+            }
+            return max_id;
+        };
 
-        for(auto &e : entities) {
-            size_t id = e.entity_id();
-            max_entity_id = std::max(max_entity_id, e.entity_id());
-            size_t contour_start = e.outline_offset;
-            for(int c = 0; c < e.num_contours; ++c) {
-                int contour_size = contour_sizes[e.contour_offset + c];
-                size_t s = contour_start;
-                size_t t = contour_start + contour_size - 1;
-                size_t u = t;
-                for(; s <= u; t = s++) {
-                    outline_lines.emplace_back((uint32_t)s, (uint32_t)t, (uint32_t)id, 0);
+        int max_entity_id = job_pool::parallel_reduce(size_t{ 0 }, entities.size(), 256, 0, build_lines, [](int a, int b) { return std::max(a, b); });
+
+        entity_flags.increase_size_to(max_entity_id + 1);
+
+        // the float fill data isn't needed if the compact version was built
+        if(use_compact_vertices && build_compact()) {
+            fill_vertices.release();
+            fill_indices.release();
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Group the fill geometry into tiles of nearby entities and quantize each
+    // tile to 16 bits. Returns false (and leaves the float data alone) if an
+    // entity won't fit in a tile or there would be too many tiles.
+    //
+    // Tiles are drawn in order, so a tile can't just be a run of consecutive
+    // entities (a layer which jumps about the board would be hundreds of tiny
+    // tiles). A fill entity can go back into an earlier tile near it as long as
+    // no clear entity drawn after that tile overlaps it, clear ones only ever
+    // go in the newest tile, so everything with a different polarity which
+    // overlaps stays in the same order
+
+    bool gerber_drawer::build_compact()
+    {
+        auto clear_compact = [&]() {
+            compact_fill_vertices.clear();
+            compact_fill_indices.clear();
+            compact_tiles.clear();
+            compact_ranges.clear();
+            compact_range_entities.clear();
+        };
+
+        clear_compact();
+
+        compact_fill_vertices.reserve(fill_vertices.size());
+        compact_fill_indices.reserve(fill_indices.size());
+
+        size_t num_entities = entities.size();
+
+        // which tile each entity goes in
+
+        struct tile_bounds
+        {
+            rect bounds;
+            uint32_t vertices;
+        };
+        std::vector<tile_bounds> groups;
+        std::vector<uint32_t> group_of(num_entities, UINT32_MAX);
+        std::vector<std::pair<uint32_t, rect>> clears;    // group, in the order they went in
+        std::unordered_map<uint64_t, uint32_t> cell_group;
+        double const cell_size = compact_tile::max_extent / 2;
+
+        auto fits = [&](uint32_t g, tesselator_entity const &e) {
+            rect r = groups[g].bounds.union_with(e.bounds);
+            return groups[g].vertices + e.fill_vertex_count <= compact_tile::max_vertices && r.width() <= compact_tile::max_extent &&
+                   r.height() <= compact_tile::max_extent;
+        };
+
+        auto clear_drawn_after = [&](uint32_t g, rect const &r) {
+            for(auto it = clears.rbegin(); it != clears.rend() && it->first > g; ++it) {
+                if(it->second.overlaps_rect(r)) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        for(size_t i = 0; i < num_entities; ++i) {
+            tesselator_entity const &e = entities[i];
+            if(e.fill_vertex_count == 0) {
+                continue;
+            }
+            if((uint32_t)e.fill_vertex_count > compact_tile::max_vertices) {
+                LOG_INFO("Entity {} in {} has too many vertices ({}) for the compact format", e.entity_id(), name(), e.fill_vertex_count);
+                clear_compact();
+                return false;
+            }
+            vec2d center = e.bounds.center();
+            uint64_t cell = ((uint64_t)(uint32_t)(int32_t)std::floor(center.x / cell_size) << 32) | (uint32_t)(int32_t)std::floor(center.y / cell_size);
+            bool clear = (e.flags & entity_flags_t::clear) != 0;
+
+            uint32_t g = UINT32_MAX;
+            if(!clear) {
+                auto found = cell_group.find(cell);
+                if(found != cell_group.end() && fits(found->second, e) && !clear_drawn_after(found->second, e.bounds)) {
+                    g = found->second;
+                }
+            }
+            if(g == UINT32_MAX && !groups.empty() && fits((uint32_t)groups.size() - 1, e)) {
+                g = (uint32_t)groups.size() - 1;
+            }
+            if(g == UINT32_MAX) {
+                g = (uint32_t)groups.size();
+                groups.push_back({ rect{ { FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX } }, 0 });
+            }
+            groups[g].bounds = groups[g].bounds.union_with(e.bounds);
+            groups[g].vertices += e.fill_vertex_count;
+            group_of[i] = g;
+            cell_group[cell] = g;
+            if(clear) {
+                clears.emplace_back(g, e.bounds);
+            }
+        }
+
+        if(groups.size() > compact_tile::max_tiles) {
+            LOG_DEBUG("{} would be {} tiles in the compact format, using the float one", name(), groups.size());
+            return false;
+        }
+
+        // the entities of each group, in order
+        std::vector<uint32_t> group_start(groups.size() + 1, 0);
+        for(uint32_t g : group_of) {
+            if(g != UINT32_MAX) {
+                group_start[g + 1] += 1;
+            }
+        }
+        for(size_t g = 1; g < group_start.size(); ++g) {
+            group_start[g] += group_start[g - 1];
+        }
+        std::vector<uint32_t> members(group_start.back());
+        {
+            std::vector<uint32_t> fill(group_start.begin(), group_start.end() - 1);
+            for(size_t i = 0; i < num_entities; ++i) {
+                if(group_of[i] != UINT32_MAX) {
+                    members[fill[group_of[i]]++] = (uint32_t)i;
+                }
+            }
+        }
+
+        for(size_t g = 0; g < groups.size(); ++g) {
+
+            compact_tiles.emplace_back();
+            compact_tile &tile = compact_tiles.back();
+
+            vec2d size = groups[g].bounds.size();
+            tile.origin = vec2f(groups[g].bounds.min_pos);
+            tile.scale = { size.x > 0 ? (float)(size.x / 65535.0) : 1.0f, size.y > 0 ? (float)(size.y / 65535.0) : 1.0f };
+            tile.vertex_offset = (uint32_t)compact_fill_vertices.size();
+            tile.vertex_count = groups[g].vertices;
+            tile.index_offset = (uint32_t)compact_fill_indices.size();
+            tile.range_offset = (uint32_t)compact_ranges.size();
+
+            float inv_x = 1.0f / tile.scale.x;
+            float inv_y = 1.0f / tile.scale.y;
+
+            uint32_t local_base = 0;
+            for(uint32_t m = group_start[g]; m < group_start[g + 1]; ++m) {
+                tesselator_entity const &e = entities[members[m]];
+                compact_ranges.push_back({ local_base, (uint32_t)e.entity_id() });
+                compact_range_entities.push_back(members[m]);
+
+                gpu::vertex_entity const *src = fill_vertices.data() + e.fill_vertex_offset;
+                for(gpu::vertex_q16 &v : compact_fill_vertices.grow_uninitialized(e.fill_vertex_count)) {
+                    float x = std::clamp(std::round((src->x - tile.origin.x) * inv_x), 0.0f, 65535.0f);
+                    float y = std::clamp(std::round((src->y - tile.origin.y) * inv_y), 0.0f, 65535.0f);
+                    v = { (uint16_t)x, (uint16_t)y };
+                    src += 1;
+                }
+
+                // fill indices are absolute, make them tile relative
+                uint32_t rebase = (uint32_t)e.fill_vertex_offset - local_base;
+                uint32_t const *idx = fill_indices.data() + e.fill_index_offset;
+                for(uint16_t &i16 : compact_fill_indices.grow_uninitialized(e.fill_index_count)) {
+                    i16 = (uint16_t)(*idx++ - rebase);
+                }
+                local_base += e.fill_vertex_count;
+            }
+            tile.index_count = (uint32_t)compact_fill_indices.size() - tile.index_offset;
+            tile.range_count = (uint32_t)compact_ranges.size() - tile.range_offset;
+        }
+
+        LOG_DEBUG("Compact {}: {} tiles, {} KB (was {} KB)",
+                  name(),
+                  compact_tiles.size(),
+                  (compact_fill_vertices.size() * sizeof(gpu::vertex_q16) + compact_fill_indices.size() * sizeof(uint16_t) +
+                   compact_ranges.size() * sizeof(gpu::entity_range)) /
+                      1024,
+                  (fill_vertices.size() * sizeof(gpu::vertex_entity) + fill_indices.size() * sizeof(uint32_t)) / 1024);
+
+        return !compact_tiles.empty();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Same search as the layer_compact vertex shader
+
+    int gerber_drawer::compact_entity_id(compact_tile const &tile, uint32_t vertex) const
+    {
+        gpu::entity_range const *ranges = compact_ranges.data() + tile.range_offset;
+        uint32_t lo = 0;
+        uint32_t hi = tile.range_count;
+        while(hi - lo > 1) {
+            uint32_t mid = (lo + hi) / 2;
+            if(ranges[mid].first_vertex <= vertex) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        return (int)ranges[lo].entity_id;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Expand the compact format back to absolute float verts + 32 bit indices,
+    // each entity back where it was in the float format (the soft renderer
+    // draws them in entity order)
+
+    void gerber_drawer::decode_compact(std::vector<gpu::vertex_entity> &vertices, std::vector<uint32_t> &indices) const
+    {
+        vertices.clear();
+        indices.clear();
+        vertices.resize(compact_fill_vertices.size());
+        indices.resize(compact_fill_indices.size());
+
+        for(compact_tile const &tile : compact_tiles) {
+            uint16_t const *idx = compact_fill_indices.data() + tile.index_offset;
+            for(uint32_t r = 0; r < tile.range_count; ++r) {
+                gpu::entity_range const &range = compact_ranges[tile.range_offset + r];
+                tesselator_entity const &e = entities[compact_range_entities[tile.range_offset + r]];
+                gpu::vertex_q16 const *src = compact_fill_vertices.data() + tile.vertex_offset + range.first_vertex;
+                for(int v = 0; v < e.fill_vertex_count; ++v) {
+                    vec2f p = tile.decode(src[v]);
+                    vertices[e.fill_vertex_offset + v] = { p.x, p.y, range.entity_id };
+                }
+                uint32_t rebase = (uint32_t)e.fill_vertex_offset - range.first_vertex;
+                for(int i = 0; i < e.fill_index_count; ++i) {
+                    indices[e.fill_index_offset + i] = *idx++ + rebase;
                 }
-                contour_start += contour_size;
             }
         }
-        entity_flags.increase_size_to(max_entity_id + 1);
     }
 
     //////////////////////////////////////////////////////////////////////
@@ -241,14 +516,16 @@ namespace gerber
             tesselator_entity &e = entities.back();
             e.contour_offset = (int)contour_sizes.size();
 
+            std::span<int> sizes = contour_sizes.grow_uninitialized(nelems);
+
             for(int i = 0; i < nelems; ++i) {
                 int b = elems[i * 2];
                 int n = elems[i * 2 + 1];
                 float const *f = &verts[b * 2];
                 tessAddContour(interior_tesselator, 2, f, sizeof(float) * 2, n);
-                contour_sizes.push_back(n);
-                for(int p = 0; p < n; ++p) {
-                    outline_vertices.emplace_back(f[0], f[1]);
+                sizes[i] = n;
+                for(vec2f &v : outline_vertices.grow_uninitialized(n)) {
+                    v = { f[0], f[1] };
                     f += 2;
                 }
             }
@@ -256,14 +533,7 @@ namespace gerber
             e.num_contours = (int)contour_sizes.size() - e.contour_offset;
             e.outline_size = (int)(outline_vertices.size() - e.outline_offset);
 
-            vec2f min{ FLT_MAX, FLT_MAX };
-            vec2f max{ -FLT_MAX, -FLT_MAX };
-            for(int i = 0; i < e.outline_size; ++i) {
-                vec2f const &v = outline_vertices[e.outline_offset + i];
-                min = { std::min(v.x, min.x), std::min(v.y, min.y) };
-                max = { std::max(v.x, max.x), std::max(v.y, max.y) };
-            }
-            e.bounds = rect(vec2d(min), vec2d(max));
+            // bounds are done in bulk by set_gerber once all the outlines are in
 
             tessTesselate(interior_tesselator, TESS_WINDING_POSITIVE, TESS_POLYGONS, 3, 2, nullptr);
 
@@ -273,22 +543,33 @@ namespace gerber
             int const tri_nelems = tessGetElementCount(interior_tesselator);
 
             size_t base = fill_vertices.size();
-            for(int v = 0; v < tri_nverts; ++v) {
-                float const *vrt = tri_verts + v * 2;
-                fill_vertices.emplace_back(vrt[0], vrt[1], current_entity_id);
+            float const *vrt = tri_verts;
+            for(gpu::vertex_entity &v : fill_vertices.grow_uninitialized(tri_nverts)) {
+                v = { vrt[0], vrt[1], (uint32_t)current_entity_id };
+                vrt += 2;
             }
 
+            // grow for all the triangles, then trim off any which were skipped
+            size_t index_base = fill_indices.size();
+            std::span<uint32_t> indices = fill_indices.grow_uninitialized(tri_nelems * 3);
+            size_t num_indices = 0;
             for(int x = 0; x < tri_nelems; ++x) {
                 int const *p = &tri_elems[x * 3];
                 int const p0 = p[0];
                 int const p1 = p[1];
                 int const p2 = p[2];
                 if(p0 != TESS_UNDEF && p1 != TESS_UNDEF && p2 != TESS_UNDEF) {
-                    fill_indices.push_back(static_cast<uint32_t>(p0 + base));
-                    fill_indices.push_back(static_cast<uint32_t>(p1 + base));
-                    fill_indices.push_back(static_cast<uint32_t>(p2 + base));
+                    indices[num_indices++] = static_cast<uint32_t>(p0 + base);
+                    indices[num_indices++] = static_cast<uint32_t>(p1 + base);
+                    indices[num_indices++] = static_cast<uint32_t>(p2 + base);
                 }
             }
+            fill_indices.truncate(index_base + num_indices);
+
+            e.fill_vertex_offset = (int)base;
+            e.fill_vertex_count = tri_nverts;
+            e.fill_index_offset = (int)index_base;
+            e.fill_index_count = (int)num_indices;
 
             LOG_DEBUG("Interior: {}% used!", interior_arena.percent_committed());
 
@@ -338,14 +619,16 @@ namespace gerber
 
         double constexpr THRESHOLD = 1e-38;
 
-        // max chord deviation in mm per quality level
-        double constexpr DEVIATION_MM[tesselation_quality::num_qualities] = { 0.001, 0.0005, 0.0001 };
+        // max chord deviation in pixels per quality level (when tesselating for a particular zoom level)
         double constexpr MAX_PIXEL_ERROR[tesselation_quality::num_qualities] = { 0.5, 0.25, 0.125 };
-        double const deviation = (pixels_per_world_unit > 0) ? MAX_PIXEL_ERROR[tesselation_quality] / pixels_per_world_unit : DEVIATION_MM[tesselation_quality];
+        double const deviation = (pixels_per_world_unit > 0) ? MAX_PIXEL_ERROR[tesselation_quality] / pixels_per_world_unit : arc_deviation_mm[tesselation_quality];
 
         int flag = polarity == polarity_clear ? entity_flags_t::clear : entity_flags_t::fill;
 
         if(gnet->entity_id != current_entity_id) {
+            if(stop_token.stop_requested()) {
+                return gerber_lib::error_cancelled;
+            }
             new_entity(gnet, flag);
         }
 
@@ -360,13 +643,6 @@ namespace gerber
             }
         };
 
-        auto add_arc_point = [&](gerber_draw_element const &element, double t) {
-            double radians = deg_2_rad(t);
-            double x = cos(radians) * element.arc.radius + element.arc.center.x;
-            double y = sin(radians) * element.arc.radius + element.arc.center.y;
-            add_point(x, y);
-        };
-
         for(size_t n = 0; n < num_elements; ++n) {
 
             gerber_draw_element const &element = elements[n];
@@ -378,39 +654,16 @@ namespace gerber
                 break;
 
             case draw_element_arc: {
-
-                double start = element.arc.start_degrees;
-                double end = element.arc.end_degrees;
-                double arc_span = fabs(end - start);
-
-                // compute step size from deviation limit: sagitta = r * (1 - cos(theta/2))
-                // solve for theta: theta = 2 * acos(1 - deviation / r)
-                double arc_degrees;
-                double r = element.arc.radius;
-                if(r > deviation) {
-                    arc_degrees = 2.0 * rad_2_deg(acos(1.0 - deviation / r));
-                } else {
-                    arc_degrees = arc_span;
-                }
-
-                arc_degrees = std::min(arc_span / 8, arc_degrees);
-
-                double final_angle = end;
-
-                if(start < end) {
-                    for(double t = start; t < end; t += arc_degrees) {
-                        add_arc_point(element, t);
-                        final_angle = t;
-                    }
-                } else {
-                    for(double t = start; t > end; t -= arc_degrees) {
-                        add_arc_point(element, t);
-                        final_angle = t;
-                    }
-                }
-                if(final_angle != end) {
-                    add_arc_point(element, end);
+                auto const &arc = element.arc;
+                int segments = arc_segment_count(arc.radius, arc.start_degrees, arc.end_degrees, deviation);
+                size_t at = temp_points.size();
+                std::span<vec2f> points = temp_points.grow_uninitialized(segments + 1);
+                if(points.empty()) {
+                    LOG_ERROR("No room for {} arc points in entity {}", segments + 1, gnet->entity_id);
+                    break;
                 }
+                vec2f const *previous = at != 0 ? &temp_points[at - 1] : nullptr;
+                temp_points.truncate(at + flatten_arc(arc.center, arc.radius, arc.start_degrees, arc.end_degrees, segments, points, previous));
             } break;
             }
         }
@@ -437,9 +690,10 @@ namespace gerber
 
     //////////////////////////////////////////////////////////////////////
     // Given some entities, create a shape which encloses them
-    // This is used for drawing inverted layers...
+    // This is used for drawing inverted layers. It only depends on the
+    // outlines so the caller decides when it's worth (re)building
 
-    void gerber_drawer::create_mask()
+    void gerber_drawer::create_mask(solid_shape &mask) const
     {
         using namespace Clipper2Lib;
 
@@ -497,9 +751,6 @@ namespace gerber
             }
         }
         tessDeleteTess(tess);
-
-        // we need to notify that mask.vertex_array and mask.index_array need to be rebuilt
-        got_mask = true;
     }
 
 }    // namespace gerber
@@ -4,6 +4,7 @@
 
 #include <cstring>
 #include <cstdint>
+#include <stop_token>
 
 #include "gerber_lib.h"
 #include "gerber_draw.h"
@@ -63,9 +64,9 @@ namespace gerber
 
     //////////////////////////////////////////////////////////////////////
 
-    struct tess_arena_t : gerber_lib::gerber_arena<1ULL << 30, 16>
+    template <size_t reserve_size = 1ULL << 30> struct basic_tess_arena : gerber_lib::gerber_arena<reserve_size, 16>
     {
-        tess_arena_t() : gerber_arena()
+        basic_tess_arena()
         {
             memset(&tess_alloc, 0, sizeof(tess_alloc));
             tess_alloc.memalloc = tess_allocate;
@@ -75,7 +76,7 @@ namespace gerber
 
         static void *tess_allocate(void *userData, unsigned int size)
         {
-            auto arena = (tess_arena_t *)userData;
+            auto arena = (basic_tess_arena *)userData;
             return arena->alloc(size);
         }
 
@@ -86,6 +87,8 @@ namespace gerber
         TESSalloc tess_alloc{};
     };
 
+    using tess_arena_t = basic_tess_arena<>;
+
     //////////////////////////////////////////////////////////////////////
 
     struct tesselator_entity
@@ -97,6 +100,10 @@ namespace gerber
         int num_contours{};                 // # of contours
         int flags;                           // see entity_flags_t
         gerber_lib::rect bounds{};           // for picking speedup
+        int fill_vertex_offset{};            // offset into fill_vertices
+        int fill_vertex_count{};             // # of fill vertices
+        int fill_index_offset{};             // offset into fill_indices
+        int fill_index_count{};              // # of fill indices
 
         int entity_id() const
         {
@@ -124,6 +131,37 @@ namespace gerber
         }
     };
 
+    //////////////////////////////////////////////////////////////////////
+    // A group of nearby entities in the compact fill format
+    // Positions are 16 bit offsets from origin in units of scale, indices are
+    // 16 bit relative to vertex_offset, entity ids come from the ranges
+
+    struct compact_tile
+    {
+        gerber_lib::vec2f origin;
+        gerber_lib::vec2f scale;
+        uint32_t vertex_offset;    // into compact_fill_vertices
+        uint32_t vertex_count;
+        uint32_t index_offset;     // into compact_fill_indices
+        uint32_t index_count;
+        uint32_t range_offset;     // into compact_ranges
+        uint32_t range_count;
+
+        // max # of verts in a tile (so indices fit in 16 bits)
+        static constexpr uint32_t max_vertices = 65536;
+
+        // max tile width/height in world units, keeps the quantization error < ~1um
+        static constexpr double max_extent = 64.0;
+
+        // each tile is a draw call, past this many the float format (one draw) is used instead
+        static constexpr uint32_t max_tiles = 1024;
+
+        gerber_lib::vec2f decode(gpu::vertex_q16 v) const
+        {
+            return { origin.x + v.x * scale.x, origin.y + v.y * scale.y };
+        }
+    };
+
     //////////////////////////////////////////////////////////////////////
 
     struct gerber_drawer : gerber_lib::gerber_draw_interface
@@ -148,6 +186,11 @@ namespace gerber
             fill_vertices.init();
             fill_indices.init();
             contour_sizes.init();
+            compact_fill_vertices.init();
+            compact_fill_indices.init();
+            compact_tiles.init();
+            compact_ranges.init();
+            compact_range_entities.init();
         }
 
         // setup from a parsed gerber file
@@ -173,16 +216,25 @@ namespace gerber
         void select_hovered_entities();
 
         void release();
-        void create_mask();
+        void create_mask(solid_shape &mask) const;
+
+        // compact fill format (see compact_tile)
+        bool build_compact();
+        int compact_entity_id(compact_tile const &tile, uint32_t vertex) const;
+        void decode_compact(std::vector<gpu::vertex_entity> &vertices, std::vector<uint32_t> &indices) const;
+        bool is_compact() const
+        {
+            return !compact_tiles.empty();
+        }
 
         gerber_layer const *layer{};
-        bool got_mask{ false };
         std::string const &name() const;
-        solid_shape mask{};    // only used if it's an outline layer
 
         // ===== TESSELATION =====
         tesselation_quality_t tesselation_quality;
         double pixels_per_world_unit{0};  // 0 = use fixed quality table, >0 = dynamic (0.5px error)
+        bool use_compact_vertices{ false };    // build the compact fill format and drop the float one
+        std::stop_token stop_token;            // checked between entities, set_gerber gives up (and clears) if it's stopped
         int current_flag{ entity_flags_t::none };
         int base_vert{};
         int current_entity_id{ -1 };
@@ -197,6 +249,11 @@ namespace gerber
         typed_arena<uint8_t> entity_flags;    // one byte per entity
         typed_arena<gpu::vertex_entity> fill_vertices;
         typed_arena<uint32_t> fill_indices;
+        typed_arena<gpu::vertex_q16> compact_fill_vertices;
+        typed_arena<uint16_t> compact_fill_indices;
+        typed_arena<compact_tile> compact_tiles;
+        typed_arena<gpu::entity_range> compact_ranges;
+        typed_arena<uint32_t> compact_range_entities;    // index into entities of each range (for decode_compact)
     };
 
 }    // namespace gerber
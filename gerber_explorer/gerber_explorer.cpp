@@ -4,6 +4,7 @@
 
 #include <filesystem>
 #include <expected>
+#include <fstream>
 
 #define IMGUI_DEFINE_MATH_OPERATORS
 
@@ -23,6 +24,13 @@
 #include "gpu_matrix.h"
 #include "gpu_colors.h"
 #include "util.h"
+#include "job_trace.h"
+#include "soft_render.h"
+#include "layer_xor.h"
+#include "board_stack.h"
+#include "drill_holes.h"
+#include "copper_nets.h"
+#include "clearance_check.h"
 
 #include "assets/matsym_codepoints_utf8.h"
 
@@ -417,6 +425,9 @@ void gerber_explorer::on_key(int key, int scancode, int action, int mods)
             case KEY_E:
                 settings.show_extent = !settings.show_extent;
                 break;
+            case KEY_N:
+                select_net();
+                break;
             default:
                 break;
             }
@@ -673,14 +684,28 @@ void gerber_explorer::handle_mouse()
 
 void gerber_explorer::on_closed()
 {
-    bool should_save_files = pool.get_active_job_count(job_type_load_gerber) == 0;
+    bool should_save_files = pending_loads.load() == 0;
     save_settings(config_path(app_name, settings_filename), should_save_files);
     pool.shut_down();
     // after shut_down, all jobs are done, safe to delete deferred layers
     for(auto *l : layers) {
         delete l;
     }
+    for(gerber_layer *l = take_loaded_layers(); l != nullptr;) {
+        gerber_layer *next = l->next_loaded;
+        delete l;
+        l = next;
+    }
     layers.clear();
+    {
+        auto stats = gerber_lib::arena_pool::get().get_stats();
+        LOG_INFO("Arena high-water marks: {} MB reserved, {} MB committed, {} blocks ({} recycled, {} over budget)",
+                 stats.peak_reserved >> 20,
+                 stats.peak_committed >> 20,
+                 stats.peak_blocks_in_use,
+                 stats.recycled,
+                 stats.budget_failures);
+    }
     NFD_Quit();
     if(crosshair_cursor != nullptr) {
         SDL_DestroyCursor(crosshair_cursor);
@@ -707,6 +732,7 @@ void gerber_explorer::load_settings(std::filesystem::path const &path)
         window_state.x = settings.window_xpos;
         window_state.y = settings.window_ypos;
         window_state.isMaximized = settings.window_maximized;
+        job_trace::enable(settings.job_tracing);
         for(auto const &layer : settings.files) {
             add_gerber(layer);
         }
@@ -736,6 +762,18 @@ void gerber_explorer::on_window_refresh()
     }
 }
 
+//////////////////////////////////////////////////////////////////////
+// Main thread only. A mask job dropped before it ran never clears its claim
+// on the mask, so hand it back here or the mask could never be asked for again
+
+void gerber_explorer::abort_layer_jobs(gerber_layer *l)
+{
+    pool.abort_group(l);
+    if(l->job_count.load() == 0 && !l->got_mask) {
+        l->mask_requested = false;
+    }
+}
+
 //////////////////////////////////////////////////////////////////////
 
 void gerber_explorer::close_all_layers()
@@ -743,7 +781,9 @@ void gerber_explorer::close_all_layers()
     LOG_INFO("CLOSE ALL");
     set_active_entity(nullptr);
     select_layer(nullptr);
-    layers.remove_if([](gerber_layer *l) {
+    layers.remove_if([this](gerber_layer *l) {
+        abort_layer_jobs(l);
+        forget_nets(l);
         if(l->job_count.load() == 0) {
             delete l;
             return true;
@@ -787,6 +827,32 @@ bool gerber_explorer::layer_is_visible(gerber_layer const *layer) const
     return true;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Drawing order for the current board view (the layer list order for all)
+
+void gerber_explorer::sort_layers_for_view(std::vector<gerber_layer *> &ordered_layers) const
+{
+    if(settings.board_view != board_view_all) {
+        std::sort(ordered_layers.begin(), ordered_layers.end(), [this](gerber_layer const *a, gerber_layer const *b) {
+            using namespace gerber_lib;
+            layer::type_t drill_ordered = layer::type_t::drill_top;
+            if(settings.board_view == board_view_bottom) {
+                drill_ordered = layer::type_t::drill_bottom;
+                std::swap(a, b);
+            }
+            int ta = a->file.layer_type;
+            int tb = b->file.layer_type;
+            if(is_layer_type(ta, layer::type_t::drill)) {
+                ta = drill_ordered;
+            }
+            if(is_layer_type(tb, layer::type_t::drill)) {
+                tb = drill_ordered;
+            }
+            return ta > tb;
+        });
+    }
+}
+
 //////////////////////////////////////////////////////////////////////
 
 void gerber_explorer::save_settings(std::filesystem::path const &path, bool save_files)
@@ -904,6 +970,15 @@ bool gerber_explorer::on_init()
     }
 #endif
 
+    job_trace::set_thread_name("main");
+    job_trace::name_flag(job_type_load_gerber, "load");
+    job_trace::name_flag(job_type_tesselate, "tesselate");
+    job_trace::name_flag(job_type_create_mask, "mask");
+    job_trace::name_flag(job_type_export, "export");
+    job_trace::name_flag(job_type_density, "density");
+    job_trace::name_flag(job_type_check, "check");
+    job_trace::name_flag(job_type_nets, "nets");
+
     pool.start_workers();
 
     NFD_Init();
@@ -959,6 +1034,9 @@ bool gerber_explorer::on_init()
         settings.multisamples = max_multisamples;
     }
 
+    // 0 = no limit on how much memory the tesselation arenas can commit
+    gerber_lib::arena_pool::get().set_commit_budget((size_t)std::max(0, settings.arena_commit_budget_mb) << 20);
+
     return true;
 }
 
@@ -1050,28 +1128,33 @@ void gerber_explorer::select_layer(gerber_layer *layer)
 }
 
 //////////////////////////////////////////////////////////////////////
-// It's annoying that we retesselate the layer when all we want is
-// to generate the mask...
+// Retesselate into the idle drawer and swap it in when it's done. Jobs for
+// a layer are chained so only one uses the idle drawer at a time; a newer
+// request stops the running one (the drawer checks between entities) and
+// anything stale is thrown away rather than swapped in.
+// Outline layers are tesselated at fixed quality but the mask is not
+// rebuilt here - it's cached in the layer (see create_layer_mask)
 
 void gerber_explorer::tesselate_layer(gerber_layer *layer, tesselation_options_t options, double pixels_per_world_unit)
 {
-    pool.add_job(job_type_tesselate, [this, layer, options, pixels_per_world_unit](std::stop_token st) {
+    uint32_t generation = layer->tess_generation.fetch_add(1) + 1;
+
+    auto after = layer->tess_job;
+    layer->tess_job = pool.add_task(job_type_tesselate, job_pool::priority_interactive, layer, { after }, [=, this](std::stop_token st) {
         layer->job_count.fetch_add(1);
         DEFER(layer->job_count.fetch_sub(1));
+
+        auto is_stale = [&]() { return st.stop_requested() || layer->tess_generation.load() != generation; };
+
+        if(is_stale()) {
+            return;
+        }
         bool force_outline = (options & tesselation_options_force_outline) != 0;
 
-        // Atomically claim the idle drawer. If another retesselation job is already
-        // running for this layer (possible in the non-blocking dynamic-tess path),
-        // bail out - the running job will produce a result and another retesselation
-        // will be triggered by the next debounce if needed.
         int d;
         {
             std::lock_guard l(layer_drawer_mutex);
-            if(layer->retesselating) {
-                return;
-            }
             d = 1 - layer->current_drawer;
-            layer->retesselating = true;
         }
 
         gerber_drawer *other_drawer = &layer->drawers[d];
@@ -1080,39 +1163,100 @@ void gerber_explorer::tesselate_layer(gerber_layer *layer, tesselation_options_t
         layer->is_outline_layer = force_outline || is_layer_type(layer_type, layer::type_t::board) || is_layer_type(layer_type, layer::type_t::outline);
         other_drawer->pixels_per_world_unit = layer->is_outline_layer ? 0 : pixels_per_world_unit;
         other_drawer->tesselation_quality = layer->is_outline_layer ? tesselation_quality::high : settings.tesselation_quality;
-        other_drawer->set_gerber(&layer->file);
-        if(layer->is_outline_layer) {
-            other_drawer->create_mask();
+        other_drawer->use_compact_vertices = settings.compact_vertices;
+        other_drawer->stop_token = st;
+        {
+            job_trace::stage trace("tesselate", layer->name);
+            other_drawer->set_gerber(&layer->file);
+        }
+        other_drawer->stop_token = {};
+        if(is_stale()) {
+            LOG_DEBUG("Discarding stale tesselation of {}", layer->name);
+            return;
         }
         // transfer entity flags (hovered/selected/active) from old drawer to new
         // NOTE: only transfer selection flags - fill/clear come from the new tesselation
         // and must not be overwritten (old_drawer->entity_flags is zero for layers that
         // were never rendered, which would wipe out the fill/clear flags)
         gerber_drawer *old_drawer = &layer->drawers[layer->current_drawer];
-        for(auto &e : other_drawer->entities) {
-            int id = e.entity_id();
-            if(id >= 0 && id < (int)old_drawer->entity_flags.size()) {
-                e.flags = (e.flags & ~entity_flags_t::all_select) | (old_drawer->entity_flags[id] & entity_flags_t::all_select);
+        job_pool::parallel_for(0, other_drawer->entities.size(), 4096, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                auto &e = other_drawer->entities[i];
+                int id = e.entity_id();
+                if(id >= 0 && id < (int)old_drawer->entity_flags.size()) {
+                    e.flags = (e.flags & ~entity_flags_t::all_select) | (old_drawer->entity_flags[id] & entity_flags_t::all_select);
+                }
             }
-        }
+        });
         {
             std::lock_guard l(layer_drawer_mutex);
-            layer->current_drawer = d;
-            layer->retesselating = false;
+            if(layer->tess_generation.load() == generation) {
+                layer->current_drawer = d;
+            }
+        }
+    });
+}
+
+//////////////////////////////////////////////////////////////////////
+// Queue the mask build for an outline layer, unless it's been done already.
+// The mask only depends on the parsed file, so tesselate a private drawer at
+// fixed quality rather than borrow the view drawers which follow the LOD
+
+job_pool::job_handle gerber_explorer::create_layer_mask(gerber_layer *layer)
+{
+    // held while it's queued so nobody sees the request claimed but the old handle
+    std::lock_guard lock(outline_mask_mutex);
+    if(layer->mask_requested.exchange(true)) {
+        return {};
+    }
+    auto mask_job = pool.add_task(job_type_create_mask, job_pool::priority_normal, layer, {}, [layer](std::stop_token st) {
+        layer->job_count.fetch_add(1);
+        DEFER(layer->job_count.fetch_sub(1));
+        if(st.stop_requested()) {
+            layer->mask_requested = false;
+            return;
         }
+        job_trace::stage trace("mask", layer->name);
+        gerber_drawer mask_drawer;
+        mask_drawer.init(layer);
+        mask_drawer.tesselation_quality = tesselation_quality::high;
+        mask_drawer.set_gerber(&layer->file);
+        mask_drawer.create_mask(layer->mask);
+        mask_drawer.release();
+        layer->got_mask = true;
+        LOG_DEBUG("Created mask for {}: {} triangles", layer->name, layer->mask.indices.size() / 3);
     });
+    outline_mask_job = mask_job;
+    return mask_job;
 }
 
 //////////////////////////////////////////////////////////////////////
+// Runs in the load job. Once the file is parsed the rest of the pipeline is
+// a little graph grouped by layer:
+//
+//   tesselate ---------------------.
+//   mask (outline layers only) ----+--> publish to the main thread
+//   outline mask (inverted only) --'
+//
+// so tesselation and the mask run side by side and an inverted layer doesn't
+// show up before the board outline it's drawn through
 
 void gerber_explorer::load_gerber(settings::layer_t const &layer_to_load)
 {
     gerber_layer *layer = new gerber_layer();
     layer->init();
-    gerber_lib::gerber_error_code err = layer->file.parse_file(layer_to_load.filename.c_str());
+    gerber_lib::gerber_error_code err;
+    {
+        job_trace::stage trace("parse", layer_to_load.filename);
+        err = layer->file.parse_file(layer_to_load.filename.c_str());
+    }
     if(err != gerber_lib::ok) {
         LOG_ERROR("Error loading {} ({})", layer_to_load.filename, gerber_lib::get_error_text(err));
         delete layer;
+        pending_loads.fetch_sub(1);
+        SDL_Event e{};
+        e.type = SDL_EVENT_USER;
+        SDL_PushEvent(&e);
         return;
     }
 
@@ -1122,6 +1266,7 @@ void gerber_explorer::load_gerber(settings::layer_t const &layer_to_load)
     layer->visible = layer_to_load.visible;
     layer->clear_color = gpu::colors::black;
     layer->drawer = &layer->drawers[0];
+    job_trace::set_group_name(layer, layer->name);
 
     layer_defaults_t d = get_defaults_for_layer_type(g.layer_type);
     if(layer->index == -1) {
@@ -1142,42 +1287,89 @@ void gerber_explorer::load_gerber(settings::layer_t const &layer_to_load)
 
     LOG_DEBUG("Finished loading {}, \"{}\"", layer->index, layer_to_load.filename);
 
-    pool.add_job(job_type_tesselate, [layer, this]([[maybe_unused]] std::stop_token st) {
+    using namespace gerber_lib;
+    auto layer_type = layer->layer_type();
+    layer->is_outline_layer = is_layer_type(layer_type, layer::type_t::board) || is_layer_type(layer_type, layer::type_t::outline);
+
+    // these are part of loading, not retesselation, so abort_jobs(job_type_tesselate) leaves them alone
+    auto tesselate = pool.add_task(job_type_load_gerber, job_pool::priority_normal, layer, {}, [layer, this](std::stop_token) {
         layer->job_count.fetch_add(1);
         DEFER(layer->job_count.fetch_sub(1));
-
-        using namespace gerber_lib;
-        auto layer_type = layer->layer_type();
-        layer->is_outline_layer = is_layer_type(layer_type, layer::type_t::board) || is_layer_type(layer_type, layer::type_t::outline);
         layer->drawer->tesselation_quality = layer->is_outline_layer ? tesselation_quality::high : settings.tesselation_quality;
+        layer->drawer->use_compact_vertices = settings.compact_vertices;
+        job_trace::stage trace("tesselate", layer->name);
         layer->drawer->set_gerber(&layer->file);
-        LOG_DEBUG("Tesselated ({}:{}) {}", layer_type_name(layer_type), layer->is_outline_layer, layer->filename());
-        if(layer->is_outline_layer) {
-            layer->drawer->create_mask();
-        }
+        LOG_DEBUG("Tesselated ({}:{}) {}", layer_type_name(layer->layer_type()), layer->is_outline_layer, layer->filename());
+    });
+
+    job_pool::job_handle mask;
+    if(layer->is_outline_layer) {
+        mask = create_layer_mask(layer);
+    }
+
+    job_pool::job_handle outline_mask;
+    if(layer->invert) {
+        std::lock_guard lock(outline_mask_mutex);
+        outline_mask = outline_mask_job;
+    }
+
+    // the task owns the layer until it's published, so if it's cancelled (or the pool
+    // shuts down before it runs) the layer is freed when the task is thrown away. That
+    // only happens once the jobs it's waiting for are done with the layer
+    struct unpublished_layer
+    {
+        gerber_explorer *app;
 
-        // inform main thread that there's a new layer available and wait for it to pick it up
+        void operator()(gerber_layer *l) const
         {
-            std::lock_guard loaded_lock(loaded_mutex);
-            loaded_layers.push_back(layer);
-        }
-        bool loaded = false;
-        while(!loaded && !st.stop_requested()) {
-            {
-                std::lock_guard loaded_lock(loaded_mutex);
-                loaded = loaded_layers.empty();
-                SDL_Event e{}; e.type = SDL_EVENT_USER; SDL_PushEvent(&e);
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(25));
+            LOG_INFO("Dropped {} before it was published", l->filename());
+            delete l;
+            app->pending_loads.fetch_sub(1);
         }
+    };
+    std::unique_ptr<gerber_layer, unpublished_layer> owned_layer(layer, unpublished_layer{ this });
+
+    pool.add_task(job_type_load_gerber, job_pool::priority_normal, layer, { tesselate, mask, outline_mask }, [owned_layer = std::move(owned_layer), this](std::stop_token) mutable {
+        publish_loaded_layer(owned_layer.release());
     });
 }
 
+//////////////////////////////////////////////////////////////////////
+// Hand a finished layer to the main thread and wake it up, the job is done
+// as soon as it's pushed
+
+void gerber_explorer::publish_loaded_layer(gerber_layer *layer)
+{
+    layer->next_loaded = loaded_layers.load(std::memory_order_relaxed);
+    while(!loaded_layers.compare_exchange_weak(layer->next_loaded, layer, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+    SDL_Event e{};
+    e.type = SDL_EVENT_USER;
+    SDL_PushEvent(&e);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Main thread only, returns everything published so far in the order it arrived
+
+gerber_layer *gerber_explorer::take_loaded_layers()
+{
+    gerber_layer *newest_first = loaded_layers.exchange(nullptr, std::memory_order_acquire);
+    gerber_layer *oldest_first = nullptr;
+    while(newest_first != nullptr) {
+        gerber_layer *next = newest_first->next_loaded;
+        newest_first->next_loaded = oldest_first;
+        oldest_first = newest_first;
+        newest_first = next;
+    }
+    return oldest_first;
+}
+
 //////////////////////////////////////////////////////////////////////
 
 void gerber_explorer::add_gerber(settings::layer_t const &layer)
 {
     settings::layer_t l = layer;
+    pending_loads.fetch_add(1);
     pool.add_job(job_type_load_gerber, [l, this]([[maybe_unused]] std::stop_token st) { load_gerber(l); });
 }
 
@@ -1312,7 +1504,7 @@ void gerber_explorer::set_active_entity(tesselator_entity *entity)
 
 //////////////////////////////////////////////////////////////////////
 
-void gerber_explorer::export_stl(std::filesystem::path filepath, gerber_layer *l, rect board_ext)
+void gerber_explorer::export_mesh(std::filesystem::path filepath, gerber_layer *l, rect board_ext)
 {
     gerber_layer *outline_layer{ nullptr };
     if(l->invert) {
@@ -1323,17 +1515,33 @@ void gerber_explorer::export_stl(std::filesystem::path filepath, gerber_layer *l
             }
         }
     }
-    pool.add_job(job_type_export, [this, filepath, l, outline_layer, board_ext] (std::stop_token st) {
-        l->job_count.fetch_add(1);
-        if(outline_layer != nullptr) {
-            outline_layer->job_count.fetch_add(1);
-        }
+    // not in the layer's group, abort_group would drop it before it ran and leave
+    // the export showing forever. The job counts keep the layers alive instead
+    l->job_count.fetch_add(1);
+    if(outline_layer != nullptr) {
+        outline_layer->job_count.fetch_add(1);
+    }
+    auto job = add_export_job(std::format("{} to {}", l->name, filepath.filename().string()));
+    pool.add_task(job_type_export, job_pool::priority_background, nullptr, {}, [this, filepath, l, outline_layer, board_ext, job] (std::stop_token st) {
+        DEFER(if(outline_layer != nullptr) { outline_layer->job_count.fetch_sub(1); } l->job_count.fetch_sub(1); job->done = true);
+        std::stop_callback forward_stop(st, [job]() { job->stop.request_stop(); });
+        std::stop_token stop = job->stop.get_token();
         LOG_CONTEXT("export", debug);
         LOG_INFO("Export {} as {}", l->name, filepath.string());
+        job_trace::stage trace("export", l->name);
         gerber_3d::gpu_3d_drawer drawer;
         drawer.init();
         drawer.tesselation_quality = settings.tesselation_quality;
+        drawer.decimation_tolerance = settings.decimation_tolerance;
+        drawer.stop_token = stop;
+        drawer.progress = &job->progress;
+        job->progress.step(0.0f, 0.5f);
         drawer.set_gerber(&l->file);
+        if(stop.stop_requested()) {
+            drawer.release();
+            LOG_INFO("Cancelled export of {}", l->name);
+            return;
+        }
         if(l->invert) {
             using namespace Clipper2Lib;
             Paths64 openings = PolyTreeToPaths64(drawer.resolved_tree);
@@ -1343,6 +1551,7 @@ void gerber_explorer::export_stl(std::filesystem::path filepath, gerber_layer *l
                 gerber_3d::gpu_3d_drawer outline_drawer;
                 outline_drawer.init();
                 outline_drawer.tesselation_quality = settings.tesselation_quality;
+                outline_drawer.stop_token = stop;
                 outline_drawer.set_gerber(&outline_layer->file);
                 // take only outer contours (top-level children), not holes
                 for(auto const &child : outline_drawer.resolved_tree) {
@@ -1364,172 +1573,1298 @@ void gerber_explorer::export_stl(std::filesystem::path filepath, gerber_layer *l
             drawer.resolved_tree.Clear();
             clipper.Execute(ClipType::Difference, FillRule::NonZero, drawer.resolved_tree);
         }
+        job->progress.step(0.5f, 0.7f);
         drawer.extrude(0.035);
-        drawer.export_stl(filepath.string());
+        job->progress.step(0.7f, 1.0f);
+        bool exported = !stop.stop_requested() && drawer.export_mesh(filepath);
         drawer.release();
-        LOG_INFO("Completed export to {}", filepath.string());
-        if(outline_layer != nullptr) {
-            outline_layer->job_count.fetch_sub(1);
+        if(exported) {
+            LOG_INFO("Completed export to {}", filepath.string());
+        } else if(stop.stop_requested()) {
+            LOG_INFO("Cancelled export of {}", l->name);
         }
-        l->job_count.fetch_sub(1);
     });
 }
 
 //////////////////////////////////////////////////////////////////////
+// Like the density the nets are made from private drawers at fixed quality (the
+// entities are the same whatever the quality) in the background, and kept for
+// the set of layers they were made with. Until they're in, the selection waits
+// (see update_nets)
 
-void gerber_explorer::ui()
+struct gerber_explorer::net_cache
 {
-    auto is_active = [] {
-        ImGuiIO &io = ImGui::GetIO();
-        if(io.Ctx->DimBgRatio != 0.0f && io.Ctx->DimBgRatio != 1.0f) {
-            return true;
-        }
-        if(io.MouseDelta.x != 0 || io.MouseDelta.y != 0) {
-            return true;
+    std::vector<gerber_layer *> layers;
+    gerber::copper_nets nets;
+};
+
+void gerber_explorer::select_net()
+{
+    LOG_CONTEXT("nets", info);
+
+    select_net_pending = false;
+    if(selected_layer == nullptr || active_entity == nullptr) {
+        return;
+    }
+    std::vector<gerber_layer *> net_layers;
+    std::vector<uint8_t> drills;
+    uint32_t active_layer = gerber::copper_nets::no_net;
+    for(auto *l : layers) {
+        if(!l->is_valid() || (l != selected_layer && !layer_is_visible(l))) {
+            continue;
         }
-        for(int i = 0; i < 5; ++i) {
-            if(io.MouseClicked[i] || io.MouseReleased[i]) {
-                return true;
-            }
+        using namespace gerber_lib;
+        int t = l->layer_type();
+        bool copper = is_layer_type(t, layer::copper_top) || is_layer_type(t, layer::copper_inner) || is_layer_type(t, layer::copper_bottom);
+        bool drill = is_layer_type(t, layer::drill) || is_layer_type(t, layer::drill_top) || is_layer_type(t, layer::drill_bottom);
+        if(l == selected_layer) {
+            active_layer = static_cast<uint32_t>(net_layers.size());
+        } else if(!copper && !(drill && gerber_3d::drill_file_is_plated(l->file))) {
+            continue;
         }
-        return false;
-    };
-
-    if(is_active()) {
-        set_active();
+        net_layers.push_back(l);
+        drills.push_back(drill);
     }
 
-    ImGui::PushStyleVar(ImGuiStyleVar_WindowBorderSize, 0.0f);
-    if(ImGui::BeginMainMenuBar()) {
-        if(ImGui::BeginMenu("File")) {
-            if(ImGui::MenuItem("Open Layers", "Ctrl-O", nullptr)) {
-                file_open();
-            }
-            ImGui::Separator();
-            if(ImGui::MenuItem("Save Settings", "Ctrl-S", nullptr)) {
-                auto save_path = save_file_dialog("settings.json");
-                if(save_path.has_value()) {
-                    save_settings(save_path.value(), true);
-                }
-            }
-            if(ImGui::MenuItem("Load Settings", "Ctrl-L", nullptr)) {
-                auto load_path = load_file_dialog();
-                if(load_path.has_value()) {
-                    load_settings(load_path.value());
-                }
-            }
-            // ImGui::MenuItem("Stats", nullptr, &show_stats);
-            // ImGui::MenuItem("Options", nullptr, &show_options);
-            ImGui::Separator();
-            if(ImGui::MenuItem("Close all", nullptr, nullptr)) {
-                close_all_layers();
-            }
-            ImGui::Separator();
-            if(ImGui::MenuItem("Exit", "Esc", nullptr)) {
-                set_should_close();
-            }
-            ImGui::EndMenu();
+    std::shared_ptr<net_cache const> cache;
+    {
+        std::lock_guard l(layer_drawer_mutex);
+        cache = nets;
+    }
+    if(cache == nullptr || cache->layers != net_layers) {
+        select_net_pending = true;
+        if(nets_requested == net_layers) {
+            return;
         }
-        if(ImGui::BeginMenu("View")) {
-            if(ImGui::MenuItem("Fit to window", "F", nullptr, !layers.empty())) {
-                fit_to_viewport();
-            }
-            ImGui::MenuItem("Flip X", "X", &settings.flip_x);
-            ImGui::MenuItem("Flip Y", "Y", &settings.flip_y);
-            ImGui::MenuItem("Toolbar", "", &settings.view_toolbar);
-
-            // Background color
-            ImVec2 pos = ImGui::GetCursorScreenPos();
-            if(ImGui::Selectable("Background", false, ImGuiSelectableFlags_DontClosePopups)) {
-                ImGui::OpenPopup("BackgroundColorPickerPopup");
-            }
-            float boxSize = ImGui::GetFontSize();
-            float posX = pos.x + ImGui::GetItemRectSize().x - boxSize - ImGui::GetStyle().ItemSpacing.x;
-            ImGui::SetCursorScreenPos(ImVec2(posX, pos.y));
-            ImGui::ColorButton("##bgcolor_btn",
-                               { settings.background_color.r, settings.background_color.g, settings.background_color.b, 1.0f },
-                               ImGuiColorEditFlags_NoAlpha,
-                               ImVec2(boxSize, boxSize));
-            if(ImGui::BeginPopup("BackgroundColorPickerPopup")) {
-                ImGui::ColorPicker3("##bgcolor_picker", (float *)settings.background_color, ImGuiColorEditFlags_NoAlpha);
-                ImGui::EndPopup();
-            }
-
-            ImGui::MenuItem("Wireframe", "W", &settings.wireframe);
-            ImGui::MenuItem("Show Axes", "A", &settings.show_axes);
-            ImGui::MenuItem("Show Extent", "E", &settings.show_extent);
-            if(ImGui::BeginMenu("Units")) {
-                if(ImGui::MenuItem("MM", "", settings.units == settings::units_mm)) {
-                    settings.units = settings::units_mm;
-                    set_active_entity(active_entity);
-                }
-                if(ImGui::MenuItem("Inch", "", settings.units == settings::units_inch)) {
-                    settings.units = settings::units_inch;
-                    set_active_entity(active_entity);
-                }
-                ImGui::EndMenu();
-            }
-            if(ImGui::BeginMenu("Anti-Aliasing")) {
-                int msaa_options[] = { 1, 2, 4, 8 };
-                int num_options = 0;
-                for(int i = 0; i < 4; ++i) {
-                    if(msaa_options[i] <= max_multisamples) {
-                        num_options = i + 1;
-                    }
-                }
-                for(int i = 0; i < num_options; ++i) {
-                    char label[16];
-                    snprintf(label, sizeof(label), "%dx", msaa_options[i]);
-                    if(ImGui::MenuItem(label, "", settings.multisamples == msaa_options[i])) {
-                        settings.multisamples = msaa_options[i];
+        nets_requested = net_layers;
+        uint32_t generation = nets_generation.fetch_add(1) + 1;
+        for(auto *l : net_layers) {
+            l->job_count.fetch_add(1);
+        }
+        pool.add_task(job_type_nets, job_pool::priority_normal, nullptr, {}, [this, net_layers, drills, generation](std::stop_token st) {
+            // a newer request went in before this started
+            if(nets_generation.load() == generation) {
+                job_trace::stage trace("nets", {});
+                std::unique_ptr<gerber_drawer[]> drawers(new gerber_drawer[net_layers.size()]);
+                std::vector<gerber::copper_nets::layer_input> inputs(net_layers.size());
+                job_pool::parallel_for(0, net_layers.size(), 1, [&](size_t begin, size_t end) {
+                    for(size_t i = begin; i < end; ++i) {
+                        drawers[i].init(net_layers[i]);
+                        drawers[i].tesselation_quality = tesselation_quality::medium;
+                        drawers[i].set_gerber(&net_layers[i]->file);
+                        inputs[i] = gerber::copper_nets::layer_input::from_drawer(drawers[i], drills[i] != 0);
                     }
+                });
+                auto result = std::make_shared<net_cache>();
+                result->layers = net_layers;
+                bool built = result->nets.build(inputs, st);
+                for(size_t i = 0; i < net_layers.size(); ++i) {
+                    drawers[i].release();
                 }
-                ImGui::EndMenu();
-            }
-            if(ImGui::BeginMenu("Tesselation")) {
-                if(ImGui::Checkbox("Dynamic", &settings.dynamic_tesselation)) {
-                    if(settings.dynamic_tesselation) {
-                        last_tess_ppwu = 0;
+                if(built) {
+                    std::lock_guard l(layer_drawer_mutex);
+                    if(nets_generation.load() == generation) {
+                        nets = std::move(result);
                     }
-                    retesselate = true;
-                }
-                if(ImGui::SliderInt("Quality",
-                                    &settings.tesselation_quality,
-                                    tesselation_quality::low,
-                                    tesselation_quality::high,
-                                    tesselation_quality_name(settings.tesselation_quality))) {
-                    retesselate = true;
-                }
-                int delay_ms = static_cast<int>(settings.tesselation_delay * 1000.0f);
-                if(ImGui::SliderInt("Delay", &delay_ms, 20, 200, "%d ms")) {
-                    settings.tesselation_delay = delay_ms / 1000.0f;
                 }
-                ImGui::EndMenu();
             }
-            if(ImGui::BeginMenu("Outline")) {
-                ImGui::SliderFloat("##val", &settings.outline_width, 0.0f, 8.0f, "%.1f");
-                ImGui::ColorEdit4("Outline color",
-                                  (float *)&settings.outline_color,
-                                  ImGuiColorEditFlags_AlphaPreview | ImGuiColorEditFlags_NoInputs | ImGuiColorEditFlags_AlphaBar);
-                ImGui::EndMenu();
+            for(auto *l : net_layers) {
+                l->job_count.fetch_sub(1);
             }
-            ImGui::EndMenu();
-        }
-
-#if defined(_DEBUG)
-        static int frames = 0;
-        frames += 1;
-        std::string text = std::format("Frame {:07d} {:06.2f}ms {:06.2f}ms", frames, last_frame_elapsed_time * 1000.0, last_frame_cpu_time * 1000.0);
-        float text_width = ImGui::CalcTextSize(text.c_str()).x;
-        float posX = ImGui::GetWindowWidth() - text_width - ImGui::GetStyle().ItemSpacing.x;
-        ImGui::SetCursorPosX(posX);
-        ImGui::Text("%s", text.c_str());
-#endif
-        ImGui::EndMainMenuBar();
+        });
+        LOG_INFO("Finding the nets on {} layers", net_layers.size());
+        return;
     }
-    ImGui::PopStyleVar(1);
 
-    if(settings.view_toolbar) {
+    uint32_t active_index = static_cast<uint32_t>(active_entity - selected_layer->drawer->entities.data());
+    auto members = cache->nets.same_net(active_layer, active_index);
+
+    for(auto *l : net_layers) {
+        l->drawer->clear_entity_flags(entity_flags_t::selected);
+    }
+    for(auto const &m : members) {
+        auto &entities = net_layers[m.layer]->drawer->entities;
+        if(m.entity < entities.size()) {
+            entities[m.entity].flags |= entity_flags_t::selected;
+        }
+    }
+    LOG_INFO("Net of entity {} in {}: {} entities on {} layers", active_entity->entity_id(), selected_layer->name, members.size(), net_layers.size());
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void gerber_explorer::update_nets()
+{
+    if(!select_net_pending) {
+        return;
+    }
+    bool ready;
+    {
+        std::lock_guard l(layer_drawer_mutex);
+        ready = nets != nullptr && nets->layers == nets_requested;
+    }
+    if(ready) {
+        select_net();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// A job which is making the nets holds a job_count on its layers so they're
+// still there, but a new layer could turn up at the same address later
+
+void gerber_explorer::forget_nets(gerber_layer const *layer)
+{
+    if(std::ranges::find(nets_requested, layer) == nets_requested.end()) {
+        return;
+    }
+    nets_requested.clear();
+    select_net_pending = false;
+    nets_generation.fetch_add(1);
+    std::lock_guard l(layer_drawer_mutex);
+    nets.reset();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Like the outline mask the density is made from a private drawer at fixed
+// quality, the view drawers follow the LOD and get swapped under it. The
+// heatmap shows whatever finished last until the new one's in
+
+void gerber_explorer::update_density()
+{
+    if(!settings.show_density || selected_layer == nullptr || !selected_layer->is_valid() || selected_layer->is_outline_layer) {
+        return;
+    }
+    gerber_layer *layer = selected_layer;
+    gerber_layer *outline_layer = get_outline_layer();
+    if(outline_layer != nullptr && !outline_layer->got_mask) {
+        outline_layer = nullptr;
+    }
+    if(layer->density_tile_size == settings.density_tile_size && layer->density_outline == outline_layer && layer->density_invert == layer->invert) {
+        return;
+    }
+    layer->density_tile_size = settings.density_tile_size;
+    layer->density_outline = outline_layer;
+    layer->density_invert = layer->invert;
+    bool invert = layer->invert;
+
+    uint32_t generation = layer->density_generation.fetch_add(1) + 1;
+    rect board = outline_layer != nullptr ? outline_layer->extent() : layer->extent();
+    double tile_size = settings.density_tile_size;
+
+    std::vector<gerber_layer *> job_layers{ layer };
+    if(outline_layer != nullptr) {
+        job_layers.push_back(outline_layer);
+    }
+    for(auto *l : job_layers) {
+        l->job_count.fetch_add(1);
+    }
+    pool.add_task(job_type_density, job_pool::priority_normal, nullptr, {}, [this, layer, outline_layer, board, tile_size, invert, generation, job_layers](std::stop_token) {
+        // a newer request went in before this started
+        if(layer->density_generation.load() == generation) {
+            job_trace::stage trace("density", layer->name);
+            gerber_drawer density_drawer;
+            density_drawer.init(layer);
+            density_drawer.tesselation_quality = tesselation_quality::medium;
+            density_drawer.set_gerber(&layer->file);
+            solid_shape const *mask = outline_layer != nullptr ? &outline_layer->mask : nullptr;
+            auto density = std::make_shared<gerber::soft_density const>(
+                gerber::soft_copper_density({ &density_drawer, layer->fill_color, invert }, board, tile_size, mask, 2048));
+            density_drawer.release();
+            std::lock_guard l(layer_drawer_mutex);
+            if(layer->density_generation.load() == generation) {
+                layer->density = density;
+            }
+        }
+        for(auto *l : job_layers) {
+            l->job_count.fetch_sub(1);
+        }
+    });
+}
+
+//////////////////////////////////////////////////////////////////////
+// The visible layers as one 3D board, each layer goes where its type says
+// in the stack. The outline layer is the board shape whatever its type is
+
+void gerber_explorer::export_board_stack(std::filesystem::path filepath)
+{
+    std::vector<gerber_layer *> export_layers;
+    std::vector<gerber_3d::board_stack_input> inputs;
+    for(auto *l : layers) {
+        if(!layer_is_visible(l) || !l->is_valid()) {
+            continue;
+        }
+        gerber_3d::board_role role = l->is_outline_layer ? gerber_3d::board_role::outline : gerber_3d::board_role_from_layer_type(l->layer_type());
+        if(role == gerber_3d::board_role::none) {
+            LOG_INFO("{} ({}) isn't part of the board stack", l->name, gerber_lib::layer_type_name_friendly(l->layer_type()));
+            continue;
+        }
+        export_layers.push_back(l);
+        inputs.push_back({ &l->file, role });
+    }
+    if(inputs.empty()) {
+        LOG_ERROR("No visible board layers to export");
+        return;
+    }
+
+    gerber_3d::board_stack_params params;
+    params.board_thickness = settings.board_thickness;
+    params.copper_thickness = settings.copper_thickness;
+    params.soldermask_thickness = settings.soldermask_thickness;
+    params.silkscreen_thickness = settings.silkscreen_thickness;
+    params.plating_thickness = settings.plating_thickness;
+    params.decimation_tolerance = settings.decimation_tolerance;
+    params.board_extent = board_extent;
+
+    for(auto *l : export_layers) {
+        l->job_count.fetch_add(1);
+    }
+
+    auto job = add_export_job(std::format("Board to {}", filepath.filename().string()));
+    pool.add_task(job_type_export, job_pool::priority_background, nullptr, {}, [filepath, export_layers, inputs, params, job](std::stop_token st) {
+        std::stop_callback forward_stop(st, [job]() { job->stop.request_stop(); });
+        LOG_CONTEXT("export", info);
+        LOG_INFO("Export board ({} layers) as {}", inputs.size(), filepath.string());
+        if(gerber_3d::export_board_stack(filepath, inputs, params, job->stop.get_token(), &job->progress)) {
+            LOG_INFO("Completed export to {}", filepath.string());
+        }
+        for(auto *l : export_layers) {
+            l->job_count.fetch_sub(1);
+        }
+        job->done = true;
+    });
+}
+
+//////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<gerber_explorer::cancellable_job> gerber_explorer::add_export_job(std::string name)
+{
+    auto job = std::make_shared<cancellable_job>();
+    job->name = std::move(name);
+    export_jobs.push_back(job);
+    return job;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<gerber_explorer::cancellable_job> gerber_explorer::add_check_job(std::string name)
+{
+    auto job = std::make_shared<cancellable_job>();
+    job->name = std::move(name);
+    check_jobs.push_back(job);
+    return job;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void gerber_explorer::cancellable_jobs_ui(char const *title, cancellable_jobs &jobs)
+{
+    std::erase_if(jobs, [](auto const &job) { return job->done.load(); });
+
+    if(jobs.empty()) {
+        return;
+    }
+    ImGui::Begin(title);
+    for(auto const &job : jobs) {
+        ImGui::PushID(job.get());
+        ImGui::TextUnformatted(job->name.c_str());
+        bool cancelling = job->stop.stop_requested();
+        ImGui::ProgressBar(job->progress.get(), ImVec2(-80, 0), cancelling ? "Cancelling" : nullptr);
+        ImGui::SameLine();
+        ImGui::BeginDisabled(cancelling);
+        if(ImGui::Button("Cancel", ImVec2(-1, 0))) {
+            job->stop.request_stop();
+        }
+        ImGui::EndDisabled();
+        ImGui::PopID();
+    }
+    ImGui::End();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Render the visible layers as they're shown now (order, flip, colors) with
+// the software rasterizer. Each layer is tesselated again at high quality
+// into a private drawer so the view's LOD and retesselation don't matter
+
+void gerber_explorer::export_png(std::filesystem::path filepath)
+{
+    std::vector<gerber_layer *> export_layers;
+    for(auto *l : layers) {
+        if(layer_is_visible(l) && l->is_valid()) {
+            export_layers.push_back(l);
+        }
+    }
+    sort_layers_for_view(export_layers);
+    if(export_layers.empty()) {
+        LOG_ERROR("No visible layers to export");
+        return;
+    }
+    gerber_layer *outline_layer = get_outline_layer();
+    if(outline_layer != nullptr && !outline_layer->got_mask) {
+        outline_layer = nullptr;
+    }
+
+    gerber::soft_render_params params;
+    params.board_rect = board_rect_from_world_rect(visible_board_extent);
+    params.flip_xy = flip_xy;
+    params.flip_center = board_center;
+    params.background = gpu::color_from_floats(settings.background_color.r, settings.background_color.g, settings.background_color.b, 1.0f);
+    params.outline_mask = outline_layer != nullptr ? &outline_layer->mask : nullptr;
+    gerber::soft_render_size(params.board_rect, (uint32_t)std::max(1, settings.png_export_size), params.width, params.height);
+
+    for(auto *l : export_layers) {
+        l->job_count.fetch_add(1);
+    }
+    if(outline_layer != nullptr) {
+        outline_layer->job_count.fetch_add(1);
+    }
+
+    auto job = add_export_job(std::format("PNG to {}", filepath.filename().string()));
+    pool.add_task(job_type_export, job_pool::priority_background, nullptr, {}, [filepath, export_layers, outline_layer, params, job](std::stop_token st) {
+        std::stop_callback forward_stop(st, [job]() { job->stop.request_stop(); });
+        std::stop_token stop = job->stop.get_token();
+        LOG_CONTEXT("export", debug);
+        LOG_INFO("Export {} layers as {} ({}x{})", export_layers.size(), filepath.string(), params.width, params.height);
+        job_trace::stage trace("export", filepath.filename().string());
+
+        size_t num_layers = export_layers.size();
+        std::unique_ptr<gerber::gerber_drawer[]> drawers(new gerber::gerber_drawer[num_layers]);
+        job_pool::parallel_for(0, num_layers, 1, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                drawers[i].init(export_layers[i]);
+                drawers[i].tesselation_quality = tesselation_quality::high;
+                drawers[i].stop_token = stop;
+                drawers[i].set_gerber(&export_layers[i]->file);
+            }
+        });
+        job->progress.set(0.5f);
+
+        std::vector<gerber::soft_layer> soft_layers;
+        for(size_t i = 0; i < num_layers; ++i) {
+            soft_layers.push_back({ &drawers[i], export_layers[i]->fill_color, export_layers[i]->invert });
+        }
+        gerber::soft_image image;
+        if(!stop.stop_requested()) {
+            image = gerber::soft_render(soft_layers, params, stop);
+        }
+        if(stop.stop_requested()) {
+            LOG_INFO("Cancelled export to {}", filepath.string());
+        } else if(image.save_png(filepath)) {
+            LOG_INFO("Completed export to {}", filepath.string());
+        }
+
+        for(size_t i = 0; i < num_layers; ++i) {
+            drawers[i].release();
+            export_layers[i]->job_count.fetch_sub(1);
+        }
+        if(outline_layer != nullptr) {
+            outline_layer->job_count.fetch_sub(1);
+        }
+        job->done = true;
+    });
+}
+
+//////////////////////////////////////////////////////////////////////
+// For the headless modes: parse and tesselate a file (at high quality)
+// with the same defaults as loading it into the window
+
+namespace
+{
+    std::unique_ptr<gerber_layer> load_headless_layer(std::string const &filename)
+    {
+        auto layer = std::make_unique<gerber_layer>();
+        layer->init();
+        gerber_lib::gerber_error_code err;
+        {
+            job_trace::stage trace("parse", filename);
+            err = layer->file.parse_file(filename.c_str());
+        }
+        if(err != gerber_lib::ok) {
+            LOG_ERROR("Error loading {} ({})", filename, gerber_lib::get_error_text(err));
+            return nullptr;
+        }
+        gerber_lib::gerber_file &g = layer->file;
+        layer_defaults_t d = get_defaults_for_layer_type(g.layer_type);
+        layer->index = g.layer_type;
+        layer->name = std::filesystem::path(g.filename).filename().string();
+        if(g.image.info.polarity == gerber_lib::polarity_unspecified) {
+            layer->invert = d.is_inverted;
+        } else {
+            layer->invert = g.image.info.polarity == gerber_lib::polarity_negative;
+        }
+        layer->fill_color = d.color;
+        layer->layer_order = d.layer_order;
+        using namespace gerber_lib;
+        layer->is_outline_layer = is_layer_type(g.layer_type, layer::type_t::board) || is_layer_type(g.layer_type, layer::type_t::outline);
+        layer->drawer = &layer->drawers[0];
+        layer->drawer->tesselation_quality = tesselation_quality::high;
+        layer->drawer->set_gerber(&g);
+        if(layer->is_outline_layer) {
+            layer->drawer->create_mask(layer->mask);
+            layer->got_mask = true;
+        }
+        return layer;
+    }
+
+}    // namespace
+
+//////////////////////////////////////////////////////////////////////
+// No window or GPU: load the files, tesselate them and render them all
+// (in the default colors, top view) straight to a PNG
+
+int gerber_explorer::export_png_headless(std::vector<std::string> const &args)
+{
+    LOG_CONTEXT("export_png", info);
+
+    std::filesystem::path output;
+    uint32_t size = 4096;
+    std::vector<std::string> files;
+    for(size_t i = 0; i < args.size(); ++i) {
+        if(args[i] == "--size" && i + 1 < args.size()) {
+            size = (uint32_t)std::max(1, atoi(args[++i].c_str()));
+        } else if(output.empty()) {
+            output = args[i];
+        } else {
+            files.push_back(args[i]);
+        }
+    }
+    if(output.empty() || files.empty()) {
+        LOG_ERROR("Usage: gerber_explorer --export-png <output.png> [--size <pixels>] <gerber files...>");
+        return 1;
+    }
+
+    job_pool export_pool;
+    export_pool.start_workers(std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+    std::vector<std::unique_ptr<gerber_layer>> loaded(files.size());
+    job_pool::parallel_for(0, files.size(), 1, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; ++i) {
+            loaded[i] = load_headless_layer(files[i]);
+        }
+    });
+
+    // same order as the layer list in the window
+    std::vector<gerber_layer *> ordered;
+    for(auto &l : loaded) {
+        if(l != nullptr) {
+            ordered.push_back(l.get());
+        }
+    }
+    std::stable_sort(ordered.begin(), ordered.end(), [](gerber_layer const *a, gerber_layer const *b) { return a->index > b->index; });
+
+    gerber_layer *outline_layer{ nullptr };
+    rect extent{ { FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX } };
+    std::vector<gerber::soft_layer> soft_layers;
+    for(auto *l : ordered) {
+        if(outline_layer == nullptr && l->got_mask) {
+            outline_layer = l;
+        }
+        if(l->extent().is_normalized()) {
+            extent = extent.union_with(l->extent());
+        }
+        soft_layers.push_back({ l->drawer, l->fill_color, l->invert });
+    }
+    if(soft_layers.empty() || !extent.is_normalized()) {
+        LOG_ERROR("Nothing to export");
+        return 1;
+    }
+
+    gerber::soft_render_params params;
+    params.board_rect = extent;
+    params.outline_mask = outline_layer != nullptr ? &outline_layer->mask : nullptr;
+    gerber::soft_render_size(extent, size, params.width, params.height);
+
+    bool saved = gerber::soft_render(soft_layers, params).save_png(output);
+
+    for(auto *l : ordered) {
+        l->drawer->release();
+        l->mask.release();
+    }
+    export_pool.shut_down();
+    return saved ? 0 : 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Diff two layers (eg two revisions of the same one) as they're shown
+// (flip, polarity, outline mask), log the changed regions and save the diff image
+
+void gerber_explorer::compare_layers(gerber_layer *before, gerber_layer *after, std::filesystem::path diff_path)
+{
+    if(!before->is_valid() || !after->is_valid()) {
+        return;
+    }
+    gerber_layer *outline_layer = get_outline_layer();
+    if(outline_layer != nullptr && !outline_layer->got_mask) {
+        outline_layer = nullptr;
+    }
+
+    gerber::soft_render_params params;
+    params.board_rect = board_rect_from_world_rect(before->extent().union_with(after->extent()));
+    params.flip_xy = flip_xy;
+    params.flip_center = board_center;
+    params.background = gpu::color_from_floats(settings.background_color.r, settings.background_color.g, settings.background_color.b, 1.0f);
+    params.outline_mask = outline_layer != nullptr ? &outline_layer->mask : nullptr;
+    gerber::soft_render_size(params.board_rect, (uint32_t)std::max(1, settings.png_export_size), params.width, params.height);
+
+    std::vector<gerber_layer *> job_layers{ before, after };
+    if(outline_layer != nullptr) {
+        job_layers.push_back(outline_layer);
+    }
+    for(auto *l : job_layers) {
+        l->job_count.fetch_add(1);
+    }
+
+    auto job = add_check_job(std::format("Compare {} with {}", after->name, before->name));
+    pool.add_task(job_type_export, job_pool::priority_background, nullptr, {}, [before, after, diff_path, params, job_layers, job](std::stop_token st) {
+        std::stop_callback forward_stop(st, [job]() { job->stop.request_stop(); });
+        std::stop_token stop = job->stop.get_token();
+        DEFER(for(auto *l : job_layers) { l->job_count.fetch_sub(1); } job->done = true);
+        LOG_CONTEXT("compare", info);
+        job_trace::stage trace("compare", after->name);
+
+        gerber_drawer drawers[2];
+        gerber_layer *compare[2] = { before, after };
+        job_pool::parallel_for(0, 2, 1, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                drawers[i].init(compare[i]);
+                drawers[i].tesselation_quality = tesselation_quality::high;
+                drawers[i].stop_token = stop;
+                drawers[i].set_gerber(&compare[i]->file);
+            }
+        });
+        job->progress.set(0.5f);
+
+        gerber::soft_diff diff;
+        if(!stop.stop_requested()) {
+            diff = gerber::soft_compare({ &drawers[0], before->fill_color, before->invert }, { &drawers[1], after->fill_color, after->invert }, params, 0.5f, stop);
+        }
+        for(auto &d : drawers) {
+            d.release();
+        }
+        if(stop.stop_requested() || diff.cancelled) {
+            LOG_INFO("Cancelled compare of {} with {}", after->name, before->name);
+            return;
+        }
+        LOG_INFO("{} -> {}: added {:.4f}, removed {:.4f}, unchanged {:.4f} in {} regions",
+                 before->name,
+                 after->name,
+                 diff.added_area,
+                 diff.removed_area,
+                 diff.unchanged_area,
+                 diff.changed_regions.size());
+        for(auto const &r : diff.changed_regions) {
+            LOG_INFO("Changed: {:.4f},{:.4f} - {:.4f},{:.4f}", r.min_pos.x, r.min_pos.y, r.max_pos.x, r.max_pos.y);
+        }
+        diff.image.save_png(diff_path);
+    });
+}
+
+//////////////////////////////////////////////////////////////////////
+// Exact version of compare_layers, logs the difference polygons. This
+// compares the drawn geometry, the inverted flags and the outline don't come into it
+
+void gerber_explorer::xor_layers(gerber_layer *before, gerber_layer *after)
+{
+    if(!before->is_valid() || !after->is_valid()) {
+        return;
+    }
+    before->job_count.fetch_add(1);
+    after->job_count.fetch_add(1);
+
+    auto job = add_check_job(std::format("XOR {} with {}", after->name, before->name));
+    pool.add_task(job_type_export, job_pool::priority_background, nullptr, {}, [before, after, job](std::stop_token st) {
+        std::stop_callback forward_stop(st, [job]() { job->stop.request_stop(); });
+        std::stop_token stop = job->stop.get_token();
+        DEFER(before->job_count.fetch_sub(1); after->job_count.fetch_sub(1); job->done = true);
+        LOG_CONTEXT("xor", info);
+        job_trace::stage trace("xor", after->name);
+
+        gerber_3d::gpu_3d_drawer drawers[2];
+        gerber_layer *compare[2] = { before, after };
+        job_pool::parallel_for(0, 2, 1, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                drawers[i].init();
+                drawers[i].tesselation_quality = gerber_3d::tesselation_quality::high;
+                drawers[i].stop_token = stop;
+                drawers[i].set_gerber(&compare[i]->file);
+            }
+        });
+        job->progress.set(0.5f);
+
+        gerber_3d::xor_result result;
+        if(!stop.stop_requested()) {
+            result = gerber_3d::xor_layers(drawers[0].resolved_tree, drawers[1].resolved_tree, 1e-9, stop);
+        }
+        for(auto &d : drawers) {
+            d.release();
+        }
+        if(stop.stop_requested() || result.cancelled) {
+            LOG_INFO("Cancelled XOR of {} with {}", after->name, before->name);
+            return;
+        }
+        LOG_INFO("{} -> {}: {} polygons, added {:.6f}, removed {:.6f}", before->name, after->name, result.polygons.size(), result.added_area, result.removed_area);
+        size_t constexpr max_logged = 32;
+        for(size_t i = 0; i < std::min(result.polygons.size(), max_logged); ++i) {
+            auto const &p = result.polygons[i];
+            LOG_INFO("{} {:.6f} at {:.4f},{:.4f} - {:.4f},{:.4f}", p.added ? "Added" : "Removed", p.area, p.bounds.min_pos.x, p.bounds.min_pos.y, p.bounds.max_pos.x, p.bounds.max_pos.y);
+        }
+        if(result.polygons.size() > max_logged) {
+            LOG_INFO("...and {} more", result.polygons.size() - max_logged);
+        }
+    });
+}
+
+//////////////////////////////////////////////////////////////////////
+// The report goes to stdout so it can be used as a regression check
+
+int gerber_explorer::compare_headless(std::vector<std::string> const &args)
+{
+    LOG_CONTEXT("compare", info);
+
+    uint32_t size = 4096;
+    bool exact = false;
+    std::vector<std::string> paths;
+    for(size_t i = 0; i < args.size(); ++i) {
+        if(args[i] == "--size" && i + 1 < args.size()) {
+            size = (uint32_t)std::max(1, atoi(args[++i].c_str()));
+        } else if(args[i] == "--exact") {
+            exact = true;
+        } else {
+            paths.push_back(args[i]);
+        }
+    }
+    if(paths.size() != 3) {
+        LOG_ERROR("Usage: gerber_explorer --compare <before> <after> <diff.png> [--size <pixels>] [--exact]");
+        return 1;
+    }
+
+    job_pool compare_pool;
+    compare_pool.start_workers(std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+    std::unique_ptr<gerber_layer> layer[2];
+    job_pool::parallel_for(0, 2, 1, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; ++i) {
+            layer[i] = load_headless_layer(paths[i]);
+        }
+    });
+    if(layer[0] == nullptr || layer[1] == nullptr) {
+        return 1;
+    }
+
+    gerber::soft_render_params params;
+    params.board_rect = layer[0]->extent().union_with(layer[1]->extent());
+    gerber::soft_render_size(params.board_rect, size, params.width, params.height);
+
+    // polarity from the files only, there's no outline so inverted layers cover the whole extent
+    gerber::soft_diff diff = gerber::soft_compare({ layer[0]->drawer, gpu::colors::white, layer[0]->invert }, { layer[1]->drawer, gpu::colors::white, layer[1]->invert }, params);
+    for(auto &l : layer) {
+        l->drawer->release();
+        l->mask.release();
+    }
+    if(!diff.image.save_png(paths[2])) {
+        return 1;
+    }
+    puts(std::format("added {:.6f}\nremoved {:.6f}\nunchanged {:.6f}\nchanged_pixels {}\nregions {}",
+                     diff.added_area,
+                     diff.removed_area,
+                     diff.unchanged_area,
+                     diff.changed_pixels,
+                     diff.changed_regions.size())
+             .c_str());
+    for(auto const &r : diff.changed_regions) {
+        puts(std::format("region {:.6f} {:.6f} {:.6f} {:.6f}", r.min_pos.x, r.min_pos.y, r.max_pos.x, r.max_pos.y).c_str());
+    }
+    bool identical = diff.identical();
+
+    if(exact) {
+        gerber_3d::gpu_3d_drawer drawers[2];
+        job_pool::parallel_for(0, 2, 1, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                drawers[i].init();
+                drawers[i].tesselation_quality = gerber_3d::tesselation_quality::high;
+                drawers[i].set_gerber(&layer[i]->file);
+            }
+        });
+        gerber_3d::xor_result result = gerber_3d::xor_layers(drawers[0].resolved_tree, drawers[1].resolved_tree);
+        puts(std::format("exact_added {:.9f}\nexact_removed {:.9f}\npolygons {}", result.added_area, result.removed_area, result.polygons.size()).c_str());
+        for(auto const &p : result.polygons) {
+            puts(std::format("polygon {} {:.9f} {:.6f} {:.6f} {:.6f} {:.6f}",
+                             p.added ? "added" : "removed",
+                             p.area,
+                             p.bounds.min_pos.x,
+                             p.bounds.min_pos.y,
+                             p.bounds.max_pos.x,
+                             p.bounds.max_pos.y)
+                     .c_str());
+        }
+        for(auto &d : drawers) {
+            d.release();
+        }
+        identical = result.polygons.empty();
+    }
+    return identical ? 0 : 2;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Clearance check on some copper layers, plated drill layers join up the
+// nets on the different layers. Used by the menu item and headless
+
+namespace
+{
+    struct clearance_input
+    {
+        gerber_lib::gerber_file *file;
+        bool drill;
+    };
+
+    gerber_3d::clearance_result run_clearance_check(std::vector<clearance_input> const &inputs,
+                                                    double min_clearance,
+                                                    std::stop_token stop_token,
+                                                    job_progress *progress)
+    {
+        std::vector<gerber_3d::gpu_3d_drawer> drawers(inputs.size());
+        job_pool::parallel_for(0, inputs.size(), 1, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                drawers[i].init();
+                drawers[i].stop_token = stop_token;
+                drawers[i].tesselation_quality = gerber_3d::tesselation_quality::high;
+                if(inputs[i].drill) {
+                    drawers[i].set_drill_file(inputs[i].file);
+                } else {
+                    drawers[i].set_gerber(inputs[i].file);
+                }
+            }
+        });
+        if(progress != nullptr) {
+            progress->set(0.5f);
+        }
+
+        std::vector<Clipper2Lib::PolyTree64 const *> copper;
+        Clipper2Lib::Paths64 holes;
+        for(size_t i = 0; i < inputs.size(); ++i) {
+            if(!inputs[i].drill) {
+                copper.push_back(&drawers[i].resolved_tree);
+            } else {
+                for(auto const &hole : drawers[i].resolved_tree) {
+                    holes.push_back(hole->Polygon());
+                }
+            }
+        }
+        gerber_3d::clearance_result result;
+        if(stop_token.stop_requested()) {
+            result.cancelled = true;
+        } else {
+            result = gerber_3d::check_clearance(copper, holes, min_clearance, stop_token);
+        }
+        for(auto &d : drawers) {
+            d.release();
+        }
+        if(progress != nullptr) {
+            progress->set(1.0f);
+        }
+        return result;
+    }
+
+}    // namespace
+
+//////////////////////////////////////////////////////////////////////
+// The visible copper layers, checked in the background and logged
+
+void gerber_explorer::check_clearance()
+{
+    std::vector<gerber_layer *> check_layers;
+    std::vector<clearance_input> inputs;
+    std::vector<std::string> copper_names;
+    for(auto *l : layers) {
+        if(!layer_is_visible(l) || !l->is_valid()) {
+            continue;
+        }
+        using namespace gerber_lib;
+        int t = l->layer_type();
+        bool copper = is_layer_type(t, layer::copper_top) || is_layer_type(t, layer::copper_inner) || is_layer_type(t, layer::copper_bottom);
+        bool drill = is_layer_type(t, layer::drill) || is_layer_type(t, layer::drill_top) || is_layer_type(t, layer::drill_bottom);
+        if(copper) {
+            copper_names.push_back(l->name);
+        } else if(!drill || !gerber_3d::drill_file_is_plated(l->file)) {
+            continue;
+        }
+        check_layers.push_back(l);
+        inputs.push_back({ &l->file, drill });
+    }
+    if(copper_names.empty()) {
+        LOG_ERROR("No visible copper layers to check");
+        return;
+    }
+    for(auto *l : check_layers) {
+        l->job_count.fetch_add(1);
+    }
+
+    double min_clearance = settings.drc_clearance;
+    auto job = add_check_job(std::format("Clearance {:.3f} mm", min_clearance));
+    pool.add_task(job_type_check, job_pool::priority_background, nullptr, {}, [check_layers, inputs, copper_names, min_clearance, job](std::stop_token st) {
+        std::stop_callback forward_stop(st, [job]() { job->stop.request_stop(); });
+        LOG_CONTEXT("clearance", info);
+        gerber_3d::clearance_result result = run_clearance_check(inputs, min_clearance, job->stop.get_token(), &job->progress);
+        if(!result.cancelled) {
+            LOG_INFO("{} copper layers, {} nets: {} places closer than {:.3f} mm", copper_names.size(), result.num_nets, result.violations.size(), min_clearance);
+            size_t constexpr max_logged = 32;
+            for(size_t i = 0; i < std::min(result.violations.size(), max_logged); ++i) {
+                auto const &v = result.violations[i];
+                LOG_INFO("{} {:.4f} at {:.4f},{:.4f} - {:.4f},{:.4f}", copper_names[v.layer], v.distance, v.from.x, v.from.y, v.to.x, v.to.y);
+            }
+            if(result.violations.size() > max_logged) {
+                LOG_INFO("...and {} more", result.violations.size() - max_logged);
+            }
+        }
+        for(auto *l : check_layers) {
+            l->job_count.fetch_sub(1);
+        }
+        job->done = true;
+    });
+}
+
+//////////////////////////////////////////////////////////////////////
+// The report goes to stdout so it can gate a build
+
+int gerber_explorer::check_clearance_headless(std::vector<std::string> const &args)
+{
+    LOG_CONTEXT("clearance", info);
+
+    double min_clearance = args.empty() ? 0.0 : atof(args[0].c_str());
+    if(args.size() < 2 || min_clearance <= 0) {
+        LOG_ERROR("Usage: gerber_explorer --check-clearance <mm> <copper and drill files...>");
+        return 1;
+    }
+
+    job_pool check_pool;
+    check_pool.start_workers(std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+    std::vector<gerber_lib::gerber_file> files(args.size() - 1);
+    std::vector<gerber_lib::gerber_error_code> errors(files.size());
+    job_pool::parallel_for(0, files.size(), 1, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; ++i) {
+            job_trace::stage trace("parse", args[i + 1]);
+            errors[i] = files[i].parse_file(args[i + 1].c_str());
+        }
+    });
+    bool failed = false;
+    for(size_t i = 0; i < files.size(); ++i) {
+        if(errors[i] != gerber_lib::ok) {
+            LOG_ERROR("Error loading {} ({})", args[i + 1], gerber_lib::get_error_text(errors[i]));
+            failed = true;
+        }
+    }
+    if(failed) {
+        return 1;
+    }
+
+    std::vector<clearance_input> inputs;
+    std::vector<std::string> copper_names;
+    for(auto &f : files) {
+        using namespace gerber_lib;
+        int t = f.layer_type;
+        bool copper = is_layer_type(t, layer::copper_top) || is_layer_type(t, layer::copper_inner) || is_layer_type(t, layer::copper_bottom);
+        bool drill = is_layer_type(t, layer::drill) || is_layer_type(t, layer::drill_top) || is_layer_type(t, layer::drill_bottom);
+        if(copper) {
+            copper_names.push_back(std::filesystem::path(f.filename).filename().string());
+        } else if(!drill || !gerber_3d::drill_file_is_plated(f)) {
+            LOG_INFO("{} isn't copper or plated drill, skipped", f.filename);
+            continue;
+        }
+        inputs.push_back({ &f, drill });
+    }
+    if(copper_names.empty()) {
+        LOG_ERROR("No copper layers to check");
+        return 1;
+    }
+
+    gerber_3d::clearance_result result = run_clearance_check(inputs, min_clearance, {}, nullptr);
+    for(auto const &v : result.violations) {
+        puts(std::format("violation {} {:.6f} {:.6f} {:.6f} {:.6f} {:.6f}", copper_names[v.layer], v.from.x, v.from.y, v.to.x, v.to.y, v.distance).c_str());
+    }
+    puts(std::format("layers {}\nnets {}\nviolations {}", copper_names.size(), result.num_nets, result.violations.size()).c_str());
+    check_pool.shut_down();
+    return result.violations.empty() ? 0 : 2;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Copper density per tile of each layer to CSV (one row per tile) or JSON,
+// the totals for each layer go to stdout
+
+namespace
+{
+    struct density_report
+    {
+        std::string name;
+        gerber::soft_density density;
+    };
+
+    bool save_density_csv(std::filesystem::path const &path, std::vector<density_report> const &reports)
+    {
+        std::ofstream out(path);
+        if(!out.good()) {
+            return false;
+        }
+        out << "layer,x,y,min_x,min_y,max_x,max_y,copper_area,board_area,fill_percent\n";
+        for(auto const &r : reports) {
+            gerber::soft_density const &d = r.density;
+            for(int y = 0; y < d.tiles_y; ++y) {
+                for(int x = 0; x < d.tiles_x; ++x) {
+                    size_t i = (size_t)y * d.tiles_x + x;
+                    rect t = d.tile_rect(x, y);
+                    out << std::format("{},{},{},{:.4f},{:.4f},{:.4f},{:.4f},{:.6f},{:.6f},{:.3f}\n",
+                                       r.name,
+                                       x,
+                                       y,
+                                       t.min_pos.x,
+                                       t.min_pos.y,
+                                       t.max_pos.x,
+                                       t.max_pos.y,
+                                       d.copper_area[i],
+                                       d.board_area[i],
+                                       d.fill(x, y) * 100);
+                }
+            }
+        }
+        return out.good();
+    }
+
+    bool save_density_json(std::filesystem::path const &path, std::vector<density_report> const &reports)
+    {
+        nlohmann::json json = nlohmann::json::array();
+        for(auto const &r : reports) {
+            gerber::soft_density const &d = r.density;
+            nlohmann::json fill = nlohmann::json::array();
+            for(int y = 0; y < d.tiles_y; ++y) {
+                nlohmann::json row = nlohmann::json::array();
+                for(int x = 0; x < d.tiles_x; ++x) {
+                    row.push_back(d.fill(x, y) * 100);
+                }
+                fill.push_back(std::move(row));
+            }
+            nlohmann::json layer;
+            layer["layer"] = r.name;
+            layer["origin_x"] = d.board_rect.min_pos.x;
+            layer["origin_y"] = d.board_rect.min_pos.y;
+            layer["tile_size"] = d.tile_size;
+            layer["tiles_x"] = d.tiles_x;
+            layer["tiles_y"] = d.tiles_y;
+            layer["copper_area"] = d.total_copper_area;
+            layer["board_area"] = d.total_board_area;
+            layer["fill_percent"] = d.total_fill() * 100;
+            layer["tile_copper_area"] = d.copper_area;
+            layer["tile_board_area"] = d.board_area;
+            layer["tile_fill_percent"] = std::move(fill);
+            json.push_back(std::move(layer));
+        }
+        std::ofstream out(path);
+        if(!out.good()) {
+            return false;
+        }
+        out << json.dump(4);
+        return out.good();
+    }
+
+}    // namespace
+
+//////////////////////////////////////////////////////////////////////
+// The tiles are rows from the bottom left of the board (the outline's
+// extent if there's an outline layer, else all the layers')
+
+int gerber_explorer::density_headless(std::vector<std::string> const &args)
+{
+    LOG_CONTEXT("density", info);
+
+    std::filesystem::path output;
+    double tile_size = 10;
+    uint32_t size = 4096;
+    std::vector<std::string> files;
+    for(size_t i = 0; i < args.size(); ++i) {
+        if(args[i] == "--tile" && i + 1 < args.size()) {
+            tile_size = atof(args[++i].c_str());
+        } else if(args[i] == "--size" && i + 1 < args.size()) {
+            size = (uint32_t)std::max(1, atoi(args[++i].c_str()));
+        } else if(output.empty()) {
+            output = args[i];
+        } else {
+            files.push_back(args[i]);
+        }
+    }
+    std::string ext = output.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    if(files.empty() || tile_size <= 0 || (ext != ".csv" && ext != ".json")) {
+        LOG_ERROR("Usage: gerber_explorer --density <output.csv|output.json> [--tile <mm>] [--size <pixels>] <gerber files...>");
+        return 1;
+    }
+
+    job_pool density_pool;
+    density_pool.start_workers(std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+    std::vector<std::unique_ptr<gerber_layer>> loaded(files.size());
+    job_pool::parallel_for(0, files.size(), 1, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; ++i) {
+            loaded[i] = load_headless_layer(files[i]);
+        }
+    });
+    gerber_layer *outline_layer{ nullptr };
+    std::vector<gerber_layer *> ordered;
+    rect board{ { FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX } };
+    for(auto &l : loaded) {
+        if(l == nullptr) {
+            return 1;
+        }
+        if(l->got_mask) {
+            if(outline_layer == nullptr) {
+                outline_layer = l.get();
+            }
+        } else {
+            ordered.push_back(l.get());
+        }
+        if(l->extent().is_normalized()) {
+            board = board.union_with(l->extent());
+        }
+    }
+    std::stable_sort(ordered.begin(), ordered.end(), [](gerber_layer const *a, gerber_layer const *b) { return a->index > b->index; });
+    if(outline_layer != nullptr) {
+        board = outline_layer->extent();
+    }
+    if(ordered.empty() || !board.is_normalized()) {
+        LOG_ERROR("Nothing to measure");
+        return 1;
+    }
+
+    std::vector<density_report> reports(ordered.size());
+    for(size_t i = 0; i < ordered.size(); ++i) {
+        gerber_layer *l = ordered[i];
+        reports[i].name = l->name;
+        reports[i].density = gerber::soft_copper_density(
+            { l->drawer, l->fill_color, l->invert }, board, tile_size, outline_layer != nullptr ? &outline_layer->mask : nullptr, size);
+        gerber::soft_density const &d = reports[i].density;
+        puts(std::format("layer {} copper {:.6f} board {:.6f} fill {:.3f}", l->name, d.total_copper_area, d.total_board_area, d.total_fill() * 100).c_str());
+    }
+    for(auto &l : loaded) {
+        l->drawer->release();
+        l->mask.release();
+    }
+    density_pool.shut_down();
+
+    bool saved = ext == ".csv" ? save_density_csv(output, reports) : save_density_json(output, reports);
+    if(!saved) {
+        LOG_ERROR("Can't write {}", output.string());
+        return 1;
+    }
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void gerber_explorer::ui()
+{
+    auto is_active = [] {
+        ImGuiIO &io = ImGui::GetIO();
+        if(io.Ctx->DimBgRatio != 0.0f && io.Ctx->DimBgRatio != 1.0f) {
+            return true;
+        }
+        if(io.MouseDelta.x != 0 || io.MouseDelta.y != 0) {
+            return true;
+        }
+        for(int i = 0; i < 5; ++i) {
+            if(io.MouseClicked[i] || io.MouseReleased[i]) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    if(is_active()) {
+        set_active();
+    }
+
+    ImGui::PushStyleVar(ImGuiStyleVar_WindowBorderSize, 0.0f);
+    if(ImGui::BeginMainMenuBar()) {
+        if(ImGui::BeginMenu("File")) {
+            if(ImGui::MenuItem("Open Layers", "Ctrl-O", nullptr)) {
+                file_open();
+            }
+            ImGui::Separator();
+            if(ImGui::MenuItem("Save Settings", "Ctrl-S", nullptr)) {
+                auto save_path = save_file_dialog("settings.json");
+                if(save_path.has_value()) {
+                    save_settings(save_path.value(), true);
+                }
+            }
+            if(ImGui::MenuItem("Load Settings", "Ctrl-L", nullptr)) {
+                auto load_path = load_file_dialog();
+                if(load_path.has_value()) {
+                    load_settings(load_path.value());
+                }
+            }
+            ImGui::Separator();
+            if(ImGui::BeginMenu("Job Trace")) {
+                if(ImGui::MenuItem("Record", nullptr, &settings.job_tracing)) {
+                    job_trace::enable(settings.job_tracing);
+                }
+                if(ImGui::MenuItem("Clear", nullptr, nullptr)) {
+                    job_trace::clear();
+                }
+                if(ImGui::MenuItem("Save Trace...", nullptr, nullptr)) {
+                    auto save_path = save_file_dialog("trace.json");
+                    if(save_path.has_value()) {
+                        job_trace::save(save_path.value());
+                    }
+                }
+                ImGui::EndMenu();
+            }
+            if(ImGui::MenuItem("Export PNG...", nullptr, nullptr)) {
+                auto save_path = save_file_dialog("board.png");
+                if(save_path.has_value()) {
+                    export_png(save_path.value());
+                }
+            }
+            if(ImGui::MenuItem("Export Board 3D...", nullptr, nullptr)) {
+                // 3MF keeps the layers as separate objects, OBJ does too
+                auto save_path = save_file_dialog("board.3mf");
+                if(save_path.has_value()) {
+                    export_board_stack(save_path.value());
+                }
+            }
+            ImGui::Separator();
+            if(ImGui::MenuItem("Check Clearance", nullptr, nullptr, !layers.empty())) {
+                check_clearance();
+            }
+            // ImGui::MenuItem("Stats", nullptr, &show_stats);
+            // ImGui::MenuItem("Options", nullptr, &show_options);
+            ImGui::Separator();
+            if(ImGui::MenuItem("Close all", nullptr, nullptr)) {
+                close_all_layers();
+            }
+            ImGui::Separator();
+            if(ImGui::MenuItem("Exit", "Esc", nullptr)) {
+                set_should_close();
+            }
+            ImGui::EndMenu();
+        }
+        if(ImGui::BeginMenu("View")) {
+            if(ImGui::MenuItem("Fit to window", "F", nullptr, !layers.empty())) {
+                fit_to_viewport();
+            }
+            ImGui::MenuItem("Flip X", "X", &settings.flip_x);
+            ImGui::MenuItem("Flip Y", "Y", &settings.flip_y);
+            ImGui::MenuItem("Toolbar", "", &settings.view_toolbar);
+
+            // Background color
+            ImVec2 pos = ImGui::GetCursorScreenPos();
+            if(ImGui::Selectable("Background", false, ImGuiSelectableFlags_DontClosePopups)) {
+                ImGui::OpenPopup("BackgroundColorPickerPopup");
+            }
+            float boxSize = ImGui::GetFontSize();
+            float posX = pos.x + ImGui::GetItemRectSize().x - boxSize - ImGui::GetStyle().ItemSpacing.x;
+            ImGui::SetCursorScreenPos(ImVec2(posX, pos.y));
+            ImGui::ColorButton("##bgcolor_btn",
+                               { settings.background_color.r, settings.background_color.g, settings.background_color.b, 1.0f },
+                               ImGuiColorEditFlags_NoAlpha,
+                               ImVec2(boxSize, boxSize));
+            if(ImGui::BeginPopup("BackgroundColorPickerPopup")) {
+                ImGui::ColorPicker3("##bgcolor_picker", (float *)settings.background_color, ImGuiColorEditFlags_NoAlpha);
+                ImGui::EndPopup();
+            }
+
+            ImGui::MenuItem("Wireframe", "W", &settings.wireframe);
+            ImGui::MenuItem("Show Axes", "A", &settings.show_axes);
+            ImGui::MenuItem("Show Extent", "E", &settings.show_extent);
+            ImGui::MenuItem("Copper Density", nullptr, &settings.show_density);
+            ImGui::MenuItem("Arena Stats", nullptr, &settings.show_arena_stats);
+            if(ImGui::BeginMenu("Units")) {
+                if(ImGui::MenuItem("MM", "", settings.units == settings::units_mm)) {
+                    settings.units = settings::units_mm;
+                    set_active_entity(active_entity);
+                }
+                if(ImGui::MenuItem("Inch", "", settings.units == settings::units_inch)) {
+                    settings.units = settings::units_inch;
+                    set_active_entity(active_entity);
+                }
+                ImGui::EndMenu();
+            }
+            if(ImGui::BeginMenu("Anti-Aliasing")) {
+                int msaa_options[] = { 1, 2, 4, 8 };
+                int num_options = 0;
+                for(int i = 0; i < 4; ++i) {
+                    if(msaa_options[i] <= max_multisamples) {
+                        num_options = i + 1;
+                    }
+                }
+                for(int i = 0; i < num_options; ++i) {
+                    char label[16];
+                    snprintf(label, sizeof(label), "%dx", msaa_options[i]);
+                    if(ImGui::MenuItem(label, "", settings.multisamples == msaa_options[i])) {
+                        settings.multisamples = msaa_options[i];
+                    }
+                }
+                ImGui::EndMenu();
+            }
+            if(ImGui::BeginMenu("Tesselation")) {
+                if(ImGui::Checkbox("Dynamic", &settings.dynamic_tesselation)) {
+                    if(settings.dynamic_tesselation) {
+                        last_tess_ppwu = 0;
+                    }
+                    retesselate = true;
+                }
+                if(ImGui::SliderInt("Quality",
+                                    &settings.tesselation_quality,
+                                    tesselation_quality::low,
+                                    tesselation_quality::high,
+                                    tesselation_quality_name(settings.tesselation_quality))) {
+                    retesselate = true;
+                }
+                if(ImGui::Checkbox("Compact vertices", &settings.compact_vertices)) {
+                    retesselate = true;
+                }
+                int delay_ms = static_cast<int>(settings.tesselation_delay * 1000.0f);
+                if(ImGui::SliderInt("Delay", &delay_ms, 20, 200, "%d ms")) {
+                    settings.tesselation_delay = delay_ms / 1000.0f;
+                }
+                ImGui::EndMenu();
+            }
+            if(ImGui::BeginMenu("Board 3D")) {
+                ImGui::SliderFloat("Board", &settings.board_thickness, 0.2f, 3.2f, "%.2f mm");
+                ImGui::SliderFloat("Copper", &settings.copper_thickness, 0.01f, 0.2f, "%.3f mm");
+                ImGui::SliderFloat("Soldermask", &settings.soldermask_thickness, 0.005f, 0.1f, "%.3f mm");
+                ImGui::SliderFloat("Silkscreen", &settings.silkscreen_thickness, 0.005f, 0.1f, "%.3f mm");
+                ImGui::SliderFloat("Plating", &settings.plating_thickness, 0.0f, 0.1f, "%.3f mm");
+                ImGui::SliderFloat("Decimate", &settings.decimation_tolerance, 0.0f, 0.01f, "%.4f mm");
+                ImGui::EndMenu();
+            }
+            if(ImGui::BeginMenu("Copper Density")) {
+                ImGui::SliderFloat("Tile", &settings.density_tile_size, 1.0f, 50.0f, "%.1f mm");
+                ImGui::EndMenu();
+            }
+            if(ImGui::BeginMenu("Clearance Check")) {
+                ImGui::SliderFloat("Minimum", &settings.drc_clearance, 0.05f, 1.0f, "%.3f mm");
+                ImGui::EndMenu();
+            }
+            if(ImGui::BeginMenu("Outline")) {
+                ImGui::SliderFloat("##val", &settings.outline_width, 0.0f, 8.0f, "%.1f");
+                ImGui::ColorEdit4("Outline color",
+                                  (float *)&settings.outline_color,
+                                  ImGuiColorEditFlags_AlphaPreview | ImGuiColorEditFlags_NoInputs | ImGuiColorEditFlags_AlphaBar);
+                ImGui::EndMenu();
+            }
+            ImGui::EndMenu();
+        }
+
+#if defined(_DEBUG)
+        static int frames = 0;
+        frames += 1;
+        std::string text = std::format("Frame {:07d} {:06.2f}ms {:06.2f}ms", frames, last_frame_elapsed_time * 1000.0, last_frame_cpu_time * 1000.0);
+        float text_width = ImGui::CalcTextSize(text.c_str()).x;
+        float posX = ImGui::GetWindowWidth() - text_width - ImGui::GetStyle().ItemSpacing.x;
+        ImGui::SetCursorPosX(posX);
+        ImGui::Text("%s", text.c_str());
+#endif
+        ImGui::EndMainMenuBar();
+    }
+    ImGui::PopStyleVar(1);
+
+    if(settings.view_toolbar) {
         ImGui::Begin("Toolbar", nullptr, ImGuiWindowFlags_NoDecoration);
         {
             if(ImGui::Button("Open " MATSYM_file_open)) {
@@ -1649,12 +2984,35 @@ void gerber_explorer::ui()
                             set_outline_layer(nullptr);
                         }
                     }
-                    if(ImGui::MenuItem("Export STL")) {
+                    if(ImGui::BeginMenu("Compare With")) {
+                        for(auto *other : layers) {
+                            if(other == l || !other->is_valid()) {
+                                continue;
+                            }
+                            ImGui::PushID(other);
+                            if(ImGui::BeginMenu(other->name.c_str())) {
+                                if(ImGui::MenuItem("Pixel Diff...")) {
+                                    auto save_path = save_file_dialog("diff.png");
+                                    if(save_path.has_value()) {
+                                        compare_layers(other, l, save_path.value());
+                                    }
+                                }
+                                if(ImGui::MenuItem("Exact XOR")) {
+                                    xor_layers(other, l);
+                                }
+                                ImGui::EndMenu();
+                            }
+                            ImGui::PopID();
+                        }
+                        ImGui::EndMenu();
+                    }
+                    if(ImGui::MenuItem("Export Mesh...")) {
+                        // STL unless they change the extension to .ply, .obj or .3mf
                         std::filesystem::path p(l->name);
                         p.replace_extension(".stl");
                         auto save_path = save_file_dialog(p.string().c_str());
                         if(save_path.has_value()) {
-                            export_stl(save_path.value(), l, board_extent);
+                            export_mesh(save_path.value(), l, board_extent);
                         }
                     }
                     ImGui::EndPopup();
@@ -1734,6 +3092,8 @@ void gerber_explorer::ui()
         if(item_to_delete) {
             set_active_entity(nullptr);
             select_layer(nullptr);
+            abort_layer_jobs(item_to_delete);
+            forget_nets(item_to_delete);
             if(item_to_delete->job_count.load() == 0) {
                 layers.erase(std::remove(layers.begin(), layers.end(), item_to_delete), layers.end());
                 delete item_to_delete;
@@ -1807,16 +3167,38 @@ void gerber_explorer::ui()
                 }
                 ImGui::EndTable();
             }
+            if(ImGui::Button("Select Net (N)")) {
+                select_net();
+            }
         } else if(selected_layer != nullptr) {
             char const *layer_type_name = gerber_lib::layer_type_name_friendly(selected_layer->layer_type());
             ImGui::Text("%s", selected_layer->name.c_str());
             ImGui::Text("%s, %zu entities", layer_type_name, selected_layer->drawer->entities.size());
+            if(settings.show_density) {
+                std::shared_ptr<gerber::soft_density const> density;
+                {
+                    std::lock_guard l(layer_drawer_mutex);
+                    density = selected_layer->density;
+                }
+                if(density != nullptr && !density->empty()) {
+                    ImGui::Text("Copper: %.2f of %.2f mm^2 (%.1f%%)", density->total_copper_area, density->total_board_area, density->total_fill() * 100);
+                    vec2d pos = board_pos_from_viewport_pos(mouse_pos).subtract(density->board_rect.min_pos);
+                    int x = (int)std::floor(pos.x / density->tile_size);
+                    int y = (int)std::floor(pos.y / density->tile_size);
+                    if(x >= 0 && x < density->tiles_x && y >= 0 && y < density->tiles_y) {
+                        ImGui::Text("Tile %d,%d: %.1f%%", x, y, density->fill(x, y) * 100);
+                    }
+                }
+            }
         } else {
             ImGui::Text("Select a layer...");
         }
     }
     ImGui::End();
 
+    cancellable_jobs_ui("Exports", export_jobs);
+    cancellable_jobs_ui("Checks", check_jobs);
+
     job_pool::pool_info info = pool.get_info();
 
 #ifdef _DEBUG
@@ -1826,6 +3208,19 @@ void gerber_explorer::ui()
     }
     ImGui::End();
 #endif
+
+    if(settings.show_arena_stats) {
+        ImGui::Begin("Arenas", &settings.show_arena_stats);
+        auto stats = gerber_lib::arena_pool::get().get_stats();
+        ImGui::Text("Blocks: %zu in use, %zu pooled (peak %zu)", stats.blocks_in_use, stats.blocks_pooled, stats.peak_blocks_in_use);
+        ImGui::Text("Committed: %zu MB (peak %zu MB)", stats.committed >> 20, stats.peak_committed >> 20);
+        ImGui::Text("Reserved: %zu MB (peak %zu MB)", stats.reserved >> 20, stats.peak_reserved >> 20);
+        ImGui::Text("Pooled: %zu MB, recycled %zu", stats.pooled >> 20, stats.recycled);
+        if(stats.commit_budget != 0) {
+            ImGui::Text("Budget: %zu MB, %zu failures", stats.commit_budget >> 20, stats.budget_failures);
+        }
+        ImGui::End();
+    }
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -1871,23 +3266,13 @@ void gerber_explorer::set_outline_layer(gerber_layer *new_outline_layer)
 {
     for(auto *l : layers) {
         if(l->is_outline_layer && l != new_outline_layer) {
+            // keep its mask, it's still valid if this layer becomes the outline again
             l->is_outline_layer = false;
-            l->got_mask = false;
-            l->drawer->got_mask = false;
-            l->gpu_resources.ready = false;
-            l->drawer->mask.release();
         }
     }
     if(new_outline_layer != nullptr) {
         new_outline_layer->is_outline_layer = true;
-        pool.add_job(job_type_create_mask, [new_outline_layer](std::stop_token st) {
-            new_outline_layer->job_count.fetch_add(1);
-            if(!st.stop_requested()) {
-                new_outline_layer->drawer->create_mask();
-                new_outline_layer->gpu_resources.ready = false;    // force GPU recreation with mask
-            }
-            new_outline_layer->job_count.fetch_sub(1);
-        });
+        create_layer_mask(new_outline_layer);
     }
 }
 
@@ -1904,31 +3289,34 @@ void gerber_explorer::on_render()
         io.ConfigFlags &= ~ImGuiConfigFlags_NoMouseCursorChange;
     }
 
-    // gather up any layers which finished loading
-    // if we just got the last one loaded, fit to viewport
-    {
-        std::lock_guard _(loaded_mutex);
-        if(!loaded_layers.empty()) {
-            gerber_layer *loaded_layer = loaded_layers.front();
-            loaded_layers.pop_front();
-            layers.push_front(loaded_layer);
-
-            // Auto-detect outline layer (only if none exists)
-            if(get_outline_layer() == nullptr) {
-                auto layer_type = loaded_layer->layer_type();
-                if(gerber_lib::is_layer_type(layer_type, gerber_lib::layer::type_t::board) ||
-                   gerber_lib::is_layer_type(layer_type, gerber_lib::layer::type_t::outline)) {
-                    set_outline_layer(loaded_layer);
-                }
-            }
-
-            layers.sort([](gerber_layer const *a, gerber_layer const *b) { return a->index > b->index; });
-            LOG_VERBOSE("Loaded layer \"{}\"", loaded_layer->filename());
-            if(loaded_layers.empty()) {
-                select_layer(nullptr);
-                fit_to_viewport();
+    // gather up any layers which finished loading, fit to viewport once the last one is in
+    gerber_layer *loaded_layer = take_loaded_layers();
+    bool got_layers = loaded_layer != nullptr;
+    while(loaded_layer != nullptr) {
+        gerber_layer *next = loaded_layer->next_loaded;
+        loaded_layer->next_loaded = nullptr;
+        layers.push_front(loaded_layer);
+        pending_loads.fetch_sub(1);
+
+        // Auto-detect outline layer (only if none exists)
+        if(get_outline_layer() == nullptr) {
+            auto layer_type = loaded_layer->layer_type();
+            if(gerber_lib::is_layer_type(layer_type, gerber_lib::layer::type_t::board) ||
+               gerber_lib::is_layer_type(layer_type, gerber_lib::layer::type_t::outline)) {
+                set_outline_layer(loaded_layer);
             }
         }
+        LOG_VERBOSE("Loaded layer \"{}\"", loaded_layer->filename());
+        loaded_layer = next;
+    }
+    if(got_layers) {
+        layers.sort([](gerber_layer const *a, gerber_layer const *b) { return a->index > b->index; });
+        fit_after_load = true;
+    }
+    if(fit_after_load && pending_loads.load() == 0) {
+        fit_after_load = false;
+        select_layer(nullptr);
+        fit_to_viewport();
     }
 
     // delete layers whose jobs have finished
@@ -1940,6 +3328,12 @@ void gerber_explorer::on_render()
         return false;
     });
 
+    update_density();
+    update_nets();
+
+    // nothing else gives the pooled arena blocks back while the app is idle
+    gerber_lib::arena_pool::get().trim_idle();
+
     ImGuiID dockspace_id = ImGui::DockSpaceOverViewport(0, ImGui::GetMainViewport(), ImGuiDockNodeFlags_PassthruCentralNode);
 
     // On first run (no imgui.ini), set up a default docking layout
@@ -2052,8 +3446,7 @@ void gerber_explorer::on_render()
     if(retesselate) {
         retesselate = false;
         pool.abort_jobs(job_type_tesselate);
-        // busy-wait for explicit changes (user expects immediate result)
-        while(pool.get_info().active != 0) {}
+        // non-blocking like the dynamic path, the old drawers stay visible until the new ones are ready
         double ppwu = settings.dynamic_tesselation ? std::min(scale.x, scale.y) : 0;
         for(auto l : layers) {
             if(l->marked_for_deletion) continue;
@@ -2137,7 +3530,6 @@ void gerber_explorer::on_render()
         for(auto &layer : layers) {
             gerber_drawer *old_drawer = layer->drawer;
             layer->drawer = &layer->drawers[layer->current_drawer];
-            layer->got_mask = layer->drawer->got_mask;
             if(layer->drawer != old_drawer) {
                 layer->gpu_resources.ready = false;
             }
@@ -2161,25 +3553,7 @@ void gerber_explorer::on_render()
     }
 
     // 2. sort them, based on current view mode
-    if(settings.board_view != board_view_all) {
-        std::sort(ordered_layers.begin(), ordered_layers.end(), [this](gerber_layer const *a, gerber_layer const *b) {
-            using namespace gerber_lib;
-            layer::type_t drill_ordered = layer::type_t::drill_top;
-            if(settings.board_view == board_view_bottom) {
-                drill_ordered = layer::type_t::drill_bottom;
-                std::swap(a, b);
-            }
-            int ta = a->file.layer_type;
-            int tb = b->file.layer_type;
-            if(is_layer_type(ta, layer::type_t::drill)) {
-                ta = drill_ordered;
-            }
-            if(is_layer_type(tb, layer::type_t::drill)) {
-                tb = drill_ordered;
-            }
-            return ta > tb;
-        });
-    }
+    sort_layers_for_view(ordered_layers);
 
     double t = get_time();
 
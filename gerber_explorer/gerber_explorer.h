@@ -10,8 +10,10 @@
 #include "gpu_base.h"
 #include "gpu_drawer.h"
 #include "gerber_drawer.h"
+#include "soft_render.h"
 
 #include "job_pool.h"
+#include "job_trace.h"
 
 #include "settings.h"
 
@@ -53,6 +55,12 @@ struct gerber_layer
     {
         drawers[0].init(this);
         drawers[1].init(this);
+        mask.init();
+    }
+
+    ~gerber_layer()
+    {
+        job_trace::forget_group(this);
     }
 
     // have two gerber_drawer instances and a pointer to one of them
@@ -67,8 +75,12 @@ struct gerber_layer
     gerber_lib::gerber_file file;
 
     std::atomic<int> job_count{0};
+    gerber_layer *next_loaded{};    // link in gerber_explorer::loaded_layers
     bool marked_for_deletion{false};
-    bool retesselating{false};    // protected by gerber_explorer::layer_drawer_mutex
+
+    // retesselation: the newest request's generation wins, older results are dropped
+    std::atomic<uint32_t> tess_generation{ 0 };
+    job_pool::job_handle tess_job{};    // the last one queued, the next waits for it (main thread only)
 
     int index;
     bool visible{ true };
@@ -77,7 +89,19 @@ struct gerber_layer
     bool is_outline_layer{ false };
     int alpha{ 255 };
 
-    bool got_mask{false};
+    // board outline mask, built once from the parsed file (at fixed quality) the first
+    // time this becomes the outline layer and kept for the life of the layer
+    gerber::solid_shape mask{};
+    std::atomic<bool> mask_requested{ false };    // claimed by whoever builds it
+    std::atomic<bool> got_mask{ false };          // mask is complete and won't change
+
+    // copper density for the heatmap, made in the background from the parsed file
+    // (see update_density), the newest request's generation wins
+    std::shared_ptr<gerber::soft_density const> density;    // under layer_drawer_mutex
+    std::atomic<uint32_t> density_generation{ 0 };
+    float density_tile_size{};                   // of the last request (main thread only)
+    gerber_layer const *density_outline{};       // and the outline it was clipped to
+    bool density_invert{};                       // and whether the layer was inverted
 
     std::string name;
     layer_order_t layer_order{ layer_order_t::all };
@@ -142,6 +166,9 @@ struct gerber_explorer : gpu_window
         job_type_tesselate = 2,
         job_type_create_mask = 4,
         job_type_export = 8,
+        job_type_density = 16,
+        job_type_check = 32,
+        job_type_nets = 64,
     };
 
     gerber::tesselation_quality_t tesselate_quality{ gerber::tesselation_quality::medium };
@@ -221,6 +248,7 @@ struct gerber_explorer : gpu_window
 
     void gpu_render();
     void gpu_render_layer(SDL_GPUCommandBuffer *cmd, gerber_layer &layer, gerber_layer *outline_layer);
+    void gpu_draw_layer_fill(SDL_GPUCommandBuffer *cmd, SDL_GPURenderPass *pass, gerber::gpu_drawer_resources const &res, int draw_flags, bool wireframe);
     void gpu_render_selection(SDL_GPUCommandBuffer *cmd, SDL_GPUTexture *swapchain_texture);
     void gpu_render_overlay(SDL_GPUCommandBuffer *cmd, SDL_GPUTexture *swapchain_texture);
     void on_gpu_imgui() override;
@@ -246,6 +274,34 @@ struct gerber_explorer : gpu_window
 
     std::mutex layer_drawer_mutex;
 
+    // copper nets of a set of layers, made in the background from the parsed
+    // files (see select_net) and kept until the set changes
+    struct net_cache;
+    std::shared_ptr<net_cache const> nets;             // under layer_drawer_mutex
+    std::atomic<uint32_t> nets_generation{ 0 };        // the newest request's generation wins
+    std::vector<gerber_layer *> nets_requested;        // layers of the last request (main thread only)
+    bool select_net_pending{ false };                  // select the net when they come in (main thread only)
+
+    // exports and checks in flight, shown with a progress bar and a cancel button.
+    // Cancel stops the job's own stop_source rather than aborting it in the pool
+    // so it always runs and gets to tidy up (job counts, partly written files)
+    struct cancellable_job
+    {
+        std::string name;
+        std::stop_source stop;
+        job_progress progress;
+        std::atomic<bool> done{ false };
+    };
+
+    using cancellable_jobs = std::list<std::shared_ptr<cancellable_job>>;
+
+    cancellable_jobs export_jobs;
+    cancellable_jobs check_jobs;
+
+    std::shared_ptr<cancellable_job> add_export_job(std::string name);
+    std::shared_ptr<cancellable_job> add_check_job(std::string name);
+    void cancellable_jobs_ui(char const *title, cancellable_jobs &jobs);
+
     bool retesselate{ false };
 
     double last_tess_ppwu{0};               // pixels_per_world_unit used for last tesselation
@@ -261,13 +317,39 @@ struct gerber_explorer : gpu_window
 
     void tesselate_layer(gerber_layer *layer, tesselation_options_t options = tesselation_options_none, double pixels_per_world_unit = 0);
 
-    std::list<gerber_layer *> loaded_layers;
-    std::mutex loaded_mutex;
+    job_pool::job_handle create_layer_mask(gerber_layer *layer);
+
+    // most recent outline mask job, inverted layers wait for it before they're published.
+    // Loads queue it from the workers and set_outline_layer from the main thread
+    std::mutex outline_mask_mutex;
+    job_pool::job_handle outline_mask_job{};    // under outline_mask_mutex
+
+    // finished layers waiting for the main thread - a lock-free stack (newest first,
+    // linked through gerber_layer::next_loaded) which the main thread takes in one go
+    std::atomic<gerber_layer *> loaded_layers{ nullptr };
+    std::atomic<int> pending_loads{ 0 };    // from add_gerber until the main thread takes it (or it fails)
+    bool fit_after_load{ false };
+
+    void publish_loaded_layer(gerber_layer *layer);
+    gerber_layer *take_loaded_layers();
 
     settings_t settings;
 
     void set_active_entity(gerber::tesselator_entity *entity);
 
+    // select everything connected to the active entity on the visible copper
+    // layers, through the plated drill layers
+    void select_net();
+
+    // do the select_net which was waiting for its nets if they've come in
+    void update_nets();
+
+    // drop the nets if they were made with a layer which is going away
+    void forget_nets(gerber_layer const *layer);
+
+    // queue the density of the selected layer if the heatmap is on and it's out of date
+    void update_density();
+
     void update_board_extent();
 
     // -1 or 1 for each x,y based on settings.flip_x/y
@@ -301,6 +383,7 @@ struct gerber_explorer : gpu_window
     void update_view_rect();
 
     bool layer_is_visible(gerber_layer const *layer) const;
+    void sort_layers_for_view(std::vector<gerber_layer *> &ordered_layers) const;
     void next_view();
 
     void add_gerber(settings::layer_t const &layer);
@@ -310,6 +393,7 @@ struct gerber_explorer : gpu_window
     void file_open();
 
     void close_all_layers();
+    void abort_layer_jobs(gerber_layer *l);
 
     static std::expected<std::filesystem::path, std::error_code> save_file_dialog(char const *filename);
     static std::expected<std::filesystem::path, std::error_code> load_file_dialog();
@@ -317,7 +401,28 @@ struct gerber_explorer : gpu_window
     void save_settings(std::filesystem::path const &path, bool save_files);
     void load_settings(std::filesystem::path const &path);
 
-    void export_stl(std::filesystem::path filepath, gerber_layer *l, rect board_ext);
+    void export_mesh(std::filesystem::path filepath, gerber_layer *l, rect board_ext);
+    void export_png(std::filesystem::path filepath);
+    void export_board_stack(std::filesystem::path filepath);
+
+    // gerber_explorer --export-png out.png [--size pixels] files...
+    static int export_png_headless(std::vector<std::string> const &args);
+
+    void compare_layers(gerber_layer *before, gerber_layer *after, std::filesystem::path diff_path);
+    void xor_layers(gerber_layer *before, gerber_layer *after);
+
+    // gerber_explorer --compare before after diff.png [--size pixels] [--exact]
+    // exit code is 0 if they're the same, 2 if not, 1 for errors
+    static int compare_headless(std::vector<std::string> const &args);
+
+    void check_clearance();
+
+    // gerber_explorer --check-clearance mm files...
+    // exit code is 0 if nothing's too close, 2 if something is, 1 for errors
+    static int check_clearance_headless(std::vector<std::string> const &args);
+
+    // gerber_explorer --density out.csv|out.json [--tile mm] [--size pixels] files...
+    static int density_headless(std::vector<std::string> const &args);
 
     void on_window_size(int w, int h) override;
     void on_window_refresh() override;
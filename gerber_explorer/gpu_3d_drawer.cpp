@@ -5,13 +5,22 @@
 #include "gerber_explorer.h"
 #include "gerber_lib.h"
 #include "gerber_net.h"
+#include "gerber_aperture.h"
 #include "gerber_math.h"
+#include "gerber_flatten.h"
+#include "gerber_drawer.h"
 
 #include "tesselator.h"
 
+#include "job_pool.h"
+#include "spatial_grid.h"
+
 #include <cmath>
 #include <algorithm>
+#include <atomic>
 #include <limits>
+#include <map>
+#include <tuple>
 
 LOG_CONTEXT("gpu_3d_drawer", info);
 
@@ -25,11 +34,6 @@ namespace gerber_3d
 
     namespace
     {
-        struct vec2f
-        {
-            float x, y;
-        };
-
         bool is_clockwise(std::vector<vec2f> const &points, size_t start, size_t end)
         {
             double sum = 0;
@@ -40,6 +44,225 @@ namespace gerber_3d
             }
             return sum < 0;
         }
+
+        //////////////////////////////////////////////////////////////////////
+        // Part of a union in progress and the bounds of it
+
+        struct partial_union
+        {
+            Clipper2Lib::Paths64 paths;
+            Clipper2Lib::Rect64 bounds{ INT64_MAX, INT64_MAX, INT64_MIN, INT64_MIN };
+        };
+
+        size_t constexpr union_leaf_size = 1024;
+
+        //////////////////////////////////////////////////////////////////////
+        // If the bounds don't overlap the union is just the two sets of paths,
+        // so shapes which are far apart never go through Clipper together
+
+        partial_union merge_unions(partial_union &&a, partial_union &&b)
+        {
+            using namespace Clipper2Lib;
+
+            if(b.paths.empty()) {
+                return std::move(a);
+            }
+            if(a.paths.empty()) {
+                return std::move(b);
+            }
+            partial_union r;
+            r.bounds = { std::min(a.bounds.left, b.bounds.left),
+                         std::min(a.bounds.top, b.bounds.top),
+                         std::max(a.bounds.right, b.bounds.right),
+                         std::max(a.bounds.bottom, b.bounds.bottom) };
+            bool apart = a.bounds.right < b.bounds.left || b.bounds.right < a.bounds.left || a.bounds.bottom < b.bounds.top || b.bounds.bottom < a.bounds.top;
+            if(apart) {
+                r.paths = std::move(a.paths);
+                r.paths.insert(r.paths.end(), std::make_move_iterator(b.paths.begin()), std::make_move_iterator(b.paths.end()));
+            } else {
+                Clipper64 clipper;
+                clipper.AddSubject(a.paths);
+                clipper.AddSubject(b.paths);
+                clipper.Execute(ClipType::Union, FillRule::NonZero, r.paths);
+            }
+            return r;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // Union of a batch of separate contours as a tree reduction over the job_pool.
+        // With spatial_bucketing the contours are sorted along a Morton curve first so
+        // each leaf (and each merge above it) covers a compact area of the board
+
+        Clipper2Lib::Paths64 parallel_union(Clipper2Lib::Paths64 &&batch, bool spatial_bucketing, std::stop_token const &stop_token)
+        {
+            using namespace Clipper2Lib;
+
+            if(batch.size() <= union_leaf_size) {
+                Clipper64 clipper;
+                clipper.AddSubject(batch);
+                Paths64 result;
+                clipper.Execute(ClipType::Union, FillRule::NonZero, result);
+                return result;
+            }
+
+            std::vector<Rect64> bounds(batch.size());
+            job_pool::parallel_for(0, batch.size(), 4096, [&](size_t b, size_t e) {
+                for(size_t i = b; i < e; ++i) {
+                    bounds[i] = GetBounds(batch[i]);
+                }
+            });
+
+            std::vector<uint32_t> order(batch.size());
+            for(uint32_t i = 0; i < (uint32_t)order.size(); ++i) {
+                order[i] = i;
+            }
+            if(spatial_bucketing) {
+                Rect64 all{ INT64_MAX, INT64_MAX, INT64_MIN, INT64_MIN };
+                for(auto const &b : bounds) {
+                    all = { std::min(all.left, b.left), std::min(all.top, b.top), std::max(all.right, b.right), std::max(all.bottom, b.bottom) };
+                }
+                double sx = 65535.0 / std::max<double>(1.0, (double)all.right - all.left);
+                double sy = 65535.0 / std::max<double>(1.0, (double)all.bottom - all.top);
+                auto spread = [](uint32_t v) {
+                    v = (v | (v << 8)) & 0x00ff00ff;
+                    v = (v | (v << 4)) & 0x0f0f0f0f;
+                    v = (v | (v << 2)) & 0x33333333;
+                    v = (v | (v << 1)) & 0x55555555;
+                    return v;
+                };
+                std::vector<uint32_t> keys(batch.size());
+                job_pool::parallel_for(0, batch.size(), 4096, [&](size_t b, size_t e) {
+                    for(size_t i = b; i < e; ++i) {
+                        double cx = ((double)bounds[i].left + bounds[i].right) * 0.5 - all.left;
+                        double cy = ((double)bounds[i].top + bounds[i].bottom) * 0.5 - all.top;
+                        keys[i] = spread((uint32_t)(cx * sx)) | (spread((uint32_t)(cy * sy)) << 1);
+                    }
+                });
+                std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+            }
+
+            // leaves
+            size_t num_leaves = (batch.size() + union_leaf_size - 1) / union_leaf_size;
+            std::vector<partial_union> level(num_leaves);
+            job_pool::parallel_for(0, num_leaves, 1, [&](size_t b, size_t e) {
+                for(size_t leaf = b; leaf < e && !stop_token.stop_requested(); ++leaf) {
+                    size_t first = leaf * union_leaf_size;
+                    size_t last = std::min(first + union_leaf_size, batch.size());
+                    partial_union &p = level[leaf];
+                    Paths64 paths;
+                    paths.reserve(last - first);
+                    for(size_t i = first; i < last; ++i) {
+                        Rect64 const &r = bounds[order[i]];
+                        p.bounds = { std::min(p.bounds.left, r.left), std::min(p.bounds.top, r.top), std::max(p.bounds.right, r.right), std::max(p.bounds.bottom, r.bottom) };
+                        paths.push_back(std::move(batch[order[i]]));
+                    }
+                    Clipper64 clipper;
+                    clipper.AddSubject(paths);
+                    clipper.Execute(ClipType::Union, FillRule::NonZero, p.paths);
+                }
+            });
+            batch.clear();
+
+            // merge neighbours pairwise until there's one left
+            while(level.size() > 1 && !stop_token.stop_requested()) {
+                size_t pairs = level.size() / 2;
+                std::vector<partial_union> next((level.size() + 1) / 2);
+                job_pool::parallel_for(0, pairs, 1, [&](size_t b, size_t e) {
+                    for(size_t i = b; i < e; ++i) {
+                        next[i] = merge_unions(std::move(level[i * 2]), std::move(level[i * 2 + 1]));
+                    }
+                });
+                if((level.size() & 1) != 0) {
+                    next.back() = std::move(level.back());
+                }
+                level = std::move(next);
+            }
+            return std::move(level[0].paths);
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // libtess needs a lot less than tess_bytes_per_point for each contour point
+        // of a polygon, so a chunk of outers which are all up to small_tess_points
+        // shares a small reserve instead of the full size one
+
+        using small_tess_arena = gerber::basic_tess_arena<64ULL << 20>;
+
+        size_t constexpr tess_bytes_per_point = 1024;
+        size_t constexpr small_tess_points = (64ULL << 20) / tess_bytes_per_point;
+
+        size_t polygon_points(Clipper2Lib::PolyPath64 const &outer)
+        {
+            size_t points = outer.Polygon().size();
+            for(auto const &hole : outer) {
+                points += hole->Polygon().size();
+            }
+            return points;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // The outers below node in the order the recursive walk would visit
+        // them: each one, then the islands in its holes
+
+        void collect_outers(Clipper2Lib::PolyPath64 const &node, std::vector<Clipper2Lib::PolyPath64 const *> &outers)
+        {
+            for(auto const &child : node) {
+                outers.push_back(child.get());
+                for(auto const &hole : *child) {
+                    collect_outers(*hole, outers);
+                }
+            }
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // segments which don't cross are closest at an end of one of them
+
+        double point_segment_distance_sq(Clipper2Lib::Point64 const &p, Clipper2Lib::Point64 const &a, Clipper2Lib::Point64 const &b)
+        {
+            double dx = static_cast<double>(b.x - a.x);
+            double dy = static_cast<double>(b.y - a.y);
+            double len_sq = dx * dx + dy * dy;
+            double t = len_sq > 0 ? std::clamp(((p.x - a.x) * dx + (p.y - a.y) * dy) / len_sq, 0.0, 1.0) : 0.0;
+            double qx = p.x - (a.x + t * dx);
+            double qy = p.y - (a.y + t * dy);
+            return qx * qx + qy * qy;
+        }
+
+        double segment_distance_sq(contour_grid::edge const &p, contour_grid::edge const &q)
+        {
+            return std::min({ point_segment_distance_sq(p.a, q.a, q.b),
+                              point_segment_distance_sq(p.b, q.a, q.b),
+                              point_segment_distance_sq(q.a, p.a, p.b),
+                              point_segment_distance_sq(q.b, p.a, p.b) });
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // How close the contours of one polygon get to each other, or limit if they're
+        // all further apart than that. Edges closer than limit have grown boxes which
+        // overlap so they share a cell
+
+        double contour_gap(Clipper2Lib::Paths64 const &contours, double limit)
+        {
+            std::vector<Clipper2Lib::Path64 const *> paths;
+            paths.reserve(contours.size());
+            for(auto const &contour : contours) {
+                paths.push_back(&contour);
+            }
+            contour_grid grid;
+            grid.build(paths, 8, 1024, limit / 2, limit);
+            double gap_sq = limit * limit;
+            for(size_t c = 0; c < grid.grid.num_cells(); ++c) {
+                std::span<contour_grid::edge const> edges = grid.cell(c);
+                for(size_t i = 0; i < edges.size(); ++i) {
+                    for(size_t j = i + 1; j < edges.size(); ++j) {
+                        if(edges[i].contour != edges[j].contour) {
+                            gap_sq = std::min(gap_sq, segment_distance_sq(edges[i], edges[j]));
+                        }
+                    }
+                }
+            }
+            return std::sqrt(gap_sq);
+        }
+
     }    // namespace
 
     //////////////////////////////////////////////////////////////////////
@@ -77,11 +300,124 @@ namespace gerber_3d
 
     //////////////////////////////////////////////////////////////////////
 
+    bool gpu_3d_drawer::give_up()
+    {
+        if(!stopped()) {
+            return false;
+        }
+        LOG_INFO("Stopped, releasing");
+        release();
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
     void gpu_3d_drawer::set_gerber(gerber_file *g)
     {
         clear();
-        g->draw(*this);
+
+        // drawing is about a third of the time, the union the rest
+        nets_total = g->image.nets.size();
+        nets_drawn = 0;
+        progress_range(0.0f, 0.3f);
+        if(g->draw(*this) == error_cancelled) {
+            give_up();
+            progress_range(0.0f, 1.0f);
+            return;
+        }
+        progress_range(0.3f, 1.0f);
         resolve_2d();
+        progress_range(0.0f, 1.0f);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void gpu_3d_drawer::set_drill_file(gerber_file const *g)
+    {
+        clear();
+
+        double const max_deviation = mesh_arc_deviation_mm[tesselation_quality];
+
+        // every hole from a tool is the same circle, so work out the points once
+        struct tool_circle
+        {
+            double radius;
+            std::vector<vec2d> points;    // around the origin, counter-clockwise
+        };
+        std::map<int, tool_circle> circles;
+
+        auto get_circle = [&](int tool) -> tool_circle const * {
+            auto found = circles.find(tool);
+            if(found != circles.end()) {
+                return &found->second;
+            }
+            auto aperture = g->image.apertures.find(tool);
+            if(aperture == g->image.apertures.end() || aperture->second->parameters.empty()) {
+                return nullptr;
+            }
+            tool_circle &c = circles[tool];
+            c.radius = aperture->second->parameters[0] / 2.0;
+            // an even number so a capsule can use half of it at each end
+            int segments = (arc_segment_count(c.radius, 0, 360, max_deviation) + 1) & ~1;
+            c.points.resize(segments);
+            for(int i = 0; i < segments; ++i) {
+                double a = deg_2_rad(i * 360.0 / segments);
+                c.points[i] = { cos(a) * c.radius, sin(a) * c.radius };
+            }
+            return &c;
+        };
+
+        auto to_point = [](double x, double y) { return Clipper2Lib::Point64(static_cast<int64_t>(x * CLIPPER_SCALE), static_cast<int64_t>(y * CLIPPER_SCALE)); };
+
+        size_t num_nets = 0;
+        for(gerber_net const *net : g->image.nets) {
+            if((++num_nets & 1023) == 0) {
+                if(give_up()) {
+                    return;
+                }
+                report_progress(0.2f * num_nets / g->image.nets.size());
+            }
+            if(net->aperture_state != aperture_state_flash && net->aperture_state != aperture_state_on) {
+                continue;
+            }
+            tool_circle const *c = get_circle(net->aperture);
+            if(c == nullptr || c->radius <= 0) {
+                continue;
+            }
+            size_t n = c->points.size();
+            Clipper2Lib::Path64 path;
+
+            double dx = net->end.x - net->start.x;
+            double dy = net->end.y - net->start.y;
+            if(net->aperture_state == aperture_state_flash || (dx * dx + dy * dy) < 1e-12) {
+                path.reserve(n);
+                for(auto const &p : c->points) {
+                    path.push_back(to_point(net->start.x + p.x, net->start.y + p.y));
+                }
+            } else {
+                // slot: half a circle around each end, rotated to face along the slot
+                double a = atan2(dy, dx) - deg_2_rad(90);
+                double ca = cos(a);
+                double sa = sin(a);
+                path.reserve(n + 2);
+                for(size_t i = 0; i <= n / 2; ++i) {
+                    vec2d const &p = c->points[i];
+                    path.push_back(to_point(net->end.x + p.x * ca - p.y * sa, net->end.y + p.x * sa + p.y * ca));
+                }
+                for(size_t i = n / 2; i <= n; ++i) {
+                    vec2d const &p = c->points[i % n];
+                    path.push_back(to_point(net->start.x + p.x * ca - p.y * sa, net->start.y + p.x * sa + p.y * ca));
+                }
+            }
+            pending_contours.push_back({ std::move(path), polarity_dark });
+        }
+
+        LOG_INFO("set_drill_file: {} holes from {} tools", pending_contours.size(), circles.size());
+
+        // holes can overlap (slots which cross, the same hole twice) so they still get unioned
+        progress_range(0.2f, 1.0f);
+        resolve_2d();
+        progress_range(0.0f, 1.0f);
     }
 
     //////////////////////////////////////////////////////////////////////
@@ -90,9 +426,16 @@ namespace gerber_3d
     {
         double constexpr THRESHOLD = 1e-38;
 
-        // max chord deviation in mm per quality level
-        double constexpr DEVIATION_MM[tesselation_quality::num_qualities] = { 0.01, 0.005, 0.001 };
-        double const max_deviation = DEVIATION_MM[tesselation_quality];
+        if(stopped()) {
+            return error_cancelled;
+        }
+
+        // not quite one call per net (macros have several parts) but near enough
+        if((++nets_drawn & 255) == 0 && nets_total != 0) {
+            report_progress(std::min(1.0f, static_cast<float>(nets_drawn) / nets_total));
+        }
+
+        double const max_deviation = mesh_arc_deviation_mm[tesselation_quality];
 
         std::vector<vec2f> temp_points;
 
@@ -102,13 +445,6 @@ namespace gerber_3d
             }
         };
 
-        auto add_arc_point = [&](gerber_draw_element const &element, double t) {
-            double radians = deg_2_rad(t);
-            double x = cos(radians) * element.arc.radius + element.arc.center.x;
-            double y = sin(radians) * element.arc.radius + element.arc.center.y;
-            add_point(x, y);
-        };
-
         for(size_t n = 0; n < num_elements; ++n) {
 
             gerber_draw_element const &element = elements[n];
@@ -120,41 +456,13 @@ namespace gerber_3d
                 break;
 
             case draw_element_arc: {
-                double start = element.arc.start_degrees;
-                double end = element.arc.end_degrees;
-                double arc_span = fabs(end - start);
-
-                // compute step size from deviation limit: sagitta = r * (1 - cos(theta/2))
-                // solve for theta: theta = 2 * acos(1 - deviation / r)
-                double arc_degrees;
-                double r = element.arc.radius;
-                if(r > max_deviation) {
-                    arc_degrees = 2.0 * rad_2_deg(acos(1.0 - max_deviation / r));
-                } else {
-                    arc_degrees = arc_span;
-                }
-
-                // ensure at least one interim point
-                if(arc_degrees > arc_span * 0.5) {
-                    arc_degrees = arc_span * 0.5;
-                }
-
-                double final_angle = end;
-
-                if(start < end) {
-                    for(double t = start; t < end; t += arc_degrees) {
-                        add_arc_point(element, t);
-                        final_angle = t;
-                    }
-                } else {
-                    for(double t = start; t > end; t -= arc_degrees) {
-                        add_arc_point(element, t);
-                        final_angle = t;
-                    }
-                }
-                if(final_angle != end) {
-                    add_arc_point(element, end);
-                }
+                auto const &arc = element.arc;
+                int segments = arc_segment_count(arc.radius, arc.start_degrees, arc.end_degrees, max_deviation);
+                size_t at = temp_points.size();
+                temp_points.resize(at + segments + 1);
+                std::span<vec2f> points(temp_points.data() + at, segments + 1);
+                vec2f const *previous = at != 0 ? &temp_points[at - 1] : nullptr;
+                temp_points.resize(at + flatten_arc(arc.center, arc.radius, arc.start_degrees, arc.end_degrees, segments, points, previous));
             } break;
             }
         }
@@ -199,9 +507,17 @@ namespace gerber_3d
 
         Paths64 result;
 
+        // each batch is unioned on its own in parallel, then folded into the result
+        // in order, so clear batches still only cut what came before them
+
         size_t i = 0;
         while(i < pending_contours.size()) {
 
+            if(give_up()) {
+                return;
+            }
+            report_progress(0.9f * i / pending_contours.size());
+
             auto current_polarity = pending_contours[i].polarity;
 
             // batch consecutive contours with same polarity
@@ -211,21 +527,24 @@ namespace gerber_3d
                 i++;
             }
 
-            bool should_fill = current_polarity == polarity_dark || current_polarity == polarity_negative;
+            bool is_clear = current_polarity == polarity_clear;
 
-            if(result.empty() && should_fill) {
-                // first batch of additive material: just union them
-                Clipper64 clipper;
-                clipper.AddSubject(batch);
-                Paths64 temp;
-                clipper.Execute(ClipType::Union, FillRule::NonZero, temp);
-                result = std::move(temp);
-            } else if(!batch.empty()) {
+            // nothing to clear from yet
+            if(result.empty() && is_clear) {
+                continue;
+            }
+
+            Paths64 batch_union = parallel_union(std::move(batch), spatial_bucketing, stop_token);
+
+            if(result.empty()) {
+                // first batch of additive material
+                result = std::move(batch_union);
+            } else if(!batch_union.empty()) {
                 Clipper64 clipper;
                 clipper.AddSubject(result);
-                clipper.AddClip(batch);
+                clipper.AddClip(batch_union);
 
-                ClipType op = (current_polarity == polarity_clear) ? ClipType::Difference : ClipType::Union;
+                ClipType op = is_clear ? ClipType::Difference : ClipType::Union;
 
                 Paths64 temp;
                 clipper.Execute(op, FillRule::NonZero, temp);
@@ -233,6 +552,11 @@ namespace gerber_3d
             }
         }
 
+        if(give_up()) {
+            return;
+        }
+        report_progress(0.9f);
+
         // final pass to get PolyTree with outer/hole hierarchy
         {
             Clipper64 clipper;
@@ -244,6 +568,7 @@ namespace gerber_3d
         pending_contours.clear();
         pending_contours.shrink_to_fit();
 
+        report_progress(1.0f);
         LOG_INFO("resolve_2d: {} top-level contours", resolved_tree.Count());
     }
 
@@ -263,6 +588,9 @@ namespace gerber_3d
         extruded_depth = z_top - z_bot;
 
         process_polytree_children(resolved_tree, static_cast<float>(z_bot), static_cast<float>(z_top));
+        if(give_up()) {
+            return;
+        }
 
         has_mesh = true;
         LOG_INFO("extrude: {} vertices, {} indices ({} triangles)",
@@ -273,23 +601,103 @@ namespace gerber_3d
 
     void gpu_3d_drawer::process_polytree_children(Clipper2Lib::PolyPath64 const &node, float z_bot, float z_top)
     {
-        for(auto const &child : node) {
-            // each top-level child is an outer boundary
-            extrude_polygon(*child, z_bot, z_top);
+        std::vector<Clipper2Lib::PolyPath64 const *> outers;
+        collect_outers(node, outers);
+        if(outers.empty()) {
+            return;
+        }
 
-            // holes may contain nested outers (islands inside holes)
-            for(auto const &hole : *child) {
-                process_polytree_children(*hole, z_bot, z_top);
+        // each chunk gets its own arena for libtess, reset after every polygon
+        std::vector<polygon_mesh> meshes(outers.size());
+        std::atomic<size_t> outers_done{ 0 };
+        auto extrude_outers = [&](auto &arena, size_t begin, size_t end) {
+            for(size_t i = begin; i < end && !stopped(); ++i) {
+                extrude_polygon(*outers[i], z_bot, z_top, &arena.tess_alloc, meshes[i]);
+                arena.reset();
+            }
+        };
+        job_pool::parallel_for(0, outers.size(), 8, [&](size_t begin, size_t end) {
+            size_t most_points = 0;
+            for(size_t i = begin; i < end; ++i) {
+                most_points = std::max(most_points, polygon_points(*outers[i]));
             }
+            if(most_points <= small_tess_points) {
+                small_tess_arena arena;
+                extrude_outers(arena, begin, end);
+            } else {
+                gerber::tess_arena_t arena;
+                extrude_outers(arena, begin, end);
+            }
+            size_t done = outers_done.fetch_add(end - begin) + (end - begin);
+            report_progress(static_cast<float>(done) / outers.size());
+        });
+        if(stopped()) {
+            return;
         }
+
+        // concatenate them in tree order with the indices rebased
+        std::vector<size_t> vertex_offset(outers.size() + 1, 0);
+        std::vector<size_t> index_offset(outers.size() + 1, 0);
+        for(size_t i = 0; i < outers.size(); ++i) {
+            vertex_offset[i + 1] = vertex_offset[i] + meshes[i].vertices.size();
+            index_offset[i + 1] = index_offset[i] + meshes[i].indices.size();
+        }
+        uint32_t const first_vertex = static_cast<uint32_t>(mesh_vertices.size());
+        size_t const first_index = mesh_indices.size();
+        vec3f *vertices = mesh_vertices.grow_uninitialized(vertex_offset.back()).data();
+        uint32_t *indices = mesh_indices.grow_uninitialized(index_offset.back()).data();
+        if(mesh_vertices.size() != first_vertex + vertex_offset.back() || mesh_indices.size() != first_index + index_offset.back()) {
+            LOG_ERROR("extrude: no room for {} more vertices, {} more indices", vertex_offset.back(), index_offset.back());
+            mesh_vertices.truncate(first_vertex);
+            mesh_indices.truncate(first_index);
+            return;
+        }
+        job_pool::parallel_for(0, outers.size(), 64, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; ++i) {
+                polygon_mesh const &m = meshes[i];
+                std::copy(m.vertices.begin(), m.vertices.end(), vertices + vertex_offset[i]);
+                uint32_t const base = first_vertex + static_cast<uint32_t>(vertex_offset[i]);
+                uint32_t *dst = indices + index_offset[i];
+                for(uint32_t index : m.indices) {
+                    *dst++ = base + index;
+                }
+            }
+        });
     }
 
     //////////////////////////////////////////////////////////////////////
 
-    void gpu_3d_drawer::extrude_polygon(Clipper2Lib::PolyPath64 const &outer_node, float z_bot, float z_top)
+    void gpu_3d_drawer::extrude_polygon(Clipper2Lib::PolyPath64 const &outer_node, float z_bot, float z_top, TESSalloc *tess_alloc, polygon_mesh &mesh) const
     {
         double const inv_scale = 1.0 / CLIPPER_SCALE;
 
+        // how far a point libtess added can be from a contour edge and still be on it
+        // (libtess works in floats)
+        double const added_point_tolerance = 1e-4;
+
+        // drop collinear and nearly collinear vertices (mostly from arc flattening
+        // and Clipper) before capping, the caps and walls both get smaller. Each
+        // contour can move by up to the tolerance, so it's kept under half the
+        // narrowest gap between the outer and its holes or they could cross
+        Clipper2Lib::Paths64 contours;
+        contours.push_back(outer_node.Polygon());
+        for(auto const &hole_child : outer_node) {
+            contours.push_back(hole_child->Polygon());
+        }
+        double epsilon = decimation_tolerance * CLIPPER_SCALE;
+        if(epsilon > 0 && contours.size() > 1) {
+            epsilon = std::min(epsilon, contour_gap(contours, epsilon * 2) / 2);
+        }
+        if(epsilon > 0) {
+            for(auto &contour : contours) {
+                contour = Clipper2Lib::SimplifyPath(contour, epsilon, true);
+            }
+        }
+        if(contours[0].size() < 3) {
+            return;
+        }
+        std::erase_if(contours, [](Clipper2Lib::Path64 const &contour) { return contour.size() < 3; });
+
         auto path_to_floats = [&](Clipper2Lib::Path64 const &path) -> std::vector<float> {
             std::vector<float> coords;
             coords.reserve(path.size() * 2);
@@ -301,15 +709,17 @@ namespace gerber_3d
         };
 
         // triangulate the polygon (outer + holes) using libtess2
-        TESStesselator *tess = tessNewTess(nullptr);
+        TESStesselator *tess = tessNewTess(tess_alloc);
+        if(tess == nullptr) {
+            return;
+        }
         tessSetOption(tess, TESS_CONSTRAINED_DELAUNAY_TRIANGULATION, 1);
 
-        auto outer_coords = path_to_floats(outer_node.Polygon());
-        tessAddContour(tess, 2, outer_coords.data(), sizeof(float) * 2, static_cast<int>(outer_node.Polygon().size()));
-
-        for(auto const &hole_child : outer_node) {
-            auto hole_coords = path_to_floats(hole_child->Polygon());
-            tessAddContour(tess, 2, hole_coords.data(), sizeof(float) * 2, static_cast<int>(hole_child->Polygon().size()));
+        size_t total_points = 0;
+        for(auto const &contour : contours) {
+            auto coords = path_to_floats(contour);
+            tessAddContour(tess, 2, coords.data(), sizeof(float) * 2, static_cast<int>(contour.size()));
+            total_points += contour.size();
         }
 
         if(!tessTesselate(tess, TESS_WINDING_ODD, TESS_POLYGONS, 3, 2, nullptr)) {
@@ -321,78 +731,145 @@ namespace gerber_3d
         int const nverts = tessGetVertexCount(tess);
         int const *elems = tessGetElements(tess);
         int const nelems = tessGetElementCount(tess);
+        TESSindex const *vertex_indices = tessGetVertexIndices(tess);
+
+        // both caps in one go: bottom verts then top verts
+        uint32_t const base_bot = 0;
+        uint32_t const base_top = base_bot + nverts;
+        mesh.vertices.resize(nverts * 2);
+        for(int v = 0; v < nverts; v++) {
+            mesh.vertices[v] = { verts[v * 2], verts[v * 2 + 1], z_bot };
+            mesh.vertices[nverts + v] = { verts[v * 2], verts[v * 2 + 1], z_top };
+        }
 
-        // bottom cap (z = z_bot)
-        uint32_t base_bot = static_cast<uint32_t>(mesh_vertices.size());
+        // which cap vertex each contour point became (libtess keeps the input
+        // points, it only adds new ones where edges cross)
+        std::vector<uint32_t> cap_vertex(total_points, UINT32_MAX);
         for(int v = 0; v < nverts; v++) {
-            mesh_vertices.push_back({ verts[v * 2], verts[v * 2 + 1], z_bot });
+            TESSindex src = vertex_indices[v];
+            if(src != TESS_UNDEF && static_cast<size_t>(src) < total_points) {
+                cap_vertex[src] = static_cast<uint32_t>(v);
+            }
         }
+
+        mesh.indices.reserve(nelems * 6 + total_points * 6);
         for(int t = 0; t < nelems; t++) {
             int const *tri = &elems[t * 3];
             if(tri[0] != TESS_UNDEF && tri[1] != TESS_UNDEF && tri[2] != TESS_UNDEF) {
                 // bottom face: normal points -Z, so reverse winding
-                mesh_indices.push_back(base_bot + tri[0]);
-                mesh_indices.push_back(base_bot + tri[2]);
-                mesh_indices.push_back(base_bot + tri[1]);
+                mesh.indices.push_back(base_bot + tri[0]);
+                mesh.indices.push_back(base_bot + tri[2]);
+                mesh.indices.push_back(base_bot + tri[1]);
+                // top face: normal points +Z, standard winding
+                mesh.indices.push_back(base_top + tri[0]);
+                mesh.indices.push_back(base_top + tri[1]);
+                mesh.indices.push_back(base_top + tri[2]);
             }
         }
 
-        // top cap (z = z_top)
-        uint32_t base_top = static_cast<uint32_t>(mesh_vertices.size());
+        // points libtess added where edges of different contours cross or touch,
+        // they're on the cap edges so the walls have to go through them too. Each
+        // one looks for the edges it's on in its cell of a grid over the contours,
+        // then they're sorted along the contours to be taken in order
+        struct edge_split
+        {
+            uint32_t contour;
+            uint32_t edge;
+            double t;
+            uint32_t vertex;
+        };
+        std::vector<edge_split> splits;
+        contour_grid edges;
+        double const tolerance = added_point_tolerance * CLIPPER_SCALE;
         for(int v = 0; v < nverts; v++) {
-            mesh_vertices.push_back({ verts[v * 2], verts[v * 2 + 1], z_top });
-        }
-        for(int t = 0; t < nelems; t++) {
-            int const *tri = &elems[t * 3];
-            if(tri[0] != TESS_UNDEF && tri[1] != TESS_UNDEF && tri[2] != TESS_UNDEF) {
-                // top face: normal points +Z, standard winding
-                mesh_indices.push_back(base_top + tri[0]);
-                mesh_indices.push_back(base_top + tri[1]);
-                mesh_indices.push_back(base_top + tri[2]);
+            if(vertex_indices[v] != TESS_UNDEF && static_cast<size_t>(vertex_indices[v]) < total_points) {
+                continue;
+            }
+            if(edges.edges.empty()) {
+                std::vector<Clipper2Lib::Path64 const *> paths;
+                for(auto const &contour : contours) {
+                    paths.push_back(&contour);
+                }
+                edges.build(paths, 8, 1024, tolerance);
+            }
+            double px = verts[v * 2] * static_cast<double>(CLIPPER_SCALE);
+            double py = verts[v * 2 + 1] * static_cast<double>(CLIPPER_SCALE);
+            for(auto const &e : edges.cell(edges.grid.cell_index(edges.grid.cell_x(px), edges.grid.cell_y(py)))) {
+                double dx = static_cast<double>(e.b.x - e.a.x);
+                double dy = static_cast<double>(e.b.y - e.a.y);
+                double len_sq = dx * dx + dy * dy;
+                if(len_sq == 0) {
+                    continue;
+                }
+                double t = ((px - e.a.x) * dx + (py - e.a.y) * dy) / len_sq;
+                double cx = px - (e.a.x + t * dx);
+                double cy = py - (e.a.y + t * dy);
+                if(t > 0 && t < 1 && cx * cx + cy * cy < tolerance * tolerance) {
+                    splits.push_back({ e.contour, e.index, t, base_bot + static_cast<uint32_t>(v) });
+                }
             }
         }
+        std::sort(splits.begin(), splits.end(), [](edge_split const &a, edge_split const &b) {
+            return std::tie(a.contour, a.edge, a.t) < std::tie(b.contour, b.edge, b.t);
+        });
 
         tessDeleteTess(tess);
 
-        // side walls
-        auto add_side_walls = [&](Clipper2Lib::Path64 const &contour, bool is_hole) {
+        // side walls use the cap vertices along the contours so the mesh is closed
+        // (none of the export formats have vertex normals so the sharp edge at the
+        // caps doesn't matter). A point libtess merged away gets its own pair
+        size_t next_split = 0;
+        auto add_side_walls = [&](uint32_t c, size_t first_point) {
+            Clipper2Lib::Path64 const &contour = contours[c];
             size_t n = contour.size();
+            std::vector<uint32_t> bot;
+            bot.reserve(n);
             for(size_t i = 0; i < n; i++) {
-                size_t j = (i + 1) % n;
-                float x0 = static_cast<float>(contour[i].x * inv_scale);
-                float y0 = static_cast<float>(contour[i].y * inv_scale);
-                float x1 = static_cast<float>(contour[j].x * inv_scale);
-                float y1 = static_cast<float>(contour[j].y * inv_scale);
-
-                uint32_t base = static_cast<uint32_t>(mesh_vertices.size());
-                mesh_vertices.push_back({ x0, y0, z_bot });    // 0
-                mesh_vertices.push_back({ x1, y1, z_bot });    // 1
-                mesh_vertices.push_back({ x1, y1, z_top });    // 2
-                mesh_vertices.push_back({ x0, y0, z_top });    // 3
-
-                if(is_hole) {
-                    // hole contours wind clockwise, so walls face inward
-                    mesh_indices.push_back(base + 0);
-                    mesh_indices.push_back(base + 2);
-                    mesh_indices.push_back(base + 1);
-                    mesh_indices.push_back(base + 0);
-                    mesh_indices.push_back(base + 3);
-                    mesh_indices.push_back(base + 2);
+                uint32_t v = cap_vertex[first_point + i];
+                if(v != UINT32_MAX) {
+                    bot.push_back(base_bot + v);
                 } else {
-                    // outer contours wind counter-clockwise, walls face outward
-                    mesh_indices.push_back(base + 0);
-                    mesh_indices.push_back(base + 1);
-                    mesh_indices.push_back(base + 2);
-                    mesh_indices.push_back(base + 0);
-                    mesh_indices.push_back(base + 2);
-                    mesh_indices.push_back(base + 3);
+                    float x = static_cast<float>(contour[i].x * inv_scale);
+                    float y = static_cast<float>(contour[i].y * inv_scale);
+                    bot.push_back(static_cast<uint32_t>(mesh.vertices.size()));
+                    mesh.vertices.push_back({ x, y, z_bot });
+                    mesh.vertices.push_back({ x, y, z_top });
                 }
+                // split the edge at any added points on it
+                for(; next_split < splits.size() && splits[next_split].contour == c && splits[next_split].edge == i; ++next_split) {
+                    bot.push_back(splits[next_split].vertex);
+                }
+            }
+            n = bot.size();
+
+            // top vertex is always nverts after the bottom one (caps) or just after it (extra pairs)
+            auto top = [&](uint32_t b) { return b < base_top ? b + nverts : b + 1; };
+
+            size_t first_index = mesh.indices.size();
+            mesh.indices.resize(first_index + n * 6);
+            uint32_t *idx = mesh.indices.data() + first_index;
+            for(size_t i = 0; i < n; i++) {
+                size_t j = (i + 1) % n;
+                uint32_t v0 = bot[i];
+                uint32_t v1 = bot[j];
+                uint32_t v2 = top(bot[j]);
+                uint32_t v3 = top(bot[i]);
+
+                // outers wind counter-clockwise and holes clockwise, the material is
+                // on the left of both so the same winding faces out of it
+                *idx++ = v0;
+                *idx++ = v1;
+                *idx++ = v2;
+                *idx++ = v0;
+                *idx++ = v2;
+                *idx++ = v3;
             }
         };
 
-        add_side_walls(outer_node.Polygon(), false);
-        for(auto const &hole_child : outer_node) {
-            add_side_walls(hole_child->Polygon(), true);
+        size_t first_point = 0;
+        for(uint32_t c = 0; c < static_cast<uint32_t>(contours.size()); c++) {
+            add_side_walls(c, first_point);
+            first_point += contours[c].size();
         }
     }
 
@@ -400,41 +877,28 @@ namespace gerber_3d
 
     namespace
     {
-        double point_to_segment_distance_sq(int64_t px, int64_t py, int64_t ax, int64_t ay, int64_t bx, int64_t by)
-        {
-            double dx = static_cast<double>(bx - ax);
-            double dy = static_cast<double>(by - ay);
-            double len_sq = dx * dx + dy * dy;
-
-            double t = 0;
-            if(len_sq > 0) {
-                t = ((px - ax) * dx + (py - ay) * dy) / len_sq;
-                if(t < 0) t = 0;
-                else if(t > 1) t = 1;
-            }
+        //////////////////////////////////////////////////////////////////////
+        // Spatial grid for nearest edge distance queries. The segments are bucketed
+        // by a cell_grid then stored as separate components relative to the grid
+        // origin so the distance loop is straight line code the compiler can vectorize
 
-            double cx = ax + t * dx - px;
-            double cy = ay + t * dy - py;
-            return cx * cx + cy * cy;
-        }
-
-        // spatial grid for fast nearest-edge distance queries
         struct edge_grid
         {
-            struct segment
-            {
-                int64_t ax, ay, bx, by;
-            };
-
             int64_t origin_x{}, origin_y{};
             double cell_size{};
             double query_radius{};    // max distance we need to find
             int search_r{};           // cell radius to search
-            int nx{}, ny{};
-            std::vector<std::vector<segment>> cells;
+
+            gerber_3d::cell_grid grid;             // relative to the origin
+            std::vector<double> seg_ax, seg_ay;    // start point
+            std::vector<double> seg_dx, seg_dy;    // end - start
+            std::vector<double> seg_inv_len_sq;    // 0 for a degenerate segment
 
             static constexpr int MAX_GRID_DIM = 512;
 
+            // segment distances are worked out this many at a time
+            static constexpr int batch_size = 8;
+
             void build(Clipper2Lib::Paths64 const &paths, double max_query_dist)
             {
                 query_radius = max_query_dist;
@@ -462,50 +926,135 @@ namespace gerber_3d
 
                 origin_x = lo_x;
                 origin_y = lo_y;
-                nx = std::min(MAX_GRID_DIM, static_cast<int>(span_x / cell_size) + 3);
-                ny = std::min(MAX_GRID_DIM, static_cast<int>(span_y / cell_size) + 3);
-                cells.resize(static_cast<size_t>(nx) * ny);
+                int nx = std::min(MAX_GRID_DIM, static_cast<int>(span_x / cell_size) + 3);
+                int ny = std::min(MAX_GRID_DIM, static_cast<int>(span_y / cell_size) + 3);
+                grid.set_cells(0, 0, cell_size, cell_size, nx, ny);
 
-                for(auto const &path : paths) {
-                    size_t n = path.size();
-                    for(size_t i = 0; i < n; i++) {
-                        size_t j = (i + 1) % n;
-                        segment seg{ path[i].x, path[i].y, path[j].x, path[j].y };
-
-                        int gx0 = static_cast<int>((std::min(seg.ax, seg.bx) - origin_x) / cell_size);
-                        int gy0 = static_cast<int>((std::min(seg.ay, seg.by) - origin_y) / cell_size);
-                        int gx1 = static_cast<int>((std::max(seg.ax, seg.bx) - origin_x) / cell_size);
-                        int gy1 = static_cast<int>((std::max(seg.ay, seg.by) - origin_y) / cell_size);
-
-                        gx0 = std::max(0, gx0);
-                        gy0 = std::max(0, gy0);
-                        gx1 = std::min(nx - 1, gx1);
-                        gy1 = std::min(ny - 1, gy1);
-
-                        for(int gy = gy0; gy <= gy1; gy++) {
-                            for(int gx = gx0; gx <= gx1; gx++) {
-                                cells[static_cast<size_t>(gy) * nx + gx].push_back(seg);
-                            }
+                struct segment
+                {
+                    Clipper2Lib::Point64 a;
+                    Clipper2Lib::Point64 b;
+                };
+                std::vector<segment> segments;
+                grid.bucket(segments, [&](auto &&place) {
+                    for(auto const &path : paths) {
+                        size_t n = path.size();
+                        for(size_t i = 0; i < n; i++) {
+                            Clipper2Lib::Point64 const &a = path[i];
+                            Clipper2Lib::Point64 const &b = path[(i + 1) % n];
+                            place(static_cast<double>(std::min(a.x, b.x) - origin_x),
+                                  static_cast<double>(std::min(a.y, b.y) - origin_y),
+                                  static_cast<double>(std::max(a.x, b.x) - origin_x),
+                                  static_cast<double>(std::max(a.y, b.y) - origin_y),
+                                  segment{ a, b });
                         }
                     }
+                });
+
+                // as separate components so the distance loop vectorizes
+                size_t total = segments.size();
+                seg_ax.resize(total);
+                seg_ay.resize(total);
+                seg_dx.resize(total);
+                seg_dy.resize(total);
+                seg_inv_len_sq.resize(total);
+                for(size_t s = 0; s < total; s++) {
+                    segment const &seg = segments[s];
+                    double dx = static_cast<double>(seg.b.x - seg.a.x);
+                    double dy = static_cast<double>(seg.b.y - seg.a.y);
+                    double len_sq = dx * dx + dy * dy;
+                    seg_ax[s] = static_cast<double>(seg.a.x - origin_x);
+                    seg_ay[s] = static_cast<double>(seg.a.y - origin_y);
+                    seg_dx[s] = dx;
+                    seg_dy[s] = dy;
+                    seg_inv_len_sq[s] = len_sq > 0 ? 1.0 / len_sq : 0.0;
+                }
+            }
+
+            //////////////////////////////////////////////////////////////////////
+            // squared distance from (px, py) (relative to the origin) to the nearest
+            // segment in [first, last), or best if none are nearer
+
+            double cell_min_distance_sq(double px, double py, uint32_t first, uint32_t last, double best) const
+            {
+                double const *ax = seg_ax.data();
+                double const *ay = seg_ay.data();
+                double const *dx = seg_dx.data();
+                double const *dy = seg_dy.data();
+                double const *inv = seg_inv_len_sq.data();
+
+                auto distance_sq = [&](uint32_t s) {
+                    double rx = px - ax[s];
+                    double ry = py - ay[s];
+                    double t = std::clamp((rx * dx[s] + ry * dy[s]) * inv[s], 0.0, 1.0);
+                    double cx = rx - t * dx[s];
+                    double cy = ry - t * dy[s];
+                    return cx * cx + cy * cy;
+                };
+
+                uint32_t s = first;
+                for(; s + batch_size <= last; s += batch_size) {
+                    double d[batch_size];
+                    for(int i = 0; i < batch_size; i++) {
+                        d[i] = distance_sq(s + i);
+                    }
+                    for(int i = 0; i < batch_size; i++) {
+                        best = std::min(best, d[i]);
+                    }
+                }
+                for(; s < last; s++) {
+                    best = std::min(best, distance_sq(s));
                 }
+                return best;
             }
 
-            double min_distance(int64_t px, int64_t py) const
+            //////////////////////////////////////////////////////////////////////
+            // distance to the nearest segment, query_radius if there's none within that
+            // The cells are searched in rings outward from the one the point is in and
+            // it stops when the nearest the next ring could be is further than the best so far
+
+            double min_distance(int64_t qx, int64_t qy) const
             {
-                int gx = static_cast<int>((px - origin_x) / cell_size);
-                int gy = static_cast<int>((py - origin_y) / cell_size);
-
-                double best_sq = query_radius * query_radius * 4;
-
-                int r = search_r;
-                for(int dy = -r; dy <= r; dy++) {
-                    for(int dx = -r; dx <= r; dx++) {
-                        int cx = gx + dx, cy = gy + dy;
-                        if(cx < 0 || cx >= nx || cy < 0 || cy >= ny) continue;
-                        for(auto const &seg : cells[static_cast<size_t>(cy) * nx + cx]) {
-                            double d = point_to_segment_distance_sq(px, py, seg.ax, seg.ay, seg.bx, seg.by);
-                            if(d < best_sq) best_sq = d;
+                if(grid.cell_start.empty()) {
+                    return query_radius;
+                }
+
+                double px = static_cast<double>(qx - origin_x);
+                double py = static_cast<double>(qy - origin_y);
+                int gx = static_cast<int>(std::floor(px / cell_size));
+                int gy = static_cast<int>(std::floor(py / cell_size));
+
+                // how far the point is from the edge of its own cell
+                double fx = px - gx * cell_size;
+                double fy = py - gy * cell_size;
+                double edge_gap = std::max(0.0, std::min({ fx, cell_size - fx, fy, cell_size - fy }));
+
+                double best_sq = query_radius * query_radius;
+
+                for(int r = 0; r <= search_r; r++) {
+                    if(r > 0) {
+                        double lower_bound = (r - 1) * cell_size + edge_gap;
+                        if(lower_bound * lower_bound >= best_sq) {
+                            break;
+                        }
+                    }
+                    for(int cy = gy - r; cy <= gy + r; cy++) {
+                        if(cy < 0 || cy >= grid.ny) continue;
+                        bool edge_row = cy == gy - r || cy == gy + r;
+                        int step = edge_row ? 1 : std::max(1, 2 * r);
+                        for(int cx = gx - r; cx <= gx + r; cx += step) {
+                            if(cx < 0 || cx >= grid.nx) continue;
+                            size_t c = grid.cell_index(cx, cy);
+                            uint32_t first = grid.cell_start[c];
+                            uint32_t last = grid.cell_start[c + 1];
+                            if(first == last) continue;
+
+                            // skip the cell if all of it is further than the best so far
+                            double ox = std::max({ 0.0, cx * cell_size - px, px - (cx + 1) * cell_size });
+                            double oy = std::max({ 0.0, cy * cell_size - py, py - (cy + 1) * cell_size });
+                            if(ox * ox + oy * oy >= best_sq) continue;
+
+                            best_sq = cell_min_distance_sq(px, py, first, last, best_sq);
                         }
                     }
                 }
@@ -556,14 +1105,6 @@ namespace gerber_3d
         edge_grid grid;
         grid.build(reference_paths, dw_scaled);
 
-        // all vertices in band_paths are outside the reference, so t = distance / draft_width
-        auto compute_t = [&](int64_t px, int64_t py) -> float {
-            double dist = grid.min_distance(px, py);
-            double t = (dw_scaled > 0) ? dist / dw_scaled : 1.0;
-            if(t > 1.0) t = 1.0;
-            return static_cast<float>(t);
-        };
-
         auto lerp = [](float a, float b, float t) -> float { return a + t * (b - a); };
 
         PolyTree64 tree;
@@ -573,132 +1114,188 @@ namespace gerber_3d
             clipper.Execute(ClipType::Union, FillRule::NonZero, tree);
         }
 
-        std::function<void(PolyPath64 const &)> process_node;
-        process_node = [&](PolyPath64 const &node) {
-            for(auto const &outer_child : node) {
+        // triangulate every polygon first and gather up all the points which need
+        // a distance, then do those in parallel, then build the mesh
 
-                auto path_to_floats = [&](Path64 const &path) -> std::vector<float> {
-                    std::vector<float> coords;
-                    coords.reserve(path.size() * 2);
-                    for(auto const &pt : path) {
-                        coords.push_back(static_cast<float>(pt.x * inv_scale));
-                        coords.push_back(static_cast<float>(pt.y * inv_scale));
-                    }
-                    return coords;
-                };
+        struct band_polygon
+        {
+            std::vector<float> verts;
+            std::vector<int> elems;
+            std::vector<Path64 const *> contours;    // outer then holes
+            size_t first_query;                      // the tess vertices then the contour points
+        };
+
+        std::vector<band_polygon> polygons;
+        std::vector<Point64> queries;
+
+        auto path_to_floats = [&](Path64 const &path) -> std::vector<float> {
+            std::vector<float> coords;
+            coords.reserve(path.size() * 2);
+            for(auto const &pt : path) {
+                coords.push_back(static_cast<float>(pt.x * inv_scale));
+                coords.push_back(static_cast<float>(pt.y * inv_scale));
+            }
+            return coords;
+        };
+
+        std::function<void(PolyPath64 const &)> collect;
+        collect = [&](PolyPath64 const &node) {
+            for(auto const &outer_child : node) {
 
                 TESStesselator *tess = tessNewTess(nullptr);
                 tessSetOption(tess, TESS_CONSTRAINED_DELAUNAY_TRIANGULATION, 1);
 
-                auto outer_coords = path_to_floats(outer_child->Polygon());
-                tessAddContour(tess, 2, outer_coords.data(), sizeof(float) * 2,
-                               static_cast<int>(outer_child->Polygon().size()));
-
+                band_polygon poly;
+                poly.contours.push_back(&outer_child->Polygon());
                 for(auto const &hole_child : *outer_child) {
-                    auto hole_coords = path_to_floats(hole_child->Polygon());
-                    tessAddContour(tess, 2, hole_coords.data(), sizeof(float) * 2,
-                                   static_cast<int>(hole_child->Polygon().size()));
+                    poly.contours.push_back(&hole_child->Polygon());
                 }
-
-                if(!tessTesselate(tess, TESS_WINDING_ODD, TESS_POLYGONS, 3, 2, nullptr)) {
-                    tessDeleteTess(tess);
-                    goto next;
+                for(Path64 const *contour : poly.contours) {
+                    auto coords = path_to_floats(*contour);
+                    tessAddContour(tess, 2, coords.data(), sizeof(float) * 2, static_cast<int>(contour->size()));
                 }
 
-                {
+                if(tessTesselate(tess, TESS_WINDING_ODD, TESS_POLYGONS, 3, 2, nullptr)) {
                     float const *verts = tessGetVertices(tess);
                     int const nverts = tessGetVertexCount(tess);
                     int const *elems = tessGetElements(tess);
                     int const nelems = tessGetElementCount(tess);
 
-                    std::vector<float> vt(nverts);
+                    poly.verts.assign(verts, verts + nverts * 2);
+                    poly.elems.assign(elems, elems + nelems * 3);
+                    poly.first_query = queries.size();
                     for(int v = 0; v < nverts; v++) {
-                        int64_t cx = static_cast<int64_t>(verts[v * 2] * CLIPPER_SCALE);
-                        int64_t cy = static_cast<int64_t>(verts[v * 2 + 1] * CLIPPER_SCALE);
-                        vt[v] = compute_t(cx, cy);
+                        queries.push_back({ static_cast<int64_t>(verts[v * 2] * CLIPPER_SCALE), static_cast<int64_t>(verts[v * 2 + 1] * CLIPPER_SCALE) });
                     }
-
-                    // bottom cap
-                    uint32_t base_bot = static_cast<uint32_t>(mesh_vertices.size());
-                    for(int v = 0; v < nverts; v++) {
-                        mesh_vertices.push_back({ verts[v * 2], verts[v * 2 + 1], lerp(z_bot_on, z_bot_off, vt[v]) });
-                    }
-                    for(int t = 0; t < nelems; t++) {
-                        int const *tri = &elems[t * 3];
-                        if(tri[0] != TESS_UNDEF && tri[1] != TESS_UNDEF && tri[2] != TESS_UNDEF) {
-                            mesh_indices.push_back(base_bot + tri[0]);
-                            mesh_indices.push_back(base_bot + tri[2]);
-                            mesh_indices.push_back(base_bot + tri[1]);
-                        }
+                    for(Path64 const *contour : poly.contours) {
+                        queries.insert(queries.end(), contour->begin(), contour->end());
                     }
+                    polygons.push_back(std::move(poly));
+                }
+                tessDeleteTess(tess);
 
-                    // top cap
-                    uint32_t base_top = static_cast<uint32_t>(mesh_vertices.size());
-                    for(int v = 0; v < nverts; v++) {
-                        mesh_vertices.push_back({ verts[v * 2], verts[v * 2 + 1], lerp(z_top_on, z_top_off, vt[v]) });
-                    }
-                    for(int t = 0; t < nelems; t++) {
-                        int const *tri = &elems[t * 3];
-                        if(tri[0] != TESS_UNDEF && tri[1] != TESS_UNDEF && tri[2] != TESS_UNDEF) {
-                            mesh_indices.push_back(base_top + tri[0]);
-                            mesh_indices.push_back(base_top + tri[1]);
-                            mesh_indices.push_back(base_top + tri[2]);
-                        }
-                    }
+                for(auto const &hole_child : *outer_child) {
+                    collect(*hole_child);
+                }
+            }
+        };
+        collect(tree);
 
-                    tessDeleteTess(tess);
+        if(stopped()) {
+            return;
+        }
 
-                    // side walls with per-vertex Z
-                    auto add_side_walls = [&](Path64 const &contour, bool is_hole) {
-                        size_t n = contour.size();
-                        for(size_t i = 0; i < n; i++) {
-                            size_t j = (i + 1) % n;
-                            float x0 = static_cast<float>(contour[i].x * inv_scale);
-                            float y0 = static_cast<float>(contour[i].y * inv_scale);
-                            float x1 = static_cast<float>(contour[j].x * inv_scale);
-                            float y1 = static_cast<float>(contour[j].y * inv_scale);
-
-                            float t0 = compute_t(contour[i].x, contour[i].y);
-                            float t1 = compute_t(contour[j].x, contour[j].y);
-
-                            uint32_t base = static_cast<uint32_t>(mesh_vertices.size());
-                            mesh_vertices.push_back({ x0, y0, lerp(z_bot_on, z_bot_off, t0) });
-                            mesh_vertices.push_back({ x1, y1, lerp(z_bot_on, z_bot_off, t1) });
-                            mesh_vertices.push_back({ x1, y1, lerp(z_top_on, z_top_off, t1) });
-                            mesh_vertices.push_back({ x0, y0, lerp(z_top_on, z_top_off, t0) });
-
-                            if(is_hole) {
-                                mesh_indices.push_back(base + 0);
-                                mesh_indices.push_back(base + 2);
-                                mesh_indices.push_back(base + 1);
-                                mesh_indices.push_back(base + 0);
-                                mesh_indices.push_back(base + 3);
-                                mesh_indices.push_back(base + 2);
-                            } else {
-                                mesh_indices.push_back(base + 0);
-                                mesh_indices.push_back(base + 1);
-                                mesh_indices.push_back(base + 2);
-                                mesh_indices.push_back(base + 0);
-                                mesh_indices.push_back(base + 2);
-                                mesh_indices.push_back(base + 3);
-                            }
-                        }
-                    };
+        // all vertices in band_paths are outside the reference, so t = distance / draft_width
+        std::vector<float> query_t(queries.size());
+        job_pool::parallel_for(0, queries.size(), 4096, [&](size_t begin, size_t end) {
+            if(stopped()) {
+                return;
+            }
+            for(size_t q = begin; q < end; q++) {
+                double dist = grid.min_distance(queries[q].x, queries[q].y);
+                double t = (dw_scaled > 0) ? dist / dw_scaled : 1.0;
+                if(t > 1.0) t = 1.0;
+                query_t[q] = static_cast<float>(t);
+            }
+        });
 
-                    add_side_walls(outer_child->Polygon(), false);
-                    for(auto const &hole_child : *outer_child) {
-                        add_side_walls(hole_child->Polygon(), true);
-                    }
-                }
+        if(stopped()) {
+            return;
+        }
 
-            next:
-                for(auto const &hole_child : *outer_child) {
-                    process_node(*hole_child);
+        for(band_polygon const &poly : polygons) {
+
+            int const nverts = static_cast<int>(poly.verts.size() / 2);
+            int const nelems = static_cast<int>(poly.elems.size() / 3);
+            float const *verts = poly.verts.data();
+            float const *vt = query_t.data() + poly.first_query;
+
+            // bottom cap then top cap
+            uint32_t base_bot = static_cast<uint32_t>(mesh_vertices.size());
+            uint32_t base_top = base_bot + nverts;
+            size_t index_base = mesh_indices.size();
+            std::span<vec3f> cap_verts = mesh_vertices.grow_uninitialized(nverts * 2);
+            std::span<uint32_t> cap_indices = mesh_indices.grow_uninitialized(nelems * 6);
+            if(cap_verts.size() != static_cast<size_t>(nverts) * 2 || cap_indices.size() != static_cast<size_t>(nelems) * 6) {
+                LOG_ERROR("extrude: no room for a {} vertex band cap", nverts);
+                mesh_vertices.truncate(base_bot);
+                mesh_indices.truncate(index_base);
+                break;
+            }
+            for(int v = 0; v < nverts; v++) {
+                cap_verts[v] = { verts[v * 2], verts[v * 2 + 1], lerp(z_bot_on, z_bot_off, vt[v]) };
+                cap_verts[nverts + v] = { verts[v * 2], verts[v * 2 + 1], lerp(z_top_on, z_top_off, vt[v]) };
+            }
+
+            uint32_t *idx = cap_indices.data();
+            for(int t = 0; t < nelems; t++) {
+                int const *tri = &poly.elems[t * 3];
+                if(tri[0] != TESS_UNDEF && tri[1] != TESS_UNDEF && tri[2] != TESS_UNDEF) {
+                    *idx++ = base_bot + tri[0];
+                    *idx++ = base_bot + tri[2];
+                    *idx++ = base_bot + tri[1];
+                    *idx++ = base_top + tri[0];
+                    *idx++ = base_top + tri[1];
+                    *idx++ = base_top + tri[2];
                 }
             }
-        };
+            mesh_indices.truncate(index_base + (idx - cap_indices.data()));
 
-        process_node(tree);
+            // side walls with per-vertex Z
+            auto add_side_walls = [&](Path64 const &contour, float const *contour_t, bool is_hole) {
+                size_t n = contour.size();
+                uint32_t base = static_cast<uint32_t>(mesh_vertices.size());
+                size_t index_base = mesh_indices.size();
+                std::span<vec3f> wall_verts = mesh_vertices.grow_uninitialized(n * 4);
+                std::span<uint32_t> wall_indices = mesh_indices.grow_uninitialized(n * 6);
+                if(wall_verts.size() != n * 4 || wall_indices.size() != n * 6) {
+                    LOG_ERROR("extrude: no room for a {} point band wall", n);
+                    mesh_vertices.truncate(base);
+                    mesh_indices.truncate(index_base);
+                    return;
+                }
+                vec3f *vert = wall_verts.data();
+                uint32_t *idx = wall_indices.data();
+                for(size_t i = 0; i < n; i++) {
+                    size_t j = (i + 1) % n;
+                    float x0 = static_cast<float>(contour[i].x * inv_scale);
+                    float y0 = static_cast<float>(contour[i].y * inv_scale);
+                    float x1 = static_cast<float>(contour[j].x * inv_scale);
+                    float y1 = static_cast<float>(contour[j].y * inv_scale);
+
+                    float t0 = contour_t[i];
+                    float t1 = contour_t[j];
+
+                    *vert++ = { x0, y0, lerp(z_bot_on, z_bot_off, t0) };
+                    *vert++ = { x1, y1, lerp(z_bot_on, z_bot_off, t1) };
+                    *vert++ = { x1, y1, lerp(z_top_on, z_top_off, t1) };
+                    *vert++ = { x0, y0, lerp(z_top_on, z_top_off, t0) };
+
+                    if(is_hole) {
+                        *idx++ = base + 0;
+                        *idx++ = base + 2;
+                        *idx++ = base + 1;
+                        *idx++ = base + 0;
+                        *idx++ = base + 3;
+                        *idx++ = base + 2;
+                    } else {
+                        *idx++ = base + 0;
+                        *idx++ = base + 1;
+                        *idx++ = base + 2;
+                        *idx++ = base + 0;
+                        *idx++ = base + 2;
+                        *idx++ = base + 3;
+                    }
+                    base += 4;
+                }
+            };
+
+            float const *contour_t = vt + nverts;
+            for(size_t c = 0; c < poly.contours.size(); c++) {
+                add_side_walls(*poly.contours[c], contour_t, c != 0);
+                contour_t += poly.contours[c]->size();
+            }
+        }
     }
 
     //////////////////////////////////////////////////////////////////////
@@ -743,8 +1340,13 @@ namespace gerber_3d
             clipper.AddClip(reference_paths);
             clipper.Execute(ClipType::Intersection, FillRule::NonZero, on_ref_tree);
             LOG_INFO("extrude_two_shell: on_ref tree {} outers", on_ref_tree.Count());
+            progress_range(0.0f, 0.3f);
             process_polytree_children(on_ref_tree, z_bot_on, z_top_on);
         }
+        if(give_up()) {
+            progress_range(0.0f, 1.0f);
+            return;
+        }
         LOG_INFO("extrude_two_shell: after on_ref: {} verts, {} tris",
                  mesh_vertices.size(), mesh_indices.size() / 3);
 
@@ -756,8 +1358,13 @@ namespace gerber_3d
             clipper.AddClip(inflated_ref);
             clipper.Execute(ClipType::Difference, FillRule::NonZero, off_ref_tree);
             LOG_INFO("extrude_two_shell: off_ref tree {} outers", off_ref_tree.Count());
+            progress_range(0.3f, 0.6f);
             process_polytree_children(off_ref_tree, z_bot_off, z_top_off);
         }
+        if(give_up()) {
+            progress_range(0.0f, 1.0f);
+            return;
+        }
         LOG_INFO("extrude_two_shell: after off_ref: {} verts, {} tris",
                  mesh_vertices.size(), mesh_indices.size() / 3);
 
@@ -778,8 +1385,14 @@ namespace gerber_3d
         }
         LOG_INFO("extrude_two_shell: draft_band {} paths", draft_band.size());
 
+        progress_range(0.6f, 1.0f);
         extrude_conformal_region(draft_band, reference_paths, draft_width,
                                  z_bot_on, z_top_on, z_bot_off, z_top_off);
+        progress_range(0.0f, 1.0f);
+        if(give_up()) {
+            return;
+        }
+        report_progress(1.0f);
 
         has_mesh = true;
         LOG_INFO("extrude_two_shell: {} vertices, {} indices ({} triangles)",
@@ -788,56 +1401,13 @@ namespace gerber_3d
 
     //////////////////////////////////////////////////////////////////////
 
-    void gpu_3d_drawer::export_stl(std::string const &filename) const
+    bool gpu_3d_drawer::export_mesh(std::filesystem::path const &path) const
     {
         if(!has_mesh) {
-            LOG_ERROR("export_stl: no mesh data");
-            return;
+            LOG_ERROR("export_mesh: no mesh data");
+            return false;
         }
-
-        FILE *f = fopen(filename.c_str(), "wb");
-        if(!f) {
-            LOG_ERROR("export_stl: failed to open {}", filename);
-            return;
-        }
-
-        char header[80] = {};
-        snprintf(header, sizeof(header), "gerber_explorer STL export");
-        fwrite(header, 80, 1, f);
-
-        uint32_t num_triangles = static_cast<uint32_t>(mesh_indices.size() / 3);
-        fwrite(&num_triangles, 4, 1, f);
-
-        for(uint32_t t = 0; t < num_triangles; t++) {
-            vec3f const &v0 = mesh_vertices[mesh_indices[t * 3 + 0]];
-            vec3f const &v1 = mesh_vertices[mesh_indices[t * 3 + 1]];
-            vec3f const &v2 = mesh_vertices[mesh_indices[t * 3 + 2]];
-
-            // face normal via cross product
-            float ax = v1.x - v0.x, ay = v1.y - v0.y, az = v1.z - v0.z;
-            float bx = v2.x - v0.x, by = v2.y - v0.y, bz = v2.z - v0.z;
-            float nx = ay * bz - az * by;
-            float ny = az * bx - ax * bz;
-            float nz = ax * by - ay * bx;
-            float len = sqrtf(nx * nx + ny * ny + nz * nz);
-            if(len > 0) {
-                nx /= len;
-                ny /= len;
-                nz /= len;
-            }
-
-            fwrite(&nx, 4, 1, f);
-            fwrite(&ny, 4, 1, f);
-            fwrite(&nz, 4, 1, f);
-            fwrite(&v0, 12, 1, f);
-            fwrite(&v1, 12, 1, f);
-            fwrite(&v2, 12, 1, f);
-            uint16_t attr = 0;
-            fwrite(&attr, 2, 1, f);
-        }
-
-        fclose(f);
-        LOG_INFO("export_stl: wrote {} triangles to {}", num_triangles, filename);
+        return write_mesh(path, mesh_format_from_path(path), { mesh_vertices.data(), mesh_vertices.size() }, { mesh_indices.data(), mesh_indices.size() }, stop_token, progress);
     }
 
 }    // namespace gerber_3d
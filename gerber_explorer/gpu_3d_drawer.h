@@ -9,7 +9,10 @@
 #include "gerber_net.h"
 #include "gerber_arena.h"
 
+#include "mesh_writer.h"
+
 #include "clipper2/clipper.h"
+#include "tesselator.h"
 
 #include "gerber_log.h"
 
@@ -35,10 +38,7 @@ namespace gerber_3d
 
     struct gpu_3d_drawer : gerber_lib::gerber_draw_interface
     {
-        struct vec3f
-        {
-            float x, y, z;
-        };
+        using vec3f = mesh_vertex;
 
         struct contour_entry
         {
@@ -55,6 +55,10 @@ namespace gerber_3d
         [[nodiscard]] gerber_lib::gerber_error_code fill_elements(gerber_lib::gerber_draw_element const *elements, size_t num_elements,
                                                                    gerber_lib::gerber_polarity polarity, gerber_lib::gerber_net *gnet) override;
 
+        // drill files are only round holes and slots, so they go straight from the
+        // nets to contours (circles and capsules) without the general drawing code
+        void set_drill_file(gerber_lib::gerber_file const *g);
+
         // process accumulated 2D contours into final result via Clipper2
         void resolve_2d();
 
@@ -67,8 +71,8 @@ namespace gerber_3d
                                double z_bot_on_ref, double z_top_on_ref,
                                double z_bot_off_ref, double z_top_off_ref);
 
-        // export
-        void export_stl(std::string const &filename) const;
+        // export, the format comes from the extension (.stl, .ply, .obj or .3mf)
+        bool export_mesh(std::filesystem::path const &path) const;
 
         void clear();
         void release();
@@ -76,6 +80,25 @@ namespace gerber_3d
         // settings
         tesselation_quality_t tesselation_quality{ tesselation_quality::medium };
 
+        // sort contours spatially before the parallel union in resolve_2d
+        bool spatial_bucketing{ true };
+
+        // contour vertices closer than this (board units) to the line between their
+        // neighbours are dropped before extruding, 0 keeps them all
+        double decimation_tolerance{ 0.0005 };
+
+        // checked as the drawer works, set_gerber, set_drill_file, resolve_2d and the
+        // extrudes give up if it's stopped and leave the drawer released
+        std::stop_token stop_token;
+
+        // each of those calls reports its own 0..1 into this if it's set
+        job_progress *progress{};
+
+        bool stopped() const
+        {
+            return stop_token.stop_requested();
+        }
+
         static constexpr int64_t CLIPPER_SCALE = 1000000;
 
         // intermediate 2D data (pending contours from fill_elements)
@@ -91,7 +114,40 @@ namespace gerber_3d
         bool has_mesh{};
 
     private:
-        void extrude_polygon(Clipper2Lib::PolyPath64 const &outer_node, float z_bot, float z_top);
+        // fraction of the part of the call between progress_begin and progress_end
+        void report_progress(float fraction) const
+        {
+            if(progress != nullptr) {
+                progress->set(progress_begin + (progress_end - progress_begin) * fraction);
+            }
+        }
+
+        void progress_range(float begin, float end)
+        {
+            progress_begin = begin;
+            progress_end = end;
+            report_progress(0);
+        }
+
+        // release everything if it's been stopped
+        bool give_up();
+
+        float progress_begin{ 0 };
+        float progress_end{ 1 };
+
+        size_t nets_total{};
+        size_t nets_drawn{};
+
+        // one outer (and its holes) extruded on its own, the indices start at 0
+        struct polygon_mesh
+        {
+            std::vector<vec3f> vertices;
+            std::vector<uint32_t> indices;
+        };
+
+        void extrude_polygon(Clipper2Lib::PolyPath64 const &outer_node, float z_bot, float z_top, TESSalloc *tess_alloc, polygon_mesh &mesh) const;
+
+        // every outer in the tree, triangulated in parallel then appended to the mesh
         void process_polytree_children(Clipper2Lib::PolyPath64 const &node, float z_bot, float z_top);
 
         void extrude_flat_region(Clipper2Lib::Paths64 const &paths, float z_bot, float z_top);
@@ -326,6 +326,11 @@ namespace gpu
         auto layer_fs = dev.load_shader("layer.frag", "main", SDL_GPU_SHADERSTAGE_FRAGMENT, 0, 0, 0, 1);
         if(!layer_vs || !layer_fs) return false;
 
+        // layer_compact: VS(0,0,2 storage bufs (flags, entity ranges),1 uniform) + layer FS
+        LOG_INFO("Loading layer_compact shaders");
+        auto layer_compact_vs = dev.load_shader("layer_compact.vert", "main", SDL_GPU_SHADERSTAGE_VERTEX, 0, 0, 2, 1);
+        if(!layer_compact_vs) return false;
+
         // line2: VS(0,0,3 storage bufs,1 uniform) + FS(0,0,0,1 uniform)
         LOG_INFO("Loading line2 shaders");
         auto line2_vs = dev.load_shader("line2.vert", "main", SDL_GPU_SHADERSTAGE_VERTEX, 0, 0, 3, 1);
@@ -507,6 +512,44 @@ namespace gpu
             LOG_INFO("  layer_fill_wireframe pipeline: {}", layer_fill_wireframe != nullptr ? "OK" : "FAILED");
         }
 
+        // ---- Compact layer fill pipeline (same as layer fill but 16 bit tile relative positions, no per vertex entity id) ----
+        {
+            SDL_GPUColorTargetBlendState bs = alpha_blend(true);
+            SDL_GPUColorTargetDescription ct{};
+            ct.format = rt_format;
+            ct.blend_state = bs;
+
+            SDL_GPUVertexAttribute attrs[] = {
+                { 0, 0, SDL_GPU_VERTEXELEMENTFORMAT_USHORT2, 0 },    // position
+            };
+            SDL_GPUVertexBufferDescription vb{};
+            vb.slot = 0;
+            vb.pitch = sizeof(vertex_q16);
+            vb.input_rate = SDL_GPU_VERTEXINPUTRATE_VERTEX;
+
+            SDL_GPUGraphicsPipelineCreateInfo pi{};
+            pi.vertex_shader = layer_compact_vs;
+            pi.fragment_shader = layer_fs;
+            pi.vertex_input_state.vertex_buffer_descriptions = &vb;
+            pi.vertex_input_state.num_vertex_buffers = 1;
+            pi.vertex_input_state.vertex_attributes = attrs;
+            pi.vertex_input_state.num_vertex_attributes = 1;
+            pi.primitive_type = SDL_GPU_PRIMITIVETYPE_TRIANGLELIST;
+            pi.target_info.color_target_descriptions = &ct;
+            pi.target_info.num_color_targets = 1;
+            pi.target_info.has_depth_stencil_target = false;
+            pi.multisample_state.sample_count = msaa_samples;
+            pi.rasterizer_state.fill_mode = SDL_GPU_FILLMODE_FILL;
+            pi.rasterizer_state.cull_mode = SDL_GPU_CULLMODE_NONE;
+
+            layer_fill_compact = dev.create_pipeline(pi);
+            LOG_INFO("  layer_fill_compact pipeline: {}", layer_fill_compact != nullptr ? "OK" : "FAILED");
+
+            pi.rasterizer_state.fill_mode = SDL_GPU_FILLMODE_LINE;
+            layer_fill_compact_wireframe = dev.create_pipeline(pi);
+            LOG_INFO("  layer_fill_compact_wireframe pipeline: {}", layer_fill_compact_wireframe != nullptr ? "OK" : "FAILED");
+        }
+
         // ---- Blit pipeline (render to swapchain, premultiplied alpha) ----
         {
             SDL_GPUColorTargetBlendState bs = premultiplied_blend();
@@ -586,6 +629,7 @@ namespace gpu
         dev.release_shader(color_vs);
         dev.release_shader(common_fs);
         dev.release_shader(layer_vs);
+        dev.release_shader(layer_compact_vs);
         dev.release_shader(layer_fs);
         dev.release_shader(line2_vs);
         dev.release_shader(line2_fs);
@@ -604,6 +648,8 @@ namespace gpu
         dev.release_pipeline(color_lines);
         dev.release_pipeline(layer_fill);
         dev.release_pipeline(layer_fill_wireframe);
+        dev.release_pipeline(layer_fill_compact);
+        dev.release_pipeline(layer_fill_compact_wireframe);
         dev.release_pipeline(blit);
         dev.release_pipeline(blit_blend_premultiplied);
         dev.release_pipeline(selection);
@@ -612,6 +658,7 @@ namespace gpu
         dev.release_pipeline(line2_additive);
         dev.release_sampler(nearest_sampler);
         solid = color = layer_fill = blit = blit_blend_premultiplied = nullptr;
+        layer_fill_wireframe = layer_fill_compact = layer_fill_compact_wireframe = nullptr;
         selection = selection_blend = line2 = line2_additive = nullptr;
         nearest_sampler = nullptr;
     }
@@ -646,6 +693,21 @@ namespace gpu
         add_vertex(end, c);
     }
 
+    void drawlist::triangles()
+    {
+        entries.emplace_back(SDL_GPU_PRIMITIVETYPE_TRIANGLELIST, static_cast<uint32_t>(verts.size()), 0);
+    }
+
+    void drawlist::add_quad(rect const &r, gpu::color c)
+    {
+        add_vertex(r.min_pos, c);
+        add_vertex({ r.max_pos.x, r.min_pos.y }, c);
+        add_vertex(r.max_pos, c);
+        add_vertex(r.min_pos, c);
+        add_vertex(r.max_pos, c);
+        add_vertex({ r.min_pos.x, r.max_pos.y }, c);
+    }
+
     void drawlist::add_outline_rect(rect const &r, gpu::color c)
     {
         // 4 individual lines (8 verts) instead of line strip
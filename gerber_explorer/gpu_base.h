@@ -37,6 +37,21 @@ namespace gpu
         uint32_t entity_id;
     };
 
+    //////////////////////////////////////////////////////////////////////
+    // Compact fill vertex - 16 bit position relative to a tile's origin/scale
+    // entity ids live in a separate table of entity_ranges (one per entity per tile)
+
+    struct vertex_q16
+    {
+        uint16_t x, y;
+    };
+
+    struct entity_range
+    {
+        uint32_t first_vertex;    // tile relative
+        uint32_t entity_id;
+    };
+
     //////////////////////////////////////////////////////////////////////
     // Line instance data (matches gpu::line2_program::line)
 
@@ -124,6 +139,8 @@ namespace gpu
         SDL_GPUGraphicsPipeline *color_lines{};
         SDL_GPUGraphicsPipeline *layer_fill{};
         SDL_GPUGraphicsPipeline *layer_fill_wireframe{};
+        SDL_GPUGraphicsPipeline *layer_fill_compact{};
+        SDL_GPUGraphicsPipeline *layer_fill_compact_wireframe{};
         SDL_GPUGraphicsPipeline *blit{};
         SDL_GPUGraphicsPipeline *blit_blend_premultiplied{};
         SDL_GPUGraphicsPipeline *selection{};
@@ -153,7 +170,7 @@ namespace gpu
             uint32_t count;
         };
 
-        static constexpr int max_verts = 8192;
+        static constexpr int max_verts = 65536;
 
         std::vector<vertex_color> verts;
         std::vector<entry> entries;
@@ -164,6 +181,10 @@ namespace gpu
 
         void lines();
         void add_line(vec2d const &start, vec2d const &end, gpu::color color);
+
+        // lots of filled rects in one draw: triangles() then add_quad for each
+        void triangles();
+        void add_quad(rect const &r, gpu::color color);
         void add_outline_rect(rect const &r, gpu::color color);
         void add_rect(rect const &r, gpu::color color);
     };
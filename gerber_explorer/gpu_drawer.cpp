@@ -2,27 +2,61 @@
 
 #include "gpu_drawer.h"
 #include "gerber_drawer.h"
+#include "job_pool.h"
 
 LOG_CONTEXT("gpu_drawer", info);
 
 namespace gerber
 {
+    namespace
+    {
+        // pad uint8 to uint32 for storage buffer compatibility
+
+        void widen_flags(gerber_drawer const &drawer, std::vector<uint32_t> &flags32)
+        {
+            flags32.resize(drawer.entity_flags.size());
+            job_pool::parallel_for(0, flags32.size(), 16384, [&](size_t begin, size_t end) {
+                for(size_t i = begin; i < end; ++i) {
+                    flags32[i] = drawer.entity_flags[i];
+                }
+            });
+        }
+
+    }    // namespace
+
     void gpu_drawer_resources::create(gpu::device &dev, gerber_drawer const &drawer)
     {
         if(ready) {
             return;
         }
 
-        release(dev);
+        release_geometry(dev);
+
+        bool compact = drawer.is_compact();
 
-        if(drawer.fill_vertices.empty() || drawer.fill_indices.empty()) {
+        if(!compact && (drawer.fill_vertices.empty() || drawer.fill_indices.empty())) {
             return;
         }
 
         LOG_DEBUG("Creating GPU resources for layer '{}'", drawer.name());
 
         // Fill geometry
-        {
+        if(compact) {
+            uint32_t vb_size = static_cast<uint32_t>(drawer.compact_fill_vertices.size() * sizeof(gpu::vertex_q16));
+            vertex_buffer = dev.create_buffer(SDL_GPU_BUFFERUSAGE_VERTEX, vb_size, "fill_verts_compact");
+            dev.upload_to_buffer(vertex_buffer, drawer.compact_fill_vertices.data(), vb_size);
+
+            num_indices = static_cast<uint32_t>(drawer.compact_fill_indices.size());
+            uint32_t ib_size = num_indices * sizeof(uint16_t);
+            index_buffer = dev.create_buffer(SDL_GPU_BUFFERUSAGE_INDEX, ib_size, "fill_indices_compact");
+            dev.upload_to_buffer(index_buffer, drawer.compact_fill_indices.data(), ib_size);
+
+            uint32_t rb_size = static_cast<uint32_t>(drawer.compact_ranges.size() * sizeof(gpu::entity_range));
+            range_buffer = dev.create_buffer(SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ, rb_size, "entity_ranges");
+            dev.upload_to_buffer(range_buffer, drawer.compact_ranges.data(), rb_size);
+
+            compact_tiles.assign(drawer.compact_tiles.begin(), drawer.compact_tiles.end());
+        } else {
             uint32_t vb_size = static_cast<uint32_t>(drawer.fill_vertices.size() * sizeof(gpu::vertex_entity));
             vertex_buffer = dev.create_buffer(SDL_GPU_BUFFERUSAGE_VERTEX, vb_size, "fill_verts");
             dev.upload_to_buffer(vertex_buffer, drawer.fill_vertices.data(), vb_size);
@@ -33,13 +67,11 @@ namespace gerber
             dev.upload_to_buffer(index_buffer, drawer.fill_indices.data(), ib_size);
         }
 
-        // Flags storage buffer - pad uint8 to uint32 for storage buffer compatibility
+        // Flags storage buffer
         if(!drawer.entity_flags.empty()) {
             uint32_t count = static_cast<uint32_t>(drawer.entity_flags.size());
-            std::vector<uint32_t> flags32(count);
-            for(uint32_t i = 0; i < count; ++i) {
-                flags32[i] = drawer.entity_flags[i];
-            }
+            std::vector<uint32_t> flags32;
+            widen_flags(drawer, flags32);
             uint32_t size = count * sizeof(uint32_t);
             flags_buffer = dev.create_buffer(SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ, size, "flags");
             dev.upload_to_buffer(flags_buffer, flags32.data(), size);
@@ -60,37 +92,50 @@ namespace gerber
             dev.upload_to_buffer(line_vertex_buffer, drawer.outline_vertices.data(), size);
         }
 
-        // Mask geometry (for inverted layers)
-        if(drawer.got_mask && !drawer.mask.vertices.empty() && !drawer.mask.indices.empty()) {
-            uint32_t mvb_size = static_cast<uint32_t>(drawer.mask.vertices.size() * sizeof(gpu::vertex_solid));
-            mask_vertex_buffer = dev.create_buffer(SDL_GPU_BUFFERUSAGE_VERTEX, mvb_size, "mask_verts");
-            dev.upload_to_buffer(mask_vertex_buffer, drawer.mask.vertices.data(), mvb_size);
+        ready = true;
+        LOG_DEBUG("GPU resources created: {} verts, {} indices, {} lines, {} tiles",
+                 compact ? drawer.compact_fill_vertices.size() : drawer.fill_vertices.size(), num_indices, num_lines, compact_tiles.size());
+    }
 
-            mask_num_indices = static_cast<uint32_t>(drawer.mask.indices.size());
-            uint32_t mib_size = mask_num_indices * sizeof(uint32_t);
-            mask_index_buffer = dev.create_buffer(SDL_GPU_BUFFERUSAGE_INDEX, mib_size, "mask_indices");
-            dev.upload_to_buffer(mask_index_buffer, drawer.mask.indices.data(), mib_size);
-        }
+    // Mask geometry (for inverted layers), the mask never changes once built
 
-        ready = true;
-        LOG_DEBUG("GPU resources created: {} verts, {} indices, {} lines",
-                 drawer.fill_vertices.size(), drawer.fill_indices.size(), num_lines);
+    void gpu_drawer_resources::create_mask(gpu::device &dev, solid_shape const &mask)
+    {
+        if(mask_vertex_buffer != nullptr || mask.vertices.empty() || mask.indices.empty()) {
+            return;
+        }
+        uint32_t mvb_size = static_cast<uint32_t>(mask.vertices.size() * sizeof(gpu::vertex_solid));
+        mask_vertex_buffer = dev.create_buffer(SDL_GPU_BUFFERUSAGE_VERTEX, mvb_size, "mask_verts");
+        dev.upload_to_buffer(mask_vertex_buffer, mask.vertices.data(), mvb_size);
+
+        mask_num_indices = static_cast<uint32_t>(mask.indices.size());
+        uint32_t mib_size = mask_num_indices * sizeof(uint32_t);
+        mask_index_buffer = dev.create_buffer(SDL_GPU_BUFFERUSAGE_INDEX, mib_size, "mask_indices");
+        dev.upload_to_buffer(mask_index_buffer, mask.indices.data(), mib_size);
     }
 
-    void gpu_drawer_resources::release(gpu::device &dev)
+    void gpu_drawer_resources::release_geometry(gpu::device &dev)
     {
         dev.release_buffer(vertex_buffer);
         dev.release_buffer(index_buffer);
         dev.release_buffer(flags_buffer);
         dev.release_buffer(line_instance_buffer);
         dev.release_buffer(line_vertex_buffer);
+        dev.release_buffer(range_buffer);
+        vertex_buffer = index_buffer = flags_buffer = range_buffer = nullptr;
+        compact_tiles.clear();
+        line_instance_buffer = line_vertex_buffer = nullptr;
+        num_indices = num_lines = 0;
+        ready = false;
+    }
+
+    void gpu_drawer_resources::release(gpu::device &dev)
+    {
+        release_geometry(dev);
         dev.release_buffer(mask_vertex_buffer);
         dev.release_buffer(mask_index_buffer);
-        vertex_buffer = index_buffer = flags_buffer = nullptr;
-        line_instance_buffer = line_vertex_buffer = nullptr;
         mask_vertex_buffer = mask_index_buffer = nullptr;
-        num_indices = num_lines = mask_num_indices = 0;
-        ready = false;
+        mask_num_indices = 0;
     }
 
     void gpu_drawer_resources::update_flags(gpu::device &dev, gerber_drawer const &drawer)
@@ -99,10 +144,8 @@ namespace gerber
             return;
         }
         uint32_t count = static_cast<uint32_t>(drawer.entity_flags.size());
-        std::vector<uint32_t> flags32(count);
-        for(uint32_t i = 0; i < count; ++i) {
-            flags32[i] = drawer.entity_flags[i];
-        }
+        std::vector<uint32_t> flags32;
+        widen_flags(drawer, flags32);
         uint32_t size = count * sizeof(uint32_t);
         dev.upload_to_buffer(flags_buffer, flags32.data(), size);
     }
@@ -6,25 +6,28 @@
 
 #include "gpu_base.h"
 #include "gerber_arena.h"
+#include "gerber_drawer.h"
 
 namespace gerber
 {
-    struct gerber_drawer;    // forward - we read its arenas
-
     struct gpu_drawer_resources
     {
         // GPU buffers for fill geometry
         SDL_GPUBuffer *vertex_buffer{};      // vertex_entity data
-        SDL_GPUBuffer *index_buffer{};       // uint32 triangle indices
+        SDL_GPUBuffer *index_buffer{};       // uint32 triangle indices (uint16 if compact)
         uint32_t num_indices{};
 
+        // Compact fill format - vertex_buffer is vertex_q16, one draw per tile
+        SDL_GPUBuffer *range_buffer{};                // entity_range structs
+        std::vector<compact_tile> compact_tiles;    // empty if not compact
+
         // Storage buffers (replace GL TBOs)
         SDL_GPUBuffer *flags_buffer{};           // uint32 per entity (padded from uint8)
         SDL_GPUBuffer *line_instance_buffer{};   // line_instance structs
         SDL_GPUBuffer *line_vertex_buffer{};     // vec2f positions
         uint32_t num_lines{};
 
-        // Mask for inverted layers
+        // Mask for inverted layers - uploaded once, survives retesselation
         SDL_GPUBuffer *mask_vertex_buffer{};
         SDL_GPUBuffer *mask_index_buffer{};
         uint32_t mask_num_indices{};
@@ -32,6 +35,8 @@ namespace gerber
         bool ready{};
 
         void create(gpu::device &dev, gerber_drawer const &drawer);
+        void create_mask(gpu::device &dev, solid_shape const &mask);
+        void release_geometry(gpu::device &dev);
         void release(gpu::device &dev);
         void update_flags(gpu::device &dev, gerber_drawer const &drawer);
     };
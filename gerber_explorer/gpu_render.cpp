@@ -24,6 +24,18 @@ static SDL_GPUSampleCount msaa_int_to_enum(int n)
     return SDL_GPU_SAMPLECOUNT_1;
 }
 
+// the heatmap leaves this much of the overlay drawlist for everything else
+static constexpr int overlay_reserved_verts = 16384;
+
+// heatmap: empty is blue, half full green, full red
+static gpu::color density_color(double fill)
+{
+    float f = (float)std::clamp(fill, 0.0, 1.0);
+    float r = std::clamp(f * 2 - 1, 0.0f, 1.0f);
+    float b = std::clamp(1 - f * 2, 0.0f, 1.0f);
+    return gpu::color_from_floats(r, 1 - r - b, b, 0.45f);
+}
+
 //////////////////////////////////////////////////////////////////////
 
 void gerber_explorer::gpu_render()
@@ -110,10 +122,10 @@ void gerber_explorer::gpu_render()
     // ---- Render each layer (use the sorted order from on_render) ----
     gerber_layer *outline_layer = get_outline_layer();
 
-    // Ensure outline layer's GPU resources exist even if it's not visible
+    // Ensure outline layer's mask is uploaded even if it's not visible
     // (needed for inverted layer mask rendering)
-    if(outline_layer != nullptr && outline_layer->got_mask && outline_layer->drawer != nullptr) {
-        outline_layer->gpu_resources.create(gpu_dev, *outline_layer->drawer);
+    if(outline_layer != nullptr && outline_layer->got_mask) {
+        outline_layer->gpu_resources.create_mask(gpu_dev, outline_layer->mask);
     }
 
     // Build ordered_layers and sort them the same way on_render() does
@@ -123,25 +135,7 @@ void gerber_explorer::gpu_render()
             ordered_layers.push_back(l);
         }
     }
-    if(settings.board_view != board_view_all) {
-        std::sort(ordered_layers.begin(), ordered_layers.end(), [this](gerber_layer const *a, gerber_layer const *b) {
-            using namespace gerber_lib;
-            layer::type_t drill_ordered = layer::type_t::drill_top;
-            if(settings.board_view == board_view_bottom) {
-                drill_ordered = layer::type_t::drill_bottom;
-                std::swap(a, b);
-            }
-            int ta = a->file.layer_type;
-            int tb = b->file.layer_type;
-            if(is_layer_type(ta, layer::type_t::drill)) {
-                ta = drill_ordered;
-            }
-            if(is_layer_type(tb, layer::type_t::drill)) {
-                tb = drill_ordered;
-            }
-            return ta > tb;
-        });
-    }
+    sort_layers_for_view(ordered_layers);
 
     for(auto *layer_ptr : ordered_layers) {
         gerber_layer &layer = *layer_ptr;
@@ -290,18 +284,6 @@ void gerber_explorer::gpu_render_layer(SDL_GPUCommandBuffer *cmd, gerber_layer &
         }
 
         // Draw layer fill
-        SDL_BindGPUGraphicsPipeline(pass, settings.wireframe ? gpu_pipelines.layer_fill_wireframe : gpu_pipelines.layer_fill);
-
-        // Vertex uniforms: transform + draw_flags
-        struct {
-            gpu::matrix transform;
-            int32_t draw_flags;
-            int32_t _pad[3];
-        } layer_vs_uniforms;
-        layer_vs_uniforms.transform = world_matrix;
-        layer_vs_uniforms.draw_flags = entity_flags_t::fill | entity_flags_t::clear;
-        SDL_PushGPUVertexUniformData(cmd, 0, &layer_vs_uniforms, sizeof(layer_vs_uniforms));
-
         // Fragment uniforms: red/green/blue flags + value
         struct {
             int32_t red_flags;
@@ -320,6 +302,35 @@ void gerber_explorer::gpu_render_layer(SDL_GPUCommandBuffer *cmd, gerber_layer &
         layer_fs_uniforms.value[3] = 1;
         SDL_PushGPUFragmentUniformData(cmd, 0, &layer_fs_uniforms, sizeof(layer_fs_uniforms));
 
+        gpu_draw_layer_fill(cmd, pass, res, entity_flags_t::fill | entity_flags_t::clear, settings.wireframe);
+
+        SDL_EndGPURenderPass(pass);
+    }
+
+    // Blit is handled by the caller (gpu_render) after this function returns
+}
+
+//////////////////////////////////////////////////////////////////////
+// Draw the fill triangles of a layer (fragment uniforms must already be pushed)
+// Compact layers are drawn one tile at a time: the vertex buffer is bound at the
+// tile's offset so vertex ids (and the 16 bit indices) are tile relative
+
+void gerber_explorer::gpu_draw_layer_fill(SDL_GPUCommandBuffer *cmd, SDL_GPURenderPass *pass, gerber::gpu_drawer_resources const &res, int draw_flags, bool wireframe)
+{
+    if(res.compact_tiles.empty()) {
+
+        SDL_BindGPUGraphicsPipeline(pass, wireframe ? gpu_pipelines.layer_fill_wireframe : gpu_pipelines.layer_fill);
+
+        // Vertex uniforms: transform + draw_flags
+        struct {
+            gpu::matrix transform;
+            int32_t draw_flags;
+            int32_t _pad[3];
+        } layer_vs_uniforms;
+        layer_vs_uniforms.transform = world_matrix;
+        layer_vs_uniforms.draw_flags = draw_flags;
+        SDL_PushGPUVertexUniformData(cmd, 0, &layer_vs_uniforms, sizeof(layer_vs_uniforms));
+
         // Bind vertex storage buffer (flags)
         SDL_BindGPUVertexStorageBuffers(pass, 0, &res.flags_buffer, 1);
 
@@ -333,11 +344,47 @@ void gerber_explorer::gpu_render_layer(SDL_GPUCommandBuffer *cmd, gerber_layer &
         SDL_BindGPUIndexBuffer(pass, &ib, SDL_GPU_INDEXELEMENTSIZE_32BIT);
 
         SDL_DrawGPUIndexedPrimitives(pass, res.num_indices, 1, 0, 0, 0);
-
-        SDL_EndGPURenderPass(pass);
+        return;
     }
 
-    // Blit is handled by the caller (gpu_render) after this function returns
+    SDL_BindGPUGraphicsPipeline(pass, wireframe ? gpu_pipelines.layer_fill_compact_wireframe : gpu_pipelines.layer_fill_compact);
+
+    SDL_GPUBuffer *storage_buffers[] = { res.flags_buffer, res.range_buffer };
+    SDL_BindGPUVertexStorageBuffers(pass, 0, storage_buffers, 2);
+
+    SDL_GPUBufferBinding ib{};
+    ib.buffer = res.index_buffer;
+    SDL_BindGPUIndexBuffer(pass, &ib, SDL_GPU_INDEXELEMENTSIZE_16BIT);
+
+    struct {
+        gpu::matrix transform;
+        int32_t draw_flags;
+        uint32_t range_offset;
+        uint32_t range_count;
+        int32_t _pad;
+        float tile_origin[2];
+        float tile_scale[2];
+    } compact_vs_uniforms;
+    compact_vs_uniforms.transform = world_matrix;
+    compact_vs_uniforms.draw_flags = draw_flags;
+    compact_vs_uniforms._pad = 0;
+
+    for(auto const &tile : res.compact_tiles) {
+        compact_vs_uniforms.range_offset = tile.range_offset;
+        compact_vs_uniforms.range_count = tile.range_count;
+        compact_vs_uniforms.tile_origin[0] = tile.origin.x;
+        compact_vs_uniforms.tile_origin[1] = tile.origin.y;
+        compact_vs_uniforms.tile_scale[0] = tile.scale.x;
+        compact_vs_uniforms.tile_scale[1] = tile.scale.y;
+        SDL_PushGPUVertexUniformData(cmd, 0, &compact_vs_uniforms, sizeof(compact_vs_uniforms));
+
+        SDL_GPUBufferBinding vb{};
+        vb.buffer = res.vertex_buffer;
+        vb.offset = tile.vertex_offset * sizeof(gpu::vertex_q16);
+        SDL_BindGPUVertexBuffers(pass, 0, &vb, 1);
+
+        SDL_DrawGPUIndexedPrimitives(pass, tile.index_count, 1, tile.index_offset, 0, 0);
+    }
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -366,14 +413,6 @@ void gerber_explorer::gpu_render_selection(SDL_GPUCommandBuffer *cmd, SDL_GPUTex
 
         SDL_GPURenderPass *pass = SDL_BeginGPURenderPass(cmd, &ct, 1, nullptr);
 
-        SDL_BindGPUGraphicsPipeline(pass, gpu_pipelines.layer_fill);
-
-        // Vertex uniforms: world_matrix + draw_flags (only selection-flagged entities)
-        struct { gpu::matrix transform; int32_t draw_flags; int32_t _pad[3]; } vs_uni;
-        vs_uni.transform = world_matrix;
-        vs_uni.draw_flags = draw_flags;
-        SDL_PushGPUVertexUniformData(cmd, 0, &vs_uni, sizeof(vs_uni));
-
         // Fragment uniforms: map hovered→R, selected→G, active→B
         struct { int32_t red_flags, green_flags, blue_flags, _pad; float value[4]; } fs_uni;
         fs_uni.red_flags = entity_flags_t::hovered;
@@ -383,14 +422,8 @@ void gerber_explorer::gpu_render_selection(SDL_GPUCommandBuffer *cmd, SDL_GPUTex
         fs_uni.value[0] = fs_uni.value[1] = fs_uni.value[2] = fs_uni.value[3] = 1.0f;
         SDL_PushGPUFragmentUniformData(cmd, 0, &fs_uni, sizeof(fs_uni));
 
-        SDL_BindGPUVertexStorageBuffers(pass, 0, &res.flags_buffer, 1);
-
-        SDL_GPUBufferBinding vb{}; vb.buffer = res.vertex_buffer;
-        SDL_BindGPUVertexBuffers(pass, 0, &vb, 1);
-        SDL_GPUBufferBinding ib{}; ib.buffer = res.index_buffer;
-        SDL_BindGPUIndexBuffer(pass, &ib, SDL_GPU_INDEXELEMENTSIZE_32BIT);
-
-        SDL_DrawGPUIndexedPrimitives(pass, res.num_indices, 1, 0, 0, 0);
+        // only selection-flagged entities
+        gpu_draw_layer_fill(cmd, pass, res, draw_flags, false);
 
         SDL_EndGPURenderPass(pass);
     }
@@ -545,6 +578,50 @@ void gerber_explorer::gpu_render_overlay(SDL_GPUCommandBuffer *cmd, SDL_GPUTextu
     // Build overlay drawlist (same as GL path)
     gpu_overlay.reset();
 
+    // copper density heatmap for the selected layer, first so the rest of the overlay goes on top
+    if(settings.show_density && selected_layer != nullptr) {
+        std::shared_ptr<gerber::soft_density const> density;
+        {
+            std::lock_guard l(layer_drawer_mutex);
+            density = selected_layer->density;
+        }
+        if(density != nullptr && !density->empty()) {
+            // the drawlist drops anything past max_verts, so when there are too many
+            // tiles draw blocks of them instead and leave room for the rest of the overlay
+            int constexpr max_quads = (gpu::drawlist::max_verts - overlay_reserved_verts) / 6;
+            int step = 1;
+            while(((density->tiles_x + step - 1) / step) * ((density->tiles_y + step - 1) / step) > max_quads) {
+                step += 1;
+            }
+            gpu_overlay.triangles();
+            for(int y = 0; y < density->tiles_y; y += step) {
+                for(int x = 0; x < density->tiles_x; x += step) {
+                    int x_end = std::min(x + step, density->tiles_x);
+                    int y_end = std::min(y + step, density->tiles_y);
+                    double copper = 0;
+                    double board = 0;
+                    for(int ty = y; ty < y_end; ++ty) {
+                        for(int tx = x; tx < x_end; ++tx) {
+                            size_t i = (size_t)ty * density->tiles_x + tx;
+                            copper += density->copper_area[i];
+                            board += density->board_area[i];
+                        }
+                    }
+                    if(board <= 0) {
+                        continue;
+                    }
+                    rect block = density->tile_rect(x, y);
+                    block.max_pos = density->tile_rect(x_end - 1, y_end - 1).max_pos;
+                    rect s = viewport_rect_from_board_rect(block);
+                    if(s.max_pos.x < 0 || s.max_pos.y < 0 || s.min_pos.x > viewport_size.x || s.min_pos.y > viewport_size.y) {
+                        continue;
+                    }
+                    gpu_overlay.add_quad(s, density_color(copper / board));
+                }
+            }
+        }
+    }
+
     if(mouse_mode == mouse_drag_zoom_select) {
         // TODO: correct_aspect_ratio for zoom select preview
         gpu_overlay.add_rect(drag_rect, 0x800000ff);
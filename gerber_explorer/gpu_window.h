@@ -134,6 +134,7 @@ namespace sdl_compat
     constexpr int KEY_O = SDLK_O;
     constexpr int KEY_S = SDLK_S;
     constexpr int KEY_L = SDLK_L;
+    constexpr int KEY_N = SDLK_N;
     constexpr int KEY_LEFT_ALT = SDLK_LALT;
     constexpr int KEY_RIGHT_ALT = SDLK_RALT;
 }
@@ -1,49 +1,552 @@
 #include <algorithm>
 #include "job_pool.h"
+#include "job_trace.h"
 #include "gerber_log.h"
 
 //////////////////////////////////////////////////////////////////////
 
+namespace
+{
+    // which pool/worker (if any) the current thread belongs to
+
+    thread_local job_pool *current_pool{ nullptr };
+    thread_local size_t current_worker{ 0 };
+
+    // how many times an idle worker yields and looks again before it sleeps. A
+    // thread adding lots of jobs would otherwise wake it for every one of them
+    int constexpr idle_spins = 16;
+
+}    // namespace
+
+std::atomic<job_pool *> job_pool::running_pool{ nullptr };
+
+//////////////////////////////////////////////////////////////////////
+// Chase-Lev work stealing deque (Le, Pop, Cohen, Zappa Nardelli 2013)
+
+bool job_pool::work_deque::push(uint32_t job)
+{
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    if(b - t >= capacity) {
+        return false;
+    }
+    items[b & (capacity - 1)].store(job, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+uint32_t job_pool::work_deque::pop()
+{
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    if(t > b) {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return no_job;
+    }
+    uint32_t job = items[b & (capacity - 1)].load(std::memory_order_relaxed);
+    if(t == b) {
+        // last one, race the thieves for it
+        if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            job = no_job;
+        }
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+uint32_t job_pool::work_deque::steal()
+{
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if(t >= b) {
+        return no_job;
+    }
+    uint32_t job = items[t & (capacity - 1)].load(std::memory_order_relaxed);
+    if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return no_job;
+    }
+    return job;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+bool job_pool::work_deque::empty() const
+{
+    return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Vyukov bounded MPMC queue
+
+job_pool::injection_queue::injection_queue() : cells(new cell[capacity])
+{
+    for(size_t i = 0; i < capacity; ++i) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+bool job_pool::injection_queue::push(uint32_t job)
+{
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    cell *c;
+    while(true) {
+        c = &cells[pos & (capacity - 1)];
+        size_t seq = c->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if(diff == 0) {
+            if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {
+            return false;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    c->job = job;
+    c->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+uint32_t job_pool::injection_queue::pop()
+{
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    cell *c;
+    while(true) {
+        c = &cells[pos & (capacity - 1)];
+        size_t seq = c->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if(diff == 0) {
+            if(dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {
+            return no_job;
+        } else {
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    uint32_t job = c->job;
+    c->sequence.store(pos + capacity, std::memory_order_release);
+    return job;
+}
+
+//////////////////////////////////////////////////////////////////////
+
 job_pool::~job_pool()
 {
-    cv.notify_all();
+    shut_down();
 }
 
 //////////////////////////////////////////////////////////////////////
 
 void job_pool::shut_down()
 {
+    job_pool *self = this;
+    running_pool.compare_exchange_strong(self, nullptr);
+    num_workers.store(0, std::memory_order_release);
+
     abort_jobs(0xffffffff);
 
+    stopping.store(true);
     for(auto &w : workers) {
         w.get_stop_source().request_stop();
     }
-
-    cv.notify_all();
+    wake_workers(true);
     workers.clear();
+
+    // nobody is left to pop the cancelled ones, destroy their closures here
+    discard_queued_jobs();
 }
 
 //////////////////////////////////////////////////////////////////////
 
 void job_pool::start_workers(size_t thread_count)
 {
+    stopping.store(false);
+    worker_states.clear();
+    for(size_t i = 0; i < thread_count; ++i) {
+        worker_states.push_back(std::make_unique<worker_state>());
+    }
     for(size_t i = 0; i < thread_count; ++i) {
-        workers.emplace_back([this](std::stop_token stoken) { worker_loop(stoken); });
+        workers.emplace_back([this, i](std::stop_token stoken) { worker_loop(stoken, i); });
     }
+    num_workers.store(thread_count, std::memory_order_release);
+    running_pool.store(this, std::memory_order_release);
 }
 
 //////////////////////////////////////////////////////////////////////
+// Slots are never freed until the pool is destroyed so a stale index
+// is always safe to look at
 
-bool job_pool::get_active_job_count(uint32_t mask)
+void job_pool::grow_slots()
+{
+    std::lock_guard lock(grow_mutex);
+
+    // someone else might have grown it while we waited
+    if((free_head.load(std::memory_order_acquire) & 0xffffffff) != no_job) {
+        return;
+    }
+    uint32_t c = num_chunks.load(std::memory_order_relaxed);
+    if(c == max_chunks) {
+        return;
+    }
+    chunk_storage[c] = std::make_unique<job_slot[]>(slots_per_chunk);
+    chunks[c].store(chunk_storage[c].get(), std::memory_order_release);
+    num_chunks.store(c + 1, std::memory_order_release);
+    for(uint32_t i = slots_per_chunk; i != 0; --i) {
+        free_slot(c * slots_per_chunk + i - 1);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+uint32_t job_pool::alloc_slot()
 {
-    std::lock_guard lock(queue_mutex);
-    for(auto &task : tasks) {
-        if((task.flags & mask) != 0) {
+    while(true) {
+        uint64_t head = free_head.load(std::memory_order_acquire);
+        uint32_t job = static_cast<uint32_t>(head);
+        if(job == no_job) {
+            if(num_chunks.load(std::memory_order_acquire) == max_chunks) {
+                // every slot is in use, free one up by running something
+                run_queued_job();
+            } else {
+                grow_slots();
+            }
+            continue;
+        }
+        uint64_t next = slot(job).next_free.load(std::memory_order_relaxed);
+        uint64_t new_head = ((head >> 32) + 1) << 32 | next;
+        if(free_head.compare_exchange_weak(head, new_head, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return job;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void job_pool::free_slot(uint32_t job)
+{
+    job_slot &s = slot(job);
+    uint64_t head = free_head.load(std::memory_order_relaxed);
+    while(true) {
+        s.next_free.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        uint64_t new_head = ((head >> 32) + 1) << 32 | job;
+        if(free_head.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void job_pool::wake_workers(bool all)
+{
+    wake_epoch.fetch_add(1);
+    if(sleeping.load() != 0) {
+        if(all) {
+            wake_epoch.notify_all();
+        } else {
+            wake_epoch.notify_one();
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void job_pool::submit(uint32_t job)
+{
+    priority_t priority = slot(job).priority;
+    bool queued = false;
+    if(current_pool == this) {
+        queued = worker_states[current_worker]->deques[priority].push(job);
+    }
+    if(!queued) {
+        injected[priority].push(job);
+    }
+    wake_workers(false);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    struct spin_lock_guard
+    {
+        std::atomic_flag &flag;
+
+        explicit spin_lock_guard(std::atomic_flag &f) : flag(f)
+        {
+            while(flag.test_and_set(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        }
+
+        ~spin_lock_guard()
+        {
+            flag.clear(std::memory_order_release);
+        }
+    };
+
+}    // namespace
+
+//////////////////////////////////////////////////////////////////////
+// Keeps job_trace out of the header, it's only a relaxed load when tracing is off
+
+uint64_t job_pool::trace_time()
+{
+    return job_trace::enabled() ? job_trace::now() : 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+uint32_t job_pool::get_generation(job_slot &s)
+{
+    spin_lock_guard lock(s.successor_lock);
+    return s.generation;
+}
+
+//////////////////////////////////////////////////////////////////////
+// If the dependency hasn't finished yet, it releases the job when it does
+
+void job_pool::add_dependency(uint32_t job, job_handle dependency)
+{
+    if(!dependency.valid()) {
+        return;
+    }
+    job_slot &d = slot(dependency.job);
+    spin_lock_guard lock(d.successor_lock);
+    if(d.generation == dependency.generation) {
+        slot(job).pending.fetch_add(1, std::memory_order_relaxed);
+        d.successors.push_back(job);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// When the last dependency goes the job is queued (cancelled ones are
+// queued too, the worker which pops it throws it away)
+
+void job_pool::release_dependency(uint32_t job)
+{
+    job_slot &s = slot(job);
+    if(s.pending.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    uint32_t state = s.state.load(std::memory_order_acquire);
+    while(state != job_state_cancelled) {
+        if((state & job_state_locked) != 0) {
+            std::this_thread::yield();
+            state = s.state.load(std::memory_order_acquire);
+            continue;
+        }
+        if(s.state.compare_exchange_weak(state, job_state_queued, std::memory_order_acq_rel)) {
+            break;
+        }
+    }
+    submit(job);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void job_pool::finish_job(uint32_t job)
+{
+    job_slot &s = slot(job);
+    spin_lock_guard lock(s.successor_lock);
+    s.generation += 1;
+    for(uint32_t successor : s.successors) {
+        release_dependency(successor);
+    }
+    s.successors.clear();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Highest priority first: own deque, then the injection queue, then steal
+
+uint32_t job_pool::find_job(size_t worker_index)
+{
+    size_t num_workers = worker_states.size();
+    for(uint32_t p = 0; p < num_priorities; ++p) {
+        uint32_t job = worker_states[worker_index]->deques[p].pop();
+        if(job != no_job) {
+            return job;
+        }
+        job = injected[p].pop();
+        if(job != no_job) {
+            return job;
+        }
+        for(size_t i = 1; i < num_workers; ++i) {
+            job = worker_states[(worker_index + i) % num_workers]->deques[p].steal();
+            if(job != no_job) {
+                return job;
+            }
+        }
+    }
+    return no_job;
+}
+
+//////////////////////////////////////////////////////////////////////
+// For threads which aren't workers: the injection queues, then steal
+
+uint32_t job_pool::steal_job()
+{
+    for(uint32_t p = 0; p < num_priorities; ++p) {
+        uint32_t job = injected[p].pop();
+        if(job != no_job) {
+            return job;
+        }
+        for(auto &w : worker_states) {
+            job = w->deques[p].steal();
+            if(job != no_job) {
+                return job;
+            }
+        }
+    }
+    return no_job;
+}
+
+//////////////////////////////////////////////////////////////////////
+// When every slot is in use the thread adding a job runs a queued one
+// instead of waiting for a slot to come back. A worker adding jobs (or the
+// only thread when there are no workers) would otherwise wait for itself
+
+void job_pool::run_queued_job()
+{
+    uint32_t job = current_pool == this ? find_job(current_worker) : steal_job();
+    if(job != no_job) {
+        run_job(job);
+    } else {
+        std::this_thread::yield();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Spin while abort_jobs has the slot locked, it only holds it briefly
+
+bool job_pool::lock_slot(job_slot &s, uint32_t &state)
+{
+    state = s.state.load(std::memory_order_acquire);
+    while(true) {
+        if((state & job_state_locked) != 0) {
+            std::this_thread::yield();
+            state = s.state.load(std::memory_order_acquire);
+            continue;
+        }
+        if(state != job_state_queued && state != job_state_running && state != job_state_waiting) {
+            return false;
+        }
+        if(s.state.compare_exchange_weak(state, state | job_state_locked, std::memory_order_acquire)) {
             return true;
         }
     }
-    for(auto *active : active_jobs) {
-        if((active->flags & mask) != 0) {
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void job_pool::run_job(uint32_t job)
+{
+    job_slot &s = slot(job);
+
+    // queued -> running unless it was cancelled while it sat in a queue
+    uint32_t state = s.state.load(std::memory_order_acquire);
+    while(true) {
+        if((state & job_state_locked) != 0) {
+            std::this_thread::yield();
+            state = s.state.load(std::memory_order_acquire);
+            continue;
+        }
+        if(state == job_state_cancelled) {
+            break;
+        }
+        if(s.state.compare_exchange_weak(state, job_state_running, std::memory_order_acq_rel)) {
+            queued_count.fetch_sub(1, std::memory_order_relaxed);
+            active_count.fetch_add(1, std::memory_order_relaxed);
+            if(s.enqueue_time != 0 && job_trace::enabled()) {
+                uint64_t start_time = job_trace::now();
+                s.work(s.stop_src.get_token());
+                job_trace::record_job(s.flags.load(std::memory_order_relaxed), s.group.load(std::memory_order_relaxed), s.enqueue_time, start_time, job_trace::now());
+            } else {
+                s.work(s.stop_src.get_token());
+            }
+            break;
+        }
+    }
+    s.work.reset();
+
+    // running/cancelled -> free, waiting for abort_jobs to let go of it
+    state = s.state.load(std::memory_order_acquire);
+    while(true) {
+        if((state & job_state_locked) != 0) {
+            std::this_thread::yield();
+            state = s.state.load(std::memory_order_acquire);
+            continue;
+        }
+        if(s.state.compare_exchange_weak(state, job_state_free, std::memory_order_acq_rel)) {
+            break;
+        }
+    }
+    if(state == job_state_running) {
+        active_count.fetch_sub(1, std::memory_order_relaxed);
+    }
+    finish_job(job);
+
+    // a stop_source can't be reset, so only a stopped one costs an allocation
+    if(s.stop_src.stop_requested()) {
+        s.stop_src = std::stop_source{};
+    }
+    free_slot(job);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void job_pool::discard_queued_jobs()
+{
+    for(uint32_t p = 0; p < num_priorities; ++p) {
+        while(injected[p].pop() != no_job) {
+        }
+        for(auto &w : worker_states) {
+            while(w->deques[p].steal() != no_job) {
+            }
+        }
+    }
+    uint32_t n = num_chunks.load(std::memory_order_acquire);
+    for(uint32_t job = 0; job < n * slots_per_chunk; ++job) {
+        job_slot &s = slot(job);
+        uint32_t state = s.state.exchange(job_state_free);
+        if(state == job_state_free) {
+            continue;
+        }
+        if(state == job_state_queued || state == job_state_waiting) {
+            queued_count.fetch_sub(1, std::memory_order_relaxed);
+        }
+        s.work.reset();
+        s.generation += 1;
+        s.successors.clear();
+        free_slot(job);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+bool job_pool::get_active_job_count(uint32_t mask)
+{
+    uint32_t n = num_chunks.load(std::memory_order_acquire);
+    for(uint32_t job = 0; job < n * slots_per_chunk; ++job) {
+        job_slot &s = slot(job);
+        uint32_t state = s.state.load(std::memory_order_acquire) & ~job_state_locked;
+        bool outstanding = state == job_state_queued || state == job_state_running || state == job_state_waiting;
+        if(outstanding && (s.flags.load(std::memory_order_relaxed) & mask) != 0) {
             return true;
         }
     }
@@ -54,63 +557,153 @@ bool job_pool::get_active_job_count(uint32_t mask)
 
 job_pool::pool_info job_pool::get_info()
 {
-    std::lock_guard lock(queue_mutex);
-    return { active_jobs.size(), tasks.size() };
+    return { active_count.load(std::memory_order_relaxed), queued_count.load(std::memory_order_relaxed) };
+}
+
+//////////////////////////////////////////////////////////////////////
+// Queued (or waiting) jobs which match are cancelled and will be discarded
+// when a worker pops them, running ones are asked to stop
+
+template <typename P> void job_pool::abort_where(P &&matches)
+{
+    uint32_t n = num_chunks.load(std::memory_order_acquire);
+    for(uint32_t job = 0; job < n * slots_per_chunk; ++job) {
+        job_slot &s = slot(job);
+        uint32_t state;
+        if(!lock_slot(s, state)) {
+            continue;
+        }
+        uint32_t new_state = state;
+        if(matches(s)) {
+            if(state == job_state_running) {
+                s.stop_src.request_stop();
+            } else {
+                new_state = job_state_cancelled;
+                queued_count.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        s.state.store(new_state, std::memory_order_release);
+    }
 }
 
 //////////////////////////////////////////////////////////////////////
 
 void job_pool::abort_jobs(uint32_t mask)
 {
-    std::lock_guard lock(queue_mutex);
+    abort_where([mask](job_slot const &s) { return (s.flags.load(std::memory_order_relaxed) & mask) != 0; });
+}
 
-    auto [first, last] = std::ranges::remove_if(tasks, [mask](const job_item &item) {
-        if((item.flags & mask) != 0) {
-            item.stop_src.request_stop();
-            return true;
-        }
-        return false;
-    });
-    tasks.erase(first, last);
+//////////////////////////////////////////////////////////////////////
 
-    for(auto *active_job : active_jobs) {
-        if((active_job->flags & mask) != 0) {
-            active_job->stop_src.request_stop();
-        }
+// Jobs without a group have a null one, so that would abort all of those
+
+void job_pool::abort_group(void const *group)
+{
+    LOG_CONTEXT("job_pool", info);
+
+    if(group == nullptr) {
+        LOG_ERROR("abort_group needs a group");
+        return;
     }
+    abort_where([group](job_slot const &s) { return s.group.load(std::memory_order_relaxed) == group; });
 }
 
 //////////////////////////////////////////////////////////////////////
 
-void job_pool::worker_loop(std::stop_token pool_stoken)
+void job_pool::worker_loop(std::stop_token pool_stoken, size_t worker_index)
 {
     LOG_CONTEXT("worker", debug);
 
-    while(!pool_stoken.stop_requested()) {
-        std::shared_ptr<job_item> current_job;    // Use shared_ptr
-        {
-            std::unique_lock lock(queue_mutex);
+    current_pool = this;
+    current_worker = worker_index;
 
-            // Wait until task available OR stop requested
-            if(!cv.wait(lock, pool_stoken, [this] { return !tasks.empty(); })) {
-                return;    // Stop requested
-            }
+    job_trace::set_thread_name(std::format("worker {}", worker_index));
 
-            // Move the job to a shared_ptr to keep it alive and trackable
-            current_job = std::make_shared<job_item>(std::move(tasks.front()));
-            tasks.pop_front();
+    while(!pool_stoken.stop_requested() && !stopping.load(std::memory_order_relaxed)) {
 
-            // Store the shared_ptr so abort_jobs can find it
-            active_jobs.insert(current_job.get());
+        uint32_t job = find_job(worker_index);
+        for(int spin = 0; job == no_job && spin < idle_spins; ++spin) {
+            std::this_thread::yield();
+            job = find_job(worker_index);
+        }
+        if(job != no_job) {
+            run_job(job);
+            continue;
         }
 
-        if(current_job->work) {
-            current_job->work(current_job->stop_src.get_token());
+        // nothing to do, look once more after saying we're going to sleep
+        // so a job added in the meantime can't be missed
+        sleeping.fetch_add(1);
+        uint32_t epoch = wake_epoch.load();
+        job = find_job(worker_index);
+        if(job == no_job && !stopping.load()) {
+            wake_epoch.wait(epoch);
         }
+        sleeping.fetch_sub(1);
 
-        {
-            std::lock_guard lock(queue_mutex);
-            active_jobs.erase(current_job.get());
+        if(job != no_job) {
+            run_job(job);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// A job's own pool, so parallel_for inside it doesn't depend on which
+// pool was started last
+
+job_pool *job_pool::parallel_pool()
+{
+    if(current_pool != nullptr) {
+        return current_pool;
+    }
+    return running_pool.load(std::memory_order_acquire);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Aim for a few chunks per thread so the uneven ones balance out, but
+// never smaller than the grain
+
+size_t job_pool::get_chunk_size(job_pool *pool, size_t count, size_t grain)
+{
+    size_t threads = (pool != nullptr ? pool->num_workers.load(std::memory_order_acquire) : 0) + 1;
+    size_t target = (count + threads * 4 - 1) / (threads * 4);
+    return std::max({ grain, target, size_t{ 1 } });
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void job_pool::parallel_state::run()
+{
+    while(true) {
+        size_t chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+        if(chunk >= num_chunks) {
+            return;
+        }
+        call(fn, chunk);
+        if(chunks_done.fetch_add(1, std::memory_order_acq_rel) + 1 == num_chunks) {
+            chunks_done.notify_all();
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// The helpers are interactive priority because something is already
+// waiting on them. Once the caller runs out of chunks it only waits for
+// ones which another thread is in the middle of
+
+void job_pool::run_parallel(std::shared_ptr<parallel_state> const &state)
+{
+    if(!stopping.load(std::memory_order_relaxed)) {
+        size_t helpers = std::min(state->num_chunks - 1, num_workers.load(std::memory_order_acquire));
+        for(size_t i = 0; i < helpers; ++i) {
+            add_job(0, priority_interactive, [state](std::stop_token) { state->run(); });
         }
     }
+    state->run();
+
+    size_t done = state->chunks_done.load(std::memory_order_acquire);
+    while(done != state->num_chunks) {
+        state->chunks_done.wait(done, std::memory_order_acquire);
+        done = state->chunks_done.load(std::memory_order_acquire);
+    }
 }
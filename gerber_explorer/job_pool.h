@@ -1,71 +1,187 @@
 #pragma once
 
-#include <condition_variable>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
 #include <mutex>
-#include <deque>
+#include <new>
 #include <stop_token>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
-#include <memory>
-#include <unordered_set>
 
 //////////////////////////////////////////////////////////////////////
+// Work stealing job pool
+//
+// Jobs live in fixed slots which are recycled through a lock-free free list,
+// the closure is stored inline in the slot so dispatching a job doesn't allocate.
+// Each worker has a lock-free deque per priority, jobs added from a worker go on
+// its own deque and idle workers steal from the others. Jobs added from any other
+// thread go through a shared injection queue per priority. When every slot is in
+// use, the thread adding a job runs queued ones until a slot comes free.
+//
+// add_task can also make a job wait for others to finish first (a continuation)
+// and tag it with a group (eg a layer) so abort_group can cancel everything
+// belonging to it. Dependencies only order things: a job which is cancelled
+// still releases the jobs waiting on it.
+//
+// parallel_for/parallel_reduce split a range into chunks which the calling thread
+// works through alongside some helper jobs. The caller never waits for a chunk
+// nobody has started, so they're safe to call from inside a job.
 
 struct job_pool
 {
     //////////////////////////////////////////////////////////////////////
-    // A simple move-only wrapper since <move_only_function> is missing in MSVC
+    // Higher priorities are always taken first
 
-    struct task_wrapper
+    enum priority_t : uint32_t
     {
-        struct base
-        {
-            virtual ~base() = default;
-            virtual void call(std::stop_token) = 0;
-        };
-
-        template <typename F> struct impl : base
-        {
-            F f;
+        priority_interactive = 0,    // eg retesselation the user is waiting to see
+        priority_normal = 1,
+        priority_background = 2,    // eg exports
+        num_priorities = 3
+    };
 
-            explicit impl(F &&f) : f(std::forward<F>(f))
-            {
-            }
+    //////////////////////////////////////////////////////////////////////
+    // A move-only callable stored inline (<move_only_function> is missing in MSVC)
+    // Closures too big for the inline storage fall back to the heap
 
-            void call(std::stop_token st) override
-            {
-                f(st);
-            }
-        };
+    struct inline_task
+    {
+        static constexpr size_t inline_size = 192;
 
-        std::unique_ptr<base> ptr;
+        void (*invoke)(void *, std::stop_token){};
+        void (*destroy)(void *){};
+        alignas(std::max_align_t) std::byte storage[inline_size];
 
-        task_wrapper() = default;
+        template <typename F> void set(F &&f)
+        {
+            using T = std::decay_t<F>;
+            if constexpr(sizeof(T) <= inline_size && alignof(T) <= alignof(std::max_align_t)) {
+                new(storage) T(std::forward<F>(f));
+                invoke = [](void *p, std::stop_token st) { (*static_cast<T *>(p))(st); };
+                destroy = [](void *p) { static_cast<T *>(p)->~T(); };
+            } else {
+                new(storage) T *(new T(std::forward<F>(f)));
+                invoke = [](void *p, std::stop_token st) { (**static_cast<T **>(p))(st); };
+                destroy = [](void *p) { delete *static_cast<T **>(p); };
+            }
+        }
 
-        template <typename F> explicit task_wrapper(F &&f) : ptr(std::make_unique<impl<std::decay_t<F>>>(std::forward<F>(f)))
+        void operator()(std::stop_token st)
         {
+            invoke(storage, st);
         }
 
-        void operator()(std::stop_token st) const
+        void reset()
         {
-            if(ptr) {
-                ptr->call(st);
+            if(destroy != nullptr) {
+                destroy(storage);
             }
+            invoke = nullptr;
+            destroy = nullptr;
         }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // state is one of job_state_xxx, possibly with job_state_locked set while
+    // abort_jobs is looking at it
+
+    static constexpr uint32_t job_state_free = 0;
+    static constexpr uint32_t job_state_queued = 1;
+    static constexpr uint32_t job_state_running = 2;
+    static constexpr uint32_t job_state_cancelled = 3;
+    static constexpr uint32_t job_state_waiting = 4;    // for its dependencies
+    static constexpr uint32_t job_state_locked = 0x100;
+
+    struct job_slot
+    {
+        inline_task work;
+        std::stop_source stop_src;    // reused until something stops it
+        std::atomic<uint32_t> flags{};
+        std::atomic<uint32_t> state{ job_state_free };
+        std::atomic<uint32_t> next_free{};
+        std::atomic<void const *> group{};
+        std::atomic<uint32_t> pending{};    // unfinished dependencies (+1 while they're being added)
+        priority_t priority{ priority_normal };
+        uint64_t enqueue_time{};    // for job_trace, 0 if it wasn't on when the job was added
+
+        // generation is bumped when the job finishes, which makes old handles to it stale
+        std::atomic_flag successor_lock;
+        uint32_t generation{};                // protected by successor_lock
+        std::vector<uint32_t> successors;    // protected by successor_lock, keeps its capacity
+    };
+
+    static constexpr uint32_t no_job = 0xffffffff;
+
+    //////////////////////////////////////////////////////////////////////
+    // Refers to a job added with add_task, stays valid (but finished) after
+    // the job has gone
 
-        explicit operator bool() const
+    struct job_handle
+    {
+        uint32_t job{ no_job };
+        uint32_t generation{};
+
+        bool valid() const
         {
-            return static_cast<bool>(ptr);
+            return job != no_job;
         }
     };
 
+    static constexpr uint32_t slots_per_chunk = 256;
+    static constexpr uint32_t max_chunks = 32;
+    static constexpr uint32_t max_jobs = slots_per_chunk * max_chunks;
+
     //////////////////////////////////////////////////////////////////////
+    // Chase-Lev deque of slot indices, fixed size. Only the owning worker
+    // pushes and pops, anyone can steal
+
+    struct work_deque
+    {
+        static constexpr int64_t capacity = 4096;
+
+        alignas(64) std::atomic<int64_t> top{ 0 };
+        alignas(64) std::atomic<int64_t> bottom{ 0 };
+        std::unique_ptr<std::atomic<uint32_t>[]> items{ new std::atomic<uint32_t>[capacity] };
+
+        bool push(uint32_t job);
+        uint32_t pop();
+        uint32_t steal();
+        bool empty() const;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // Bounded multi-producer multi-consumer queue for jobs added from outside
+    // the pool. It holds max_jobs entries so it can never fill up
+
+    struct injection_queue
+    {
+        struct cell
+        {
+            std::atomic<size_t> sequence;
+            uint32_t job;
+        };
+
+        static constexpr size_t capacity = max_jobs;
+
+        alignas(64) std::atomic<size_t> enqueue_pos{ 0 };
+        alignas(64) std::atomic<size_t> dequeue_pos{ 0 };
+        std::unique_ptr<cell[]> cells;
+
+        injection_queue();
 
-    struct job_item
+        bool push(uint32_t job);
+        uint32_t pop();
+    };
+
+    struct worker_state
     {
-        task_wrapper work;
-        uint32_t flags;
-        mutable std::stop_source stop_src;
+        work_deque deques[num_priorities];
     };
 
     //////////////////////////////////////////////////////////////////////
@@ -88,26 +204,199 @@ struct job_pool
 
     void abort_jobs(uint32_t mask);
 
+    void abort_group(void const *group);
+
     void shut_down();
 
-    void worker_loop(std::stop_token pool_stoken);
+    void worker_loop(std::stop_token pool_stoken, size_t worker_index);
 
     bool get_active_job_count(uint32_t mask);
 
     template <typename F> void add_job(uint32_t flags, F &&func)
     {
-        {
-            std::lock_guard lock(queue_mutex);
-            tasks.push_back({ task_wrapper(std::forward<F>(func)), flags, std::stop_source{} });
+        add_job(flags, priority_normal, std::forward<F>(func));
+    }
+
+    template <typename F> void add_job(uint32_t flags, priority_t priority, F &&func)
+    {
+        add_task(flags, priority, nullptr, {}, std::forward<F>(func));
+    }
+
+    // run func once all the jobs in after have finished (invalid handles are ignored)
+
+    template <typename F> job_handle add_task(uint32_t flags, priority_t priority, void const *group, std::initializer_list<job_handle> after, F &&func)
+    {
+        uint32_t job = alloc_slot();
+        job_slot &s = slot(job);
+        s.work.set(std::forward<F>(func));
+        s.flags.store(flags, std::memory_order_relaxed);
+        s.group.store(group, std::memory_order_relaxed);
+        s.priority = priority;
+        s.enqueue_time = trace_time();
+        s.pending.store(1, std::memory_order_relaxed);
+        job_handle handle{ job, get_generation(s) };
+        s.state.store(job_state_waiting, std::memory_order_release);
+        queued_count.fetch_add(1, std::memory_order_relaxed);
+        for(auto const &dependency : after) {
+            add_dependency(job, dependency);
+        }
+        release_dependency(job);
+        return handle;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Call fn(chunk_begin, chunk_end) for chunks of [begin, end) at least grain in size.
+    // Uses the pool the calling thread is a worker of, or else the one which was
+    // started most recently, and runs inline if there isn't one
+
+    template <typename F> static void parallel_for(size_t begin, size_t end, size_t grain, F &&fn)
+    {
+        if(end <= begin) {
+            return;
+        }
+        job_pool *pool = parallel_pool();
+        size_t chunk_size = get_chunk_size(pool, end - begin, grain);
+        size_t num_chunks = (end - begin + chunk_size - 1) / chunk_size;
+        run_chunks(pool, num_chunks, [&](size_t chunk) {
+            size_t chunk_begin = begin + chunk * chunk_size;
+            fn(chunk_begin, std::min(chunk_begin + chunk_size, end));
+        });
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Reduce [begin, end) with map(chunk_begin, chunk_end) -> T and combine(T, T) -> T.
+    // The chunk results are combined in order, so the answer doesn't depend on
+    // which thread ran what
+
+    template <typename T, typename M, typename C> static T parallel_reduce(size_t begin, size_t end, size_t grain, T identity, M &&map, C &&combine)
+    {
+        if(end <= begin) {
+            return identity;
+        }
+        job_pool *pool = parallel_pool();
+        size_t chunk_size = get_chunk_size(pool, end - begin, grain);
+        size_t num_chunks = (end - begin + chunk_size - 1) / chunk_size;
+        if(num_chunks == 1) {
+            return combine(std::move(identity), map(begin, end));
         }
-        cv.notify_one();
+        std::vector<T> results(num_chunks, identity);
+        run_chunks(pool, num_chunks, [&](size_t chunk) {
+            size_t chunk_begin = begin + chunk * chunk_size;
+            results[chunk] = map(chunk_begin, std::min(chunk_begin + chunk_size, end));
+        });
+        T result = std::move(identity);
+        for(auto &r : results) {
+            result = combine(std::move(result), std::move(r));
+        }
+        return result;
     }
 
     //////////////////////////////////////////////////////////////////////
+    // Shared by the caller and the helper jobs of one parallel_for, the helpers
+    // hold a reference so one which starts late just finds nothing left to do
+
+    struct parallel_state
+    {
+        std::atomic<size_t> next_chunk{ 0 };
+        std::atomic<size_t> chunks_done{ 0 };
+        size_t num_chunks{};
+        void const *fn{};
+        void (*call)(void const *, size_t){};
+
+        void run();
+    };
+
+    template <typename F> static void run_chunks(job_pool *pool, size_t num_chunks, F const &fn)
+    {
+        if(num_chunks == 1 || pool == nullptr || pool->num_workers.load(std::memory_order_acquire) == 0) {
+            for(size_t chunk = 0; chunk < num_chunks; ++chunk) {
+                fn(chunk);
+            }
+            return;
+        }
+        auto state = std::make_shared<parallel_state>();
+        state->num_chunks = num_chunks;
+        state->fn = &fn;
+        state->call = [](void const *f, size_t chunk) { (*static_cast<F const *>(f))(chunk); };
+        pool->run_parallel(state);
+    }
+
+    static job_pool *parallel_pool();
+    static size_t get_chunk_size(job_pool *pool, size_t count, size_t grain);
+    void run_parallel(std::shared_ptr<parallel_state> const &state);
+
+    //////////////////////////////////////////////////////////////////////
+
+    job_slot &slot(uint32_t job) const
+    {
+        return chunks[job / slots_per_chunk].load(std::memory_order_acquire)[job % slots_per_chunk];
+    }
+
+    uint64_t trace_time();
+    uint32_t get_generation(job_slot &s);
+    void add_dependency(uint32_t job, job_handle dependency);
+    void release_dependency(uint32_t job);
+    void finish_job(uint32_t job);
+    template <typename P> void abort_where(P &&matches);
+    uint32_t alloc_slot();
+    void free_slot(uint32_t job);
+    void grow_slots();
+    void submit(uint32_t job);
+    uint32_t find_job(size_t worker_index);
+    uint32_t steal_job();
+    void run_queued_job();
+    void run_job(uint32_t job);
+    void discard_queued_jobs();
+    bool lock_slot(job_slot &s, uint32_t &state);
+    void wake_workers(bool all);
 
     std::vector<std::jthread> workers;
-    std::deque<job_item> tasks;
-    std::unordered_set<job_item *> active_jobs;
-    std::mutex queue_mutex;
-    std::condition_variable_any cv;
+    std::atomic<size_t> num_workers{ 0 };    // workers.size() for other threads, 0 once shut_down starts
+    std::vector<std::unique_ptr<worker_state>> worker_states;
+    injection_queue injected[num_priorities];
+
+    std::atomic<job_slot *> chunks[max_chunks]{};
+    std::unique_ptr<job_slot[]> chunk_storage[max_chunks];
+    std::atomic<uint32_t> num_chunks{ 0 };
+    std::mutex grow_mutex;
+
+    std::atomic<uint64_t> free_head{ no_job };    // tag << 32 | index
+
+    std::atomic<size_t> active_count{ 0 };
+    std::atomic<size_t> queued_count{ 0 };
+
+    std::atomic<uint32_t> wake_epoch{ 0 };
+    std::atomic<uint32_t> sleeping{ 0 };
+    std::atomic<bool> stopping{ false };
+
+    static std::atomic<job_pool *> running_pool;    // for parallel_for, set by start_workers
+};
+
+//////////////////////////////////////////////////////////////////////
+// How far through a long job is, written by the job and polled by the UI.
+// Each step of the job reports its own 0..1, which lands in [begin, end] of the whole
+
+struct job_progress
+{
+    std::atomic<float> fraction{ 0 };
+    float begin{ 0 };
+    float end{ 1 };
+
+    // set by the thread running the job, between its parallel parts
+    void step(float step_begin, float step_end)
+    {
+        begin = step_begin;
+        end = step_end;
+        set(0);
+    }
+
+    void set(float f)
+    {
+        fraction.store(begin + (end - begin) * std::clamp(f, 0.0f, 1.0f), std::memory_order_relaxed);
+    }
+
+    float get() const
+    {
+        return fraction.load(std::memory_order_relaxed);
+    }
 };
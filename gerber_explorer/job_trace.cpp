@@ -0,0 +1,350 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "gerber_log.h"
+#include "job_trace.h"
+
+LOG_CONTEXT("job_trace", info);
+
+namespace
+{
+    //////////////////////////////////////////////////////////////////////
+
+    enum event_kind : uint32_t
+    {
+        event_job,
+        event_stage
+    };
+
+    struct event
+    {
+        uint64_t enqueue_time;
+        uint64_t start_time;
+        uint64_t end_time;
+        void const *group;
+        char const *name;
+        uint32_t kind;
+        uint32_t flags;
+        uint32_t thread;
+        char label[52];
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // Each slot has a sequence number (seqlock) so save() can skip
+    // one which is being overwritten while it copies. The event is kept
+    // as atomic words so the copy racing the writer isn't a data race
+
+    size_t constexpr event_words = sizeof(event) / sizeof(uint64_t);
+
+    static_assert(sizeof(event) % sizeof(uint64_t) == 0 && std::is_trivially_copyable_v<event>);
+
+    struct slot
+    {
+        std::atomic<uint64_t> sequence{ 0 };
+        std::atomic<uint64_t> words[event_words]{};
+    };
+
+    size_t constexpr ring_size = 1 << 16;
+
+    std::unique_ptr<slot[]> ring;
+    std::atomic<slot *> ring_ptr{ nullptr };
+    std::atomic<uint64_t> write_pos{ 0 };
+
+    // names are only set now and then, a mutex is fine for those
+
+    std::mutex names_mutex;
+    std::vector<std::string> thread_names;
+    std::unordered_map<void const *, std::string> group_names;
+    char const *flag_names[32]{};
+
+    std::atomic<uint32_t> next_thread_id{ 1 };
+    thread_local uint32_t thread_id{ 0 };
+
+    //////////////////////////////////////////////////////////////////////
+
+    uint32_t get_thread_id()
+    {
+        if(thread_id == 0) {
+            thread_id = next_thread_id.fetch_add(1);
+        }
+        return thread_id;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void write_event(event const &e)
+    {
+        slot *r = ring_ptr.load(std::memory_order_acquire);
+        if(r == nullptr) {
+            return;
+        }
+        uint64_t pos = write_pos.fetch_add(1, std::memory_order_relaxed);
+        slot &s = r[pos & (ring_size - 1)];
+        uint64_t words[event_words];
+        memcpy(words, &e, sizeof(e));
+        s.sequence.store(pos * 2 + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for(size_t i = 0; i < event_words; ++i) {
+            s.words[i].store(words[i], std::memory_order_relaxed);
+        }
+        s.sequence.store(pos * 2 + 2, std::memory_order_release);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void copy_label(char (&dst)[52], std::string_view label)
+    {
+        size_t len = std::min(label.size(), sizeof(dst) - 1);
+        memcpy(dst, label.data(), len);
+        dst[len] = 0;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    std::string json_string(std::string_view s)
+    {
+        std::string r;
+        r.reserve(s.size() + 2);
+        r += '"';
+        for(char c : s) {
+            switch(c) {
+            case '"':
+                r += "\\\"";
+                break;
+            case '\\':
+                r += "\\\\";
+                break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20) {
+                    r += std::format("\\u{:04x}", c);
+                } else {
+                    r += c;
+                }
+                break;
+            }
+        }
+        r += '"';
+        return r;
+    }
+
+}    // namespace
+
+namespace job_trace
+{
+    std::atomic<bool> enabled_flag{ false };
+
+    //////////////////////////////////////////////////////////////////////
+
+    void enable(bool on)
+    {
+        if(on && ring_ptr.load() == nullptr) {
+            std::lock_guard lock(names_mutex);
+            if(ring == nullptr) {
+                ring = std::make_unique<slot[]>(ring_size);
+                ring_ptr.store(ring.get(), std::memory_order_release);
+            }
+        }
+        if(enabled_flag.exchange(on) != on) {
+            LOG_INFO("Job tracing {}", on ? "on" : "off");
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Only marks the events as old, the slots are overwritten as usual
+
+    void clear()
+    {
+        slot *r = ring_ptr.load(std::memory_order_acquire);
+        if(r == nullptr) {
+            return;
+        }
+        for(size_t i = 0; i < ring_size; ++i) {
+            r[i].sequence.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    uint64_t now()
+    {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void set_thread_name(std::string_view name)
+    {
+        uint32_t id = get_thread_id();
+        std::lock_guard lock(names_mutex);
+        if(thread_names.size() <= id) {
+            thread_names.resize(id + 1);
+        }
+        thread_names[id] = name;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void set_group_name(void const *group, std::string_view name)
+    {
+        std::lock_guard lock(names_mutex);
+        group_names[group] = name;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void forget_group(void const *group)
+    {
+        std::lock_guard lock(names_mutex);
+        group_names.erase(group);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void name_flag(uint32_t flag, char const *name)
+    {
+        std::lock_guard lock(names_mutex);
+        for(int i = 0; i < 32; ++i) {
+            if((flag & (1u << i)) != 0) {
+                flag_names[i] = name;
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void record_job(uint32_t flags, void const *group, uint64_t enqueue_time, uint64_t start_time, uint64_t end_time)
+    {
+        event e{};
+        e.kind = event_job;
+        e.flags = flags;
+        e.group = group;
+        e.thread = get_thread_id();
+        e.enqueue_time = enqueue_time;
+        e.start_time = start_time;
+        e.end_time = end_time;
+        write_event(e);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void record_stage(char const *name, std::string_view label, uint64_t start_time, uint64_t end_time)
+    {
+        event e{};
+        e.kind = event_stage;
+        e.name = name;
+        e.thread = get_thread_id();
+        e.start_time = start_time;
+        e.end_time = end_time;
+        copy_label(e.label, label);
+        write_event(e);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool save(std::filesystem::path const &path)
+    {
+        slot *r = ring_ptr.load(std::memory_order_acquire);
+
+        // snapshot whatever is in the ring
+        std::vector<event> events;
+        if(r != nullptr) {
+            events.reserve(ring_size);
+            for(size_t i = 0; i < ring_size; ++i) {
+                uint64_t seq = r[i].sequence.load(std::memory_order_acquire);
+                if(seq == 0 || (seq & 1) != 0) {
+                    continue;
+                }
+                uint64_t words[event_words];
+                for(size_t w = 0; w < event_words; ++w) {
+                    words[w] = r[i].words[w].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if(r[i].sequence.load(std::memory_order_relaxed) == seq) {
+                    memcpy(&events.emplace_back(), words, sizeof(event));
+                }
+            }
+        }
+
+        uint64_t base = UINT64_MAX;
+        for(auto const &e : events) {
+            base = std::min(base, e.enqueue_time != 0 ? e.enqueue_time : e.start_time);
+        }
+
+        std::ofstream out(path);
+        if(!out.good()) {
+            LOG_ERROR("Can't write trace to {}", path.string());
+            return false;
+        }
+
+        std::lock_guard lock(names_mutex);
+
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        char const *separator = "";
+        for(uint32_t id = 1; id < thread_names.size(); ++id) {
+            if(!thread_names[id].empty()) {
+                out << std::format("{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":{}}}}}", separator, id, json_string(thread_names[id]));
+                separator = ",\n";
+            }
+        }
+        for(auto const &e : events) {
+            std::string name;
+            std::string label;
+            char const *category;
+            std::string args;
+            if(e.kind == event_job) {
+                category = "job";
+                for(int i = 0; i < 32; ++i) {
+                    if((e.flags & (1u << i)) != 0) {
+                        if(!name.empty()) {
+                            name += '|';
+                        }
+                        name += flag_names[i] != nullptr ? flag_names[i] : std::format("flag{}", i);
+                    }
+                }
+                if(name.empty()) {
+                    name = "job";
+                }
+                auto found = group_names.find(e.group);
+                if(found != group_names.end()) {
+                    label = found->second;
+                }
+                args = std::format("\"flags\":{},\"queued_us\":{}", e.flags, e.start_time - e.enqueue_time);
+            } else {
+                category = "stage";
+                name = e.name;
+                label = e.label;
+            }
+            if(!label.empty()) {
+                if(!args.empty()) {
+                    args += ',';
+                }
+                args += std::format("\"layer\":{}", json_string(label));
+            }
+            out << std::format("{}{{\"name\":{},\"cat\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{},\"dur\":{},\"args\":{{{}}}}}",
+                               separator,
+                               json_string(name),
+                               category,
+                               e.thread,
+                               e.start_time - base,
+                               e.end_time - e.start_time,
+                               args);
+            separator = ",\n";
+        }
+        out << "\n]}\n";
+        out.close();
+        LOG_INFO("Saved {} trace events to {}", events.size(), path.string());
+        return true;
+    }
+
+}    // namespace job_trace
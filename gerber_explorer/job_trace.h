@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+//////////////////////////////////////////////////////////////////////
+// Timing of jobs and pipeline stages
+// Events go into a fixed size lock-free ring buffer (the oldest get overwritten)
+// and can be saved as Chrome trace-event JSON for chrome://tracing or Perfetto.
+// While it's switched off each hook is a single relaxed load.
+
+namespace job_trace
+{
+    extern std::atomic<bool> enabled_flag;
+
+    inline bool enabled()
+    {
+        return enabled_flag.load(std::memory_order_relaxed);
+    }
+
+    void enable(bool on);
+    void clear();
+
+    // steady clock in microseconds
+    uint64_t now();
+
+    // names for the timeline, name_flag takes a string literal (it's not copied)
+    void set_thread_name(std::string_view name);
+    void set_group_name(void const *group, std::string_view name);
+    void forget_group(void const *group);    // when it goes away, a new one could be at the same address
+    void name_flag(uint32_t flag, char const *name);
+
+    void record_job(uint32_t flags, void const *group, uint64_t enqueue_time, uint64_t start_time, uint64_t end_time);
+    void record_stage(char const *name, std::string_view label, uint64_t start_time, uint64_t end_time);
+
+    bool save(std::filesystem::path const &path);
+
+    //////////////////////////////////////////////////////////////////////
+    // Times a stage from construction to destruction, name must be a string literal
+
+    struct stage
+    {
+        char const *name;
+        std::string_view label;
+        uint64_t start_time;
+
+        stage(char const *stage_name, std::string_view stage_label)
+            : name(stage_name), label(stage_label), start_time(enabled() ? now() : 0)
+        {
+        }
+
+        ~stage()
+        {
+            if(start_time != 0) {
+                record_stage(name, label, start_time, now());
+            }
+        }
+
+        stage(stage const &) = delete;
+        stage &operator=(stage const &) = delete;
+    };
+
+}    // namespace job_trace
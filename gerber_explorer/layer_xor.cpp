@@ -0,0 +1,210 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+
+#include "gerber_log.h"
+#include "gpu_3d_drawer.h"
+#include "job_pool.h"
+#include "job_trace.h"
+#include "layer_xor.h"
+
+LOG_CONTEXT("layer_xor", info);
+
+namespace
+{
+    using namespace Clipper2Lib;
+
+    // roughly how many points in a tile before it's worth splitting
+    size_t constexpr points_per_tile = 50000;
+    int constexpr max_tiles_per_side = 64;
+
+    //////////////////////////////////////////////////////////////////////
+    // A layer's paths and which tiles each of them touches
+
+    struct binned_paths
+    {
+        Paths64 paths;
+        std::vector<std::vector<uint32_t>> bins;
+        size_t num_points{};
+
+        void init(PolyTree64 const &tree)
+        {
+            paths = PolyTreeToPaths64(tree);
+            for(auto const &p : paths) {
+                num_points += p.size();
+            }
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    Rect64 union_rect(Rect64 const &a, Rect64 const &b)
+    {
+        if(a.IsEmpty()) {
+            return b;
+        }
+        if(b.IsEmpty()) {
+            return a;
+        }
+        return { std::min(a.left, b.left), std::min(a.top, b.top), std::max(a.right, b.right), std::max(a.bottom, b.bottom) };
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Outer contours of a tree (and islands in holes, recursively) as polygons
+
+    void collect_polygons(PolyPath64 const &node, bool added, double min_area, std::vector<gerber_3d::xor_polygon> &polygons)
+    {
+        double constexpr scale = (double)gerber_3d::gpu_3d_drawer::CLIPPER_SCALE;
+        double constexpr area_scale = 1.0 / (scale * scale);
+
+        for(auto const &outer : node) {
+            gerber_3d::xor_polygon p;
+            p.added = added;
+            p.paths.push_back(outer->Polygon());
+            double area = Area(outer->Polygon());
+            for(auto const &hole : *outer) {
+                p.paths.push_back(hole->Polygon());
+                area += Area(hole->Polygon());
+                collect_polygons(*hole, added, min_area, polygons);
+            }
+            p.area = std::fabs(area) * area_scale;
+            if(p.area < min_area) {
+                continue;
+            }
+            Rect64 b = GetBounds(outer->Polygon());
+            p.bounds = gerber_lib::rect(b.left / scale, b.top / scale, b.right / scale, b.bottom / scale);
+            polygons.push_back(std::move(p));
+        }
+    }
+
+}    // namespace
+
+namespace gerber_3d
+{
+    //////////////////////////////////////////////////////////////////////
+
+    xor_result xor_layers(PolyTree64 const &before, PolyTree64 const &after, double min_area, std::stop_token stop_token)
+    {
+        job_trace::stage trace("xor", {});
+
+        xor_result result;
+
+        binned_paths layer[2];
+        layer[0].init(before);
+        layer[1].init(after);
+
+        Rect64 bounds = union_rect(GetBounds(layer[0].paths), GetBounds(layer[1].paths));
+        if(bounds.IsEmpty()) {
+            return result;
+        }
+
+        // enough tiles to keep each one small, squarish in board space
+        size_t total_points = layer[0].num_points + layer[1].num_points;
+        double tiles_wanted = std::max(1.0, (double)total_points / points_per_tile);
+        double aspect = (double)bounds.Width() / std::max<int64_t>(1, bounds.Height());
+        int tiles_x = std::clamp((int)std::ceil(std::sqrt(tiles_wanted * aspect)), 1, max_tiles_per_side);
+        int tiles_y = std::clamp((int)std::ceil(tiles_wanted / tiles_x), 1, max_tiles_per_side);
+        size_t num_tiles = (size_t)tiles_x * tiles_y;
+        result.num_tiles = num_tiles;
+
+        int64_t tile_w = (bounds.Width() + tiles_x - 1) / tiles_x;
+        int64_t tile_h = (bounds.Height() + tiles_y - 1) / tiles_y;
+
+        // the tiles overlap so the cut edges of one are well inside its neighbours
+        int64_t overlap = std::max<int64_t>(std::max(tile_w, tile_h) / 16, 1);
+
+        auto tile_rect = [&](size_t tile) {
+            int64_t x = bounds.left + (int64_t)(tile % tiles_x) * tile_w;
+            int64_t y = bounds.top + (int64_t)(tile / tiles_x) * tile_h;
+            return Rect64(x - overlap, y - overlap, x + tile_w + overlap, y + tile_h + overlap);
+        };
+
+        if(num_tiles > 1) {
+            job_pool::parallel_for(0, 2, 1, [&](size_t begin, size_t end) {
+                for(size_t l = begin; l < end; ++l) {
+                    binned_paths &b = layer[l];
+                    b.bins.resize(num_tiles);
+                    for(uint32_t i = 0; i < (uint32_t)b.paths.size(); ++i) {
+                        Rect64 r = GetBounds(b.paths[i]);
+                        int x0 = (int)std::clamp<int64_t>((r.left - overlap - bounds.left) / tile_w, 0, tiles_x - 1);
+                        int x1 = (int)std::clamp<int64_t>((r.right + overlap - bounds.left) / tile_w, 0, tiles_x - 1);
+                        int y0 = (int)std::clamp<int64_t>((r.top - overlap - bounds.top) / tile_h, 0, tiles_y - 1);
+                        int y1 = (int)std::clamp<int64_t>((r.bottom + overlap - bounds.top) / tile_h, 0, tiles_y - 1);
+                        for(int y = y0; y <= y1; ++y) {
+                            for(int x = x0; x <= x1; ++x) {
+                                b.bins[y * tiles_x + x].push_back(i);
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+        // difference both ways in each tile
+        std::vector<Paths64> added(num_tiles);
+        std::vector<Paths64> removed(num_tiles);
+
+        job_pool::parallel_for(0, num_tiles, 1, [&](size_t begin, size_t end) {
+            for(size_t tile = begin; tile < end && !stop_token.stop_requested(); ++tile) {
+                Paths64 clipped[2];
+                for(int l = 0; l < 2; ++l) {
+                    if(num_tiles == 1) {
+                        clipped[l] = layer[l].paths;
+                        continue;
+                    }
+                    Paths64 in_tile;
+                    in_tile.reserve(layer[l].bins[tile].size());
+                    for(uint32_t i : layer[l].bins[tile]) {
+                        in_tile.push_back(layer[l].paths[i]);
+                    }
+                    clipped[l] = RectClip(tile_rect(tile), in_tile);
+                }
+                {
+                    Clipper64 clipper;
+                    clipper.AddSubject(clipped[1]);
+                    clipper.AddClip(clipped[0]);
+                    clipper.Execute(ClipType::Difference, FillRule::NonZero, added[tile]);
+                }
+                {
+                    Clipper64 clipper;
+                    clipper.AddSubject(clipped[0]);
+                    clipper.AddClip(clipped[1]);
+                    clipper.Execute(ClipType::Difference, FillRule::NonZero, removed[tile]);
+                }
+            }
+        });
+
+        if(stop_token.stop_requested()) {
+            result.cancelled = true;
+            return result;
+        }
+
+        // stitch the tiles back together, the differences are usually small
+        // next to the layers so this is cheap
+        PolyTree64 stitched[2];
+        job_pool::parallel_for(0, 2, 1, [&](size_t begin, size_t end) {
+            for(size_t s = begin; s < end; ++s) {
+                std::vector<Paths64> &pieces = s == 0 ? added : removed;
+                Clipper64 clipper;
+                for(auto const &p : pieces) {
+                    clipper.AddSubject(p);
+                }
+                clipper.Execute(ClipType::Union, FillRule::NonZero, stitched[s]);
+            }
+        });
+
+        collect_polygons(stitched[0], true, min_area, result.polygons);
+        collect_polygons(stitched[1], false, min_area, result.polygons);
+
+        std::sort(result.polygons.begin(), result.polygons.end(), [](xor_polygon const &a, xor_polygon const &b) { return a.area > b.area; });
+
+        for(auto const &p : result.polygons) {
+            (p.added ? result.added_area : result.removed_area) += p.area;
+        }
+
+        LOG_INFO("xor: {} polygons from {} tiles, added {:.6f}, removed {:.6f}", result.polygons.size(), num_tiles, result.added_area, result.removed_area);
+        return result;
+    }
+
+}    // namespace gerber_3d
@@ -0,0 +1,50 @@
+//////////////////////////////////////////////////////////////////////
+// Exact vector difference between two resolved layers (gpu_3d_drawer::resolved_tree)
+//
+// The board is split into overlapping tiles, both layers are clipped to each
+// tile and differenced both ways on the job_pool, then the tile results are
+// unioned back together. Since each tile's result is exact inside the tile the
+// union is the exact symmetric difference, and no single Clipper call has to
+// deal with the whole panel.
+
+#pragma once
+
+#include <stop_token>
+#include <vector>
+
+#include "gerber_2d.h"
+
+#include "clipper2/clipper.h"
+
+namespace gerber_3d
+{
+    //////////////////////////////////////////////////////////////////////
+
+    struct xor_polygon
+    {
+        Clipper2Lib::Paths64 paths;    // outer contour first, then its holes
+        double area{};                 // board units squared (outer minus holes)
+        gerber_lib::rect bounds{};     // board units
+        bool added{};                  // in the second layer but not the first (else removed)
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct xor_result
+    {
+        std::vector<xor_polygon> polygons;    // biggest first
+        double added_area{};
+        double removed_area{};
+        size_t num_tiles{};
+        bool cancelled{};
+    };
+
+    // before and after are in CLIPPER_SCALE units, polygons smaller than min_area
+    // (board units squared) are dropped - they're slivers where tiles were stitched
+
+    xor_result xor_layers(Clipper2Lib::PolyTree64 const &before,
+                          Clipper2Lib::PolyTree64 const &after,
+                          double min_area = 1e-9,
+                          std::stop_token stop_token = {});
+
+}    // namespace gerber_3d
@@ -38,10 +38,11 @@
 // X there can be only one outline layer
 // X detect & use board outline for inverted layers
 // X show icon for outline layer
+// X share arenas where possible in gerber_drawer (pool of arenas reused?)
+// X export PNG
 //
 // fix select/hover/active highlighting
 // make the gerber parser interruptible with stop_token
-// share arenas where possible in gerber_drawer (pool of arenas reused?)
 // make status bar more informative
 // use native menus on MacOS
 // dynamic tesselation
@@ -56,13 +57,13 @@
 // high DPI
 // grid
 // load zip file? (how to store path in settings?)
-// export PNG
 // fork/mirror 3rd party repos
 // ? OpenCascade 3D nonsense ?
 // ? undo/redo ?
 //
 
 #include <cstdio>
+#include <cstring>
 #include <filesystem>
 
 #ifdef _WIN32
@@ -93,7 +94,7 @@ int output_debug_string(char const *s)
 }
 #endif
 
-int main(int, char **)
+int main(int argc, char **argv)
 {
 #ifdef _DEBUG
     log_set_level(gerber_lib::log_level_debug);
@@ -121,6 +122,19 @@ int main(int, char **)
     gerber_lib::log_set_emitter_function(puts);
 #endif
 
+    if(argc > 1 && strcmp(argv[1], "--export-png") == 0) {
+        return gerber_explorer::export_png_headless(std::vector<std::string>(argv + 2, argv + argc));
+    }
+    if(argc > 1 && strcmp(argv[1], "--compare") == 0) {
+        return gerber_explorer::compare_headless(std::vector<std::string>(argv + 2, argv + argc));
+    }
+    if(argc > 1 && strcmp(argv[1], "--check-clearance") == 0) {
+        return gerber_explorer::check_clearance_headless(std::vector<std::string>(argv + 2, argv + argc));
+    }
+    if(argc > 1 && strcmp(argv[1], "--density") == 0) {
+        return gerber_explorer::density_headless(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
     gerber_explorer window;
     window.init();
 
@@ -0,0 +1,639 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gerber_log.h"
+#include "job_pool.h"
+#include "job_trace.h"
+#include "mesh_writer.h"
+
+LOG_CONTEXT("mesh_writer", info);
+
+namespace
+{
+    using namespace gerber_3d;
+
+    size_t constexpr buffer_size = 4 << 20;
+
+    // triangles (or vertices) done per block on the job_pool before it's written
+    size_t constexpr block_size = 1 << 16;
+
+    //////////////////////////////////////////////////////////////////////
+    // All output goes through here, it only touches the file when the buffer fills.
+    // Keeps a CRC of what's written for the zip entries in 3MF files
+
+    struct buffered_file
+    {
+        FILE *f{};
+        std::vector<char> buffer;
+        size_t used{};
+        uint64_t written{};
+        bool failed{};
+
+        bool crc_enabled{};
+        uint32_t crc{};
+
+        // write_blocks checks this between batches and gives up if it's stopped
+        std::stop_token stop_token;
+        bool cancelled{};
+
+        // write_blocks counts items (vertices/triangles) towards items_total
+        job_progress *progress{};
+        uint64_t items_total{};
+        uint64_t items_done{};
+
+        bool open(std::filesystem::path const &path)
+        {
+            f = fopen(path.string().c_str(), "wb");
+            if(f == nullptr) {
+                return false;
+            }
+            buffer.resize(buffer_size);
+            return true;
+        }
+
+        void write(void const *data, size_t size)
+        {
+            if(crc_enabled) {
+                update_crc(data, size);
+            }
+            written += size;
+            char const *src = static_cast<char const *>(data);
+            while(size != 0) {
+                size_t n = std::min(size, buffer.size() - used);
+                memcpy(buffer.data() + used, src, n);
+                used += n;
+                src += n;
+                size -= n;
+                if(used == buffer.size()) {
+                    flush();
+                }
+            }
+        }
+
+        void write(std::string_view s)
+        {
+            write(s.data(), s.size());
+        }
+
+        template <typename T> void write_le(T value)
+        {
+            static_assert(std::is_integral_v<T>);
+            uint8_t bytes[sizeof(T)];
+            for(size_t i = 0; i < sizeof(T); ++i) {
+                bytes[i] = (uint8_t)((uint64_t)value >> (i * 8));
+            }
+            write(bytes, sizeof(T));
+        }
+
+        void flush()
+        {
+            if(used != 0 && !failed && fwrite(buffer.data(), 1, used, f) != used) {
+                failed = true;
+            }
+            used = 0;
+        }
+
+        void seek(uint64_t pos, int origin = SEEK_SET)
+        {
+            flush();
+#ifdef _WIN32
+            int r = _fseeki64(f, (int64_t)pos, origin);
+#else
+            int r = fseeko(f, (off_t)pos, origin);
+#endif
+            if(r != 0) {
+                failed = true;
+            }
+        }
+
+        bool close()
+        {
+            flush();
+            if(f != nullptr && fclose(f) != 0) {
+                failed = true;
+            }
+            f = nullptr;
+            return !failed;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        static std::array<uint32_t, 256> const &crc_table()
+        {
+            static std::array<uint32_t, 256> const table = [] {
+                std::array<uint32_t, 256> t{};
+                for(uint32_t i = 0; i < 256; ++i) {
+                    uint32_t c = i;
+                    for(int k = 0; k < 8; ++k) {
+                        c = (c & 1) != 0 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    }
+                    t[i] = c;
+                }
+                return t;
+            }();
+            return table;
+        }
+
+        void update_crc(void const *data, size_t size)
+        {
+            auto const &table = crc_table();
+            uint8_t const *p = static_cast<uint8_t const *>(data);
+            uint32_t c = ~crc;
+            for(size_t i = 0; i < size; ++i) {
+                c = table[(c ^ p[i]) & 0xff] ^ (c >> 8);
+            }
+            crc = ~c;
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // Fill blocks in parallel and write them in order. fill(first, last, out)
+    // appends the output for items [first, last) to out
+
+    template <typename F> void write_blocks(buffered_file &file, size_t count, F &&fill)
+    {
+        size_t num_blocks = (count + block_size - 1) / block_size;
+        size_t const batch = 16;
+        std::vector<std::string> blocks(batch);
+        for(size_t b = 0; b < num_blocks; b += batch) {
+            if(file.cancelled || file.stop_token.stop_requested()) {
+                file.cancelled = true;
+                return;
+            }
+            size_t n = std::min(batch, num_blocks - b);
+            job_pool::parallel_for(0, n, 1, [&](size_t begin, size_t end) {
+                for(size_t i = begin; i < end; ++i) {
+                    size_t first = (b + i) * block_size;
+                    blocks[i].clear();
+                    fill(first, std::min(first + block_size, count), blocks[i]);
+                }
+            });
+            for(size_t i = 0; i < n; ++i) {
+                file.write(blocks[i]);
+            }
+            file.items_done += std::min(count, (b + n) * block_size) - b * block_size;
+            if(file.progress != nullptr && file.items_total != 0) {
+                file.progress->set(static_cast<float>(static_cast<double>(file.items_done) / file.items_total));
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    template <typename T> void append_raw(std::string &out, T const &value)
+    {
+        out.append(reinterpret_cast<char const *>(&value), sizeof(T));
+    }
+
+    void append_float(std::string &out, float f)
+    {
+        char buf[32];
+        auto r = std::to_chars(buf, buf + sizeof(buf), f);
+        out.append(buf, r.ptr);
+    }
+
+    void append_uint(std::string &out, uint64_t v)
+    {
+        char buf[24];
+        auto r = std::to_chars(buf, buf + sizeof(buf), v);
+        out.append(buf, r.ptr);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void write_stl(buffered_file &file, std::span<mesh_body const> bodies)
+    {
+        char header[80] = {};
+        snprintf(header, sizeof(header), "gerber_explorer STL export");
+        file.write(header, sizeof(header));
+
+        // one solid, the bodies just follow each other
+        uint32_t num_triangles = 0;
+        for(auto const &body : bodies) {
+            num_triangles += static_cast<uint32_t>(body.indices.size() / 3);
+        }
+        file.write_le(num_triangles);
+
+        for(auto const &body : bodies) {
+            auto const &vertices = body.vertices;
+            auto const &indices = body.indices;
+            write_blocks(file, indices.size() / 3, [&](size_t first, size_t last, std::string &out) {
+                out.reserve((last - first) * 50);
+                for(size_t t = first; t < last; ++t) {
+                    mesh_vertex const &v0 = vertices[indices[t * 3 + 0]];
+                    mesh_vertex const &v1 = vertices[indices[t * 3 + 1]];
+                    mesh_vertex const &v2 = vertices[indices[t * 3 + 2]];
+
+                    // face normal via cross product
+                    float ax = v1.x - v0.x, ay = v1.y - v0.y, az = v1.z - v0.z;
+                    float bx = v2.x - v0.x, by = v2.y - v0.y, bz = v2.z - v0.z;
+                    mesh_vertex n{ ay * bz - az * by, az * bx - ax * bz, ax * by - ay * bx };
+                    float len = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+                    if(len > 0) {
+                        n.x /= len;
+                        n.y /= len;
+                        n.z /= len;
+                    }
+                    append_raw(out, n);
+                    append_raw(out, v0);
+                    append_raw(out, v1);
+                    append_raw(out, v2);
+                    append_raw(out, uint16_t{ 0 });
+                }
+            });
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void write_ply(buffered_file &file, std::span<mesh_body const> bodies)
+    {
+        // one mesh, the bodies just follow each other
+        size_t num_vertices = 0;
+        size_t num_triangles = 0;
+        for(auto const &body : bodies) {
+            num_vertices += body.vertices.size();
+            num_triangles += body.indices.size() / 3;
+        }
+        file.write(std::format("ply\nformat binary_little_endian 1.0\ncomment gerber_explorer export\n"
+                               "element vertex {}\nproperty float x\nproperty float y\nproperty float z\n"
+                               "element face {}\nproperty list uchar uint vertex_indices\nend_header\n",
+                               num_vertices,
+                               num_triangles));
+
+        // the vertices are already in the right layout (little endian floats)
+        for(auto const &body : bodies) {
+            file.write(body.vertices.data(), body.vertices.size_bytes());
+        }
+
+        uint32_t base = 0;
+        for(auto const &body : bodies) {
+            auto const &indices = body.indices;
+            write_blocks(file, indices.size() / 3, [&](size_t first, size_t last, std::string &out) {
+                out.reserve((last - first) * 13);
+                for(size_t t = first; t < last; ++t) {
+                    append_raw(out, uint8_t{ 3 });
+                    append_raw(out, base + indices[t * 3 + 0]);
+                    append_raw(out, base + indices[t * 3 + 1]);
+                    append_raw(out, base + indices[t * 3 + 2]);
+                }
+            });
+            base += static_cast<uint32_t>(body.vertices.size());
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void write_obj(buffered_file &file, std::span<mesh_body const> bodies)
+    {
+        file.write("# gerber_explorer export\n");
+
+        // OBJ indices start at 1 and count up through the whole file
+        uint64_t base = 1;
+        for(auto const &body : bodies) {
+            auto const &vertices = body.vertices;
+            auto const &indices = body.indices;
+            if(!body.name.empty()) {
+                file.write(std::format("o {}\n", body.name));
+            }
+
+            write_blocks(file, vertices.size(), [&](size_t first, size_t last, std::string &out) {
+                out.reserve((last - first) * 32);
+                for(size_t i = first; i < last; ++i) {
+                    out += "v ";
+                    append_float(out, vertices[i].x);
+                    out += ' ';
+                    append_float(out, vertices[i].y);
+                    out += ' ';
+                    append_float(out, vertices[i].z);
+                    out += '\n';
+                }
+            });
+
+            write_blocks(file, indices.size() / 3, [&](size_t first, size_t last, std::string &out) {
+                out.reserve((last - first) * 24);
+                for(size_t t = first; t < last; ++t) {
+                    out += "f ";
+                    append_uint(out, indices[t * 3 + 0] + base);
+                    out += ' ';
+                    append_uint(out, indices[t * 3 + 1] + base);
+                    out += ' ';
+                    append_uint(out, indices[t * 3 + 2] + base);
+                    out += '\n';
+                }
+            });
+            base += vertices.size();
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // 3MF is a zip file with the model as XML in it. The entries are stored
+    // (not deflated), each local header is patched with the size and CRC once
+    // the entry has been written
+
+    struct zip_writer
+    {
+        struct entry
+        {
+            std::string name;
+            uint64_t offset;
+            uint32_t crc;
+            uint64_t size;
+        };
+
+        buffered_file &file;
+        std::vector<entry> entries;
+
+        void write_local_header(entry const &e)
+        {
+            file.write_le<uint32_t>(0x04034b50);
+            file.write_le<uint16_t>(20);    // version needed
+            file.write_le<uint16_t>(0);     // flags
+            file.write_le<uint16_t>(0);     // stored
+            file.write_le<uint16_t>(0);     // time
+            file.write_le<uint16_t>(0x21);  // date (1980-01-01)
+            file.write_le<uint32_t>(e.crc);
+            file.write_le<uint32_t>((uint32_t)e.size);
+            file.write_le<uint32_t>((uint32_t)e.size);
+            file.write_le<uint16_t>((uint16_t)e.name.size());
+            file.write_le<uint16_t>(0);
+            file.write(e.name);
+        }
+
+        void begin(std::string name)
+        {
+            entries.push_back({ std::move(name), file.written, 0, 0 });
+            write_local_header(entries.back());
+            file.crc = 0;
+            file.crc_enabled = true;
+        }
+
+        void end()
+        {
+            entry &e = entries.back();
+            file.crc_enabled = false;
+            e.crc = file.crc;
+            e.size = file.written - e.offset - 30 - e.name.size();
+            uint64_t end_pos = file.written;
+            file.seek(e.offset);
+            write_local_header(e);
+            file.seek(0, SEEK_END);
+            file.written = end_pos;
+        }
+
+        void add(std::string name, std::string_view data)
+        {
+            begin(std::move(name));
+            file.write(data);
+            end();
+        }
+
+        void finish()
+        {
+            uint64_t directory_offset = file.written;
+            for(auto const &e : entries) {
+                file.write_le<uint32_t>(0x02014b50);
+                file.write_le<uint16_t>(20);    // made by
+                file.write_le<uint16_t>(20);    // version needed
+                file.write_le<uint16_t>(0);
+                file.write_le<uint16_t>(0);
+                file.write_le<uint16_t>(0);
+                file.write_le<uint16_t>(0x21);
+                file.write_le<uint32_t>(e.crc);
+                file.write_le<uint32_t>((uint32_t)e.size);
+                file.write_le<uint32_t>((uint32_t)e.size);
+                file.write_le<uint16_t>((uint16_t)e.name.size());
+                file.write_le<uint16_t>(0);    // extra
+                file.write_le<uint16_t>(0);    // comment
+                file.write_le<uint16_t>(0);    // disk
+                file.write_le<uint16_t>(0);    // internal attributes
+                file.write_le<uint32_t>(0);    // external attributes
+                file.write_le<uint32_t>((uint32_t)e.offset);
+                file.write(e.name);
+            }
+            uint64_t directory_size = file.written - directory_offset;
+            file.write_le<uint32_t>(0x06054b50);
+            file.write_le<uint16_t>(0);
+            file.write_le<uint16_t>(0);
+            file.write_le<uint16_t>((uint16_t)entries.size());
+            file.write_le<uint16_t>((uint16_t)entries.size());
+            file.write_le<uint32_t>((uint32_t)directory_size);
+            file.write_le<uint32_t>((uint32_t)directory_offset);
+            file.write_le<uint16_t>(0);
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool write_3mf(buffered_file &file, std::span<mesh_body const> bodies)
+    {
+        // no zip64, the model has to fit in 4GB (about 50 million triangles)
+        uint64_t estimated = 0;
+        size_t num_triangles = 0;
+        for(auto const &body : bodies) {
+            estimated += body.vertices.size() * 80ull + body.indices.size() / 3 * 64ull;
+            num_triangles += body.indices.size() / 3;
+        }
+        if(estimated >= 0xffffffffull) {
+            LOG_ERROR("Mesh is too big for 3MF export ({} triangles)", num_triangles);
+            return false;
+        }
+
+        zip_writer zip{ file };
+
+        zip.add("[Content_Types].xml",
+                "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">\n"
+                "<Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>\n"
+                "<Default Extension=\"model\" ContentType=\"application/vnd.ms-package.3dmanufacturing-3dmodel+xml\"/>\n"
+                "</Types>\n");
+
+        zip.add("_rels/.rels",
+                "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">\n"
+                "<Relationship Target=\"/3D/3dmodel.model\" Id=\"rel0\" Type=\"http://schemas.microsoft.com/3dmanufacturing/2013/01/3dmodel\"/>\n"
+                "</Relationships>\n");
+
+        zip.begin("3D/3dmodel.model");
+        file.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                   "<model unit=\"millimeter\" xml:lang=\"en-US\" xmlns=\"http://schemas.microsoft.com/3dmanufacturing/core/2015/02\">\n"
+                   "<resources>\n");
+
+        // an object for each body
+        for(size_t b = 0; b < bodies.size(); ++b) {
+            auto const &vertices = bodies[b].vertices;
+            auto const &indices = bodies[b].indices;
+
+            std::string name;
+            for(char c : bodies[b].name) {
+                if(c != '"' && c != '<' && c != '>' && c != '&') {
+                    name += c;
+                }
+            }
+            file.write(std::format("<object id=\"{}\" type=\"model\" name=\"{}\">\n<mesh>\n<vertices>\n", b + 1, name));
+
+            write_blocks(file, vertices.size(), [&](size_t first, size_t last, std::string &out) {
+                out.reserve((last - first) * 48);
+                for(size_t i = first; i < last; ++i) {
+                    out += "<vertex x=\"";
+                    append_float(out, vertices[i].x);
+                    out += "\" y=\"";
+                    append_float(out, vertices[i].y);
+                    out += "\" z=\"";
+                    append_float(out, vertices[i].z);
+                    out += "\"/>\n";
+                }
+            });
+
+            file.write("</vertices>\n<triangles>\n");
+
+            write_blocks(file, indices.size() / 3, [&](size_t first, size_t last, std::string &out) {
+                out.reserve((last - first) * 40);
+                for(size_t t = first; t < last; ++t) {
+                    out += "<triangle v1=\"";
+                    append_uint(out, indices[t * 3 + 0]);
+                    out += "\" v2=\"";
+                    append_uint(out, indices[t * 3 + 1]);
+                    out += "\" v3=\"";
+                    append_uint(out, indices[t * 3 + 2]);
+                    out += "\"/>\n";
+                }
+            });
+
+            file.write("</triangles>\n</mesh>\n</object>\n");
+        }
+
+        file.write("</resources>\n<build>\n");
+        for(size_t b = 0; b < bodies.size(); ++b) {
+            file.write(std::format("<item objectid=\"{}\"/>\n", b + 1));
+        }
+        file.write("</build>\n</model>\n");
+        zip.end();
+
+        zip.finish();
+        return true;
+    }
+
+}    // namespace
+
+namespace gerber_3d
+{
+    //////////////////////////////////////////////////////////////////////
+
+    mesh_format mesh_format_from_path(std::filesystem::path const &path)
+    {
+        std::string ext = path.extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+        if(ext == ".stl") {
+            return mesh_format::stl;
+        }
+        if(ext == ".ply") {
+            return mesh_format::ply;
+        }
+        if(ext == ".obj") {
+            return mesh_format::obj;
+        }
+        if(ext == ".3mf") {
+            return mesh_format::threemf;
+        }
+        return mesh_format::unknown;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    char const *mesh_format_name(mesh_format format)
+    {
+        switch(format) {
+        case mesh_format::stl:
+            return "STL";
+        case mesh_format::ply:
+            return "PLY";
+        case mesh_format::obj:
+            return "OBJ";
+        case mesh_format::threemf:
+            return "3MF";
+        default:
+            return "unknown";
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool write_mesh(std::filesystem::path const &path, mesh_format format, std::span<mesh_body const> bodies, std::stop_token stop_token, job_progress *progress)
+    {
+        job_trace::stage trace("write_mesh", path.filename().string());
+
+        if(format == mesh_format::unknown) {
+            LOG_ERROR("Unknown mesh format for {}", path.string());
+            return false;
+        }
+
+        buffered_file file;
+        if(!file.open(path)) {
+            LOG_ERROR("Can't open {}", path.string());
+            return false;
+        }
+        file.stop_token = stop_token;
+        file.progress = progress;
+
+        size_t num_vertices = 0;
+        size_t num_triangles = 0;
+        for(auto const &body : bodies) {
+            num_vertices += body.vertices.size();
+            num_triangles += body.indices.size() / 3;
+        }
+        // STL and PLY only go through write_blocks for the triangles
+        bool text = format == mesh_format::obj || format == mesh_format::threemf;
+        file.items_total = num_triangles + (text ? num_vertices : 0);
+
+        bool ok = true;
+        switch(format) {
+        case mesh_format::stl:
+            write_stl(file, bodies);
+            break;
+        case mesh_format::ply:
+            write_ply(file, bodies);
+            break;
+        case mesh_format::obj:
+            write_obj(file, bodies);
+            break;
+        case mesh_format::threemf:
+            ok = write_3mf(file, bodies);
+            break;
+        default:
+            break;
+        }
+
+        // don't leave half a file behind
+        bool closed = file.close();
+        if(file.cancelled || !closed || !ok) {
+            if(file.cancelled) {
+                LOG_INFO("Cancelled writing {}", path.string());
+            } else {
+                LOG_ERROR("Error writing {}", path.string());
+            }
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+            return false;
+        }
+        LOG_INFO("Wrote {} triangles in {} bodies to {} ({}, {} bytes)", num_triangles, bodies.size(), path.string(), mesh_format_name(format), file.written);
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    bool write_mesh(std::filesystem::path const &path, mesh_format format, std::span<mesh_vertex const> vertices, std::span<uint32_t const> indices, std::stop_token stop_token, job_progress *progress)
+    {
+        mesh_body body{ {}, vertices, indices };
+        return write_mesh(path, format, { &body, 1 }, stop_token, progress);
+    }
+
+}    // namespace gerber_3d
@@ -0,0 +1,67 @@
+//////////////////////////////////////////////////////////////////////
+// Writes indexed triangle meshes to files
+//
+// Output goes through a large buffer rather than lots of small fwrites and the
+// per-triangle work (normals, text formatting) is done in blocks on the job_pool.
+// STL expands the mesh (50 bytes per triangle), PLY, OBJ and 3MF keep the
+// shared vertices.
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <stop_token>
+#include <string>
+
+#include "job_pool.h"
+
+namespace gerber_3d
+{
+    //////////////////////////////////////////////////////////////////////
+
+    enum class mesh_format
+    {
+        unknown,
+        stl,    // binary
+        ply,    // binary little endian
+        obj,
+        threemf
+    };
+
+    struct mesh_vertex
+    {
+        float x, y, z;
+    };
+
+    // several bodies go in one file, as separate objects where the format has them
+    // (OBJ, 3MF), STL and PLY just get all the triangles
+
+    struct mesh_body
+    {
+        std::string name;
+        std::span<mesh_vertex const> vertices;
+        std::span<uint32_t const> indices;
+    };
+
+    // from the file extension
+    mesh_format mesh_format_from_path(std::filesystem::path const &path);
+
+    char const *mesh_format_name(mesh_format format);
+
+    // a stopped write deletes what it wrote so far (as does a failed one)
+
+    bool write_mesh(std::filesystem::path const &path,
+                    mesh_format format,
+                    std::span<mesh_vertex const> vertices,
+                    std::span<uint32_t const> indices,
+                    std::stop_token stop_token = {},
+                    job_progress *progress = nullptr);
+
+    bool write_mesh(std::filesystem::path const &path,
+                    mesh_format format,
+                    std::span<mesh_body const> bodies,
+                    std::stop_token stop_token = {},
+                    job_progress *progress = nullptr);
+
+}    // namespace gerber_3d
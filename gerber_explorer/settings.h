@@ -59,6 +59,20 @@ namespace settings
     X(int, tesselation_quality, 1)             \
     X(float, tesselation_delay, 0.05f)         \
     X(bool, dynamic_tesselation, true)         \
+    X(bool, compact_vertices, false)           \
+    X(bool, job_tracing, false)                \
+    X(int, png_export_size, 4096)              \
+    X(float, board_thickness, 1.6f)            \
+    X(float, copper_thickness, 0.035f)         \
+    X(float, soldermask_thickness, 0.02f)      \
+    X(float, silkscreen_thickness, 0.01f)      \
+    X(float, plating_thickness, 0.025f)        \
+    X(float, decimation_tolerance, 0.0005f)    \
+    X(float, drc_clearance, 0.15f)             \
+    X(bool, show_density, false)               \
+    X(float, density_tile_size, 10.0f)         \
+    X(int, arena_commit_budget_mb, 0)          \
+    X(bool, show_arena_stats, false)           \
     X(bool, view_toolbar, true)                \
     X(int, board_view, 0)                      \
     X(int, units, settings::units_mm)          \
@@ -0,0 +1,54 @@
+// Layer vertex shader for the compact (16 bit, tile relative) vertex format
+// Entity ids come from a per tile table of { first_vertex, entity_id } ranges
+
+cbuffer Uniforms : register(b0, space1)
+{
+    float4x4 transform;
+    int draw_flags;
+    uint range_offset;    // this tile's entries in ranges_buffer
+    uint range_count;
+    int _pad0;
+    float2 tile_origin;
+    float2 tile_scale;
+};
+
+StructuredBuffer<uint> flags_buffer : register(t0, space0);
+StructuredBuffer<uint2> ranges_buffer : register(t1, space0);    // x = first_vertex, y = entity_id
+
+struct VSInput
+{
+    uint2 position : TEXCOORD0;
+    uint vertex_id : SV_VertexID;
+};
+
+struct VSOutput
+{
+    float4 pos : SV_Position;
+    nointerpolation int entity_flags : TEXCOORD0;
+};
+
+VSOutput main(VSInput input)
+{
+    // find the last range which starts at or before this vertex
+    uint lo = 0;
+    uint hi = range_count;
+    while (hi - lo > 1) {
+        uint mid = (lo + hi) / 2;
+        if (ranges_buffer[range_offset + mid].x <= input.vertex_id) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    uint entity_id = ranges_buffer[range_offset + lo].y;
+
+    VSOutput output;
+    output.entity_flags = (int)flags_buffer[entity_id];
+    if ((output.entity_flags & draw_flags) != 0) {
+        float2 position = tile_origin + float2(input.position) * tile_scale;
+        output.pos = mul(transform, float4(position, 0.0f, 1.0f));
+    } else {
+        output.pos = float4(0, 0, 0, 0);
+    }
+    return output;
+}
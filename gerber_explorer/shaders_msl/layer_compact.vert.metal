@@ -0,0 +1,62 @@
+// Layer vertex shader for the compact (16 bit, tile relative) vertex format
+// Bindings (vertex stage, 1 uniform + 2 storage buffers):
+//   uniform b0   -> [[buffer(0)]]
+//   storage buf0 -> [[buffer(1)]]   flags
+//   storage buf1 -> [[buffer(2)]]   entity ranges
+//   vertex input -> [[buffer(14)]]  via [[stage_in]]
+
+#include <metal_stdlib>
+using namespace metal;
+
+struct Uniforms
+{
+    float4x4 transform;
+    int draw_flags;
+    uint range_offset;
+    uint range_count;
+    int _pad0;
+    float2 tile_origin;
+    float2 tile_scale;
+};
+
+struct VSInput
+{
+    ushort2 position [[attribute(0)]];
+};
+
+struct VSOutput
+{
+    float4 pos [[position]];
+    int entity_flags [[flat]];
+};
+
+vertex VSOutput main0(
+    VSInput in [[stage_in]],
+    uint vertex_id [[vertex_id]],
+    constant Uniforms& u [[buffer(0)]],
+    const device uint* flags_buffer [[buffer(1)]],
+    const device uint2* ranges_buffer [[buffer(2)]])
+{
+    // find the last range which starts at or before this vertex
+    uint lo = 0;
+    uint hi = u.range_count;
+    while (hi - lo > 1) {
+        uint mid = (lo + hi) / 2;
+        if (ranges_buffer[u.range_offset + mid].x <= vertex_id) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    uint entity_id = ranges_buffer[u.range_offset + lo].y;
+
+    VSOutput out;
+    out.entity_flags = (int)flags_buffer[entity_id];
+    if ((out.entity_flags & u.draw_flags) != 0) {
+        float2 position = u.tile_origin + float2(in.position) * u.tile_scale;
+        out.pos = u.transform * float4(position, 0.0, 1.0);
+    } else {
+        out.pos = float4(0.0, 0.0, 0.0, 0.0);
+    }
+    return out;
+}
@@ -0,0 +1,842 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "gerber_log.h"
+#include "job_pool.h"
+#include "job_trace.h"
+#include "soft_render.h"
+
+LOG_CONTEXT("soft_render", info);
+
+namespace
+{
+    using namespace gerber;
+    using gerber_lib::rect;
+    using gerber_lib::vec2d;
+    using gerber_lib::vec2f;
+
+    int constexpr tile_size = 256;
+
+    //////////////////////////////////////////////////////////////////////
+    // Signed area accumulation (as in font-rs). Each edge adds the area it
+    // sweeps to the cells it crosses and the running sum along a row is the
+    // coverage of each pixel. Edges shared by two triangles cancel out so all
+    // the triangles of an entity go in before it's resolved, which means no
+    // seams where they meet
+
+    struct coverage_accumulator
+    {
+        int width{};
+        int height{};
+        int stride{};
+        std::vector<float> cells;
+
+        void begin(int w, int h)
+        {
+            width = w;
+            height = h;
+            stride = w + 2;
+            if(cells.size() < (size_t)(stride * h)) {
+                cells.resize(stride * h, 0.0f);
+            }
+        }
+
+        void add_triangle(vec2f const &a, vec2f const &b, vec2f const &c)
+        {
+            add_line(a.x, a.y, b.x, b.y);
+            add_line(b.x, b.y, c.x, c.y);
+            add_line(c.x, c.y, a.x, a.y);
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // Clip to the rows, then split where the line crosses the left/right
+        // edges and clamp the outside parts onto them - they still cover
+        // everything to their right
+
+        void add_line(float x0, float y0, float x1, float y1)
+        {
+            if(y0 == y1 || std::isnan(x0 + y0 + x1 + y1)) {
+                return;
+            }
+            float dir = 1;
+            if(y0 > y1) {
+                std::swap(x0, x1);
+                std::swap(y0, y1);
+                dir = -1;
+            }
+            float fh = (float)height;
+            if(y1 <= 0 || y0 >= fh) {
+                return;
+            }
+            float dxdy = (x1 - x0) / (y1 - y0);
+            if(y0 < 0) {
+                x0 -= y0 * dxdy;
+                y0 = 0;
+            }
+            if(y1 > fh) {
+                x1 -= (y1 - fh) * dxdy;
+                y1 = fh;
+            }
+            float fw = (float)width;
+            float ys[4] = { y0 };
+            int n = 1;
+            for(float edge : { 0.0f, fw }) {
+                if((x0 < edge) != (x1 < edge)) {
+                    ys[n++] = y0 + (edge - x0) / (x1 - x0) * (y1 - y0);
+                }
+            }
+            if(n == 3 && ys[2] < ys[1]) {
+                std::swap(ys[1], ys[2]);
+            }
+            ys[n] = y1;
+            for(int i = 0; i < n; ++i) {
+                float ya = std::clamp(ys[i], y0, y1);
+                float yb = std::clamp(ys[i + 1], y0, y1);
+                if(ya < yb) {
+                    float xa = std::clamp(x0 + (ya - y0) * dxdy, 0.0f, fw);
+                    float xb = std::clamp(x0 + (yb - y0) * dxdy, 0.0f, fw);
+                    add_segment(xa, ya, xb, yb, dir);
+                }
+            }
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // y0 < y1, both ends inside
+
+        void add_segment(float x0, float y0, float x1, float y1, float dir)
+        {
+            float fw = (float)width;
+            float dxdy = (x1 - x0) / (y1 - y0);
+            float x = x0;
+            int y_end = std::min(height, (int)std::ceil(y1));
+            for(int y = (int)y0; y < y_end; ++y) {
+                float *row = cells.data() + y * stride;
+                float dy = std::min((float)(y + 1), y1) - std::max((float)y, y0);
+                float x_next = std::clamp(x + dxdy * dy, 0.0f, fw);
+                float d = dy * dir;
+                float xa = std::min(x, x_next);
+                float xb = std::max(x, x_next);
+                float xa_floor = std::floor(xa);
+                int xai = (int)xa_floor;
+                float xb_ceil = std::ceil(xb);
+                int xbi = (int)xb_ceil;
+                if(xbi <= xai + 1) {
+                    float xmf = 0.5f * (x + x_next) - xa_floor;
+                    row[xai] += d - d * xmf;
+                    row[xai + 1] += d * xmf;
+                } else {
+                    float s = 1.0f / (xb - xa);
+                    float xaf = xa - xa_floor;
+                    float a0 = 0.5f * s * (1.0f - xaf) * (1.0f - xaf);
+                    float xbf = xb - xb_ceil + 1.0f;
+                    float am = 0.5f * s * xbf * xbf;
+                    row[xai] += d * a0;
+                    if(xbi == xai + 2) {
+                        row[xai + 1] += d * (1.0f - a0 - am);
+                    } else {
+                        float a1 = s * (1.5f - xaf);
+                        row[xai + 1] += d * (a1 - a0);
+                        for(int xi = xai + 2; xi < xbi - 1; ++xi) {
+                            row[xi] += d * s;
+                        }
+                        float a2 = a1 + (float)(xbi - xai - 3) * s;
+                        row[xbi - 1] += d * (1.0f - a2 - am);
+                    }
+                    row[xbi] += d * am;
+                }
+                x = x_next;
+            }
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // Calls apply(x, y, coverage) for every pixel and leaves the cells zeroed
+
+        template <typename F> void resolve(F &&apply)
+        {
+            for(int y = 0; y < height; ++y) {
+                float *row = cells.data() + y * stride;
+                float sum = 0;
+                for(int x = 0; x < width; ++x) {
+                    sum += row[x];
+                    row[x] = 0;
+                    apply(x, y, std::min(1.0f, std::fabs(sum)));
+                }
+                row[width] = 0;
+                row[width + 1] = 0;
+            }
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct pixel_box
+    {
+        int x0, y0, x1, y1;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct pixel_transform
+    {
+        double sx, sy, ox, oy;
+
+        vec2f operator()(float x, float y) const
+        {
+            return { (float)(x * sx + ox), (float)(y * sy + oy) };
+        }
+
+        pixel_box box(rect const &r, int width, int height) const
+        {
+            vec2f a = (*this)((float)r.min_pos.x, (float)r.min_pos.y);
+            vec2f b = (*this)((float)r.max_pos.x, (float)r.max_pos.y);
+            return { std::max(0, (int)std::floor(std::min(a.x, b.x))),
+                     std::max(0, (int)std::floor(std::min(a.y, b.y))),
+                     std::min(width, (int)std::ceil(std::max(a.x, b.x)) + 1),
+                     std::min(height, (int)std::ceil(std::max(a.y, b.y)) + 1) };
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // The image split into tiles and the world -> pixel transform
+
+    struct tile_grid
+    {
+        int width{};
+        int height{};
+        int tiles_x{};
+        int tiles_y{};
+        size_t num_tiles{};
+        pixel_transform xform{};
+
+        explicit tile_grid(soft_render_params const &params)
+        {
+            rect const &r = params.board_rect;
+            if(params.width == 0 || params.height == 0 || r.width() <= 0 || r.height() <= 0) {
+                return;
+            }
+            width = (int)params.width;
+            height = (int)params.height;
+            tiles_x = (width + tile_size - 1) / tile_size;
+            tiles_y = (height + tile_size - 1) / tile_size;
+            num_tiles = (size_t)tiles_x * tiles_y;
+
+            // world -> board (flip around the center) -> pixels (y down)
+            double sx = params.width / r.width();
+            double sy = params.height / r.height();
+            vec2d c = params.flip_center;
+            vec2d f = params.flip_xy;
+            xform = { f.x * sx, -f.y * sy, (c.x - c.x * f.x - r.min_pos.x) * sx, (r.max_pos.y - c.y + c.y * f.y) * sy };
+        }
+
+        bool empty() const
+        {
+            return num_tiles == 0;
+        }
+
+        // add an entity (or a triangle of the mask) to all the tiles it touches
+        void bin(std::vector<std::vector<uint32_t>> &bins, pixel_box const &b, uint32_t id) const
+        {
+            if(b.x0 >= b.x1 || b.y0 >= b.y1) {
+                return;
+            }
+            for(int ty = b.y0 / tile_size; ty <= (b.y1 - 1) / tile_size; ++ty) {
+                for(int tx = b.x0 / tile_size; tx <= (b.x1 - 1) / tile_size; ++tx) {
+                    bins[ty * tiles_x + tx].push_back(id);
+                }
+            }
+        }
+
+        pixel_box tile_box(size_t tile) const
+        {
+            int x = (int)(tile % tiles_x) * tile_size;
+            int y = (int)(tile / tiles_x) * tile_size;
+            return { x, y, std::min(width, x + tile_size), std::min(height, y + tile_size) };
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // A layer's geometry in pixel coordinates and which entities touch each tile
+
+    struct layer_data
+    {
+        gerber_drawer const *drawer;
+        std::vector<vec2f> vertices;
+        std::vector<uint32_t> decoded_indices;
+        uint32_t const *indices{};
+        std::vector<pixel_box> boxes;
+        std::vector<std::vector<uint32_t>> bins;
+        float color[4];
+        bool invert;
+
+        void prepare(soft_layer const &src, tile_grid const &grid)
+        {
+            gerber_drawer const &d = *src.drawer;
+            drawer = &d;
+            gpu::colorf4 col(src.fill_color);
+            std::copy(col.f, col.f + 4, color);
+            invert = src.invert;
+
+            std::vector<gpu::vertex_entity> decoded_vertices;
+            gpu::vertex_entity const *verts = d.fill_vertices.data();
+            size_t num_verts = d.fill_vertices.size();
+            indices = d.fill_indices.data();
+            if(d.is_compact()) {
+                d.decode_compact(decoded_vertices, decoded_indices);
+                verts = decoded_vertices.data();
+                num_verts = decoded_vertices.size();
+                indices = decoded_indices.data();
+            }
+            vertices.resize(num_verts);
+            job_pool::parallel_for(0, num_verts, 16384, [&](size_t vb, size_t ve) {
+                for(size_t i = vb; i < ve; ++i) {
+                    vertices[i] = grid.xform(verts[i].x, verts[i].y);
+                }
+            });
+
+            size_t num_entities = d.entities.size();
+            boxes.resize(num_entities);
+            bins.resize(grid.num_tiles);
+            for(size_t i = 0; i < num_entities; ++i) {
+                tesselator_entity const &e = d.entities[i];
+                if(e.fill_index_count == 0 || (e.flags & (entity_flags_t::fill | entity_flags_t::clear)) == 0) {
+                    continue;
+                }
+                boxes[i] = grid.xform.box(e.bounds, grid.width, grid.height);
+                grid.bin(bins, boxes[i], (uint32_t)i);
+            }
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // The outline mask for inverted layers, binned by triangle
+
+    struct mask_data
+    {
+        std::vector<vec2f> vertices;
+        std::vector<std::vector<uint32_t>> bins;
+        uint32_t const *indices{};
+
+        void prepare(solid_shape const *mask, tile_grid const &grid)
+        {
+            if(mask == nullptr || mask->indices.empty()) {
+                return;
+            }
+            vertices.reserve(mask->vertices.size());
+            for(auto const &v : mask->vertices) {
+                vertices.push_back(grid.xform(v.x, v.y));
+            }
+            indices = mask->indices.data();
+            bins.resize(grid.num_tiles);
+            for(uint32_t t = 0; t < (uint32_t)(mask->indices.size() / 3); ++t) {
+                vec2f const &a = vertices[indices[t * 3]];
+                vec2f const &b = vertices[indices[t * 3 + 1]];
+                vec2f const &v = vertices[indices[t * 3 + 2]];
+                pixel_box box{ std::max(0, (int)std::floor(std::min({ a.x, b.x, v.x }))),
+                               std::max(0, (int)std::floor(std::min({ a.y, b.y, v.y }))),
+                               std::min(grid.width, (int)std::ceil(std::max({ a.x, b.x, v.x })) + 1),
+                               std::min(grid.height, (int)std::ceil(std::max({ a.y, b.y, v.y })) + 1) };
+                grid.bin(bins, box, t);
+            }
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // Coverage of the outline mask in one tile, all 1 if there's no mask
+
+    void mask_coverage(coverage_accumulator &acc, mask_data const &mask, size_t tile, pixel_box const &t, float *cover)
+    {
+        int tw = t.x1 - t.x0;
+        int th = t.y1 - t.y0;
+        int tile_pixels = tw * th;
+
+        if(mask.indices == nullptr) {
+            std::fill(cover, cover + tile_pixels, 1.0f);
+            return;
+        }
+        std::fill(cover, cover + tile_pixels, 0.0f);
+        if(mask.bins[tile].empty()) {
+            return;
+        }
+        acc.begin(tw, th);
+        vec2f o((float)t.x0, (float)t.y0);
+        for(uint32_t i : mask.bins[tile]) {
+            vec2f a = mask.vertices[mask.indices[i * 3]];
+            vec2f b = mask.vertices[mask.indices[i * 3 + 1]];
+            vec2f v = mask.vertices[mask.indices[i * 3 + 2]];
+            acc.add_triangle({ a.x - o.x, a.y - o.y }, { b.x - o.x, b.y - o.y }, { v.x - o.x, v.y - o.y });
+        }
+        acc.resolve([&](int x, int y, float coverage) { cover[y * tw + x] = coverage; });
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // Coverage of one layer in one tile (tw * th floats in cover), this is
+    // where the polarity is handled. Returns false if the layer doesn't touch
+    // the tile (and cover is left alone)
+
+    bool layer_coverage(coverage_accumulator &acc, layer_data const &d, mask_data const &mask, size_t tile, pixel_box const &t, float *cover)
+    {
+        int tw = t.x1 - t.x0;
+        int th = t.y1 - t.y0;
+        int tile_pixels = tw * th;
+
+        float fill_value = 1;
+        float clear_value = 0;
+
+        if(d.invert) {
+            std::swap(fill_value, clear_value);
+            mask_coverage(acc, mask, tile, t, cover);
+        } else if(d.bins[tile].empty()) {
+            return false;
+        } else {
+            std::fill(cover, cover + tile_pixels, 0.0f);
+        }
+
+        // entities in order, each one pulls the coverage towards 1 (fill) or 0 (clear)
+        for(uint32_t id : d.bins[tile]) {
+            tesselator_entity const &e = d.drawer->entities[id];
+            pixel_box const &box = d.boxes[id];
+            int rx0 = std::max(box.x0, t.x0);
+            int ry0 = std::max(box.y0, t.y0);
+            int rx1 = std::min(box.x1, t.x1);
+            int ry1 = std::min(box.y1, t.y1);
+            if(rx0 >= rx1 || ry0 >= ry1) {
+                continue;
+            }
+            acc.begin(rx1 - rx0, ry1 - ry0);
+            float ox = (float)rx0;
+            float oy = (float)ry0;
+            uint32_t const *idx = d.indices + e.fill_index_offset;
+            for(int i = 0; i < e.fill_index_count; i += 3) {
+                vec2f const &a = d.vertices[idx[i]];
+                vec2f const &b = d.vertices[idx[i + 1]];
+                vec2f const &v = d.vertices[idx[i + 2]];
+                acc.add_triangle({ a.x - ox, a.y - oy }, { b.x - ox, b.y - oy }, { v.x - ox, v.y - oy });
+            }
+            float target = (e.flags & entity_flags_t::fill) != 0 ? fill_value : clear_value;
+            float *dst = cover + (ry0 - t.y0) * tw + (rx0 - t.x0);
+            acc.resolve([&](int x, int y, float coverage) {
+                float &value = dst[y * tw + x];
+                value += (target - value) * coverage;
+            });
+        }
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    uint32_t pack_rgb(float r, float g, float b)
+    {
+        uint32_t cr = (uint32_t)std::lround(std::clamp(r, 0.0f, 1.0f) * 255.0f);
+        uint32_t cg = (uint32_t)std::lround(std::clamp(g, 0.0f, 1.0f) * 255.0f);
+        uint32_t cb = (uint32_t)std::lround(std::clamp(b, 0.0f, 1.0f) * 255.0f);
+        return 0xff000000 | (cb << 16) | (cg << 8) | cr;
+    }
+
+}    // namespace
+
+namespace gerber
+{
+    //////////////////////////////////////////////////////////////////////
+
+    void soft_render_size(rect const &r, uint32_t max_size, uint32_t &width, uint32_t &height)
+    {
+        vec2d size = r.size();
+        if(size.x <= 0 || size.y <= 0) {
+            width = height = 0;
+            return;
+        }
+        if(size.x >= size.y) {
+            width = max_size;
+            height = std::max(1u, (uint32_t)std::lround(max_size * size.y / size.x));
+        } else {
+            height = max_size;
+            width = std::max(1u, (uint32_t)std::lround(max_size * size.x / size.y));
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    soft_image soft_render(std::vector<soft_layer> const &layers, soft_render_params const &params, std::stop_token stop_token)
+    {
+        job_trace::stage trace("soft_render", {});
+
+        soft_image image;
+        image.width = params.width;
+        image.height = params.height;
+        tile_grid grid(params);
+        if(grid.empty()) {
+            return image;
+        }
+        image.pixels.resize((size_t)params.width * params.height);
+
+        // get the layers into pixel space and bin their entities
+
+        std::vector<layer_data> data(layers.size());
+
+        job_pool::parallel_for(0, layers.size(), 1, [&](size_t begin, size_t end) {
+            for(size_t l = begin; l < end; ++l) {
+                data[l].prepare(layers[l], grid);
+            }
+        });
+
+        mask_data mask;
+        mask.prepare(params.outline_mask, grid);
+
+        // render the tiles
+
+        gpu::colorf4 background(params.background);
+
+        job_pool::parallel_for(0, grid.num_tiles, 1, [&](size_t begin, size_t end) {
+            coverage_accumulator acc;
+            std::vector<float> rgb(tile_size * tile_size * 3);
+            std::vector<float> cover(tile_size * tile_size);
+
+            for(size_t tile = begin; tile < end && !stop_token.stop_requested(); ++tile) {
+
+                pixel_box t = grid.tile_box(tile);
+                int tw = t.x1 - t.x0;
+                int th = t.y1 - t.y0;
+                int tile_pixels = tw * th;
+
+                for(int i = 0; i < tile_pixels; ++i) {
+                    rgb[i * 3 + 0] = background.red();
+                    rgb[i * 3 + 1] = background.green();
+                    rgb[i * 3 + 2] = background.blue();
+                }
+
+                for(layer_data const &d : data) {
+
+                    if(!layer_coverage(acc, d, mask, tile, t, cover.data())) {
+                        continue;
+                    }
+
+                    // blend it over the image in the layer color
+                    float const *col = d.color;
+                    for(int i = 0; i < tile_pixels; ++i) {
+                        float a = std::clamp(cover[i], 0.0f, 1.0f) * col[3];
+                        float *p = rgb.data() + i * 3;
+                        p[0] += (col[0] - p[0]) * a;
+                        p[1] += (col[1] - p[1]) * a;
+                        p[2] += (col[2] - p[2]) * a;
+                    }
+                }
+
+                for(int y = 0; y < th; ++y) {
+                    uint32_t *row = image.pixels.data() + (size_t)(t.y0 + y) * grid.width + t.x0;
+                    float const *src = rgb.data() + y * tw * 3;
+                    for(int x = 0; x < tw; ++x) {
+                        row[x] = pack_rgb(src[0], src[1], src[2]);
+                        src += 3;
+                    }
+                }
+            }
+        });
+
+        if(stop_token.stop_requested()) {
+            return {};
+        }
+        return image;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    soft_diff soft_compare(soft_layer const &before, soft_layer const &after, soft_render_params const &params, float threshold, std::stop_token stop_token)
+    {
+        job_trace::stage trace("soft_compare", {});
+
+        soft_diff diff;
+        diff.image.width = params.width;
+        diff.image.height = params.height;
+        tile_grid grid(params);
+        if(grid.empty()) {
+            return diff;
+        }
+        diff.image.pixels.resize((size_t)params.width * params.height);
+
+        layer_data data[2];
+        job_pool::parallel_for(0, 2, 1, [&](size_t begin, size_t end) {
+            for(size_t l = begin; l < end; ++l) {
+                data[l].prepare(l == 0 ? before : after, grid);
+            }
+        });
+
+        mask_data mask;
+        mask.prepare(params.outline_mask, grid);
+
+        // changed pixels are tracked per cell (tiles write to their own cells)
+        // and then joined up into regions
+        int constexpr cell_size = 32;
+        int const cells_x = (grid.width + cell_size - 1) / cell_size;
+        int const cells_y = (grid.height + cell_size - 1) / cell_size;
+        std::vector<pixel_box> cells((size_t)cells_x * cells_y, pixel_box{ INT_MAX, INT_MAX, -1, -1 });
+
+        struct tile_stats
+        {
+            double added;
+            double removed;
+            double unchanged;
+            size_t changed;
+        };
+        std::vector<tile_stats> stats(grid.num_tiles);
+
+        gpu::colorf4 background(params.background);
+        float constexpr unchanged_color[3] = { 0.45f, 0.45f, 0.45f };
+        float constexpr added_color[3] = { 0.1f, 0.9f, 0.2f };
+        float constexpr removed_color[3] = { 0.95f, 0.15f, 0.1f };
+
+        job_pool::parallel_for(0, grid.num_tiles, 1, [&](size_t begin, size_t end) {
+            coverage_accumulator acc;
+            std::vector<float> cover[2] = { std::vector<float>(tile_size * tile_size), std::vector<float>(tile_size * tile_size) };
+
+            for(size_t tile = begin; tile < end && !stop_token.stop_requested(); ++tile) {
+
+                pixel_box t = grid.tile_box(tile);
+                int tw = t.x1 - t.x0;
+                int th = t.y1 - t.y0;
+                int tile_pixels = tw * th;
+
+                for(int l = 0; l < 2; ++l) {
+                    if(!layer_coverage(acc, data[l], mask, tile, t, cover[l].data())) {
+                        std::fill(cover[l].begin(), cover[l].begin() + tile_pixels, 0.0f);
+                    }
+                }
+
+                tile_stats &ts = stats[tile];
+                ts = {};
+                for(int y = 0; y < th; ++y) {
+                    uint32_t *row = diff.image.pixels.data() + (size_t)(t.y0 + y) * grid.width + t.x0;
+                    for(int x = 0; x < tw; ++x) {
+                        float a = std::clamp(cover[0][y * tw + x], 0.0f, 1.0f);
+                        float b = std::clamp(cover[1][y * tw + x], 0.0f, 1.0f);
+                        float same = std::min(a, b);
+                        float added = std::max(0.0f, b - a);
+                        float removed = std::max(0.0f, a - b);
+                        ts.unchanged += same;
+                        ts.added += added;
+                        ts.removed += removed;
+
+                        float rgb[3];
+                        for(int c = 0; c < 3; ++c) {
+                            rgb[c] = background.f[c] + (unchanged_color[c] - background.f[c]) * same;
+                            rgb[c] += (added_color[c] - rgb[c]) * added;
+                            rgb[c] += (removed_color[c] - rgb[c]) * removed;
+                        }
+                        row[x] = pack_rgb(rgb[0], rgb[1], rgb[2]);
+
+                        if(added > threshold || removed > threshold) {
+                            ts.changed += 1;
+                            int px = t.x0 + x;
+                            int py = t.y0 + y;
+                            pixel_box &cell = cells[(py / cell_size) * cells_x + px / cell_size];
+                            cell.x0 = std::min(cell.x0, px);
+                            cell.y0 = std::min(cell.y0, py);
+                            cell.x1 = std::max(cell.x1, px + 1);
+                            cell.y1 = std::max(cell.y1, py + 1);
+                        }
+                    }
+                }
+            }
+        });
+
+        if(stop_token.stop_requested()) {
+            diff = {};
+            diff.cancelled = true;
+            return diff;
+        }
+
+        rect const &r = params.board_rect;
+        double pixel_width = r.width() / grid.width;
+        double pixel_height = r.height() / grid.height;
+        double pixel_area = pixel_width * pixel_height;
+        for(auto const &ts : stats) {
+            diff.added_area += ts.added * pixel_area;
+            diff.removed_area += ts.removed * pixel_area;
+            diff.unchanged_area += ts.unchanged * pixel_area;
+            diff.changed_pixels += ts.changed;
+        }
+
+        // join neighbouring cells (including diagonals) with changes into regions
+        std::vector<int> pending;
+        for(int start = 0; start < cells_x * cells_y; ++start) {
+            if(cells[start].x1 < 0) {
+                continue;
+            }
+            pixel_box region = cells[start];
+            cells[start].x1 = -1;
+            pending.push_back(start);
+            while(!pending.empty()) {
+                int c = pending.back();
+                pending.pop_back();
+                int cx = c % cells_x;
+                int cy = c / cells_x;
+                for(int ny = std::max(0, cy - 1); ny <= std::min(cells_y - 1, cy + 1); ++ny) {
+                    for(int nx = std::max(0, cx - 1); nx <= std::min(cells_x - 1, cx + 1); ++nx) {
+                        pixel_box &n = cells[ny * cells_x + nx];
+                        if(n.x1 < 0) {
+                            continue;
+                        }
+                        region.x0 = std::min(region.x0, n.x0);
+                        region.y0 = std::min(region.y0, n.y0);
+                        region.x1 = std::max(region.x1, n.x1);
+                        region.y1 = std::max(region.y1, n.y1);
+                        n.x1 = -1;
+                        pending.push_back(ny * cells_x + nx);
+                    }
+                }
+            }
+            // pixels are y down, board is y up
+            diff.changed_regions.emplace_back(r.min_pos.x + region.x0 * pixel_width,
+                                              r.max_pos.y - region.y1 * pixel_height,
+                                              r.min_pos.x + region.x1 * pixel_width,
+                                              r.max_pos.y - region.y0 * pixel_height);
+        }
+
+        LOG_INFO("Compared {}x{}: {} changed pixels in {} regions", grid.width, grid.height, diff.changed_pixels, diff.changed_regions.size());
+        return diff;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // The raster is a whole number of pixels per density tile so each pixel
+    // goes in exactly one. Render tiles don't line up with density tiles, so
+    // each render tile sums into its own little grid and those are added up after
+
+    soft_density soft_copper_density(soft_layer const &layer, rect const &board_rect, double tile, solid_shape const *outline_mask, uint32_t max_size)
+    {
+        job_trace::stage trace("soft_density", {});
+
+        soft_density density;
+        vec2d size = board_rect.size();
+        if(tile <= 0 || size.x <= 0 || size.y <= 0 || max_size == 0) {
+            return density;
+        }
+
+        // at least a pixel per tile
+        tile = std::max(tile, std::max(size.x, size.y) / max_size);
+        density.tile_size = tile;
+        density.tiles_x = std::max(1, (int)std::ceil(size.x / tile - 1e-9));
+        density.tiles_y = std::max(1, (int)std::ceil(size.y / tile - 1e-9));
+        int pixels_per_tile = std::max(1, (int)(max_size / (uint32_t)std::max(density.tiles_x, density.tiles_y)));
+        density.board_rect = rect(board_rect.min_pos.x, board_rect.min_pos.y, board_rect.min_pos.x + density.tiles_x * tile, board_rect.min_pos.y + density.tiles_y * tile);
+
+        soft_render_params params;
+        params.width = (uint32_t)(density.tiles_x * pixels_per_tile);
+        params.height = (uint32_t)(density.tiles_y * pixels_per_tile);
+        params.board_rect = density.board_rect;
+        params.outline_mask = outline_mask;
+        tile_grid grid(params);
+        if(grid.empty()) {
+            return density;
+        }
+
+        layer_data data;
+        data.prepare(layer, grid);
+
+        mask_data mask;
+        mask.prepare(outline_mask, grid);
+
+        struct tile_sums
+        {
+            pixel_box cells;    // density tiles, pixel rows so row 0 is the top
+            std::vector<double> copper;
+            std::vector<double> board;
+        };
+        std::vector<tile_sums> sums(grid.num_tiles);
+
+        job_pool::parallel_for(0, grid.num_tiles, 1, [&](size_t begin, size_t end) {
+            coverage_accumulator acc;
+            std::vector<float> copper(tile_size * tile_size);
+            std::vector<float> board(tile_size * tile_size);
+
+            for(size_t tile = begin; tile < end; ++tile) {
+
+                pixel_box t = grid.tile_box(tile);
+                int tw = t.x1 - t.x0;
+                int th = t.y1 - t.y0;
+
+                tile_sums &ts = sums[tile];
+                ts.cells = { t.x0 / pixels_per_tile, t.y0 / pixels_per_tile, (t.x1 - 1) / pixels_per_tile + 1, (t.y1 - 1) / pixels_per_tile + 1 };
+                int cw = ts.cells.x1 - ts.cells.x0;
+                size_t num_cells = (size_t)cw * (ts.cells.y1 - ts.cells.y0);
+                ts.copper.assign(num_cells, 0.0);
+                ts.board.assign(num_cells, 0.0);
+
+                mask_coverage(acc, mask, tile, t, board.data());
+                bool any_copper = layer_coverage(acc, data, mask, tile, t, copper.data());
+
+                for(int y = 0; y < th; ++y) {
+                    size_t row = (size_t)((t.y0 + y) / pixels_per_tile - ts.cells.y0) * cw;
+                    float const *c = copper.data() + y * tw;
+                    float const *b = board.data() + y * tw;
+                    for(int x = 0; x < tw; ++x) {
+                        size_t cell = row + (t.x0 + x) / pixels_per_tile - ts.cells.x0;
+                        float on_board = std::clamp(b[x], 0.0f, 1.0f);
+                        ts.board[cell] += on_board;
+                        if(any_copper) {
+                            // copper off the board doesn't count
+                            ts.copper[cell] += std::min(std::clamp(c[x], 0.0f, 1.0f), on_board);
+                        }
+                    }
+                }
+            }
+        });
+
+        double pixel_size = tile / pixels_per_tile;
+        double pixel_area = pixel_size * pixel_size;
+        size_t num_cells = (size_t)density.tiles_x * density.tiles_y;
+        density.copper_area.assign(num_cells, 0.0);
+        density.board_area.assign(num_cells, 0.0);
+        for(auto const &ts : sums) {
+            int cw = ts.cells.x1 - ts.cells.x0;
+            for(int y = ts.cells.y0; y < ts.cells.y1; ++y) {
+                // pixels are y down, tiles are y up
+                size_t dst = (size_t)(density.tiles_y - 1 - y) * density.tiles_x;
+                for(int x = ts.cells.x0; x < ts.cells.x1; ++x) {
+                    size_t src = (size_t)(y - ts.cells.y0) * cw + x - ts.cells.x0;
+                    density.copper_area[dst + x] += ts.copper[src] * pixel_area;
+                    density.board_area[dst + x] += ts.board[src] * pixel_area;
+                }
+            }
+        }
+        for(size_t i = 0; i < num_cells; ++i) {
+            density.total_copper_area += density.copper_area[i];
+            density.total_board_area += density.board_area[i];
+        }
+
+        LOG_INFO("Density {}x{} tiles of {:.3f} at {} pixels: {:.1f}% of {:.3f}",
+                 density.tiles_x,
+                 density.tiles_y,
+                 tile,
+                 pixels_per_tile,
+                 density.total_fill() * 100,
+                 density.total_board_area);
+        return density;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // stb's deflate is single threaded and at the default level it takes
+    // longer than the render for big images, so trade a bit of size for speed
+
+    bool soft_image::save_png(std::filesystem::path const &path) const
+    {
+        job_trace::stage trace("save_png", {});
+
+        if(pixels.empty()) {
+            LOG_ERROR("Nothing to save to {}", path.string());
+            return false;
+        }
+        stbi_write_png_compression_level = 2;
+        if(stbi_write_png(path.string().c_str(), (int)width, (int)height, 4, pixels.data(), (int)width * 4) == 0) {
+            LOG_ERROR("Can't write {}", path.string());
+            return false;
+        }
+        LOG_INFO("Saved {}x{} image to {}", width, height, path.string());
+        return true;
+    }
+
+}    // namespace gerber
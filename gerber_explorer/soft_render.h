@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <stop_token>
+#include <vector>
+
+#include "gerber_drawer.h"
+#include "gpu_colors.h"
+
+//////////////////////////////////////////////////////////////////////
+// CPU rasterizer for the tesselated fill geometry, so images can be made
+// without a GPU (eg headless PNG export).
+//
+// Composites the layers the same way gpu_render does: each layer is drawn
+// into a coverage buffer in entity order (fill entities add, clear entities
+// remove, swapped for inverted layers which start from the outline mask),
+// then blended over the image in its fill color. Coverage is the exact area
+// of each pixel covered by the triangles (signed area accumulation) and the
+// image is done in tiles spread over the job_pool.
+
+namespace gerber
+{
+    //////////////////////////////////////////////////////////////////////
+
+    struct soft_layer
+    {
+        gerber_drawer const *drawer{};
+        gpu::color fill_color{};
+        bool invert{ false };
+    };
+
+    //////////////////////////////////////////////////////////////////////
+
+    struct soft_render_params
+    {
+        uint32_t width{};
+        uint32_t height{};
+        gerber_lib::rect board_rect{};             // area to draw in board coordinates (ie after flipping)
+        gerber_lib::vec2d flip_xy{ 1, 1 };         // -1 or 1 for each of x, y
+        gerber_lib::vec2d flip_center{};           // world position the flip is around
+        gpu::color background{ gpu::colors::black };
+        solid_shape const *outline_mask{};         // for inverted layers, can be null
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // pixels are 0xAABBGGRR (RGBA in memory) and top row first
+
+    struct soft_image
+    {
+        uint32_t width{};
+        uint32_t height{};
+        std::vector<uint32_t> pixels;
+
+        bool save_png(std::filesystem::path const &path) const;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // Pick the image size for rendering rect with max_size pixels on the long side
+
+    void soft_render_size(gerber_lib::rect const &r, uint32_t max_size, uint32_t &width, uint32_t &height);
+
+    // the image has no pixels if stop_token was signalled before it was finished
+
+    soft_image soft_render(std::vector<soft_layer> const &layers, soft_render_params const &params, std::stop_token stop_token = {});
+
+    //////////////////////////////////////////////////////////////////////
+    // Two layers (eg two revisions of the same one) rasterized on the same grid.
+    // A pixel has changed if its coverage differs by more than the threshold
+    // (so tesselation differences along the edges don't count) and changed pixels
+    // which touch are gathered into regions
+
+    struct soft_diff
+    {
+        double added_area{};        // board units squared
+        double removed_area{};
+        double unchanged_area{};    // covered in both
+        size_t changed_pixels{};
+        std::vector<gerber_lib::rect> changed_regions;    // board coordinates
+        soft_image image;                                 // unchanged grey, added green, removed red
+        bool cancelled{};
+
+        bool identical() const
+        {
+            return changed_pixels == 0;
+        }
+    };
+
+    soft_diff soft_compare(soft_layer const &before,
+                           soft_layer const &after,
+                           soft_render_params const &params,
+                           float threshold = 0.5f,
+                           std::stop_token stop_token = {});
+
+    //////////////////////////////////////////////////////////////////////
+    // Copper density of one layer: it's rasterized the way soft_render draws
+    // it and the exact coverage is summed over square tiles. The tiles start
+    // at the bottom left of board_rect and there are whole tiles so they can
+    // go past its top and right. With an outline mask only copper on the board
+    // counts and the fill is a fraction of the board inside each tile, without
+    // one it's a fraction of the whole tile
+
+    struct soft_density
+    {
+        gerber_lib::rect board_rect{};    // all the tiles
+        double tile_size{};               // can be bigger than asked for, max_size pixels is the limit
+        int tiles_x{};
+        int tiles_y{};
+        std::vector<double> copper_area;    // per tile, board units squared, row 0 at the bottom
+        std::vector<double> board_area;
+        double total_copper_area{};
+        double total_board_area{};
+
+        bool empty() const
+        {
+            return copper_area.empty();
+        }
+
+        // 0..1
+        double fill(int x, int y) const
+        {
+            size_t i = (size_t)y * tiles_x + x;
+            return board_area[i] > 0 ? copper_area[i] / board_area[i] : 0;
+        }
+
+        double total_fill() const
+        {
+            return total_board_area > 0 ? total_copper_area / total_board_area : 0;
+        }
+
+        gerber_lib::rect tile_rect(int x, int y) const
+        {
+            double x0 = board_rect.min_pos.x + x * tile_size;
+            double y0 = board_rect.min_pos.y + y * tile_size;
+            return { x0, y0, x0 + tile_size, y0 + tile_size };
+        }
+    };
+
+    soft_density soft_copper_density(soft_layer const &layer,
+                                     gerber_lib::rect const &board_rect,
+                                     double tile_size,
+                                     solid_shape const *outline_mask,
+                                     uint32_t max_size = 4096);
+
+}    // namespace gerber
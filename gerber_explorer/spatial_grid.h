@@ -0,0 +1,285 @@
+//////////////////////////////////////////////////////////////////////
+// Uniform grids for spatial lookups
+//
+// cell_grid buckets items by their boxes. The items for all the cells are in
+// one array, cell_start[c] .. cell_start[c + 1] are cell c's, so it's two
+// passes (count, then fill) and no allocation per cell.
+//
+// contour_grid is one of those over the edges of some contours, with the ray
+// cast used to find which polygon of a resolved layer a point is in.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "clipper2/clipper.h"
+
+namespace gerber_3d
+{
+    //////////////////////////////////////////////////////////////////////
+
+    struct cell_grid
+    {
+        double left{};    // the corner with the lowest x and y
+        double top{};
+        double cell_w{ 1 };
+        double cell_h{ 1 };
+        double inv_cell_w{ 1 };
+        double inv_cell_h{ 1 };
+        int nx{};
+        int ny{};
+        std::vector<uint32_t> cell_start;
+
+        void set_cells(double x, double y, double w, double h, int cells_x, int cells_y)
+        {
+            left = x;
+            top = y;
+            cell_w = w;
+            cell_h = h;
+            inv_cell_w = 1 / w;
+            inv_cell_h = 1 / h;
+            nx = cells_x;
+            ny = cells_y;
+        }
+
+        // about this many cells over the box, shaped like it, none smaller than min_cell
+
+        void fit(double x0, double y0, double x1, double y1, double cells, int max_dim, double min_cell = 0)
+        {
+            double w = std::max(x1 - x0, std::max(min_cell, 1e-6));
+            double h = std::max(y1 - y0, std::max(min_cell, 1e-6));
+            int max_x = max_dim;
+            int max_y = max_dim;
+            if(min_cell > 0) {
+                max_x = std::max(1, static_cast<int>(std::min<double>(max_dim, w / min_cell)));
+                max_y = std::max(1, static_cast<int>(std::min<double>(max_dim, h / min_cell)));
+            }
+            cells = std::max(1.0, cells);
+            int cells_x = std::clamp(static_cast<int>(std::sqrt(cells * w / h)), 1, max_x);
+            int cells_y = std::clamp(static_cast<int>(cells / cells_x), 1, max_y);
+            set_cells(x0, y0, w / cells_x, h / cells_y, cells_x, cells_y);
+        }
+
+        int cell_x(double x) const
+        {
+            return static_cast<int>(std::clamp((x - left) * inv_cell_w, 0.0, nx - 1.0));
+        }
+
+        int cell_y(double y) const
+        {
+            return static_cast<int>(std::clamp((y - top) * inv_cell_h, 0.0, ny - 1.0));
+        }
+
+        size_t cell_index(int x, int y) const
+        {
+            return static_cast<size_t>(y) * nx + x;
+        }
+
+        size_t num_cells() const
+        {
+            return static_cast<size_t>(nx) * ny;
+        }
+
+        size_t cells_covered(double x0, double y0, double x1, double y1) const
+        {
+            return static_cast<size_t>(cell_x(x1) - cell_x(x0) + 1) * (cell_y(y1) - cell_y(y0) + 1);
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // for_each_item(place) calls place(x0, y0, x1, y1, item) for every item,
+        // which goes in each cell its box touches. It's called twice
+
+        template <typename T, typename F> void bucket(std::vector<T> &items, F &&for_each_item)
+        {
+            auto for_each_cell = [&](double x0, double y0, double x1, double y1, auto &&fn) {
+                int xa = cell_x(x0);
+                int xb = cell_x(x1);
+                int ya = cell_y(y0);
+                int yb = cell_y(y1);
+                for(int y = ya; y <= yb; ++y) {
+                    for(int x = xa; x <= xb; ++x) {
+                        fn(cell_index(x, y));
+                    }
+                }
+            };
+
+            cell_start.assign(num_cells() + 1, 0);
+            for_each_item([&](double x0, double y0, double x1, double y1, T const &) {
+                for_each_cell(x0, y0, x1, y1, [&](size_t c) { cell_start[c + 1] += 1; });
+            });
+            for(size_t i = 1; i < cell_start.size(); ++i) {
+                cell_start[i] += cell_start[i - 1];
+            }
+            items.resize(cell_start.back());
+            std::vector<uint32_t> fill(cell_start.begin(), cell_start.end() - 1);
+            for_each_item([&](double x0, double y0, double x1, double y1, T const &item) {
+                for_each_cell(x0, y0, x1, y1, [&](size_t c) { items[fill[c]++] = item; });
+            });
+        }
+
+        template <typename T> std::span<T const> cell(std::vector<T> const &items, size_t c) const
+        {
+            return { items.data() + cell_start[c], items.data() + cell_start[c + 1] };
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    // The outer polygon a contour of a polytree bounds, and which side of the
+    // contour (walking along it) the material is on
+
+    struct contour_info
+    {
+        Clipper2Lib::PolyPath64 *outer;
+        bool material_left;
+    };
+
+    // fn(path, info) for every contour under node, each outer before its holes
+    // and the islands inside a hole after it
+
+    template <typename F> void for_each_contour(Clipper2Lib::PolyPath64 const &node, F &&fn)
+    {
+        for(auto const &outer : node) {
+            fn(outer->Polygon(), contour_info{ outer.get(), Clipper2Lib::IsPositive(outer->Polygon()) });
+            for(auto const &hole : *outer) {
+                fn(hole->Polygon(), contour_info{ outer.get(), !Clipper2Lib::IsPositive(hole->Polygon()) });
+                for_each_contour(*hole, fn);
+            }
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // The edges of some contours in a cell_grid, each edge is in every cell its
+    // box (grown by margin) touches
+
+    struct contour_grid
+    {
+        struct edge
+        {
+            Clipper2Lib::Point64 a;
+            Clipper2Lib::Point64 b;
+            uint32_t contour;    // index into the contours it was built from
+            uint32_t index;      // of a in the contour
+        };
+
+        struct hit
+        {
+            bool found{};
+            uint32_t contour{};
+            bool up{};    // the edge goes towards +y
+        };
+
+        Clipper2Lib::Rect64 bounds{};    // of the edges, not grown
+        double margin{};
+        cell_grid grid;
+        std::vector<edge> edges;
+
+        //////////////////////////////////////////////////////////////////////
+
+        void build(std::span<Clipper2Lib::Path64 const *const> contours, size_t edges_per_cell, int max_dim, double grow = 0, double min_cell = 0)
+        {
+            margin = grow;
+            edges.clear();
+            size_t num_edges = 0;
+            bounds = Clipper2Lib::Rect64(INT64_MAX, INT64_MAX, INT64_MIN, INT64_MIN);
+            for(Clipper2Lib::Path64 const *path : contours) {
+                num_edges += path->size();
+                for(auto const &pt : *path) {
+                    bounds.left = std::min(bounds.left, pt.x);
+                    bounds.top = std::min(bounds.top, pt.y);
+                    bounds.right = std::max(bounds.right, pt.x);
+                    bounds.bottom = std::max(bounds.bottom, pt.y);
+                }
+            }
+            if(num_edges == 0) {
+                bounds = {};
+                grid = {};
+                return;
+            }
+            grid.fit(static_cast<double>(bounds.left),
+                     static_cast<double>(bounds.top),
+                     static_cast<double>(bounds.right),
+                     static_cast<double>(bounds.bottom),
+                     static_cast<double>(num_edges / std::max<size_t>(1, edges_per_cell)),
+                     max_dim,
+                     min_cell);
+            grid.bucket(edges, [&](auto &&place) {
+                for(uint32_t c = 0; c < static_cast<uint32_t>(contours.size()); ++c) {
+                    Clipper2Lib::Path64 const &path = *contours[c];
+                    size_t n = path.size();
+                    for(size_t i = 0; i < n; ++i) {
+                        Clipper2Lib::Point64 const &a = path[i];
+                        Clipper2Lib::Point64 const &b = path[(i + 1) % n];
+                        place(std::min(a.x, b.x) - margin, std::min(a.y, b.y) - margin, std::max(a.x, b.x) + margin, std::max(a.y, b.y) + margin, edge{ a, b, c, static_cast<uint32_t>(i) });
+                    }
+                }
+            });
+        }
+
+        std::span<edge const> cell(size_t c) const
+        {
+            return grid.cell(edges, c);
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // is any edge's bounding box touching r
+
+        bool any_edge_near(Clipper2Lib::Rect64 const &r) const
+        {
+            if(edges.empty() || r.right < bounds.left || r.left > bounds.right || r.bottom < bounds.top || r.top > bounds.bottom) {
+                return false;
+            }
+            int x0 = grid.cell_x(static_cast<double>(r.left));
+            int x1 = grid.cell_x(static_cast<double>(r.right));
+            int y0 = grid.cell_y(static_cast<double>(r.top));
+            int y1 = grid.cell_y(static_cast<double>(r.bottom));
+            for(int y = y0; y <= y1; ++y) {
+                for(int x = x0; x <= x1; ++x) {
+                    for(auto const &e : cell(grid.cell_index(x, y))) {
+                        if(std::max(e.a.x, e.b.x) >= r.left && std::min(e.a.x, e.b.x) <= r.right && std::max(e.a.y, e.b.y) >= r.top &&
+                           std::min(e.a.y, e.b.y) <= r.bottom) {
+                            return true;
+                        }
+                    }
+                }
+            }
+            return false;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // nearest edge crossed by a ray from p towards +x, a cell at a time
+        // until there's a hit before the end of the cell
+
+        hit ray_cast(Clipper2Lib::Point64 const &p) const
+        {
+            hit result;
+            if(edges.empty() || p.y < bounds.top || p.y > bounds.bottom || p.x > bounds.right) {
+                return result;
+            }
+            double best = static_cast<double>(INT64_MAX);
+            int y = grid.cell_y(static_cast<double>(p.y));
+            for(int x = grid.cell_x(static_cast<double>(p.x)); x < grid.nx; ++x) {
+                for(auto const &e : cell(grid.cell_index(x, y))) {
+                    if((e.a.y > p.y) == (e.b.y > p.y)) {
+                        continue;
+                    }
+                    double cross_x = e.a.x + static_cast<double>(p.y - e.a.y) * static_cast<double>(e.b.x - e.a.x) / static_cast<double>(e.b.y - e.a.y);
+                    if(cross_x >= p.x && cross_x < best) {
+                        best = cross_x;
+                        result.found = true;
+                        result.contour = e.contour;
+                        result.up = e.b.y > e.a.y;
+                    }
+                }
+                if(result.found && best <= grid.left + (x + 1) * grid.cell_w) {
+                    break;
+                }
+            }
+            return result;
+        }
+    };
+
+}    // namespace gerber_3d
@@ -7,6 +7,8 @@
 #include <unistd.h>
 #endif
 
+#include <algorithm>
+
 #include "gerber_log.h"
 #include "gerber_arena.h"
 
@@ -39,6 +41,14 @@ namespace gerber_lib
 
     //////////////////////////////////////////////////////////////////////
 
+    bool decommit_address_space(void *addr, size_t size)
+    {
+        LOG_DEBUG("decommit_address_space({},{})", addr, size);
+        return VirtualFree(addr, size, MEM_DECOMMIT) != 0;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
     std::byte *allocate_address_space(size_t size)
     {
         void* p = VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
@@ -74,9 +84,22 @@ namespace gerber_lib
 
     //////////////////////////////////////////////////////////////////////
 
+    bool decommit_address_space(void *addr, size_t size)
+    {
+        madvise(addr, size, MADV_DONTNEED);
+        return mprotect(addr, size, PROT_NONE) == 0;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
     std::byte *allocate_address_space(size_t size)
     {
-        return (std::byte *)mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        void *p = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED) {
+            LOG_ERROR("Failed to reserve {} bytes of address space", size);
+            return nullptr;
+        }
+        return (std::byte *)p;
     }
 
     //////////////////////////////////////////////////////////////////////
@@ -91,4 +114,197 @@ namespace gerber_lib
 
     size_t system_page_size = get_page_size();
 
+    //////////////////////////////////////////////////////////////////////
+
+    arena_pool &arena_pool::get()
+    {
+        static arena_pool pool;
+        return pool;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    arena_pool::~arena_pool()
+    {
+        trim();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void arena_pool::update_peaks()
+    {
+        stats.peak_reserved = std::max(stats.peak_reserved, stats.reserved);
+        stats.peak_committed = std::max(stats.peak_committed, stats.committed);
+        stats.peak_blocks_in_use = std::max(stats.peak_blocks_in_use, stats.blocks_in_use);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // get a block of reserve_size, preferably one from the pool which already has some pages committed
+
+    std::byte *arena_pool::acquire(size_t reserve_size, size_t &committed_size)
+    {
+        {
+            std::lock_guard lock(pool_mutex);
+
+            release_idle_blocks(std::chrono::steady_clock::now());
+
+            auto best = free_blocks.end();
+            for(auto it = free_blocks.begin(); it != free_blocks.end(); ++it) {
+                if(it->reserve_size == reserve_size && (best == free_blocks.end() || it->committed_size > best->committed_size)) {
+                    best = it;
+                }
+            }
+            if(best != free_blocks.end()) {
+                std::byte *base = best->base;
+                committed_size = best->committed_size;
+                free_blocks.erase(best);
+                stats.pooled -= committed_size;
+                stats.blocks_pooled -= 1;
+                stats.blocks_in_use += 1;
+                stats.recycled += 1;
+                update_peaks();
+                return base;
+            }
+        }
+
+        std::byte *base = allocate_address_space(reserve_size);
+        if(base == nullptr) {
+            return nullptr;
+        }
+        committed_size = 0;
+
+        std::lock_guard lock(pool_mutex);
+        stats.reserved += reserve_size;
+        stats.blocks_in_use += 1;
+        update_peaks();
+        return base;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // arena is done with a block, keep it for the next one (trimmed down a bit)
+
+    void arena_pool::recycle(std::byte *base, size_t reserve_size, size_t committed_size)
+    {
+        if(committed_size > max_block_retain_size) {
+            decommit_address_space(base + max_block_retain_size, committed_size - max_block_retain_size);
+        }
+
+        std::lock_guard lock(pool_mutex);
+
+        if(committed_size > max_block_retain_size) {
+            stats.committed -= committed_size - max_block_retain_size;
+            committed_size = max_block_retain_size;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+
+        stats.blocks_in_use -= 1;
+        free_blocks.push_back({ base, reserve_size, committed_size, now });
+        stats.blocks_pooled += 1;
+        stats.pooled += committed_size;
+
+        // oldest free blocks go first if we're holding on to too much
+        while((stats.pooled > max_pooled_size || free_blocks.size() > max_pooled_blocks) && !free_blocks.empty()) {
+            release_block(free_blocks.front());
+            free_blocks.erase(free_blocks.begin());
+        }
+        release_idle_blocks(now);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // called with pool_mutex held, free blocks are in the order they came back
+
+    void arena_pool::release_idle_blocks(std::chrono::steady_clock::time_point now)
+    {
+        auto idle = std::find_if(free_blocks.begin(), free_blocks.end(), [&](free_block const &b) { return now - b.pooled_at < max_idle_time; });
+        for(auto it = free_blocks.begin(); it != idle; ++it) {
+            release_block(*it);
+        }
+        free_blocks.erase(free_blocks.begin(), idle);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // called with pool_mutex held
+
+    void arena_pool::release_block(free_block const &block)
+    {
+        deallocate_address_space(block.base, block.reserve_size);
+        stats.reserved -= block.reserve_size;
+        stats.committed -= block.committed_size;
+        stats.pooled -= block.committed_size;
+        stats.blocks_pooled -= 1;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // commit some pages in a block, subject to the commit budget
+
+    bool arena_pool::commit(std::byte *addr, size_t size)
+    {
+        {
+            std::lock_guard lock(pool_mutex);
+
+            if(stats.commit_budget != 0 && stats.committed + size > stats.commit_budget) {
+
+                // try to get under budget by ditching free blocks
+                while(!free_blocks.empty() && stats.committed + size > stats.commit_budget) {
+                    release_block(free_blocks.front());
+                    free_blocks.erase(free_blocks.begin());
+                }
+
+                if(stats.committed + size > stats.commit_budget) {
+                    stats.budget_failures += 1;
+                    LOG_ERROR("Commit budget of {} bytes exceeded ({} committed, {} more wanted)", stats.commit_budget, stats.committed, size);
+                    return false;
+                }
+            }
+            stats.committed += size;
+            update_peaks();
+        }
+
+        if(!commit_address_space(addr, size)) {
+            std::lock_guard lock(pool_mutex);
+            stats.committed -= size;
+            return false;
+        }
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void arena_pool::set_commit_budget(size_t bytes)
+    {
+        std::lock_guard lock(pool_mutex);
+        stats.commit_budget = bytes;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // give all the free blocks back to the OS
+
+    void arena_pool::trim()
+    {
+        std::lock_guard lock(pool_mutex);
+        for(auto const &block : free_blocks) {
+            release_block(block);
+        }
+        free_blocks.clear();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // give back the free blocks nobody has wanted for a while, for when the
+    // arenas are quiet and nothing is acquiring or recycling
+
+    void arena_pool::trim_idle()
+    {
+        std::lock_guard lock(pool_mutex);
+        release_idle_blocks(std::chrono::steady_clock::now());
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    arena_pool::stats_t arena_pool::get_stats()
+    {
+        std::lock_guard lock(pool_mutex);
+        return stats;
+    }
+
 }    // namespace gerber_lib
@@ -2,6 +2,13 @@
 
 //////////////////////////////////////////////////////////////////////
 
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
 #include "gerber_log.h"
 
 //////////////////////////////////////////////////////////////////////
@@ -11,11 +18,80 @@ namespace gerber_lib
     //////////////////////////////////////////////////////////////////////
 
     bool commit_address_space(void *addr, size_t size);
+    bool decommit_address_space(void *addr, size_t size);
     std::byte *allocate_address_space(size_t size);
     void deallocate_address_space(void *p, size_t size);
 
     extern size_t system_page_size;
 
+    //////////////////////////////////////////////////////////////////////
+    // Process-wide pool of reserved address space blocks
+    // Arenas don't reserve anything until they're first used, and when they're
+    // released the block (and whatever's committed in it) goes back here so the
+    // next drawer/exporter which wants the same reserve size can pick it up
+    // without paying for the mmap/commit/page faults again
+
+    struct arena_pool
+    {
+        struct stats_t
+        {
+            size_t reserved;              // address space reserved right now (in use + pooled)
+            size_t committed;             // bytes committed right now (in use + pooled)
+            size_t pooled;                // committed bytes sitting in free blocks
+            size_t blocks_in_use;         // # of blocks owned by arenas
+            size_t blocks_pooled;         // # of free blocks waiting to be reused
+            size_t peak_reserved;         // high-water marks
+            size_t peak_committed;
+            size_t peak_blocks_in_use;
+            size_t recycled;              // # of acquires satisfied from the pool
+            size_t budget_failures;       // # of commits refused because of the commit budget
+            size_t commit_budget;         // 0 = unlimited
+        };
+
+        // free blocks keep at most this much committed, the rest is decommitted
+        static constexpr size_t max_block_retain_size = 64ULL << 20;
+
+        // total committed bytes kept in free blocks before we start unmapping them
+        static constexpr size_t max_pooled_size = 512ULL << 20;
+
+        // free blocks kept however little they have committed, they all hold address space
+        static constexpr size_t max_pooled_blocks = 64;
+
+        // free blocks which haven't been picked up for this long are unmapped
+        static constexpr std::chrono::seconds max_idle_time{ 30 };
+
+        static arena_pool &get();
+
+        ~arena_pool();
+
+        std::byte *acquire(size_t reserve_size, size_t &committed_size);
+        void recycle(std::byte *base, size_t reserve_size, size_t committed_size);
+        bool commit(std::byte *addr, size_t size);
+
+        void set_commit_budget(size_t bytes);
+        void trim();
+        void trim_idle();
+
+        stats_t get_stats();
+
+    private:
+        struct free_block
+        {
+            std::byte *base;
+            size_t reserve_size;
+            size_t committed_size;
+            std::chrono::steady_clock::time_point pooled_at;
+        };
+
+        void release_block(free_block const &block);
+        void release_idle_blocks(std::chrono::steady_clock::time_point now);
+        void update_peaks();
+
+        std::mutex pool_mutex;
+        std::vector<free_block> free_blocks;
+        stats_t stats{};
+    };
+
     //////////////////////////////////////////////////////////////////////
 
     template <size_t reserve_size = 1ULL << 30, size_t alignment = 8, size_t min_grow_size = 16 * 1024> struct gerber_arena
@@ -42,37 +118,63 @@ namespace gerber_lib
 
         //////////////////////////////////////////////////////////////////////
 
+        // the address space is acquired from the arena_pool on first alloc()
+
         void init()
         {
-            base_address = allocate_address_space(reserve_size);
-            used_size = 0;
-            committed_size = 0;
+            release();
         }
 
         //////////////////////////////////////////////////////////////////////
 
         void *alloc(size_t size)
         {
+            if(base_address == nullptr && !acquire()) {
+                return nullptr;
+            }
+
             uintptr_t current_ptr = reinterpret_cast<uintptr_t>(base_address) + used_size;
-            used_size += (alignment - (current_ptr % alignment)) % alignment;
+            size_t offset = used_size + (alignment - (current_ptr % alignment)) % alignment;
 
-            if(used_size + size > reserve_size) {
+            if(offset + size > reserve_size || !commit_to(offset + size)) {
                 return nullptr;
             }
+            used_size = offset + size;
+            return base_address + offset;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // make sure the first size bytes are committed (without using them)
 
-            void *ptr = base_address + used_size;
-            used_size += size;
+        bool commit_to(size_t size)
+        {
+            if(size <= committed_size) {
+                return true;
+            }
+            if(base_address == nullptr && !acquire()) {
+                return false;
+            }
+            if(size > reserve_size) {
+                return false;
+            }
+            size_t need_to_commit = size - committed_size;
+            size_t commit_size = (std::max(min_grow_size, need_to_commit) + system_page_size - 1) & ~(system_page_size - 1);
 
-            if(used_size > committed_size) {
-                size_t need_to_commit = used_size - committed_size;
-                size_t commit_size = (std::max(min_grow_size, need_to_commit) + system_page_size - 1) & ~(system_page_size - 1);
+            commit_size = std::min(commit_size, reserve_size - committed_size);
 
-                if(!commit_address_space(base_address + committed_size, commit_size)) {
-                    return nullptr;
-                }
-                committed_size += commit_size;
+            if(!arena_pool::get().commit(base_address + committed_size, commit_size)) {
+                return false;
             }
-            return ptr;
+            committed_size += commit_size;
+            return true;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        bool acquire()
+        {
+            base_address = arena_pool::get().acquire(reserve_size, committed_size);
+            return base_address != nullptr;
         }
 
         //////////////////////////////////////////////////////////////////////
@@ -86,7 +188,9 @@ namespace gerber_lib
 
         void release()
         {
-            deallocate_address_space(base_address, reserve_size);
+            if(base_address != nullptr) {
+                arena_pool::get().recycle(base_address, reserve_size, committed_size);
+            }
             base_address = nullptr;
             used_size = 0;
             committed_size = 0;
@@ -112,12 +216,14 @@ namespace gerber_lib
     template <typename U, size_t reserve_size = 1ULL << 32, size_t alignment = alignof(U), size_t min_grow_size = 64 * 1024>
     struct typed_arena : gerber_arena<reserve_size, alignment, min_grow_size>
     {
+        LOG_CONTEXT("arena", error);
+
         using value_type = U;
         using arena_t = gerber_arena<reserve_size, alignment, min_grow_size>;
 
         //////////////////////////////////////////////////////////////////////
 
-        typed_arena() : arena_t::gerber_arena(), count(0)
+        typed_arena() : arena_t::gerber_arena(), count(0), reported_full(false)
         {
         }
 
@@ -127,6 +233,7 @@ namespace gerber_lib
         {
             arena_t::init();
             count = 0;
+            reported_full = false;
         }
 
         //////////////////////////////////////////////////////////////////////
@@ -135,6 +242,7 @@ namespace gerber_lib
         {
             arena_t::release();
             count = 0;
+            reported_full = false;
         }
 
         //////////////////////////////////////////////////////////////////////
@@ -144,9 +252,15 @@ namespace gerber_lib
 
         //////////////////////////////////////////////////////////////////////
 
+        // typed arenas only ever allocate whole U's so used_size is always aligned
+        // and the per element path can skip alloc() until it needs to commit more
+
         void push_back(U const &item)
         {
-            U *p = reinterpret_cast<U *>(this->alloc(sizeof(U)));
+            U *p = next_element();
+            if(p == nullptr) {
+                return;
+            }
             *p = item;
             count += 1;
         }
@@ -155,7 +269,10 @@ namespace gerber_lib
 
         template <typename... Args> void emplace_back(Args &&...args)
         {
-            U *p = reinterpret_cast<U *>(this->alloc(sizeof(U)));
+            U *p = next_element();
+            if(p == nullptr) {
+                return;
+            }
             new(p) U(std::forward<Args>(args)...);
             count += 1;
         }
@@ -166,6 +283,55 @@ namespace gerber_lib
         {
             // assert(count != 0);
             count -= 1;
+            this->used_size -= sizeof(U);
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // commit space for n more elements, size() doesn't change
+
+        void reserve(size_t n)
+        {
+            this->commit_to((count + n) * sizeof(U));
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // add n elements in one go, caller fills them in
+        // does NOT call any constructors (or zero them)
+        // returns an empty span if the arena is full
+
+        std::span<U> grow_uninitialized(size_t n)
+        {
+            if(n == 0) {
+                return {};
+            }
+            U *p = reinterpret_cast<U *>(this->alloc(sizeof(U) * n));
+            if(p == nullptr) {
+                return {};
+            }
+            count += n;
+            return { p, n };
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        std::span<U> append(std::span<U const> items)
+        {
+            std::span<U> dst = grow_uninitialized(items.size());
+            if(!dst.empty()) {
+                std::uninitialized_copy(items.begin(), items.end(), dst.begin());
+            }
+            return dst;
+        }
+
+        //////////////////////////////////////////////////////////////////////
+        // drop elements off the end (no destructors called)
+
+        void truncate(size_t n)
+        {
+            if(n < count) {
+                this->used_size -= (count - n) * sizeof(U);
+                count = n;
+            }
         }
 
         //////////////////////////////////////////////////////////////////////
@@ -262,7 +428,11 @@ namespace gerber_lib
         {
             if(n > count) {
                 // does NOT call any constructors!!!!!!!!!!
-                this->alloc(sizeof(value_type) * (n - count));
+                // but it does zero the new elements because recycled blocks from the arena_pool aren't clean
+                void *p = this->alloc(sizeof(value_type) * (n - count));
+                if(p != nullptr) {
+                    memset(p, 0, sizeof(value_type) * (n - count));
+                }
                 count = n;
             }
         }
@@ -273,9 +443,29 @@ namespace gerber_lib
         {
             this->reset();
             count = 0;
+            reported_full = false;
         }
 
         size_t count;
+
+    private:
+        bool reported_full;
+
+        U *next_element()
+        {
+            size_t new_size = this->used_size + sizeof(U);
+            if(new_size <= this->committed_size) {
+                U *p = reinterpret_cast<U *>(this->base_address + this->used_size);
+                this->used_size = new_size;
+                return p;
+            }
+            U *p = reinterpret_cast<U *>(this->alloc(sizeof(U)));
+            if(p == nullptr && !reported_full) {
+                LOG_ERROR("typed_arena is full at {} elements, dropping any more", count);
+                reported_full = true;
+            }
+            return p;
+        }
     };
 
 }    // namespace gerber_lib
@@ -62,4 +62,5 @@
     GERBER_ERROR_CODE(bad_file_offset)              \
     GERBER_ERROR_CODE(file_not_found)               \
     GERBER_ERROR_CODE(missing_attribute)            \
-    GERBER_ERROR_CODE(invalid_parameter)
+    GERBER_ERROR_CODE(invalid_parameter)            \
+    GERBER_ERROR_CODE(cancelled)
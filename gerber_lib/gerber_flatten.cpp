@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <algorithm>
+
+#include "gerber_math.h"
+#include "gerber_flatten.h"
+
+namespace
+{
+    // points are generated in blocks of this many, each lane is an independent rotation
+    // of the block's base point so the inner loop has no dependency chain and vectorizes
+    int constexpr lanes = 8;
+
+    // re-seed the base point with real sin/cos every this many blocks to stop drift
+    int constexpr resync_blocks = 16;
+
+}    // namespace
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+    // sagitta = r * (1 - cos(theta / 2)), so theta = 2 * acos(1 - deviation / r)
+
+    int arc_segment_count(double radius, double start_degrees, double end_degrees, double max_deviation)
+    {
+        double arc_span = deg_2_rad(fabs(end_degrees - start_degrees));
+
+        if(radius <= max_deviation || max_deviation <= 0) {
+            return arc_min_segments;
+        }
+        double step = 2.0 * acos(1.0 - max_deviation / radius);
+        double segments = ceil(arc_span / step);
+
+        // clamp to something sane for huge arcs / tiny deviations
+        return (int)std::clamp(segments, (double)arc_min_segments, 1e6);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    size_t flatten_arc(vec2d center, double radius, double start_degrees, double end_degrees, int num_segments, std::span<vec2f> out,
+                       vec2f const *previous)
+    {
+        double start = deg_2_rad(start_degrees);
+        double end = deg_2_rad(end_degrees);
+        double step = (end - start) / num_segments;
+
+        double lane_cos[lanes];
+        double lane_sin[lanes];
+        for(int k = 0; k < lanes; ++k) {
+            lane_cos[k] = cos(step * k) * radius;
+            lane_sin[k] = sin(step * k) * radius;
+        }
+
+        double block_cos = cos(step * lanes);
+        double block_sin = sin(step * lanes);
+
+        int num_points = num_segments + 1;
+        double base_x = 0;
+        double base_y = 0;
+
+        for(int i = 0, block = 0; i < num_points; i += lanes, ++block) {
+
+            if((block % resync_blocks) == 0) {
+                base_x = cos(start + step * i);
+                base_y = sin(start + step * i);
+            }
+
+            int n = std::min(lanes, num_points - i);
+            vec2f *dst = out.data() + i;
+            for(int k = 0; k < n; ++k) {
+                dst[k].x = static_cast<float>(center.x + base_x * lane_cos[k] - base_y * lane_sin[k]);
+                dst[k].y = static_cast<float>(center.y + base_x * lane_sin[k] + base_y * lane_cos[k]);
+            }
+
+            double x = base_x * block_cos - base_y * block_sin;
+            double y = base_x * block_sin + base_y * block_cos;
+            base_x = x;
+            base_y = y;
+        }
+
+        // end point must be exact, the next element starts there
+        out[num_segments] = { static_cast<float>(center.x + cos(end) * radius), static_cast<float>(center.y + sin(end) * radius) };
+
+        size_t used = 0;
+        for(int i = 0; i < num_points; ++i) {
+            vec2f const *last = used != 0 ? &out[used - 1] : previous;
+            if(last == nullptr || out[i].x != last->x || out[i].y != last->y) {
+                out[used++] = out[i];
+            }
+        }
+        return used;
+    }
+
+}    // namespace gerber_lib
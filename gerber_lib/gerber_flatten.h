@@ -0,0 +1,37 @@
+//////////////////////////////////////////////////////////////////////
+// Arc flattening shared by the 2D and 3D drawers
+
+#pragma once
+
+#include <span>
+
+#include "gerber_2d.h"
+
+namespace gerber_lib
+{
+    //////////////////////////////////////////////////////////////////////
+    // max chord deviation in mm for low, medium, high quality in the 2D drawer,
+    // the 3D meshes are ten times coarser
+
+    double constexpr arc_deviation_mm[3] = { 0.001, 0.0005, 0.0001 };
+    double constexpr mesh_arc_deviation_mm[3] = { 0.01, 0.005, 0.001 };
+
+    // every arc gets at least this many segments however small it is
+    int constexpr arc_min_segments = 8;
+
+    //////////////////////////////////////////////////////////////////////
+    // how many segments to split an arc into so the sagitta is <= max_deviation
+
+    int arc_segment_count(double radius, double start_degrees, double end_degrees, double max_deviation);
+
+    //////////////////////////////////////////////////////////////////////
+    // write num_segments + 1 points from start to end (inclusive) into out
+    // out must have room for at least num_segments + 1 points
+    // consecutive identical points (tiny radius) are collapsed, and so is the first
+    // one if it's the same as previous (where the last element of the contour ended)
+    // returns how many were written
+
+    size_t flatten_arc(vec2d center, double radius, double start_degrees, double end_degrees, int num_segments, std::span<vec2f> out,
+                       vec2f const *previous = nullptr);
+
+}    // namespace gerber_lib
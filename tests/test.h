@@ -0,0 +1,46 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+
+//////////////////////////////////////////////////////////////////////
+
+namespace test
+{
+    // each test registers itself with a static registrar, gerber_tests <name> runs one
+
+    using test_function = void (*)();
+
+    struct registrar
+    {
+        registrar(char const *name, test_function fn);
+    };
+
+    void fail(char const *file, int line, char const *expression);
+    void fail_near(char const *file, int line, char const *expression, double a, double b, double tolerance);
+
+}    // namespace test
+
+//////////////////////////////////////////////////////////////////////
+
+#define TEST(name)                                                    \
+    static void test_##name();                                        \
+    static test::registrar test_registrar_##name(#name, test_##name); \
+    static void test_##name()
+
+#define EXPECT(condition)                               \
+    do {                                                \
+        if(!(condition)) {                              \
+            test::fail(__FILE__, __LINE__, #condition); \
+        }                                               \
+    } while(false)
+
+#define EXPECT_NEAR(a, b, tolerance)                                                            \
+    do {                                                                                        \
+        double expect_a = (a);                                                                  \
+        double expect_b = (b);                                                                  \
+        if(!(std::fabs(expect_a - expect_b) <= (tolerance))) {                                  \
+            test::fail_near(__FILE__, __LINE__, #a " == " #b, expect_a, expect_b, (tolerance)); \
+        }                                                                                       \
+    } while(false)
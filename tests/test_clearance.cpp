@@ -0,0 +1,120 @@
+//////////////////////////////////////////////////////////////////////
+// check_clearance: copper of different nets closer than the minimum
+
+#include <algorithm>
+
+#include "clearance_check.h"
+#include "test.h"
+#include "test_paths.h"
+
+using namespace Clipper2Lib;
+
+//////////////////////////////////////////////////////////////////////
+// top: pads A and B 0.1 apart, C 0.5 from B. bottom: the same A and B, or
+// one pad under both of them. Holes through the middle of A and B. The pads
+// are short enough that each gap is one place
+
+TEST(clearance_violations)
+{
+    double constexpr min_clearance = 0.15;
+
+    PolyTree64 top;
+    test::resolve({ test::rect_path(0, 0, 1, 0.4), test::rect_path(1.1, 0, 2, 0.4), test::rect_path(2.5, 0, 3, 0.4) }, top);
+
+    PolyTree64 bottom;
+    test::resolve({ test::rect_path(0, 0, 1, 0.4), test::rect_path(1.1, 0, 2, 0.4) }, bottom);
+
+    PolyTree64 bottom_pour;
+    test::resolve({ test::rect_path(0, 0, 2, 0.4) }, bottom_pour);
+
+    Paths64 holes{ test::rect_path(0.45, 0.15, 0.55, 0.25), test::rect_path(1.5, 0.15, 1.6, 0.25) };
+
+    auto expect_gap = [](gerber_3d::clearance_violation const &v) {
+        EXPECT(v.net_a < v.net_b);
+        EXPECT_NEAR(v.distance, 0.1, 1e-6);
+        EXPECT_NEAR(std::min(v.from.x, v.to.x), 1.0, 1e-6);
+        EXPECT_NEAR(std::max(v.from.x, v.to.x), 1.1, 1e-6);
+    };
+
+    {
+        // every pad its own net, A-B too close on both layers, B-C is fine
+        PolyTree64 const *layers[] = { &top, &bottom };
+        gerber_3d::clearance_result result = gerber_3d::check_clearance(layers, {}, min_clearance);
+        EXPECT(!result.cancelled);
+        EXPECT(result.num_islands == 5);
+        EXPECT(result.num_nets == 5);
+        EXPECT(result.violations.size() == 2);
+        for(gerber_3d::clearance_violation const &v : result.violations) {
+            expect_gap(v);
+        }
+        if(result.violations.size() == 2) {
+            EXPECT(result.violations[0].layer != result.violations[1].layer);
+        }
+    }
+    {
+        // the holes join A to A' and B to B', still two nets
+        PolyTree64 const *layers[] = { &top, &bottom };
+        gerber_3d::clearance_result result = gerber_3d::check_clearance(layers, holes, min_clearance);
+        EXPECT(result.num_nets == 3);
+        EXPECT(result.violations.size() == 2);
+    }
+    {
+        // the pour joins A and B, same net so not a violation
+        PolyTree64 const *layers[] = { &top, &bottom_pour };
+        gerber_3d::clearance_result result = gerber_3d::check_clearance(layers, holes, min_clearance);
+        EXPECT(result.num_islands == 4);
+        EXPECT(result.num_nets == 2);
+        EXPECT(result.violations.empty());
+    }
+    {
+        // smaller than the gap, nothing
+        PolyTree64 const *layers[] = { &top, &bottom };
+        gerber_3d::clearance_result result = gerber_3d::check_clearance(layers, {}, 0.05);
+        EXPECT(result.violations.empty());
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// top: an outer with two holes and an island in the first one, the second
+// hole leaves a 0.1 web which is all one net. A pad 0.1 off the right edge.
+// bottom: the island again and a pad 0.1 from it, holes join both of them
+// to the top
+
+TEST(clearance_islands_in_holes)
+{
+    double constexpr min_clearance = 0.15;
+
+    PolyTree64 top;
+    test::resolve({ test::rect_path(0, 0, 10, 4),
+                    test::rect_path(1, 0.5, 4.5, 3.5, true),
+                    test::rect_path(1.5, 1.8, 3.5, 2.2),
+                    test::rect_path(6, 1, 9.9, 3, true),
+                    test::rect_path(10.1, 1.8, 11, 2.2) },
+                  top);
+
+    PolyTree64 bottom;
+    test::resolve({ test::rect_path(1.5, 1.8, 3.5, 2.2), test::rect_path(3.6, 1.8, 5.5, 2.2) }, bottom);
+
+    Paths64 holes{ test::rect_path(2.45, 1.95, 2.55, 2.05), test::rect_path(4.95, 1.95, 5.05, 2.05) };
+
+    PolyTree64 const *layers[] = { &top, &bottom };
+    gerber_3d::clearance_result result = gerber_3d::check_clearance(layers, holes, min_clearance);
+    EXPECT(!result.cancelled);
+    EXPECT(result.num_islands == 5);
+    EXPECT(result.num_nets == 3);
+
+    // the outer to the pad on top, the island to the other pad underneath. Not
+    // the web, the second hole belongs to the outer and not the island
+    EXPECT(result.violations.size() == 2);
+    for(gerber_3d::clearance_violation const &v : result.violations) {
+        EXPECT_NEAR(v.distance, 0.1, 1e-6);
+        if(v.layer == 0) {
+            EXPECT_NEAR(std::min(v.from.x, v.to.x), 10.0, 1e-6);
+        } else {
+            EXPECT_NEAR(std::min(v.from.x, v.to.x), 3.5, 1e-6);
+        }
+    }
+    if(result.violations.size() == 2) {
+        EXPECT(result.violations[0].layer != result.violations[1].layer);
+    }
+}
@@ -0,0 +1,151 @@
+//////////////////////////////////////////////////////////////////////
+// copper_nets on a small two layer board with one plated hole
+
+#include "copper_nets.h"
+#include "test.h"
+#include "test_layers.h"
+
+using gerber::copper_nets;
+
+//////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    enum top_entities : uint32_t
+    {
+        pad_a,
+        trace_ab,
+        pad_b,
+        pad_c,
+        clear_in_b,
+        pad_g,
+        pad_h
+    };
+
+    enum bottom_entities : uint32_t
+    {
+        pad_d,
+        trace_de,
+        pad_e,
+        pad_f,
+        pad_under_a
+    };
+
+    uint32_t constexpr top = 0;
+    uint32_t constexpr bottom = 1;
+    uint32_t constexpr drill = 2;
+
+}    // namespace
+
+//////////////////////////////////////////////////////////////////////
+//  top:    A --- B (with a clear in it)   C         G|H (touching)
+//  bottom: A'                             D
+//                                         |
+//          F                              E
+//  a plated hole goes through C and D
+
+TEST(copper_nets_board)
+{
+    test::test_layer top_layer;
+    top_layer.add_rect(0, 0, 1, 1);
+    top_layer.add_rect(0.5f, 0.4f, 5.5f, 0.6f);
+    top_layer.add_rect(5, 0, 6, 1);
+    top_layer.add_rect(10, 0, 11, 1);
+    top_layer.add_rect(5.2f, 0.2f, 5.8f, 0.8f, true);
+    top_layer.add_rect(20, 0, 21, 1);
+    top_layer.add_rect(21, 0, 22, 1);
+
+    test::test_layer bottom_layer;
+    bottom_layer.add_rect(10, 0, 11, 1);
+    bottom_layer.add_rect(10.4f, 0.5f, 10.6f, 5.5f);
+    bottom_layer.add_rect(10, 5, 11, 6);
+    bottom_layer.add_rect(0, 5, 1, 6);
+    bottom_layer.add_rect(0, 0, 1, 1);
+
+    test::test_layer drill_layer;
+    drill_layer.add_circle(10.5f, 0.5f, 0.2f);
+
+    copper_nets::layer_input layers[] = { copper_nets::layer_input::from_drawer(top_layer.drawer, false),
+                                          copper_nets::layer_input::from_drawer(bottom_layer.drawer, false),
+                                          copper_nets::layer_input::from_drawer(drill_layer.drawer, true) };
+    copper_nets nets;
+    EXPECT(nets.build(layers));
+
+    // A-B, C-D-E and the hole, G-H, F, A'
+    EXPECT(nets.num_nets() == 5);
+
+    uint32_t ab = nets.net_of(top, pad_a);
+    EXPECT(ab != copper_nets::no_net);
+    EXPECT(nets.net_of(top, trace_ab) == ab);
+    EXPECT(nets.net_of(top, pad_b) == ab);
+    EXPECT(nets.members(ab).size() == 3);
+
+    // clear entities aren't in a net, and don't split the copper under them
+    EXPECT(nets.net_of(top, clear_in_b) == copper_nets::no_net);
+
+    uint32_t cde = nets.net_of(top, pad_c);
+    EXPECT(cde != ab);
+    EXPECT(nets.net_of(bottom, pad_d) == cde);
+    EXPECT(nets.net_of(bottom, trace_de) == cde);
+    EXPECT(nets.net_of(bottom, pad_e) == cde);
+    EXPECT(nets.net_of(drill, 0) == cde);
+    EXPECT(nets.same_net(bottom, pad_e).size() == 5);
+
+    // touching edges connect
+    EXPECT(nets.net_of(top, pad_g) == nets.net_of(top, pad_h));
+    EXPECT(nets.net_of(top, pad_g) != ab && nets.net_of(top, pad_g) != cde);
+
+    // on top of each other on different layers without a hole isn't connected
+    EXPECT(nets.net_of(bottom, pad_under_a) != ab);
+    EXPECT(nets.net_of(bottom, pad_f) != nets.net_of(bottom, pad_under_a));
+    EXPECT(nets.same_net(bottom, pad_f).size() == 1);
+
+    // out of range
+    EXPECT(nets.net_of(top, pad_h + 1) == copper_nets::no_net);
+    EXPECT(nets.net_of(drill + 1, 0) == copper_nets::no_net);
+}
+
+//////////////////////////////////////////////////////////////////////
+//  top:    A ---|--- B     a clear cuts the trace from A to B in two
+//  bottom: C ---|--- D     the same, then a dark patch over the cut joins them up
+
+TEST(copper_nets_clear_splits)
+{
+    uint32_t constexpr pad_left = 0;
+    uint32_t constexpr trace = 1;
+    uint32_t constexpr pad_right = 2;
+    uint32_t constexpr cut = 3;
+    uint32_t constexpr patch = 4;
+
+    test::test_layer top_layer;
+    test::test_layer bottom_layer;
+    for(test::test_layer *layer : { &top_layer, &bottom_layer }) {
+        layer->add_rect(0, 0, 1, 1);
+        layer->add_rect(0.5f, 0.4f, 5.5f, 0.6f);
+        layer->add_rect(5, 0, 6, 1);
+        layer->add_rect(2.5f, 0, 3, 1, true);
+    }
+    bottom_layer.add_rect(2.4f, 0.45f, 3.1f, 0.55f);
+
+    copper_nets::layer_input layers[] = { copper_nets::layer_input::from_drawer(top_layer.drawer, false),
+                                          copper_nets::layer_input::from_drawer(bottom_layer.drawer, false) };
+    copper_nets nets;
+    EXPECT(nets.build(layers));
+
+    // A, B and C-D
+    EXPECT(nets.num_nets() == 3);
+
+    // the trace is in both nets, its own net is the one its first piece is in
+    uint32_t a = nets.net_of(top, pad_left);
+    uint32_t b = nets.net_of(top, pad_right);
+    EXPECT(a != b);
+    EXPECT(nets.net_of(top, trace) == a);
+    EXPECT(nets.members(a).size() == 2);
+    EXPECT(nets.members(b).size() == 2);
+    EXPECT(nets.net_of(top, cut) == copper_nets::no_net);
+
+    uint32_t cd = nets.net_of(bottom, pad_left);
+    EXPECT(nets.net_of(bottom, pad_right) == cd);
+    EXPECT(nets.net_of(bottom, patch) == cd);
+    EXPECT(nets.members(cd).size() == 4);
+}
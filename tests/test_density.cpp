@@ -0,0 +1,55 @@
+//////////////////////////////////////////////////////////////////////
+// soft_copper_density: copper and board area per tile and in total
+
+#include "soft_render.h"
+#include "test.h"
+#include "test_layers.h"
+
+//////////////////////////////////////////////////////////////////////
+// a 10x10 square with a 2x2 clear in it in the bottom left tile and a 6x2
+// strip in the top right one, 2x2 tiles of 10 over a 20x20 board
+
+TEST(density_totals)
+{
+    test::test_layer layer;
+    layer.add_rect(0, 0, 10, 10);
+    layer.add_rect(4, 4, 6, 6, true);
+    layer.add_rect(12, 12, 18, 14);
+
+    gerber::soft_layer copper{ &layer.drawer, gpu::colors::white, false };
+    gerber_lib::rect const board{ { 0, 0 }, { 20, 20 } };
+
+    gerber::soft_density density = gerber::soft_copper_density(copper, board, 10, nullptr);
+    EXPECT(density.tiles_x == 2 && density.tiles_y == 2);
+    EXPECT_NEAR(density.tile_size, 10, 1e-9);
+    if(density.tiles_x == 2 && density.tiles_y == 2) {
+        EXPECT_NEAR(density.copper_area[0], 96, 0.01);
+        EXPECT_NEAR(density.copper_area[1], 0, 0.01);
+        EXPECT_NEAR(density.copper_area[2], 0, 0.01);
+        EXPECT_NEAR(density.copper_area[3], 12, 0.01);
+        EXPECT_NEAR(density.fill(0, 0), 0.96, 1e-4);
+        EXPECT_NEAR(density.fill(1, 1), 0.12, 1e-4);
+    }
+    EXPECT_NEAR(density.total_copper_area, 108, 0.01);
+    EXPECT_NEAR(density.total_board_area, 400, 0.01);
+    EXPECT_NEAR(density.total_fill(), 108.0 / 400, 1e-4);
+
+    // the board is only the bottom half, so the strip isn't on it
+    gerber::solid_shape mask;
+    mask.init();
+    for(gpu::vertex_solid v : { gpu::vertex_solid{ 0, 0 }, gpu::vertex_solid{ 20, 0 }, gpu::vertex_solid{ 20, 10 }, gpu::vertex_solid{ 0, 10 } }) {
+        mask.vertices.push_back(v);
+    }
+    for(uint32_t i : { 0u, 1u, 2u, 0u, 2u, 3u }) {
+        mask.indices.push_back(i);
+    }
+    gerber::soft_density masked = gerber::soft_copper_density(copper, board, 10, &mask);
+    EXPECT_NEAR(masked.total_copper_area, 96, 0.01);
+    EXPECT_NEAR(masked.total_board_area, 200, 0.01);
+    EXPECT_NEAR(masked.total_fill(), 0.48, 1e-4);
+    if(masked.tiles_x == 2 && masked.tiles_y == 2) {
+        EXPECT_NEAR(masked.board_area[2], 0, 0.01);
+        EXPECT_NEAR(masked.fill(1, 1), 0, 1e-9);
+    }
+    mask.release();
+}
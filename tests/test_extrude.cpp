@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////////////
+// gpu_3d_drawer::extrude: caps and side walls of resolved polygons
+
+#include <map>
+#include <utility>
+
+#include "gpu_3d_drawer.h"
+#include "test.h"
+#include "test_paths.h"
+
+using namespace Clipper2Lib;
+
+namespace
+{
+    Point64 point(double x, double y)
+    {
+        return { test::to_clipper(x), test::to_clipper(y) };
+    }
+
+    // every edge is used once each way, so there are no holes or cracks in the mesh
+
+    bool is_closed(gerber_3d::gpu_3d_drawer const &drawer)
+    {
+        std::map<std::pair<uint32_t, uint32_t>, int> edges;
+        for(size_t i = 0; i < drawer.mesh_indices.size(); i += 3) {
+            for(size_t j = 0; j < 3; ++j) {
+                uint32_t a = drawer.mesh_indices[i + j];
+                uint32_t b = drawer.mesh_indices[i + (j + 1) % 3];
+                edges[{ a, b }] += 1;
+            }
+        }
+        for(auto const &[edge, count] : edges) {
+            auto other = edges.find({ edge.second, edge.first });
+            if(count != 1 || other == edges.end() || other->second != 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+
+    void extrude(gerber_3d::gpu_3d_drawer &drawer, Paths64 const &paths)
+    {
+        drawer.init();
+        test::resolve(paths, drawer.resolved_tree);
+        drawer.extrude(0, 1.6);
+    }
+
+}    // namespace
+
+//////////////////////////////////////////////////////////////////////
+// a 10x10 square with a 4x4 hole, libtess keeps the 8 points and adds none so
+// each cap is 8 triangles (n + 2 * holes - 2) and each of the 8 walls is 2
+
+TEST(extrude_holed_square)
+{
+    gerber_3d::gpu_3d_drawer drawer;
+    extrude(drawer, { test::rect_path(0, 0, 10, 10), test::rect_path(3, 3, 7, 7, true) });
+    EXPECT(drawer.has_mesh);
+    EXPECT(drawer.mesh_vertices.size() == 16);
+    EXPECT(drawer.mesh_indices.size() == 32 * 3);
+    EXPECT(is_closed(drawer));
+    for(gerber_3d::mesh_vertex const &v : drawer.mesh_vertices) {
+        EXPECT(v.z == 0.0f || v.z == 1.6f);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// the outer's right edge bends out by 0.0004 (under the decimation tolerance)
+// and a hole's tip goes into the bend. Decimating the outer on its own would
+// straighten the edge and leave the tip outside it, so the bend has to stay
+
+TEST(extrude_hole_near_edge)
+{
+    Path64 outer{ point(0, 0), point(10, 0), point(10.0004, 5), point(10, 10), point(0, 10) };
+    Path64 hole{ point(7, 4), point(7, 6), point(10.0002, 5) };
+
+    gerber_3d::gpu_3d_drawer drawer;
+    extrude(drawer, { outer, hole });
+    EXPECT(drawer.mesh_vertices.size() == 16);
+    EXPECT(drawer.mesh_indices.size() == 32 * 3);
+    EXPECT(is_closed(drawer));
+}
@@ -0,0 +1,81 @@
+//////////////////////////////////////////////////////////////////////
+// xor_layers: the exact area added and removed between two layers
+
+#include "layer_xor.h"
+#include "test.h"
+#include "test_paths.h"
+
+using namespace Clipper2Lib;
+
+//////////////////////////////////////////////////////////////////////
+
+TEST(xor_layers_areas)
+{
+    PolyTree64 square;
+    test::resolve({ test::rect_path(0, 0, 10, 10) }, square);
+
+    // the same layer both sides, nothing
+    gerber_3d::xor_result same = gerber_3d::xor_layers(square, square);
+    EXPECT(same.polygons.empty());
+    EXPECT_NEAR(same.added_area, 0, 1e-9);
+    EXPECT_NEAR(same.removed_area, 0, 1e-9);
+
+    // moved 5 to the right, half of it on each side
+    PolyTree64 moved;
+    test::resolve({ test::rect_path(5, 0, 15, 10) }, moved);
+    gerber_3d::xor_result shifted = gerber_3d::xor_layers(square, moved);
+    EXPECT(shifted.polygons.size() == 2);
+    EXPECT_NEAR(shifted.added_area, 50, 1e-6);
+    EXPECT_NEAR(shifted.removed_area, 50, 1e-6);
+    for(gerber_3d::xor_polygon const &p : shifted.polygons) {
+        EXPECT_NEAR(p.area, 50, 1e-6);
+        EXPECT_NEAR(p.bounds.min_pos.x, p.added ? 10 : 0, 1e-6);
+        EXPECT_NEAR(p.bounds.max_pos.x, p.added ? 15 : 5, 1e-6);
+    }
+
+    // a hole drilled in it is removed, filling it back in is added
+    PolyTree64 holed;
+    test::resolve({ test::rect_path(0, 0, 10, 10), test::rect_path(4, 4, 6, 6, true) }, holed);
+    gerber_3d::xor_result hole = gerber_3d::xor_layers(square, holed);
+    EXPECT(hole.polygons.size() == 1);
+    EXPECT_NEAR(hole.added_area, 0, 1e-9);
+    EXPECT_NEAR(hole.removed_area, 4, 1e-6);
+    gerber_3d::xor_result filled = gerber_3d::xor_layers(holed, square);
+    EXPECT_NEAR(filled.added_area, 4, 1e-6);
+    EXPECT_NEAR(filled.removed_area, 0, 1e-9);
+}
+
+//////////////////////////////////////////////////////////////////////
+// enough points for several tiles: one row of pads moves and a strip goes
+// right across the board, which has to come out as one polygon
+
+TEST(xor_layers_tiled)
+{
+    int constexpr pads = 100;
+
+    Paths64 before_paths;
+    Paths64 after_paths;
+    for(int y = 0; y < pads; ++y) {
+        for(int x = 0; x < pads; ++x) {
+            double dx = y == 50 ? 0.25 : 0;
+            before_paths.push_back(test::rect_path(x, y, x + 0.5, y + 0.5));
+            after_paths.push_back(test::rect_path(x + dx, y, x + dx + 0.5, y + 0.5));
+        }
+    }
+    after_paths.push_back(test::rect_path(0, pads + 0.2, pads, pads + 0.4));
+
+    PolyTree64 before;
+    PolyTree64 after;
+    test::resolve(before_paths, before);
+    test::resolve(after_paths, after);
+
+    gerber_3d::xor_result result = gerber_3d::xor_layers(before, after);
+    EXPECT(result.num_tiles > 1);
+
+    // each moved pad is a 0.25 x 0.5 sliver each side, the strip is 100 x 0.2
+    EXPECT_NEAR(result.added_area, pads * 0.125 + pads * 0.2, 1e-6);
+    EXPECT_NEAR(result.removed_area, pads * 0.125, 1e-6);
+    EXPECT(result.polygons.size() == pads * 2 + 1);
+    EXPECT(!result.polygons.empty() && result.polygons.front().added);
+    EXPECT(!result.polygons.empty() && std::fabs(result.polygons.front().area - pads * 0.2) < 1e-6);
+}
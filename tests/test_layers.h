@@ -0,0 +1,106 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// Layers made by hand for the tests: each polygon is one entity with its
+// outline as the only contour and the fill as a triangle fan, so they have
+// to be convex
+
+#include <cfloat>
+#include <cmath>
+#include <deque>
+#include <initializer_list>
+#include <numbers>
+#include <span>
+#include <vector>
+
+#include "gerber_drawer.h"
+
+//////////////////////////////////////////////////////////////////////
+
+namespace test
+{
+    struct test_layer
+    {
+        using vec2f = gerber_lib::vec2f;
+
+        gerber::gerber_drawer drawer;
+        std::deque<gerber_lib::gerber_net> nets;    // entity_id() comes from these
+
+        test_layer()
+        {
+            drawer.init(nullptr);
+        }
+
+        ~test_layer()
+        {
+            drawer.release();
+        }
+
+        test_layer(test_layer const &) = delete;
+        test_layer &operator=(test_layer const &) = delete;
+
+        //////////////////////////////////////////////////////////////////////
+
+        void add_polygon(std::span<vec2f const> points, bool clear = false)
+        {
+            gerber_lib::gerber_net &net = nets.emplace_back();
+            net.entity_id = static_cast<int>(drawer.entities.size());
+
+            gerber::tesselator_entity e{};
+            e.net = &net;
+            e.flags = clear ? gerber::entity_flags_t::clear : gerber::entity_flags_t::fill;
+            e.outline_offset = static_cast<int>(drawer.outline_vertices.size());
+            e.outline_size = static_cast<int>(points.size());
+            e.contour_offset = static_cast<int>(drawer.contour_sizes.size());
+            e.num_contours = 1;
+            e.fill_vertex_offset = static_cast<int>(drawer.fill_vertices.size());
+            e.fill_vertex_count = static_cast<int>(points.size());
+            e.fill_index_offset = static_cast<int>(drawer.fill_indices.size());
+
+            gerber_lib::rect bounds{ { FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX } };
+            for(vec2f const &p : points) {
+                drawer.outline_vertices.push_back(p);
+                drawer.fill_vertices.push_back({ p.x, p.y, static_cast<uint32_t>(net.entity_id) });
+                bounds = bounds.union_with(gerber_lib::rect{ p.x, p.y, p.x, p.y });
+            }
+            drawer.contour_sizes.push_back(e.outline_size);
+
+            uint32_t first = static_cast<uint32_t>(e.fill_vertex_offset);
+            for(uint32_t i = 1; i + 1 < points.size(); ++i) {
+                drawer.fill_indices.push_back(first);
+                drawer.fill_indices.push_back(first + i);
+                drawer.fill_indices.push_back(first + i + 1);
+            }
+            e.fill_index_count = static_cast<int>(drawer.fill_indices.size()) - e.fill_index_offset;
+            e.bounds = bounds;
+            drawer.entities.push_back(e);
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        void add_polygon(std::initializer_list<vec2f> points, bool clear = false)
+        {
+            add_polygon(std::span<vec2f const>{ points.begin(), points.size() }, clear);
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        void add_rect(float x0, float y0, float x1, float y1, bool clear = false)
+        {
+            add_polygon({ { x0, y0 }, { x1, y0 }, { x1, y1 }, { x0, y1 } }, clear);
+        }
+
+        //////////////////////////////////////////////////////////////////////
+
+        void add_circle(float x, float y, float radius, int sides = 16)
+        {
+            std::vector<vec2f> points;
+            for(int i = 0; i < sides; ++i) {
+                double a = i * 2 * std::numbers::pi / sides;
+                points.push_back({ static_cast<float>(x + radius * std::cos(a)), static_cast<float>(y + radius * std::sin(a)) });
+            }
+            add_polygon(points);
+        }
+    };
+
+}    // namespace test
@@ -0,0 +1,88 @@
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstdio>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "job_pool.h"
+#include "test.h"
+
+//////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    struct entry
+    {
+        char const *name;
+        test::test_function fn;
+    };
+
+    std::vector<entry> &tests()
+    {
+        static std::vector<entry> all;
+        return all;
+    }
+
+    int failures = 0;
+
+}    // namespace
+
+//////////////////////////////////////////////////////////////////////
+
+namespace test
+{
+    registrar::registrar(char const *name, test_function fn)
+    {
+        tests().push_back({ name, fn });
+    }
+
+    void fail(char const *file, int line, char const *expression)
+    {
+        std::printf("%s(%d): EXPECT(%s) failed\n", file, line, expression);
+        failures += 1;
+    }
+
+    void fail_near(char const *file, int line, char const *expression, double a, double b, double tolerance)
+    {
+        std::printf("%s(%d): EXPECT_NEAR(%s) failed, %g vs %g (tolerance %g)\n", file, line, expression, a, b, tolerance);
+        failures += 1;
+    }
+
+}    // namespace test
+
+//////////////////////////////////////////////////////////////////////
+// gerber_tests [name...] runs the tests named (or all of them) on a job_pool,
+// returns non-zero if any check failed or a name wasn't found
+
+int main(int argc, char **argv)
+{
+    std::vector<entry> &all = tests();
+    std::sort(all.begin(), all.end(), [](entry const &a, entry const &b) { return std::string_view(a.name) < std::string_view(b.name); });
+
+    job_pool pool;
+    pool.start_workers(std::max(2u, std::thread::hardware_concurrency()) - 1);
+
+    int ran = 0;
+    for(entry const &e : all) {
+        bool run = argc < 2;
+        for(int i = 1; i < argc && !run; ++i) {
+            run = std::string_view(argv[i]) == e.name;
+        }
+        if(run) {
+            int before = failures;
+            e.fn();
+            std::printf("%s %s\n", failures == before ? "ok    " : "FAILED", e.name);
+            ran += 1;
+        }
+    }
+
+    pool.shut_down();
+
+    if(argc >= 2 && ran != argc - 1) {
+        std::printf("%d of %d tests not found\n", argc - 1 - ran, argc - 1);
+        return 1;
+    }
+    return failures == 0 ? 0 : 1;
+}
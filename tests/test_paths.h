@@ -0,0 +1,45 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+// Resolved layers (like gpu_3d_drawer::resolved_tree) made of rectangles
+// for the tests which work on polygons
+
+#include <algorithm>
+#include <cmath>
+
+#include "clipper2/clipper.h"
+#include "gpu_3d_drawer.h"
+
+//////////////////////////////////////////////////////////////////////
+
+namespace test
+{
+    inline int64_t to_clipper(double v)
+    {
+        return static_cast<int64_t>(std::llround(v * gerber_3d::gpu_3d_drawer::CLIPPER_SCALE));
+    }
+
+    // board units in, CLIPPER_SCALE units out, hole = the other way round
+
+    inline Clipper2Lib::Path64 rect_path(double x0, double y0, double x1, double y1, bool hole = false)
+    {
+        Clipper2Lib::Path64 path{ { to_clipper(x0), to_clipper(y0) },
+                                  { to_clipper(x1), to_clipper(y0) },
+                                  { to_clipper(x1), to_clipper(y1) },
+                                  { to_clipper(x0), to_clipper(y1) } };
+        if(hole) {
+            std::reverse(path.begin(), path.end());
+        }
+        return path;
+    }
+
+    // resolved the way the 3D drawer does it, a union with the non-zero rule
+
+    inline void resolve(Clipper2Lib::Paths64 const &paths, Clipper2Lib::PolyTree64 &tree)
+    {
+        Clipper2Lib::Clipper64 clipper;
+        clipper.AddSubject(paths);
+        clipper.Execute(Clipper2Lib::ClipType::Union, Clipper2Lib::FillRule::NonZero, tree);
+    }
+
+}    // namespace test
@@ -0,0 +1,90 @@
+//////////////////////////////////////////////////////////////////////
+// soft_compare: two revisions of a layer on the same pixel grid
+
+#include "soft_render.h"
+#include "test.h"
+#include "test_layers.h"
+
+//////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    // 0.1 units per pixel so the edges below are on pixel boundaries
+    gerber::soft_render_params compare_params()
+    {
+        gerber::soft_render_params params;
+        params.board_rect = gerber_lib::rect{ { 0, 0 }, { 100, 100 } };
+        gerber::soft_render_size(params.board_rect, 1000, params.width, params.height);
+        return params;
+    }
+
+    // a 10x10 square with a 2x2 clear in it and a 20x5 one, 96 + 100
+    void add_shapes(test::test_layer &layer, float dx)
+    {
+        layer.add_rect(10 + dx, 10, 20 + dx, 20);
+        layer.add_rect(14 + dx, 14, 16 + dx, 16, true);
+        layer.add_rect(40, 50, 60, 55);
+    }
+
+}    // namespace
+
+//////////////////////////////////////////////////////////////////////
+
+TEST(soft_compare_identical)
+{
+    test::test_layer layer;
+    add_shapes(layer, 0);
+
+    gerber::soft_layer same{ &layer.drawer, gpu::colors::white, false };
+    gerber::soft_diff diff = gerber::soft_compare(same, same, compare_params());
+
+    EXPECT(diff.identical());
+    EXPECT(diff.changed_regions.empty());
+    EXPECT_NEAR(diff.added_area, 0, 1e-9);
+    EXPECT_NEAR(diff.removed_area, 0, 1e-9);
+    EXPECT_NEAR(diff.unchanged_area, 196, 0.01);
+}
+
+//////////////////////////////////////////////////////////////////////
+// the first square moves 2 to the right: a 2x10 strip is removed on its left,
+// one is added on its right and the clear in it moves too
+
+TEST(soft_compare_shifted)
+{
+    test::test_layer before;
+    test::test_layer after;
+    add_shapes(before, 0);
+    add_shapes(after, 2);
+
+    gerber::soft_diff diff = gerber::soft_compare({ &before.drawer, gpu::colors::white, false }, { &after.drawer, gpu::colors::white, false }, compare_params());
+
+    EXPECT(!diff.identical());
+    EXPECT_NEAR(diff.added_area, 20 + 4, 0.01);
+    EXPECT_NEAR(diff.removed_area, 20 + 4, 0.01);
+    EXPECT_NEAR(diff.unchanged_area, 196 - 24, 0.01);
+
+    // nothing changed outside where the square was and is
+    for(gerber_lib::rect const &r : diff.changed_regions) {
+        EXPECT(r.min_pos.x >= 9.9 && r.max_pos.x <= 22.1 && r.min_pos.y >= 9.9 && r.max_pos.y <= 20.1);
+    }
+    EXPECT(!diff.changed_regions.empty());
+}
+
+//////////////////////////////////////////////////////////////////////
+// stopped before it starts, nothing is compared
+
+TEST(soft_compare_stopped)
+{
+    test::test_layer before;
+    test::test_layer after;
+    add_shapes(before, 0);
+    add_shapes(after, 2);
+
+    std::stop_source stop;
+    stop.request_stop();
+    gerber::soft_diff diff = gerber::soft_compare({ &before.drawer, gpu::colors::white, false }, { &after.drawer, gpu::colors::white, false }, compare_params(), 0.5f, stop.get_token());
+
+    EXPECT(diff.cancelled);
+    EXPECT(diff.image.pixels.empty());
+    EXPECT(diff.changed_regions.empty());
+}